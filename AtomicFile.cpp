@@ -0,0 +1,126 @@
+﻿#include "AtomicFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // The rename itself only survives a crash once the directory is synced too
+    bool SyncDirectory(const std::filesystem::path& path)
+    {
+#ifdef __linux__
+        const std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        const int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+#else
+        (void)path;
+        return true;
+#endif
+    }
+
+#ifdef __linux__
+    bool WriteTemporary(const std::filesystem::path& temporary, const std::function<bool(const AtomicFile::Sink& sink)>& produce)
+    {
+        const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const bool written = produce([fd](const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                const ssize_t count = ::write(fd, data, size);
+
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (count <= 0)
+                {
+                    return false;
+                }
+
+                data += count;
+                size -= static_cast<size_t>(count);
+            }
+
+            return true;
+        });
+
+        const bool synced = written && ::fsync(fd) == 0;
+        return ::close(fd) == 0 && synced;
+    }
+#else
+    bool WriteTemporary(const std::filesystem::path& temporary, const std::function<bool(const AtomicFile::Sink& sink)>& produce)
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+        const bool written = produce([&file](const char* data, size_t size)
+        {
+            return static_cast<bool>(file.write(data, static_cast<std::streamsize>(size)));
+        });
+
+        file.flush();
+        return written && file;
+    }
+#endif
+}
+
+bool AtomicFile::Write(const std::string& path, const char* what, const std::function<bool(const Sink& sink)>& produce)
+{
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+
+    if (!WriteTemporary(temporary, produce))
+    {
+        std::cerr << "Error writing " << what << ": " << temporary.string() << std::endl;
+        std::error_code ignored;
+        std::filesystem::remove(temporary, ignored);
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+
+    if (error)
+    {
+        std::cerr << "Error writing " << what << " " << path << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    if (!SyncDirectory(path))
+    {
+        std::cerr << "Error syncing " << what << " " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool AtomicFile::Write(const std::string& path, const char* what, const char* data, size_t size)
+{
+    return Write(path, what, [data, size](const Sink& sink)
+    {
+        return sink(data, size);
+    });
+}
@@ -0,0 +1,22 @@
+﻿#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Replaces a file whole. The contents go to a temporary file beside it, which is synced to
+// disk before it is renamed over the old one, so a reader or a crash finds the old file or
+// the new one, never half of either.
+namespace AtomicFile
+{
+    // Receives the file's bytes in order; returning false abandons the write
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    // `produce` writes the contents through the sink it is given, returning false if it
+    // fails. Errors go to std::cerr, naming the file as `what`.
+    bool Write(const std::string& path, const char* what, const std::function<bool(const Sink& sink)>& produce);
+    bool Write(const std::string& path, const char* what, const char* data, size_t size);
+}
+
+#endif
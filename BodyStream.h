@@ -0,0 +1,28 @@
+﻿#ifndef BODY_STREAM_H
+#define BODY_STREAM_H
+
+#include <functional>
+
+#include "BufferPool.h"
+
+// Takes a response body in pieces, decoded, as it comes off the socket rather than whole
+// once it is all in. Each piece is the buffer the client received or decoded it into, so
+// keeping one copies nothing. Called on the HTTP client's thread, so nothing here may block.
+class BodyStream
+{
+public:
+    virtual ~BodyStream() = default;
+
+    // A copy of the body is about to arrive. Another Begin means the copy before failed part
+    // way or lost a race, and whatever it delivered is to be dropped. `resume`, which may be
+    // called on any thread, has reading go on after Write asked for a pause.
+    virtual void Begin(std::function<void()> resume) = 0;
+
+    // Returns false to stop reading until `resume` is called
+    virtual bool Write(ResponseBuffer piece) = 0;
+
+    // Called once, when the body is complete or, with `ok` false, couldn't be fetched
+    virtual void End(bool ok) = 0;
+};
+
+#endif
@@ -0,0 +1,136 @@
+﻿#include "BufferPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+void ResponseBuffer::Append(const char* bytes, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    std::memcpy(WritableTail(count), bytes, count);
+    Commit(count);
+}
+
+char* ResponseBuffer::WritableTail(size_t count)
+{
+    Reserve(size() + count);
+    return storage->bytes.get() + storage->size;
+}
+
+void ResponseBuffer::Reserve(size_t capacity)
+{
+    if (!storage)
+    {
+        // Not from a pool; still works, it just won't be recycled
+        storage = std::make_shared<Storage>();
+    }
+
+    if (capacity <= storage->capacity)
+    {
+        return;
+    }
+
+    // Grow geometrically so appending a body of unknown length stays linear
+    const size_t newCapacity = std::max(capacity, storage->capacity * 2);
+    auto bytes = std::make_unique<char[]>(newCapacity);
+
+    if (storage->size > 0)
+    {
+        std::memcpy(bytes.get(), storage->bytes.get(), storage->size);
+    }
+
+    storage->bytes = std::move(bytes);
+    storage->capacity = newCapacity;
+
+    if (storage->owner)
+    {
+        ++storage->owner->allocations;
+    }
+}
+
+ResponseBuffer ResponseBuffer::Slice(size_t offset, size_t count) const
+{
+    ResponseBuffer slice{storage};
+    slice.offset = this->offset + offset;
+    slice.length = count;
+    slice.sliced = true;
+    return slice;
+}
+
+void ResponseBuffer::Clear()
+{
+    if (storage)
+    {
+        storage->size = 0;
+    }
+}
+
+ResponseBuffer BufferPool::Acquire(size_t capacityHint)
+{
+    std::unique_ptr<Storage> storage;
+
+    {
+        std::lock_guard lock(mutex);
+
+        if (!idle.empty())
+        {
+            // Prefer a buffer that is already big enough, otherwise take the largest
+            const auto fit = std::find_if(idle.begin(), idle.end(), [capacityHint](const auto& candidate)
+            {
+                return candidate->capacity >= capacityHint;
+            });
+
+            const auto chosen = fit != idle.end() ? fit : std::max_element(idle.begin(), idle.end(), [](const auto& a, const auto& b)
+            {
+                return a->capacity < b->capacity;
+            });
+
+            storage = std::move(*chosen);
+            idle.erase(chosen);
+        }
+    }
+
+    if (!storage)
+    {
+        storage = std::make_unique<Storage>();
+        storage->owner = this;
+    }
+
+    std::weak_ptr<BufferPool> pool = weak_from_this();
+
+    ResponseBuffer buffer{std::shared_ptr<Storage>(storage.release(), [pool](Storage* released)
+    {
+        if (const auto owner = pool.lock())
+        {
+            owner->Release(released);
+        }
+        else
+        {
+            delete released;
+        }
+    })};
+
+    buffer.Reserve(capacityHint);
+    return buffer;
+}
+
+void BufferPool::Release(Storage* storage)
+{
+    std::unique_ptr<Storage> owned{storage};
+    owned->size = 0;
+
+    if (owned->capacity > maxRetainedCapacity)
+    {
+        return;
+    }
+
+    std::lock_guard lock(mutex);
+
+    if (idle.size() < maxIdleBuffers)
+    {
+        idle.push_back(std::move(owned));
+    }
+}
@@ -0,0 +1,92 @@
+﻿#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+class BufferPool;
+
+// Reference-counted byte buffer. Copies share the same bytes; when the last one goes away
+// the storage returns to the pool it came from. Only the producer writes to a buffer, and
+// only before handing it out, or past the end of every slice it has handed out.
+class ResponseBuffer
+{
+public:
+    ResponseBuffer() = default;
+
+    [[nodiscard]] const char* data() const { return storage ? storage->bytes.get() + offset : nullptr; }
+    [[nodiscard]] size_t size() const { return storage ? (sliced ? length : storage->size) : 0; }
+    [[nodiscard]] size_t capacity() const { return storage ? storage->capacity : 0; }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    [[nodiscard]] const char* begin() const { return data(); }
+    [[nodiscard]] const char* end() const { return data() + size(); }
+    [[nodiscard]] std::string_view View() const { return {data(), size()}; }
+
+    void Append(const char* bytes, size_t count);
+
+    // Exposes at least `count` bytes of uninitialised space past the end, so a socket can
+    // read straight into the buffer; Commit then adopts however many bytes were written.
+    char* WritableTail(size_t count);
+    void Commit(size_t count) { storage->size += count; }
+
+    void Reserve(size_t capacity);
+    void Clear();
+
+    // `count` bytes from `offset` on, sharing the storage rather than copied, and read only.
+    // The producer may go on writing past the end, as long as it never has to grow.
+    [[nodiscard]] ResponseBuffer Slice(size_t offset, size_t count) const;
+
+private:
+    friend class BufferPool;
+
+    struct Storage
+    {
+        std::unique_ptr<char[]> bytes;
+        size_t capacity = 0;
+        size_t size = 0;
+        BufferPool* owner = nullptr;
+    };
+
+    explicit ResponseBuffer(std::shared_ptr<Storage> storage) : storage(std::move(storage)) {}
+
+    std::shared_ptr<Storage> storage;
+
+    // Set for a slice
+    size_t offset = 0;
+    size_t length = 0;
+    bool sliced = false;
+};
+
+// Recycles response buffer storage so steady-state crawling stops hitting the allocator.
+// Must be owned by a shared_ptr: outstanding buffers keep a weak reference to it.
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+    explicit BufferPool(size_t maxIdleBuffers = 64, size_t maxRetainedCapacity = 16 * 1024 * 1024)
+        : maxIdleBuffers(maxIdleBuffers), maxRetainedCapacity(maxRetainedCapacity) {}
+
+    [[nodiscard]] ResponseBuffer Acquire(size_t capacityHint = 0);
+
+    // Heap allocations made for buffer storage so far, including growth
+    [[nodiscard]] size_t GetAllocationCount() const { return allocations; }
+
+private:
+    friend class ResponseBuffer;
+
+    using Storage = ResponseBuffer::Storage;
+
+    void Release(Storage* storage);
+
+    const size_t maxIdleBuffers;
+    const size_t maxRetainedCapacity;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Storage>> idle;
+    std::atomic<size_t> allocations{0};
+};
+
+#endif
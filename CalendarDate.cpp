@@ -0,0 +1,82 @@
+﻿#include "CalendarDate.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace CalendarDate
+{
+    // Howard Hinnant's days_from_civil and civil_from_days, with years starting in March so
+    // the leap day comes last
+    int64_t FromCivil(int64_t year, unsigned month, unsigned day)
+    {
+        year -= month <= 2;
+        const int64_t era = (year >= 0 ? year : year - 399) / 400;
+        const auto yearOfEra = static_cast<unsigned>(year - era * 400);
+        const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+    }
+
+    bool Parse(std::string_view text, int64_t& days)
+    {
+        if (text.size() != 10 || text[4] != '-' || text[7] != '-')
+        {
+            return false;
+        }
+
+        unsigned fields[3] = {};
+        const size_t starts[3] = {0, 5, 8};
+        const size_t lengths[3] = {4, 2, 2};
+
+        for (size_t field = 0; field < 3; ++field)
+        {
+            for (size_t i = starts[field]; i < starts[field] + lengths[field]; ++i)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                {
+                    return false;
+                }
+
+                fields[field] = fields[field] * 10 + static_cast<unsigned>(text[i] - '0');
+            }
+        }
+
+        const unsigned year = fields[0];
+        const unsigned month = fields[1];
+        const unsigned day = fields[2];
+        const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+        const unsigned monthDays[12] = {31, leap ? 29u : 28u, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+        if (month < 1 || month > 12 || day < 1 || day > monthDays[month - 1])
+        {
+            return false;
+        }
+
+        days = FromCivil(year, month, day);
+        return true;
+    }
+
+    std::string Format(int64_t days)
+    {
+        days += 719468;
+        const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        const auto dayOfEra = static_cast<unsigned>(days - era * 146097);
+        const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        const unsigned shiftedMonth = (5 * dayOfYear + 2) / 153;
+        const unsigned day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+        const unsigned month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+        const int64_t year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+
+        // Sized for any int64_t year, so the compiler can see nothing is cut off
+        char text[48];
+        std::snprintf(text, sizeof(text), "%04lld-%02u-%02u", static_cast<long long>(year), month, day);
+        return text;
+    }
+
+    int64_t Today()
+    {
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    }
+}
@@ -0,0 +1,22 @@
+﻿#ifndef CALENDAR_DATE_H
+#define CALENDAR_DATE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Dates as TMDB writes them, YYYY-MM-DD, counted in days since 1970-01-01 so ranges are
+// simple arithmetic. Proleptic Gregorian, UTC.
+namespace CalendarDate
+{
+    int64_t FromCivil(int64_t year, unsigned month, unsigned day);
+
+    // False unless `text` is exactly a valid YYYY-MM-DD
+    bool Parse(std::string_view text, int64_t& days);
+
+    std::string Format(int64_t days);
+
+    int64_t Today();
+}
+
+#endif
@@ -0,0 +1,84 @@
+﻿#include "CancellationToken.h"
+
+#include <algorithm>
+
+CancellationToken CancellationToken::WithDeadline(Clock::time_point deadline)
+{
+    CancellationToken token;
+    token.state = std::make_shared<State>();
+    token.state->deadline = deadline;
+    return token;
+}
+
+void CancellationToken::Cancel() const
+{
+    if (!state)
+    {
+        return;
+    }
+
+    std::vector<std::pair<Registration, std::function<void()>>> callbacks;
+
+    {
+        std::lock_guard lock(state->mutex);
+
+        if (state->cancelled.exchange(true))
+        {
+            return;
+        }
+
+        callbacks.swap(state->callbacks);
+    }
+
+    for (auto& [registration, callback] : callbacks)
+    {
+        callback();
+    }
+}
+
+bool CancellationToken::IsCancelled() const
+{
+    return state && (state->cancelled || Clock::now() >= state->deadline);
+}
+
+CancellationToken::Registration CancellationToken::OnCancel(std::function<void()> callback) const
+{
+    if (!state)
+    {
+        return 0;
+    }
+
+    {
+        std::lock_guard lock(state->mutex);
+
+        if (!state->cancelled)
+        {
+            const Registration registration = state->nextRegistration++;
+            state->callbacks.emplace_back(registration, std::move(callback));
+            return registration;
+        }
+    }
+
+    callback();
+    return 0;
+}
+
+void CancellationToken::Unregister(Registration registration) const
+{
+    if (!state || registration == 0)
+    {
+        return;
+    }
+
+    std::lock_guard lock(state->mutex);
+
+    const auto it = std::find_if(state->callbacks.begin(), state->callbacks.end(), [registration](const auto& entry)
+    {
+        return entry.first == registration;
+    });
+
+    if (it != state->callbacks.end())
+    {
+        state->callbacks.erase(it);
+    }
+}
@@ -0,0 +1,61 @@
+﻿#ifndef CANCELLATION_TOKEN_H
+#define CANCELLATION_TOKEN_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Lets the caller of a long operation call it off, explicitly or by a deadline. Copies
+// share one state. A default-constructed token never fires and costs nothing to pass
+// around. Reaching the deadline doesn't run callbacks: anything that waits is expected
+// to bound the wait by GetDeadline() itself.
+class CancellationToken
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Registration = uint64_t;
+
+    CancellationToken() = default;
+
+    [[nodiscard]] static CancellationToken WithDeadline(Clock::time_point deadline);
+    [[nodiscard]] static CancellationToken WithTimeout(Clock::duration timeout)
+    {
+        return WithDeadline(Clock::now() + timeout);
+    }
+
+    void Cancel() const;
+
+    // True once cancelled or past the deadline
+    [[nodiscard]] bool IsCancelled() const;
+
+    // Clock::time_point::max() when there is none
+    [[nodiscard]] Clock::time_point GetDeadline() const
+    {
+        return state ? state->deadline : Clock::time_point::max();
+    }
+
+    // The callback runs once, on the thread that calls Cancel, or right away if that has
+    // already happened. It must not block.
+    Registration OnCancel(std::function<void()> callback) const;
+    void Unregister(Registration registration) const;
+
+private:
+    struct State
+    {
+        Clock::time_point deadline = Clock::time_point::max();
+        std::atomic<bool> cancelled{false};
+
+        std::mutex mutex;
+        Registration nextRegistration = 1;
+        std::vector<std::pair<Registration, std::function<void()>>> callbacks;
+    };
+
+    std::shared_ptr<State> state;
+};
+
+#endif
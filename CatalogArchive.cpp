@@ -0,0 +1,681 @@
+﻿#include "CatalogArchive.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+
+#include "AtomicFile.h"
+#include "Checksum.h"
+#include "ParallelSort.h"
+
+namespace
+{
+    constexpr char MAGIC[8] = {'S', 'F', 'X', 'A', 'R', 'C', 'H', 'V'};
+
+    // Written as is, so an archive from a machine of the other byte order reads back swapped
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    constexpr double RATING_SCALE = 1000.0;
+
+    uint8_t BitWidth(uint64_t value)
+    {
+        uint8_t width = 0;
+
+        while (value != 0)
+        {
+            ++width;
+            value >>= 1;
+        }
+
+        return width;
+    }
+
+    uint64_t WordsFor(uint64_t values, unsigned width)
+    {
+        return (values * width + 63) / 64;
+    }
+
+    // Appends `values`, `width` bits each, from the start of a new word
+    void Pack(std::vector<uint64_t>& words, const std::vector<uint64_t>& values, unsigned width)
+    {
+        const size_t start = words.size();
+        words.resize(start + WordsFor(values.size(), width), 0);
+
+        for (size_t i = 0; i < values.size() && width > 0; ++i)
+        {
+            const uint64_t bit = i * width;
+            const size_t word = start + bit / 64;
+            const unsigned shift = bit % 64;
+
+            words[word] |= values[i] << shift;
+
+            if (shift + width > 64)
+            {
+                words[word + 1] |= values[i] >> (64 - shift);
+            }
+        }
+    }
+
+    uint64_t Unpack(const uint64_t* words, unsigned width, uint64_t index)
+    {
+        if (width == 0)
+        {
+            return 0;
+        }
+
+        const uint64_t bit = index * width;
+        const uint64_t* word = words + bit / 64;
+        const unsigned shift = bit % 64;
+
+        uint64_t value = word[0] >> shift;
+
+        if (shift + width > 64)
+        {
+            value |= word[1] << (64 - shift);
+        }
+
+        return width == 64 ? value : value & ((uint64_t{1} << width) - 1);
+    }
+
+    void PutVarint(std::string& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+
+        out += static_cast<char>(value);
+    }
+
+    bool GetVarint(const char*& cursor, const char* end, uint64_t& value)
+    {
+        value = 0;
+
+        for (unsigned shift = 0; cursor < end && shift < 64; shift += 7)
+        {
+            const auto byte = static_cast<uint8_t>(*cursor++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+            if (byte < 0x80)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Turns `title` from the dictionary entry before into the next one. The first of a
+    // bucket is whole; the rest share a prefix with the one before.
+    bool NextTitle(const char*& cursor, const char* end, bool first, std::string& title)
+    {
+        uint64_t shared = 0;
+        uint64_t length;
+
+        if ((!first && !GetVarint(cursor, end, shared)) || !GetVarint(cursor, end, length)
+            || shared > title.size() || length > static_cast<uint64_t>(end - cursor))
+        {
+            return false;
+        }
+
+        title.resize(static_cast<size_t>(shared));
+        title.append(cursor, static_cast<size_t>(length));
+        cursor += length;
+        return true;
+    }
+
+    float FromThousandths(int64_t thousandths)
+    {
+        return static_cast<float>(static_cast<double>(thousandths) / RATING_SCALE);
+    }
+
+    // True if the rating is exactly some number of thousandths, as TMDB's averages are
+    bool ToThousandths(float rating, int64_t& thousandths)
+    {
+        if (!(std::fabs(rating) < 1e9f))
+        {
+            return false;
+        }
+
+        thousandths = std::llround(static_cast<double>(rating) * RATING_SCALE);
+        return FromThousandths(thousandths) == rating;
+    }
+
+    void Align(std::string& file)
+    {
+        file.resize((file.size() + 7) & ~size_t{7}, '\0');
+    }
+}
+
+bool CatalogArchive::Write(const std::string& path, const MovieView& movies)
+{
+    if (movies.size() > UINT32_MAX)
+    {
+        std::cerr << "Error writing archive " << path << ": too many movies" << std::endl;
+        return false;
+    }
+
+    // Rows by id, each knowing where it was in the database
+    std::vector<std::pair<MovieRef, uint64_t>> rows;
+    rows.reserve(movies.size());
+
+    for (const MovieRef movie : movies)
+    {
+        rows.emplace_back(movie, rows.size());
+    }
+
+    ParallelSort::StableSort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first.GetId() < b.first.GetId(); });
+
+    std::vector<std::string_view> titles;
+    titles.reserve(movies.size());
+
+    for (const MovieRef movie : movies)
+    {
+        titles.emplace_back(movie.GetTitle());
+    }
+
+    ParallelSort::StableSort(titles.begin(), titles.end(), std::less<>{});
+    titles.erase(std::unique(titles.begin(), titles.end()), titles.end());
+
+    std::string dictionary;
+    std::vector<uint64_t> buckets;
+
+    for (size_t i = 0; i < titles.size(); ++i)
+    {
+        if (i % BUCKET_TITLES == 0)
+        {
+            buckets.push_back(dictionary.size());
+            PutVarint(dictionary, titles[i].size());
+            dictionary += titles[i];
+            continue;
+        }
+
+        const std::string_view previous = titles[i - 1];
+        size_t shared = 0;
+
+        while (shared < previous.size() && shared < titles[i].size() && previous[shared] == titles[i][shared])
+        {
+            ++shared;
+        }
+
+        PutVarint(dictionary, shared);
+        PutVarint(dictionary, titles[i].size() - shared);
+        dictionary += titles[i].substr(shared);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.movies = movies.size();
+    header.titles = titles.size();
+    header.codeWidth = BitWidth(titles.empty() ? 0 : titles.size() - 1);
+    header.positionWidth = BitWidth(movies.empty() ? 0 : movies.size() - 1);
+
+    std::vector<Block> blocks;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> column;
+    std::vector<int64_t> thousandths;
+
+    for (size_t first = 0; first < rows.size(); first += BLOCK_ROWS)
+    {
+        const size_t last = std::min(rows.size(), first + BLOCK_ROWS);
+
+        Block block{};
+        block.firstId = rows[first].first.GetId();
+        block.wordOffset = words.size();
+        block.minRating = INFINITY;
+        block.maxRating = -INFINITY;
+
+        column.clear();
+
+        for (size_t row = first; row < last; ++row)
+        {
+            column.push_back(rows[row].first.GetId() - (row == first ? block.firstId : rows[row - 1].first.GetId()));
+        }
+
+        block.idWidth = BitWidth(*std::max_element(column.begin(), column.end()));
+        Pack(words, column, block.idWidth);
+
+        thousandths.clear();
+        bool exact = true;
+
+        for (size_t row = first; row < last; ++row)
+        {
+            const float rating = rows[row].first.GetRating();
+            int64_t value = 0;
+
+            exact = exact && ToThousandths(rating, value);
+            thousandths.push_back(value);
+            block.minRating = std::min(block.minRating, rating);
+            block.maxRating = std::max(block.maxRating, rating);
+        }
+
+        column.clear();
+
+        if (exact)
+        {
+            block.ratingEncoding = RatingEncoding::Thousandths;
+            block.ratingBase = *std::min_element(thousandths.begin(), thousandths.end());
+
+            for (const int64_t value : thousandths)
+            {
+                column.push_back(static_cast<uint64_t>(value - block.ratingBase));
+            }
+
+            block.ratingWidth = BitWidth(*std::max_element(column.begin(), column.end()));
+        }
+        else
+        {
+            block.ratingEncoding = RatingEncoding::Raw;
+            block.ratingWidth = 32;
+
+            for (size_t row = first; row < last; ++row)
+            {
+                const float rating = rows[row].first.GetRating();
+                uint32_t bits;
+                std::memcpy(&bits, &rating, sizeof(bits));
+                column.push_back(bits);
+            }
+        }
+
+        Pack(words, column, block.ratingWidth);
+
+        // A title's rank in the dictionary is its code
+        column.clear();
+
+        for (size_t row = first; row < last; ++row)
+        {
+            const std::string_view title = rows[row].first.GetTitle();
+            column.push_back(static_cast<uint64_t>(std::lower_bound(titles.begin(), titles.end(), title) - titles.begin()));
+        }
+
+        Pack(words, column, header.codeWidth);
+
+        column.clear();
+
+        for (size_t row = first; row < last; ++row)
+        {
+            column.push_back(rows[row].second);
+        }
+
+        Pack(words, column, header.positionWidth);
+        blocks.push_back(block);
+    }
+
+    const std::pair<const void*, uint64_t> sections[SECTIONS] = {
+        {dictionary.data(), dictionary.size()},
+        {buckets.data(), buckets.size() * sizeof(uint64_t)},
+        {blocks.data(), blocks.size() * sizeof(Block)},
+        {words.data(), words.size() * sizeof(uint64_t)},
+    };
+
+    std::string file(sizeof(Header), '\0');
+
+    for (size_t section = 0; section < SECTIONS; ++section)
+    {
+        Align(file);
+        header.sections[section] = {file.size(), sections[section].second};
+        file.append(static_cast<const char*>(sections[section].first), static_cast<size_t>(sections[section].second));
+    }
+
+    header.fileSize = file.size();
+    header.bodyChecksum = Checksum::Crc32(file.data() + sizeof(Header), file.size() - sizeof(Header));
+    header.checksum = Checksum::Crc32(&header, offsetof(Header, checksum));
+    std::memcpy(&file[0], &header, sizeof(Header));
+
+    return AtomicFile::Write(path, "archive", file.data(), file.size());
+}
+
+bool CatalogArchive::Open(const std::string& path)
+{
+    header = nullptr;
+    storage.clear();
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    const std::streamoff end = file.tellg();
+
+    if (end < static_cast<std::streamoff>(sizeof(Header)))
+    {
+        return false;
+    }
+
+    const auto size = static_cast<uint64_t>(end);
+    storage.assign(static_cast<size_t>((size + 7) / 8), 0);
+    file.seekg(0);
+
+    if (!file.read(reinterpret_cast<char*>(storage.data()), static_cast<std::streamsize>(size)))
+    {
+        storage.clear();
+        return false;
+    }
+
+    const char* base = GetBase();
+    const auto* candidate = reinterpret_cast<const Header*>(base);
+
+    bool valid = std::memcmp(candidate->magic, MAGIC, sizeof(MAGIC)) == 0
+        && candidate->version == VERSION
+        && candidate->byteOrder == BYTE_ORDER_MARK
+        && candidate->fileSize == size
+        && candidate->movies <= UINT32_MAX
+        && candidate->titles <= candidate->movies
+        && candidate->codeWidth <= 64
+        && candidate->positionWidth <= 64
+        && candidate->checksum == Checksum::Crc32(candidate, offsetof(Header, checksum))
+        && candidate->bodyChecksum == Checksum::Crc32(base + sizeof(Header), size - sizeof(Header));
+
+    for (size_t section = 0; valid && section < SECTIONS; ++section)
+    {
+        const Extent& extent = candidate->sections[section];
+        valid = extent.offset % 8 == 0 && extent.offset >= sizeof(Header) && extent.offset <= size && extent.size <= size - extent.offset;
+    }
+
+    const uint64_t blockCount = (candidate->movies + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    const uint64_t bucketCount = (candidate->titles + BUCKET_TITLES - 1) / BUCKET_TITLES;
+
+    valid = valid
+        && candidate->sections[BLOCKS].size == blockCount * sizeof(Block)
+        && candidate->sections[BUCKETS].size == bucketCount * sizeof(uint64_t)
+        && candidate->sections[WORDS].size % sizeof(uint64_t) == 0;
+
+    // Every bucket starts inside the dictionary, and every block's columns inside WORDS
+    const auto* buckets = reinterpret_cast<const uint64_t*>(base + candidate->sections[BUCKETS].offset);
+
+    for (uint64_t bucket = 0; valid && bucket < bucketCount; ++bucket)
+    {
+        valid = buckets[bucket] < candidate->sections[DICTIONARY].size;
+    }
+
+    const auto* blocks = reinterpret_cast<const Block*>(base + candidate->sections[BLOCKS].offset);
+    const uint64_t words = candidate->sections[WORDS].size / sizeof(uint64_t);
+
+    for (uint64_t block = 0; valid && block < blockCount; ++block)
+    {
+        const Block& entry = blocks[block];
+        const uint64_t rows = std::min<uint64_t>(BLOCK_ROWS, candidate->movies - block * BLOCK_ROWS);
+        const uint64_t needed = WordsFor(rows, entry.idWidth) + WordsFor(rows, entry.ratingWidth)
+            + WordsFor(rows, candidate->codeWidth) + WordsFor(rows, candidate->positionWidth);
+
+        valid = entry.idWidth <= 64 && entry.ratingWidth <= 64
+            && (entry.ratingEncoding == RatingEncoding::Thousandths || (entry.ratingEncoding == RatingEncoding::Raw && entry.ratingWidth == 32))
+            && entry.wordOffset <= words && needed <= words - entry.wordOffset;
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Not a catalog archive of version " << VERSION << ": " << path << std::endl;
+        storage.clear();
+        return false;
+    }
+
+    header = candidate;
+    return true;
+}
+
+size_t CatalogArchive::GetSize() const
+{
+    return static_cast<size_t>(header->movies);
+}
+
+bool CatalogArchive::Load(std::vector<std::shared_ptr<MovieBlock>>& blocks, std::vector<uint32_t>& titleOrder) const
+{
+    std::vector<std::string> titles;
+
+    if (!DecodeTitles(titles))
+    {
+        return false;
+    }
+
+    constexpr uint64_t EMPTY = UINT64_MAX;
+
+    const size_t size = GetSize();
+    std::vector<std::shared_ptr<MovieBlock>> slots;
+    std::vector<uint64_t> codes(size, EMPTY);
+
+    for (size_t first = 0; first < size; first += MovieBlock::CAPACITY)
+    {
+        slots.push_back(std::make_shared<MovieBlock>());
+        slots.back()->movies.resize(std::min(MovieBlock::CAPACITY, size - first));
+    }
+
+    for (size_t block = 0; block < GetBlockCount(); ++block)
+    {
+        const Block& entry = GetBlocks()[block];
+        const BlockView view = View(block);
+        uint64_t id = entry.firstId;
+
+        for (uint32_t row = 0; row < view.rows; ++row)
+        {
+            id += Unpack(view.ids, entry.idWidth, row);
+
+            const uint64_t code = Unpack(view.codes, header->codeWidth, row);
+            const uint64_t position = Unpack(view.positions, header->positionWidth, row);
+
+            if (code >= titles.size() || position >= size || codes[position] != EMPTY)
+            {
+                return false;
+            }
+
+            slots[position / MovieBlock::CAPACITY]->movies[position % MovieBlock::CAPACITY] = Movie{titles[code], GetRating(entry, view, row), id};
+            codes[position] = code;
+        }
+    }
+
+    // By rank, which is title order; counting keeps movies of the same title in order
+    std::vector<uint32_t> starts(titles.size() + 1, 0);
+
+    for (const uint64_t code : codes)
+    {
+        ++starts[code + 1];
+    }
+
+    for (size_t code = 1; code < starts.size(); ++code)
+    {
+        starts[code] += starts[code - 1];
+    }
+
+    std::vector<uint32_t> order(size);
+
+    for (size_t position = 0; position < size; ++position)
+    {
+        order[starts[codes[position]]++] = static_cast<uint32_t>(position);
+    }
+
+    blocks = std::move(slots);
+    titleOrder = std::move(order);
+    return true;
+}
+
+bool CatalogArchive::FindById(uint64_t id, Movie& movie) const
+{
+    const Block* blocks = GetBlocks();
+    const Block* end = blocks + GetBlockCount();
+
+    // A repeated id can run over from the block before the first one starting at it
+    const Block* block = std::lower_bound(blocks, end, id, [](const Block& block, uint64_t value)
+    {
+        return block.firstId < value;
+    });
+
+    if (block != blocks)
+    {
+        --block;
+    }
+
+    for (; block != end && block->firstId <= id; ++block)
+    {
+        const BlockView view = View(static_cast<size_t>(block - blocks));
+        uint64_t current = block->firstId;
+
+        for (uint32_t row = 0; row < view.rows && current <= id; ++row)
+        {
+            current += Unpack(view.ids, block->idWidth, row);
+
+            if (current == id)
+            {
+                std::string title;
+
+                if (!DecodeTitle(Unpack(view.codes, header->codeWidth, row), title))
+                {
+                    return false;
+                }
+
+                movie = Movie{std::move(title), GetRating(*block, view, row), id};
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void CatalogArchive::ForEachRatedAtLeast(float minimum, const std::function<void(uint64_t id, float rating)>& visit) const
+{
+    for (size_t block = 0; block < GetBlockCount(); ++block)
+    {
+        const Block& entry = GetBlocks()[block];
+
+        if (!(entry.maxRating >= minimum))
+        {
+            continue;
+        }
+
+        const BlockView view = View(block);
+
+        // Packed thousandths at or above this are rated `minimum` or more, so they are
+        // compared without being decoded
+        uint64_t threshold = 0;
+        const bool packed = entry.ratingEncoding == RatingEncoding::Thousandths && std::fabs(minimum) < 1e9f;
+
+        if (packed)
+        {
+            auto lowest = static_cast<int64_t>(std::ceil(static_cast<double>(minimum) * RATING_SCALE));
+
+            while (FromThousandths(lowest - 1) >= minimum)
+            {
+                --lowest;
+            }
+
+            while (FromThousandths(lowest) < minimum)
+            {
+                ++lowest;
+            }
+
+            threshold = lowest > entry.ratingBase ? static_cast<uint64_t>(lowest - entry.ratingBase) : 0;
+        }
+
+        uint64_t id = entry.firstId;
+
+        for (uint32_t row = 0; row < view.rows; ++row)
+        {
+            id += Unpack(view.ids, entry.idWidth, row);
+
+            const bool match = packed
+                ? Unpack(view.ratings, entry.ratingWidth, row) >= threshold
+                : GetRating(entry, view, row) >= minimum;
+
+            if (match)
+            {
+                visit(id, GetRating(entry, view, row));
+            }
+        }
+    }
+}
+
+const CatalogArchive::Block* CatalogArchive::GetBlocks() const
+{
+    return reinterpret_cast<const Block*>(GetBase() + header->sections[BLOCKS].offset);
+}
+
+size_t CatalogArchive::GetBlockCount() const
+{
+    return static_cast<size_t>(header->sections[BLOCKS].size / sizeof(Block));
+}
+
+CatalogArchive::BlockView CatalogArchive::View(size_t block) const
+{
+    const Block& entry = GetBlocks()[block];
+
+    BlockView view;
+    view.rows = static_cast<uint32_t>(std::min<uint64_t>(BLOCK_ROWS, header->movies - block * BLOCK_ROWS));
+    view.ids = reinterpret_cast<const uint64_t*>(GetBase() + header->sections[WORDS].offset) + entry.wordOffset;
+    view.ratings = view.ids + WordsFor(view.rows, entry.idWidth);
+    view.codes = view.ratings + WordsFor(view.rows, entry.ratingWidth);
+    view.positions = view.codes + WordsFor(view.rows, header->codeWidth);
+    return view;
+}
+
+float CatalogArchive::GetRating(const Block& block, const BlockView& view, uint32_t row) const
+{
+    const uint64_t packed = Unpack(view.ratings, block.ratingWidth, row);
+
+    if (block.ratingEncoding == RatingEncoding::Thousandths)
+    {
+        return FromThousandths(block.ratingBase + static_cast<int64_t>(packed));
+    }
+
+    const auto bits = static_cast<uint32_t>(packed);
+    float rating;
+    std::memcpy(&rating, &bits, sizeof(rating));
+    return rating;
+}
+
+bool CatalogArchive::DecodeTitles(std::vector<std::string>& titles) const
+{
+    const char* cursor = GetBase() + header->sections[DICTIONARY].offset;
+    const char* end = cursor + header->sections[DICTIONARY].size;
+    std::string title;
+
+    titles.clear();
+    titles.reserve(static_cast<size_t>(header->titles));
+
+    for (uint64_t code = 0; code < header->titles; ++code)
+    {
+        if (!NextTitle(cursor, end, code % BUCKET_TITLES == 0, title))
+        {
+            return false;
+        }
+
+        titles.push_back(title);
+    }
+
+    return true;
+}
+
+bool CatalogArchive::DecodeTitle(uint64_t code, std::string& title) const
+{
+    if (code >= header->titles)
+    {
+        return false;
+    }
+
+    const char* dictionary = GetBase() + header->sections[DICTIONARY].offset;
+    const auto* buckets = reinterpret_cast<const uint64_t*>(GetBase() + header->sections[BUCKETS].offset);
+
+    const char* cursor = dictionary + buckets[code / BUCKET_TITLES];
+    const char* end = dictionary + header->sections[DICTIONARY].size;
+
+    title.clear();
+
+    for (uint64_t entry = 0; entry <= code % BUCKET_TITLES; ++entry)
+    {
+        if (!NextTitle(cursor, end, entry == 0, title))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
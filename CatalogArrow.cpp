@@ -0,0 +1,997 @@
+﻿#include "CatalogArrow.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "AtomicFile.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char MAGIC[6] = {'A', 'R', 'R', 'O', 'W', '1'};
+
+    // Footer length and the closing magic
+    constexpr size_t TRAILER = sizeof(int32_t) + sizeof(MAGIC);
+
+    // Comes before the length of each message's metadata
+    constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+
+    // Column buffers start on a cache line, as Arrow recommends
+    constexpr uint64_t ALIGNMENT = 64;
+
+    // Columns are streamed out in pieces of this size
+    constexpr size_t CHUNK = 64 * 1024;
+
+    // From Arrow's Schema.fbs, Message.fbs and File.fbs
+    constexpr int16_t METADATA_V5 = 4;
+    constexpr int16_t LITTLE_ENDIAN_ORDER = 0;
+    constexpr uint8_t HEADER_SCHEMA = 1;
+    constexpr uint8_t HEADER_RECORD_BATCH = 3;
+    constexpr int16_t PRECISION_SINGLE = 1;
+    constexpr int16_t PRECISION_DOUBLE = 2;
+
+    enum Type : uint8_t
+    {
+        NULL_TYPE = 1,
+        INT = 2,
+        FLOATING_POINT = 3,
+        BINARY = 4,
+        UTF8 = 5,
+        BOOL = 6,
+        DECIMAL = 7,
+        DATE = 8,
+        TIME = 9,
+        TIMESTAMP = 10,
+        INTERVAL = 11,
+        FIXED_SIZE_BINARY = 15,
+        DURATION = 18,
+        LARGE_BINARY = 19,
+        LARGE_UTF8 = 20
+    };
+
+    struct FieldNode
+    {
+        int64_t length;
+        int64_t nullCount;
+    };
+
+    struct Buffer
+    {
+        int64_t offset;
+        int64_t length;
+    };
+
+    struct Block
+    {
+        int64_t offset;
+        int32_t metadataLength;     // Continuation marker and length included
+        int32_t padding;
+        int64_t bodyLength;
+    };
+
+    uint64_t AlignUp(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Buffers a flat column of the type takes in a record batch; -1 for types with children
+    // or a varying number of buffers
+    int BuffersOf(uint8_t type)
+    {
+        switch (type)
+        {
+        case NULL_TYPE:
+            return 0;
+        case BINARY:
+        case UTF8:
+        case LARGE_BINARY:
+        case LARGE_UTF8:
+            return 3;
+        case INT:
+        case FLOATING_POINT:
+        case BOOL:
+        case DECIMAL:
+        case DATE:
+        case TIME:
+        case TIMESTAMP:
+        case INTERVAL:
+        case FIXED_SIZE_BINARY:
+        case DURATION:
+            return 2;
+        default:
+            return -1;
+        }
+    }
+
+    // Lays out a flatbuffer front to back. References may only point forward, so a table or
+    // vector is written with its references zero, and Refer fills each in once its target is.
+    class FlatBuilder
+    {
+    public:
+        struct Field
+        {
+            uint16_t slot;
+            uint8_t size;               // 1, 2, 4 or 8, and 4 for a reference
+            uint64_t value = 0;
+            size_t* at = nullptr;       // Set to where the field went, for Refer
+        };
+
+        // Starts with the reference to the root table
+        FlatBuilder() : bytes(sizeof(uint32_t), '\0') {}
+
+        size_t Table(std::vector<Field> fields)
+        {
+            uint16_t slots = 0;
+
+            for (const Field& field : fields)
+            {
+                slots = std::max<uint16_t>(slots, field.slot + 1);
+            }
+
+            Pad(sizeof(uint16_t));
+            const size_t vtable = bytes.size();
+            bytes.resize(vtable + (2 + slots) * sizeof(uint16_t));
+
+            Pad(sizeof(int32_t));
+            const size_t table = bytes.size();
+            Append(static_cast<int32_t>(table - vtable));
+
+            // Widest first, so little goes to padding
+            std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b) { return a.size > b.size; });
+
+            for (const Field& field : fields)
+            {
+                Pad(field.size);
+                Put(vtable + (2 + field.slot) * sizeof(uint16_t), static_cast<uint16_t>(bytes.size() - table));
+
+                if (field.at)
+                {
+                    *field.at = bytes.size();
+                }
+
+                bytes.append(reinterpret_cast<const char*>(&field.value), field.size);
+            }
+
+            Put(vtable, static_cast<uint16_t>((2 + slots) * sizeof(uint16_t)));
+            Put(vtable + sizeof(uint16_t), static_cast<uint16_t>(bytes.size() - table));
+            return table;
+        }
+
+        size_t String(std::string_view text)
+        {
+            Pad(sizeof(uint32_t));
+            const size_t position = bytes.size();
+            Append(static_cast<uint32_t>(text.size()));
+            bytes.append(text);
+            bytes.push_back('\0');
+            return position;
+        }
+
+        // A vector of `count` structs of `size` bytes, 8-byte aligned
+        size_t Structs(const void* data, uint32_t count, size_t size)
+        {
+            Pad(sizeof(uint32_t));
+
+            if ((bytes.size() + sizeof(uint32_t)) % sizeof(uint64_t) != 0)
+            {
+                Append(uint32_t{0});
+            }
+
+            const size_t position = bytes.size();
+            Append(count);
+
+            if (count > 0)
+            {
+                bytes.append(static_cast<const char*>(data), count * size);
+            }
+
+            return position;
+        }
+
+        // A vector of references, with where each element went in `elements`
+        size_t References(uint32_t count, std::vector<size_t>& elements)
+        {
+            Pad(sizeof(uint32_t));
+            const size_t position = bytes.size();
+            Append(count);
+
+            for (uint32_t element = 0; element < count; ++element)
+            {
+                elements.push_back(bytes.size());
+                Append(uint32_t{0});
+            }
+
+            return position;
+        }
+
+        void Refer(size_t from, size_t to)
+        {
+            Put(from, static_cast<uint32_t>(to - from));
+        }
+
+        // Padded to 8 bytes, as messages are
+        std::string Finish(size_t root)
+        {
+            Refer(0, root);
+            Pad(sizeof(uint64_t));
+            return std::move(bytes);
+        }
+
+    private:
+        void Pad(size_t alignment)
+        {
+            bytes.resize(AlignUp(bytes.size(), alignment), '\0');
+        }
+
+        template <typename T>
+        void Append(T value)
+        {
+            bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        void Put(size_t position, T value)
+        {
+            std::memcpy(&bytes[position], &value, sizeof(T));
+        }
+
+        std::string bytes;
+    };
+
+    // A table in a flatbuffer, with every offset checked against the buffer before it is
+    // followed. Fields that are missing or out of bounds read as absent.
+    class FlatTable
+    {
+    public:
+        FlatTable() = default;
+
+        FlatTable(std::string_view buffer, uint64_t position) : buffer(buffer)
+        {
+            int32_t back;
+            uint16_t vtableBytes;
+            uint16_t tableBytes;
+
+            if (!Read(position, back))
+            {
+                return;
+            }
+
+            const int64_t candidate = static_cast<int64_t>(position) - back;
+
+            if (candidate < 0 || !Read(candidate, vtableBytes) || !Read(candidate + sizeof(uint16_t), tableBytes)
+                || vtableBytes < 2 * sizeof(uint16_t) || vtableBytes % sizeof(uint16_t) != 0
+                || vtableBytes > buffer.size() - candidate || tableBytes > buffer.size() - position)
+            {
+                return;
+            }
+
+            table = position;
+            vtable = static_cast<uint64_t>(candidate);
+            vtableSize = vtableBytes;
+            tableSize = tableBytes;
+            valid = true;
+        }
+
+        // The table the buffer starts by referring to
+        static FlatTable Root(std::string_view buffer)
+        {
+            uint32_t root;
+
+            if (buffer.size() < sizeof(root))
+            {
+                return {};
+            }
+
+            std::memcpy(&root, buffer.data(), sizeof(root));
+            return FlatTable(buffer, root);
+        }
+
+        explicit operator bool() const
+        {
+            return valid;
+        }
+
+        template <typename T>
+        [[nodiscard]] T Scalar(uint16_t slot, T fallback) const
+        {
+            uint64_t position;
+            T value;
+            return Locate(slot, sizeof(T), position) && Read(position, value) ? value : fallback;
+        }
+
+        [[nodiscard]] FlatTable Table(uint16_t slot) const
+        {
+            uint64_t target;
+            return Follow(slot, target) ? FlatTable(buffer, target) : FlatTable{};
+        }
+
+        [[nodiscard]] std::string_view String(uint16_t slot) const
+        {
+            uint64_t target;
+            uint32_t length;
+
+            if (!Follow(slot, target) || !Read(target, length) || length > buffer.size() - target - sizeof(length))
+            {
+                return {};
+            }
+
+            return buffer.substr(target + sizeof(length), length);
+        }
+
+        // Where the elements of a vector start, each `size` bytes, and how many there are
+        bool Vector(uint16_t slot, size_t size, uint64_t& first, uint32_t& count) const
+        {
+            uint64_t target;
+
+            if (!Follow(slot, target) || !Read(target, count) || count > (buffer.size() - target - sizeof(count)) / size)
+            {
+                return false;
+            }
+
+            first = target + sizeof(count);
+            return true;
+        }
+
+        // An element of a vector of tables
+        [[nodiscard]] FlatTable Element(uint64_t first, uint32_t index) const
+        {
+            const uint64_t position = first + uint64_t{index} * sizeof(uint32_t);
+            uint32_t offset;
+            return Read(position, offset) ? FlatTable(buffer, position + offset) : FlatTable{};
+        }
+
+        template <typename T>
+        bool Read(uint64_t position, T& value) const
+        {
+            if (position > buffer.size() || sizeof(T) > buffer.size() - position)
+            {
+                return false;
+            }
+
+            std::memcpy(&value, buffer.data() + position, sizeof(T));
+            return true;
+        }
+
+    private:
+        bool Locate(uint16_t slot, size_t size, uint64_t& position) const
+        {
+            uint16_t offset;
+
+            if (!valid || (2 + slot + 1) * sizeof(uint16_t) > vtableSize
+                || !Read(vtable + (2 + slot) * sizeof(uint16_t), offset) || offset == 0 || offset + size > tableSize)
+            {
+                return false;
+            }
+
+            position = table + offset;
+            return true;
+        }
+
+        bool Follow(uint16_t slot, uint64_t& target) const
+        {
+            uint64_t position;
+            uint32_t offset;
+
+            if (!Locate(slot, sizeof(offset), position) || !Read(position, offset))
+            {
+                return false;
+            }
+
+            target = position + offset;
+            return target < buffer.size();
+        }
+
+        std::string_view buffer;
+        uint64_t table = 0;
+        uint64_t vtable = 0;
+        uint16_t vtableSize = 0;
+        uint16_t tableSize = 0;
+        bool valid = false;
+    };
+
+    // Schema.fbs: a Field for each column, with its type and no children
+    size_t WriteSchema(FlatBuilder& builder)
+    {
+        struct Column
+        {
+            std::string_view name;
+            uint8_t type;
+            std::vector<FlatBuilder::Field> typeFields;
+        };
+
+        const Column columns[] = {
+            {"id", INT, {{0, 4, 64}, {1, 1, 0}}},                   // 64 bits, unsigned
+            {"title", LARGE_UTF8, {}},
+            {"rating", FLOATING_POINT, {{0, 2, PRECISION_SINGLE}}},
+        };
+
+        size_t fieldsAt;
+        const size_t schema = builder.Table({{0, 2, LITTLE_ENDIAN_ORDER}, {1, 4, 0, &fieldsAt}});
+
+        std::vector<size_t> fields;
+        builder.Refer(fieldsAt, builder.References(static_cast<uint32_t>(std::size(columns)), fields));
+
+        for (size_t column = 0; column < std::size(columns); ++column)
+        {
+            size_t nameAt;
+            size_t typeAt;
+            size_t childrenAt;
+
+            // Not nullable
+            builder.Refer(fields[column], builder.Table({
+                {0, 4, 0, &nameAt},
+                {1, 1, 0},
+                {2, 1, columns[column].type},
+                {3, 4, 0, &typeAt},
+                {5, 4, 0, &childrenAt},
+            }));
+
+            std::vector<size_t> none;
+            builder.Refer(nameAt, builder.String(columns[column].name));
+            builder.Refer(typeAt, builder.Table(columns[column].typeFields));
+            builder.Refer(childrenAt, builder.References(0, none));
+        }
+
+        return schema;
+    }
+
+    // Message.fbs, with the schema or a record batch as its header
+    std::string SchemaMessage()
+    {
+        FlatBuilder builder;
+        size_t headerAt;
+
+        const size_t message = builder.Table({{0, 2, METADATA_V5}, {1, 1, HEADER_SCHEMA}, {2, 4, 0, &headerAt}, {3, 8, 0}});
+        builder.Refer(headerAt, WriteSchema(builder));
+
+        return builder.Finish(message);
+    }
+
+    std::string RecordBatchMessage(uint64_t rows, const FieldNode* nodes, uint32_t nodeCount, const Buffer* buffers, uint32_t bufferCount, uint64_t bodyLength)
+    {
+        FlatBuilder builder;
+        size_t headerAt;
+        size_t nodesAt;
+        size_t buffersAt;
+
+        const size_t message = builder.Table({{0, 2, METADATA_V5}, {1, 1, HEADER_RECORD_BATCH}, {2, 4, 0, &headerAt}, {3, 8, bodyLength}});
+        const size_t batch = builder.Table({{0, 8, rows}, {1, 4, 0, &nodesAt}, {2, 4, 0, &buffersAt}});
+
+        builder.Refer(headerAt, batch);
+        builder.Refer(nodesAt, builder.Structs(nodes, nodeCount, sizeof(FieldNode)));
+        builder.Refer(buffersAt, builder.Structs(buffers, bufferCount, sizeof(Buffer)));
+
+        return builder.Finish(message);
+    }
+
+    // File.fbs: the schema again, and where each record batch is
+    std::string Footer(const Block& batch)
+    {
+        FlatBuilder builder;
+        size_t schemaAt;
+        size_t dictionariesAt;
+        size_t batchesAt;
+
+        const size_t footer = builder.Table({{0, 2, METADATA_V5}, {1, 4, 0, &schemaAt}, {2, 4, 0, &dictionariesAt}, {3, 4, 0, &batchesAt}});
+
+        builder.Refer(schemaAt, WriteSchema(builder));
+        builder.Refer(dictionariesAt, builder.Structs(nullptr, 0, sizeof(Block)));
+        builder.Refer(batchesAt, builder.Structs(&batch, 1, sizeof(Block)));
+
+        return builder.Finish(footer);
+    }
+}
+
+CatalogArrow::~CatalogArrow()
+{
+    Close();
+}
+
+bool CatalogArrow::Write(const MovieView& movies, const Sink& sink)
+{
+    const uint64_t rows = movies.size();
+    uint64_t titleBytes = 0;
+
+    for (const MovieRef movie : movies)
+    {
+        titleBytes += movie.GetTitle().size();
+    }
+
+    // Each column's validity bitmap, empty as there are no nulls, then its values
+    uint64_t bodyLength = 0;
+
+    const auto place = [&bodyLength](uint64_t length)
+    {
+        const Buffer buffer{static_cast<int64_t>(bodyLength), static_cast<int64_t>(length)};
+        bodyLength = AlignUp(bodyLength + length, ALIGNMENT);
+        return buffer;
+    };
+
+    const FieldNode nodes[] = {{static_cast<int64_t>(rows), 0}, {static_cast<int64_t>(rows), 0}, {static_cast<int64_t>(rows), 0}};
+    const Buffer buffers[] = {
+        place(0), place(rows * sizeof(uint64_t)),
+        place(0), place((rows + 1) * sizeof(int64_t)), place(titleBytes),
+        place(0), place(rows * sizeof(float)),
+    };
+
+    uint64_t written = 0;
+
+    const auto send = [&](const void* data, size_t size)
+    {
+        written += size;
+        return sink(static_cast<const char*>(data), size);
+    };
+
+    const auto padTo = [&](uint64_t position)
+    {
+        const char padding[ALIGNMENT] = {};
+        return send(padding, static_cast<size_t>(position - written));
+    };
+
+    // The metadata's length and padding are chosen so that what follows starts aligned
+    const auto sendMessage = [&](const std::string& metadata)
+    {
+        const uint64_t end = AlignUp(written + 2 * sizeof(uint32_t) + metadata.size(), ALIGNMENT);
+        const uint32_t prefix[2] = {CONTINUATION, static_cast<uint32_t>(end - written - sizeof(prefix))};
+
+        return send(prefix, sizeof(prefix)) && send(metadata.data(), metadata.size()) && padTo(end);
+    };
+
+    if (!send(MAGIC, sizeof(MAGIC)) || !padTo(sizeof(uint64_t)) || !sendMessage(SchemaMessage()))
+    {
+        return false;
+    }
+
+    Block block{static_cast<int64_t>(written), 0, 0, static_cast<int64_t>(bodyLength)};
+
+    if (!sendMessage(RecordBatchMessage(rows, nodes, std::size(nodes), buffers, std::size(buffers), bodyLength)))
+    {
+        return false;
+    }
+
+    block.metadataLength = static_cast<int32_t>(written - block.offset);
+    const uint64_t body = written;
+
+    std::string chunk;
+    chunk.reserve(CHUNK);
+
+    const auto flush = [&]
+    {
+        const bool sent = send(chunk.data(), chunk.size());
+        chunk.clear();
+        return sent;
+    };
+
+    const auto put = [&](const void* data, size_t size)
+    {
+        chunk.append(static_cast<const char*>(data), size);
+        return chunk.size() < CHUNK || flush();
+    };
+
+    bool sent = padTo(body + buffers[1].offset);
+
+    for (auto movie = movies.begin(); sent && movie != movies.end(); ++movie)
+    {
+        const uint64_t id = movie->GetId();
+        sent = put(&id, sizeof(id));
+    }
+
+    int64_t offset = 0;
+    sent = sent && flush() && padTo(body + buffers[3].offset) && put(&offset, sizeof(offset));
+
+    for (auto movie = movies.begin(); sent && movie != movies.end(); ++movie)
+    {
+        offset += static_cast<int64_t>(movie->GetTitle().size());
+        sent = put(&offset, sizeof(offset));
+    }
+
+    sent = sent && flush() && padTo(body + buffers[4].offset);
+
+    for (auto movie = movies.begin(); sent && movie != movies.end(); ++movie)
+    {
+        sent = put(movie->GetTitle().data(), movie->GetTitle().size());
+    }
+
+    sent = sent && flush() && padTo(body + buffers[6].offset);
+
+    for (auto movie = movies.begin(); sent && movie != movies.end(); ++movie)
+    {
+        const float rating = movie->GetRating();
+        sent = put(&rating, sizeof(rating));
+    }
+
+    // Then the end-of-stream marker, for readers of the stream format, and the footer
+    const uint32_t end[2] = {CONTINUATION, 0};
+    const std::string footer = Footer(block);
+    const auto footerLength = static_cast<int32_t>(footer.size());
+
+    return sent && flush() && padTo(body + bodyLength)
+        && send(end, sizeof(end))
+        && send(footer.data(), footer.size())
+        && send(&footerLength, sizeof(footerLength))
+        && send(MAGIC, sizeof(MAGIC));
+}
+
+bool CatalogArrow::Write(const std::string& path, const MovieView& movies)
+{
+    return AtomicFile::Write(path, "Arrow file", [&movies](const Sink& sink)
+    {
+        return Write(movies, sink);
+    });
+}
+
+bool CatalogArrow::Open(const std::string& path)
+{
+    Close();
+
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat status{};
+    void* mapping = MAP_FAILED;
+
+    if (::fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        mapping = ::mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    base = static_cast<const char*>(mapping);
+    size = static_cast<size_t>(status.st_size);
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open() || file.tellg() <= 0)
+    {
+        return false;
+    }
+
+    size = static_cast<size_t>(file.tellg());
+    copy.reset(new char[size]);
+    file.seekg(0);
+
+    if (!file.read(copy.get(), static_cast<std::streamsize>(size)))
+    {
+        copy.reset();
+        size = 0;
+        return false;
+    }
+
+    base = copy.get();
+#endif
+
+    if (!Index())
+    {
+        std::cerr << "Not an Arrow file with flat id, title and rating columns: " << path << std::endl;
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+bool CatalogArrow::Index()
+{
+    const std::string_view file{base, size};
+    int32_t footerLength;
+
+    if (size < sizeof(uint64_t) + TRAILER || std::memcmp(base, MAGIC, sizeof(MAGIC)) != 0
+        || std::memcmp(base + size - sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    std::memcpy(&footerLength, base + size - TRAILER, sizeof(footerLength));
+
+    if (footerLength <= 0 || static_cast<uint64_t>(footerLength) > size - sizeof(uint64_t) - TRAILER)
+    {
+        return false;
+    }
+
+    const FlatTable footer = FlatTable::Root(file.substr(size - TRAILER - footerLength, footerLength));
+    const FlatTable schema = footer.Table(1);
+    uint64_t fieldsAt;
+    uint32_t fieldCount;
+
+    if (!schema || schema.Scalar<int16_t>(0, LITTLE_ENDIAN_ORDER) != LITTLE_ENDIAN_ORDER
+        || !schema.Vector(1, sizeof(uint32_t), fieldsAt, fieldCount))
+    {
+        return false;
+    }
+
+    // The node of each column wanted, and its first buffer, counting those of the columns
+    // before it
+    enum Wanted
+    {
+        ID,
+        TITLE,
+        RATING,
+        WANTED
+    };
+
+    const std::string_view names[WANTED] = {"id", "title", "rating"};
+    int64_t nodeOf[WANTED] = {-1, -1, -1};
+    int64_t bufferOf[WANTED] = {-1, -1, -1};
+    uint32_t bufferCount = 0;
+
+    for (uint32_t column = 0; column < fieldCount; ++column)
+    {
+        const FlatTable field = schema.Element(fieldsAt, column);
+        const uint8_t type = field.Scalar<uint8_t>(2, 0);
+        const FlatTable parameters = field.Table(3);
+        uint64_t childrenAt;
+        uint32_t children = 0;
+
+        if (!field || field.Table(4) || (field.Vector(5, sizeof(uint32_t), childrenAt, children) && children > 0) || BuffersOf(type) < 0)
+        {
+            return false;
+        }
+
+        const auto wanted = static_cast<size_t>(std::find(std::begin(names), std::end(names), field.String(0)) - std::begin(names));
+
+        if (wanted < WANTED && nodeOf[wanted] < 0)
+        {
+            const int16_t precision = parameters.Scalar<int16_t>(0, 0);
+            bool fits = false;
+
+            switch (wanted)
+            {
+            case ID:
+                fits = type == INT && parameters.Scalar<int32_t>(0, 0) == 64;
+                break;
+            case TITLE:
+                fits = type == UTF8 || type == LARGE_UTF8;
+                titleOffsetWidth = type == UTF8 ? sizeof(int32_t) : sizeof(int64_t);
+                break;
+            case RATING:
+                fits = type == FLOATING_POINT && (precision == PRECISION_SINGLE || precision == PRECISION_DOUBLE);
+                ratingWidth = precision == PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+                break;
+            }
+
+            if (!fits)
+            {
+                return false;
+            }
+
+            nodeOf[wanted] = column;
+            bufferOf[wanted] = bufferCount;
+        }
+
+        bufferCount += static_cast<uint32_t>(BuffersOf(type));
+    }
+
+    if (std::find(std::begin(nodeOf), std::end(nodeOf), -1) != std::end(nodeOf))
+    {
+        return false;
+    }
+
+    uint64_t blocksAt;
+    uint32_t blockCount;
+
+    if (!footer.Vector(3, sizeof(Block), blocksAt, blockCount))
+    {
+        return false;
+    }
+
+    for (uint32_t index = 0; index < blockCount; ++index)
+    {
+        Block block{};
+
+        if (!footer.Read(blocksAt + index * sizeof(Block), block) || block.offset < 0 || block.metadataLength < 8 || block.bodyLength < 0
+            || static_cast<uint64_t>(block.offset) > size || static_cast<uint64_t>(block.metadataLength) > size - block.offset
+            || static_cast<uint64_t>(block.bodyLength) > size - block.offset - block.metadataLength)
+        {
+            return false;
+        }
+
+        // Files from before Arrow 0.15 have no continuation marker before the length
+        uint32_t marker;
+        int32_t length;
+        std::memcpy(&marker, base + block.offset, sizeof(marker));
+        const size_t prefix = marker == CONTINUATION ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+        std::memcpy(&length, base + block.offset + prefix - sizeof(length), sizeof(length));
+
+        if (length < 0 || prefix + length > static_cast<uint64_t>(block.metadataLength))
+        {
+            return false;
+        }
+
+        const FlatTable message = FlatTable::Root(file.substr(block.offset + prefix, length));
+        const FlatTable batch = message.Table(2);
+        const int64_t rows = batch.Scalar<int64_t>(0, -1);
+        uint64_t nodesAt;
+        uint64_t buffersAt;
+        uint32_t nodeCount;
+        uint32_t bufferTotal;
+
+        // Compressed bodies aren't read
+        if (message.Scalar<uint8_t>(1, 0) != HEADER_RECORD_BATCH || !batch || batch.Table(3) || rows < 0 || static_cast<uint64_t>(rows) > size
+            || !batch.Vector(1, sizeof(FieldNode), nodesAt, nodeCount) || nodeCount != fieldCount
+            || !batch.Vector(2, sizeof(Buffer), buffersAt, bufferTotal) || bufferTotal != bufferCount)
+        {
+            return false;
+        }
+
+        const char* body = base + block.offset + block.metadataLength;
+
+        // A buffer of the batch, if it lies in the body and holds at least `least` bytes
+        const auto locate = [&](int64_t which, uint64_t least, const char*& data, uint64_t& bytes)
+        {
+            Buffer buffer{};
+
+            if (!batch.Read(buffersAt + which * sizeof(Buffer), buffer) || buffer.offset < 0 || buffer.length < 0
+                || buffer.offset > block.bodyLength || buffer.length > block.bodyLength - buffer.offset
+                || static_cast<uint64_t>(buffer.length) < least)
+            {
+                return false;
+            }
+
+            data = body + buffer.offset;
+            bytes = static_cast<uint64_t>(buffer.length);
+            return true;
+        };
+
+        for (const int64_t node : nodeOf)
+        {
+            FieldNode entry{};
+
+            if (!batch.Read(nodesAt + node * sizeof(FieldNode), entry) || entry.length != rows || entry.nullCount != 0)
+            {
+                return false;
+            }
+        }
+
+        Batch entry;
+        entry.first = movies;
+        entry.rows = static_cast<size_t>(rows);
+        uint64_t bytes;
+
+        // An empty column may leave out its offsets altogether
+        if (!locate(bufferOf[ID] + 1, rows * sizeof(uint64_t), entry.ids, bytes)
+            || !locate(bufferOf[RATING] + 1, rows * ratingWidth, entry.ratings, bytes)
+            || !locate(bufferOf[TITLE] + 1, rows > 0 ? (rows + 1) * titleOffsetWidth : 0, entry.titleOffsets, bytes)
+            || !locate(bufferOf[TITLE] + 2, 0, entry.titles, entry.titleBytes))
+        {
+            return false;
+        }
+
+        batches.push_back(entry);
+        movies += entry.rows;
+    }
+
+    return true;
+}
+
+void CatalogArrow::Close()
+{
+#ifdef __linux__
+    if (base)
+    {
+        ::munmap(const_cast<char*>(base), size);
+    }
+#endif
+
+    copy.reset();
+    base = nullptr;
+    size = 0;
+    batches.clear();
+    movies = 0;
+}
+
+size_t CatalogArrow::GetSize() const
+{
+    return movies;
+}
+
+uint64_t CatalogArrow::GetId(size_t movie) const
+{
+    const Batch& batch = Find(movie);
+    uint64_t id;
+    std::memcpy(&id, batch.ids + movie * sizeof(id), sizeof(id));
+    return id;
+}
+
+float CatalogArrow::GetRating(size_t movie) const
+{
+    const Batch& batch = Find(movie);
+
+    if (ratingWidth == sizeof(double))
+    {
+        double rating;
+        std::memcpy(&rating, batch.ratings + movie * sizeof(rating), sizeof(rating));
+        return static_cast<float>(rating);
+    }
+
+    float rating;
+    std::memcpy(&rating, batch.ratings + movie * sizeof(rating), sizeof(rating));
+    return rating;
+}
+
+std::string_view CatalogArrow::GetTitle(size_t movie) const
+{
+    const Batch& batch = Find(movie);
+    int64_t begin;
+    int64_t end;
+
+    if (titleOffsetWidth == sizeof(int32_t))
+    {
+        int32_t offsets[2];
+        std::memcpy(offsets, batch.titleOffsets + movie * sizeof(int32_t), sizeof(offsets));
+        begin = offsets[0];
+        end = offsets[1];
+    }
+    else
+    {
+        int64_t offsets[2];
+        std::memcpy(offsets, batch.titleOffsets + movie * sizeof(int64_t), sizeof(offsets));
+        begin = offsets[0];
+        end = offsets[1];
+    }
+
+    if (begin < 0 || begin > end || static_cast<uint64_t>(end) > batch.titleBytes)
+    {
+        return {};
+    }
+
+    return {batch.titles + begin, static_cast<size_t>(end - begin)};
+}
+
+bool CatalogArrow::GetColumns(MovieColumns& columns) const
+{
+    const auto whole = std::find_if(batches.begin(), batches.end(), [this](const Batch& batch) { return batch.rows == movies; });
+
+    if (whole == batches.end() || ratingWidth != sizeof(float) || titleOffsetWidth != sizeof(int64_t))
+    {
+        return false;
+    }
+
+    const auto aligned = [](const char* buffer, size_t alignment) { return reinterpret_cast<uintptr_t>(buffer) % alignment == 0; };
+
+    if (!aligned(whole->ids, alignof(uint64_t)) || !aligned(whole->ratings, alignof(float)) || !aligned(whole->titleOffsets, alignof(uint64_t)))
+    {
+        return false;
+    }
+
+    // An id written as int64 reads the same as uint64, as GetId reads it; so does an
+    // offset, where a negative one comes out too large and its title empty
+    columns.ids = reinterpret_cast<const uint64_t*>(whole->ids);
+    columns.ratings = reinterpret_cast<const float*>(whole->ratings);
+    columns.titleOffsets = reinterpret_cast<const uint64_t*>(whole->titleOffsets);
+    columns.titles = whole->titles;
+    columns.titleBytes = whole->titleBytes;
+    return true;
+}
+
+const CatalogArrow::Batch& CatalogArrow::Find(size_t& movie) const
+{
+    // The last batch starting at or before the movie; empty ones before it are passed over
+    const auto batch = std::upper_bound(batches.begin(), batches.end(), movie, [](size_t wanted, const Batch& candidate)
+    {
+        return wanted < candidate.first;
+    }) - 1;
+
+    movie -= batch->first;
+    return *batch;
+}
@@ -0,0 +1,90 @@
+﻿#ifndef CATALOG_ARROW_H
+#define CATALOG_ARROW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MovieView.h"
+
+// A saved MovieDatabase in the Arrow IPC file format, for analytics tools (pyarrow, Polars,
+// DuckDB and the like) to read as they read any Arrow file. There are three columns, id as
+// uint64, title as large_utf8 and rating as float32, none with nulls, in one record batch.
+// The few flatbuffers the format wraps its metadata in are laid out by hand, so the Arrow
+// library isn't needed.
+//
+// Opening maps the file and finds each column's buffers in it, which are then read where
+// they lie, so nothing is parsed or copied however many movies there are. Files written by
+// other tools open as well if they have those columns by name, flat, uncompressed and
+// without nulls, in any number of batches; the id may also be int64, the title utf8 and
+// the rating float64.
+class CatalogArrow
+{
+public:
+    CatalogArrow() = default;
+    ~CatalogArrow();
+
+    CatalogArrow(const CatalogArrow&) = delete;
+    CatalogArrow& operator=(const CatalogArrow&) = delete;
+
+    // Receives the file's bytes in order; returning false stops the write
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    // Replaces the file whole; see AtomicFile. The columns are streamed from `movies`
+    // rather than gathered first.
+    static bool Write(const std::string& path, const MovieView& movies);
+    static bool Write(const MovieView& movies, const Sink& sink);
+
+    // Returns false, leaving the file closed, if it isn't Arrow or lacks a column as above
+    bool Open(const std::string& path);
+    void Close();
+
+    [[nodiscard]] bool IsOpen() const { return base != nullptr; }
+
+    [[nodiscard]] size_t GetSize() const;
+    [[nodiscard]] uint64_t GetId(size_t movie) const;
+    [[nodiscard]] float GetRating(size_t movie) const;
+
+    // Empty if the offsets are out of bounds, as they aren't checked on opening
+    [[nodiscard]] std::string_view GetTitle(size_t movie) const;
+
+    // Every column where it lies, for MovieDatabase to read in place. False unless the file
+    // is laid out as Write lays it out: one batch, 64-bit offsets, float32 ratings and each
+    // buffer aligned for its values.
+    bool GetColumns(MovieColumns& columns) const;
+
+private:
+    // Where a record batch's columns are, and how wide their values
+    struct Batch
+    {
+        size_t first = 0;           // Movies in the batches before
+        size_t rows = 0;
+        const char* ids = nullptr;
+        const char* ratings = nullptr;
+        const char* titleOffsets = nullptr;
+        const char* titles = nullptr;
+        uint64_t titleBytes = 0;
+    };
+
+    bool Index();
+
+    // The batch holding `movie`, which becomes its row there
+    const Batch& Find(size_t& movie) const;
+
+    const char* base = nullptr;
+    size_t size = 0;
+
+    std::vector<Batch> batches;
+    size_t movies = 0;
+    size_t ratingWidth = sizeof(float);
+    size_t titleOffsetWidth = sizeof(int64_t);
+
+    // Where mapping isn't available the file is read into memory instead
+    std::unique_ptr<char[]> copy;
+};
+
+#endif
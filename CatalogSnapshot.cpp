@@ -0,0 +1,307 @@
+﻿#include "CatalogSnapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include "AtomicFile.h"
+#include "Checksum.h"
+#include "ParallelSort.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char MAGIC[8] = {'S', 'F', 'X', 'C', 'A', 'T', 'L', 'G'};
+
+    // Written as is, so a snapshot from a machine of the other byte order reads back swapped
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    // Every column starts on a cache line
+    constexpr uint64_t ALIGNMENT = 64;
+
+    uint64_t AlignUp(uint64_t offset)
+    {
+        return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+}
+
+CatalogSnapshot::~CatalogSnapshot()
+{
+    Close();
+}
+
+bool CatalogSnapshot::Write(const MovieView& movies, const Sink& sink)
+{
+    if (movies.size() > UINT32_MAX)
+    {
+        std::cerr << "Error writing snapshot: too many movies" << std::endl;
+        return false;
+    }
+
+    std::vector<uint64_t> ids;
+    std::vector<float> ratings;
+    std::vector<uint64_t> titleOffsets{0};
+    std::string titles;
+
+    ids.reserve(movies.size());
+    ratings.reserve(movies.size());
+    titleOffsets.reserve(movies.size() + 1);
+
+    for (const MovieRef movie : movies)
+    {
+        ids.push_back(movie.GetId());
+        ratings.push_back(movie.GetRating());
+        titles += movie.GetTitle();
+        titleOffsets.push_back(titles.size());
+    }
+
+    const auto title = [&](uint32_t movie)
+    {
+        return std::string_view{titles}.substr(titleOffsets[movie], titleOffsets[movie + 1] - titleOffsets[movie]);
+    };
+
+    // Stable, as MovieDatabase's sorts are
+    std::vector<uint32_t> titleOrder(movies.size());
+    std::iota(titleOrder.begin(), titleOrder.end(), 0);
+    std::vector<uint32_t> ratingOrder = titleOrder;
+
+    {
+        TaskGroup group;
+        group.Run([&] { ParallelSort::StableSort(titleOrder.begin(), titleOrder.end(), [&](uint32_t a, uint32_t b) { return title(a) < title(b); }); });
+        ParallelSort::StableSort(ratingOrder.begin(), ratingOrder.end(), [&](uint32_t a, uint32_t b) { return ratings[a] > ratings[b]; });
+        group.Wait();
+    }
+
+    const std::pair<const void*, uint64_t> columns[COLUMNS] = {
+        {ids.data(), ids.size() * sizeof(uint64_t)},
+        {ratings.data(), ratings.size() * sizeof(float)},
+        {titleOffsets.data(), titleOffsets.size() * sizeof(uint64_t)},
+        {titles.data(), titles.size()},
+        {titleOrder.data(), titleOrder.size() * sizeof(uint32_t)},
+        {ratingOrder.data(), ratingOrder.size() * sizeof(uint32_t)},
+    };
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.movies = movies.size();
+
+    uint64_t offset = AlignUp(sizeof(Header));
+
+    for (size_t column = 0; column < COLUMNS; ++column)
+    {
+        header.sections[column] = {offset, columns[column].second};
+        offset = AlignUp(offset + columns[column].second);
+    }
+
+    header.fileSize = offset;
+    header.checksum = Checksum::Crc32(&header, offsetof(Header, checksum));
+
+    const char padding[ALIGNMENT] = {};
+
+    if (!sink(reinterpret_cast<const char*>(&header), sizeof(Header))
+        || !sink(padding, static_cast<size_t>(header.sections[0].offset - sizeof(Header))))
+    {
+        return false;
+    }
+
+    for (size_t column = 0; column < COLUMNS; ++column)
+    {
+        const Section& section = header.sections[column];
+        const uint64_t next = column + 1 < COLUMNS ? header.sections[column + 1].offset : header.fileSize;
+
+        if (!sink(static_cast<const char*>(columns[column].first), static_cast<size_t>(section.size))
+            || !sink(padding, static_cast<size_t>(next - section.offset - section.size)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CatalogSnapshot::Write(const std::string& path, const MovieView& movies)
+{
+    return AtomicFile::Write(path, "snapshot", [&movies](const Sink& sink)
+    {
+        return Write(movies, sink);
+    });
+}
+
+bool CatalogSnapshot::Open(const std::string& path)
+{
+    Close();
+
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // The mapping keeps the file open on its own
+    const bool opened = Open(fd, path);
+    ::close(fd);
+    return opened;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open() || static_cast<size_t>(file.tellg()) < sizeof(Header))
+    {
+        return false;
+    }
+
+    size = static_cast<size_t>(file.tellg());
+    copy.reset(new char[size]);
+    file.seekg(0);
+
+    if (!file.read(copy.get(), static_cast<std::streamsize>(size)))
+    {
+        copy.reset();
+        size = 0;
+        return false;
+    }
+
+    base = copy.get();
+    return Validate(path);
+#endif
+}
+
+bool CatalogSnapshot::Open(int fd, const std::string& name)
+{
+    Close();
+
+#ifdef __linux__
+    struct stat status{};
+
+    if (::fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(Header))
+    {
+        return false;
+    }
+
+    void* mapping = ::mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    base = static_cast<const char*>(mapping);
+    size = static_cast<size_t>(status.st_size);
+    return Validate(name);
+#else
+    std::cerr << "Mapping a snapshot from a descriptor is not supported here: " << name << std::endl;
+    return false;
+#endif
+}
+
+bool CatalogSnapshot::Validate(const std::string& name)
+{
+    const auto* candidate = reinterpret_cast<const Header*>(base);
+    bool valid = std::memcmp(candidate->magic, MAGIC, sizeof(MAGIC)) == 0
+        && candidate->version == VERSION
+        && candidate->byteOrder == BYTE_ORDER_MARK
+        && candidate->fileSize == size
+        && candidate->movies <= UINT32_MAX
+        && candidate->checksum == Checksum::Crc32(candidate, offsetof(Header, checksum));
+
+    // Each column where it fits in the file, aligned for its type, and as long as the
+    // number of movies says, bar the title heap
+    const uint64_t elements[COLUMNS] = {sizeof(uint64_t), sizeof(float), sizeof(uint64_t), 0, sizeof(uint32_t), sizeof(uint32_t)};
+
+    for (size_t column = 0; valid && column < COLUMNS; ++column)
+    {
+        const Section& section = candidate->sections[column];
+        const uint64_t count = column == TITLE_OFFSETS ? candidate->movies + 1 : candidate->movies;
+
+        valid = section.offset % ALIGNMENT == 0 && section.offset <= size && section.size <= size - section.offset
+            && (elements[column] == 0 || section.size == count * elements[column]);
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Not a catalog snapshot of version " << VERSION << ": " << name << std::endl;
+        Close();
+        return false;
+    }
+
+    header = candidate;
+    return true;
+}
+
+void CatalogSnapshot::Close()
+{
+#ifdef __linux__
+    if (base)
+    {
+        ::munmap(const_cast<char*>(base), size);
+    }
+#endif
+
+    copy.reset();
+    base = nullptr;
+    size = 0;
+    header = nullptr;
+}
+
+size_t CatalogSnapshot::GetSize() const
+{
+    return static_cast<size_t>(header->movies);
+}
+
+uint64_t CatalogSnapshot::GetId(size_t movie) const
+{
+    return GetColumn<uint64_t>(IDS)[movie];
+}
+
+float CatalogSnapshot::GetRating(size_t movie) const
+{
+    return GetColumn<float>(RATINGS)[movie];
+}
+
+std::string_view CatalogSnapshot::GetTitle(size_t movie) const
+{
+    const uint64_t* offsets = GetColumn<uint64_t>(TITLE_OFFSETS);
+    const uint64_t begin = offsets[movie];
+    const uint64_t end = offsets[movie + 1];
+
+    if (begin > end || end > header->sections[TITLES].size)
+    {
+        return {};
+    }
+
+    return {GetColumn<char>(TITLES) + begin, static_cast<size_t>(end - begin)};
+}
+
+MovieColumns CatalogSnapshot::GetColumns() const
+{
+    MovieColumns columns;
+    columns.ids = GetColumn<uint64_t>(IDS);
+    columns.ratings = GetColumn<float>(RATINGS);
+    columns.titleOffsets = GetColumn<uint64_t>(TITLE_OFFSETS);
+    columns.titles = GetColumn<char>(TITLES);
+    columns.titleBytes = header->sections[TITLES].size;
+    return columns;
+}
+
+const uint32_t* CatalogSnapshot::GetTitleOrder() const
+{
+    return GetColumn<uint32_t>(TITLE_ORDER);
+}
+
+const uint32_t* CatalogSnapshot::GetRatingOrder() const
+{
+    return GetColumn<uint32_t>(RATING_ORDER);
+}
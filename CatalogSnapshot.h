@@ -0,0 +1,111 @@
+﻿#ifndef CATALOG_SNAPSHOT_H
+#define CATALOG_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "MovieView.h"
+
+// A saved MovieDatabase, laid out so that loading it needs no parsing. After a fixed header
+// come the columns: ids, ratings, offsets into a heap holding every title back to back,
+// the heap, and the two orders MovieDatabase sorts by, precomputed.
+//
+// Opening maps the file read-only and checks the header, and costs the same whatever the
+// size of the catalog. The pages come from the page cache, so processes that open the same
+// snapshot share them.
+class CatalogSnapshot
+{
+public:
+    // Bumped whenever the layout changes; a snapshot of another version is not opened
+    static constexpr uint32_t VERSION = 1;
+
+    CatalogSnapshot() = default;
+    ~CatalogSnapshot();
+
+    CatalogSnapshot(const CatalogSnapshot&) = delete;
+    CatalogSnapshot& operator=(const CatalogSnapshot&) = delete;
+
+    // Receives the snapshot's bytes in order; returning false stops the write
+    using Sink = std::function<bool(const char* data, size_t size)>;
+
+    // Replaces the file whole; see AtomicFile
+    static bool Write(const std::string& path, const MovieView& movies);
+    static bool Write(const MovieView& movies, const Sink& sink);
+
+    // Returns false, leaving the snapshot closed, if the file is missing, of another
+    // version or byte order, or not the size its header says
+    bool Open(const std::string& path);
+
+    // Maps an already open file or shared memory object, which may be closed afterwards.
+    // `name` is for messages.
+    bool Open(int fd, const std::string& name);
+    void Close();
+
+    [[nodiscard]] bool IsOpen() const { return header != nullptr; }
+
+    [[nodiscard]] size_t GetSize() const;
+    [[nodiscard]] uint64_t GetId(size_t movie) const;
+    [[nodiscard]] float GetRating(size_t movie) const;
+
+    // Empty if the offsets are out of bounds, as only the header is checked on opening
+    [[nodiscard]] std::string_view GetTitle(size_t movie) const;
+
+    // Every column where it lies, for MovieDatabase to read in place
+    [[nodiscard]] MovieColumns GetColumns() const;
+
+    // Movies by title, and by rating from the highest, ties in catalog order. Entries are
+    // only checked against GetSize by the reader.
+    [[nodiscard]] const uint32_t* GetTitleOrder() const;
+    [[nodiscard]] const uint32_t* GetRatingOrder() const;
+
+private:
+    enum Column
+    {
+        IDS,
+        RATINGS,
+        TITLE_OFFSETS,
+        TITLES,
+        TITLE_ORDER,
+        RATING_ORDER,
+        COLUMNS
+    };
+
+    struct Section
+    {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t fileSize;
+        uint64_t movies;
+        Section sections[COLUMNS];
+        uint32_t checksum;      // CRC-32 of the header up to here
+        uint32_t reserved;
+    };
+
+    bool Validate(const std::string& name);
+
+    template <typename T>
+    const T* GetColumn(Column column) const
+    {
+        return reinterpret_cast<const T*>(base + header->sections[column].offset);
+    }
+
+    const char* base = nullptr;
+    size_t size = 0;
+    const Header* header = nullptr;
+
+    // Where mapping isn't available the file is read into memory instead
+    std::unique_ptr<char[]> copy;
+};
+
+#endif
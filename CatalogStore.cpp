@@ -0,0 +1,372 @@
+﻿#include "CatalogStore.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+
+#include "CatalogSnapshot.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Operation, id and rating, then the title
+    constexpr size_t RECORD_HEADER = 1 + sizeof(uint64_t) + sizeof(float);
+
+    // The generation in a name like catalog-12.wal, if it has that form
+    bool ParseGeneration(const std::string& name, const std::string& extension, uint64_t& generation)
+    {
+        const std::string prefix = "catalog-";
+
+        if (name.size() <= prefix.size() + extension.size() || name.compare(0, prefix.size(), prefix) != 0
+            || name.compare(name.size() - extension.size(), extension.size(), extension) != 0)
+        {
+            return false;
+        }
+
+        const std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - extension.size());
+
+        if (digits.size() > 19 || !std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            return false;
+        }
+
+        generation = std::stoull(digits);
+        return true;
+    }
+
+    // A renamed file is only sure to survive a crash once both it and its directory are synced
+    bool Sync(const std::string& path)
+    {
+#ifdef __linux__
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+#else
+        return true;
+#endif
+    }
+}
+
+CatalogStore::CatalogStore(std::string directory, const Settings& settings)
+    : directory(std::move(directory)), settings(settings)
+{
+}
+
+CatalogStore::~CatalogStore()
+{
+    {
+        std::lock_guard lock(compactorMutex);
+        stopping = true;
+    }
+
+    compactorWake.notify_one();
+
+    if (compactor.joinable())
+    {
+        compactor.join();
+    }
+}
+
+bool CatalogStore::Open()
+{
+    if (compactor.joinable())
+    {
+        std::cerr << "Catalog already open: " << directory << std::endl;
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    if (error)
+    {
+        std::cerr << "Error creating catalog directory " << directory << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    std::map<uint64_t, std::string> snapshots;
+    std::map<uint64_t, std::string> logs;
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        const std::string name = entry.path().filename().string();
+        uint64_t found;
+
+        if (ParseGeneration(name, ".snapshot", found))
+        {
+            snapshots[found] = entry.path().string();
+        }
+        else if (ParseGeneration(name, ".wal", found))
+        {
+            logs[found] = entry.path().string();
+        }
+    }
+
+    std::lock_guard lock(mutex);
+
+    // The newest snapshot that opens, then every log it doesn't cover, oldest first
+    generation = 0;
+
+    for (auto it = snapshots.rbegin(); it != snapshots.rend(); ++it)
+    {
+        if (database.LoadSnapshot(it->second))
+        {
+            generation = it->first;
+            break;
+        }
+    }
+
+    uint64_t validBytes = 0;
+
+    for (auto it = logs.lower_bound(generation); it != logs.end(); ++it)
+    {
+        generation = it->first;
+        validBytes = WriteAheadLog::Replay(it->second, [this](std::string_view record)
+        {
+            if (!Apply(record))
+            {
+                std::cerr << "Skipping an unreadable record in " << directory << std::endl;
+            }
+        });
+    }
+
+    // Appends go on after the last intact record of the newest log
+    if (!log.Open(GetLogPath(generation), validBytes) || !Sync(directory))
+    {
+        return false;
+    }
+
+    compactor = std::thread([this] { RunCompactor(); });
+    return true;
+}
+
+bool CatalogStore::AddMovie(Movie movie)
+{
+    uint64_t sequence;
+
+    {
+        std::lock_guard lock(mutex);
+        sequence = log.Append(Encode(Operation::Add, movie));
+        database.AddMovie(std::move(movie));
+    }
+
+    return Committed(sequence);
+}
+
+bool CatalogStore::AddMovies(MovieList movies)
+{
+    uint64_t sequence = 0;
+
+    {
+        std::lock_guard lock(mutex);
+
+        for (const Movie& movie : movies)
+        {
+            sequence = log.Append(Encode(Operation::Add, movie));
+        }
+
+        database.AddMovies(std::move(movies));
+    }
+
+    return Committed(sequence);
+}
+
+bool CatalogStore::UpsertMovie(Movie movie)
+{
+    uint64_t sequence;
+
+    {
+        std::lock_guard lock(mutex);
+        sequence = log.Append(Encode(Operation::Upsert, movie));
+        database.UpsertMovie(std::move(movie));
+    }
+
+    return Committed(sequence);
+}
+
+bool CatalogStore::UpsertMovies(MovieList movies)
+{
+    uint64_t sequence = 0;
+
+    {
+        std::lock_guard lock(mutex);
+
+        for (Movie& movie : movies)
+        {
+            sequence = log.Append(Encode(Operation::Upsert, movie));
+            database.UpsertMovie(std::move(movie));
+        }
+    }
+
+    return Committed(sequence);
+}
+
+void CatalogStore::Read(const std::function<void(const MovieDatabase& database)>& read) const
+{
+    std::lock_guard lock(mutex);
+    read(database);
+}
+
+bool CatalogStore::Compact()
+{
+    std::lock_guard one(compacting);
+
+    MovieView movies;
+    uint64_t next;
+
+    {
+        std::lock_guard lock(mutex);
+        next = generation + 1;
+    }
+
+    // The next log is created and its name synced before writers are held up at all
+    if (!log.PrepareRotation(GetLogPath(next)) || !Sync(directory))
+    {
+        return false;
+    }
+
+    // Changes logged from here on go to the next log, which the snapshot doesn't cover. The
+    // view taken with it is what the snapshot holds; writers carry on as it is written out,
+    // copying only the blocks they change meanwhile. What the old log still has queued is
+    // synced by the next commit, ahead of anything in the new one.
+    {
+        std::lock_guard lock(mutex);
+
+        if (!log.Rotate())
+        {
+            return false;
+        }
+
+        generation = next;
+        movies = database.GetMovies();
+    }
+
+    const std::string path = GetSnapshotPath(next);
+
+    if (!CatalogSnapshot::Write(path, movies))
+    {
+        return false;
+    }
+
+    // Everything before the new snapshot is now redundant
+    std::error_code error;
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        const std::string name = entry.path().filename().string();
+        uint64_t found;
+
+        if ((ParseGeneration(name, ".snapshot", found) || ParseGeneration(name, ".wal", found)) && found < next)
+        {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+    return true;
+}
+
+std::string CatalogStore::Encode(Operation operation, const Movie& movie)
+{
+    const uint64_t id = movie.GetId();
+    const float rating = movie.GetRating();
+
+    std::string record(RECORD_HEADER, '\0');
+    record[0] = static_cast<char>(operation);
+    std::memcpy(&record[1], &id, sizeof(id));
+    std::memcpy(&record[1 + sizeof(id)], &rating, sizeof(rating));
+    record += movie.GetTitle();
+
+    return record;
+}
+
+bool CatalogStore::Apply(std::string_view record)
+{
+    if (record.size() < RECORD_HEADER)
+    {
+        return false;
+    }
+
+    uint64_t id;
+    float rating;
+    std::memcpy(&id, record.data() + 1, sizeof(id));
+    std::memcpy(&rating, record.data() + 1 + sizeof(id), sizeof(rating));
+
+    Movie movie{std::string{record.substr(RECORD_HEADER)}, rating, id};
+
+    switch (static_cast<Operation>(record[0]))
+    {
+    case Operation::Add:
+        database.AddMovie(std::move(movie));
+        return true;
+    case Operation::Upsert:
+        database.UpsertMovie(std::move(movie));
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string CatalogStore::GetSnapshotPath(uint64_t generation) const
+{
+    return (std::filesystem::path(directory) / ("catalog-" + std::to_string(generation) + ".snapshot")).string();
+}
+
+std::string CatalogStore::GetLogPath(uint64_t generation) const
+{
+    return (std::filesystem::path(directory) / ("catalog-" + std::to_string(generation) + ".wal")).string();
+}
+
+bool CatalogStore::Committed(uint64_t sequence)
+{
+    const bool durable = log.WaitDurable(sequence);
+
+    if (log.GetSize() >= settings.compactionThreshold)
+    {
+        {
+            std::lock_guard lock(compactorMutex);
+            compactionWanted = true;
+        }
+
+        compactorWake.notify_one();
+    }
+
+    return durable;
+}
+
+void CatalogStore::RunCompactor()
+{
+    std::unique_lock lock(compactorMutex);
+
+    for (;;)
+    {
+        compactorWake.wait(lock, [this] { return compactionWanted || stopping; });
+
+        if (stopping)
+        {
+            return;
+        }
+
+        compactionWanted = false;
+        lock.unlock();
+
+        if (!Compact())
+        {
+            std::cerr << "Error compacting the catalog in " << directory << std::endl;
+        }
+
+        lock.lock();
+    }
+}
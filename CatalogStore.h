@@ -0,0 +1,88 @@
+﻿#ifndef CATALOG_STORE_H
+#define CATALOG_STORE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "MovieDatabase.h"
+#include "WriteAheadLog.h"
+
+// A MovieDatabase kept on disk as a snapshot plus a write-ahead log of the changes made
+// since. A change is applied in memory and logged in the same order, and returns once the
+// log has it on disk; changes made at the same time share a sync. Opening loads the newest
+// snapshot and replays the logs after it. Once the log passes a size, a background thread
+// folds everything into a new snapshot and deletes the logs it covers; it writes from a
+// MovieView, so changes only wait for it to take one.
+//
+// In the directory, catalog-<n>.snapshot holds all that was logged in catalog-<m>.wal for
+// every m below n.
+class CatalogStore
+{
+public:
+    struct Settings
+    {
+        uint64_t compactionThreshold = 64 * 1024 * 1024;   // Log bytes that start a new snapshot
+    };
+
+    CatalogStore(std::string directory, const Settings& settings);
+    explicit CatalogStore(std::string directory) : CatalogStore(std::move(directory), Settings{}) {}
+    ~CatalogStore();
+
+    CatalogStore(const CatalogStore&) = delete;
+    CatalogStore& operator=(const CatalogStore&) = delete;
+
+    // Only once; opening again fails, as the log and the compactor are already running
+    bool Open();
+
+    // Each returns false if the change couldn't be logged, and is then only in memory
+    bool AddMovie(Movie movie);
+    bool AddMovies(MovieList movies);
+    bool UpsertMovie(Movie movie);
+    bool UpsertMovies(MovieList movies);
+
+    // Calls `read` with the database, which holds still until it returns
+    void Read(const std::function<void(const MovieDatabase& database)>& read) const;
+
+    // Folds the log into a new snapshot now rather than when it is big enough
+    bool Compact();
+
+private:
+    enum class Operation : uint8_t
+    {
+        Add = 1,
+        Upsert = 2
+    };
+
+    static std::string Encode(Operation operation, const Movie& movie);
+    bool Apply(std::string_view record);
+
+    [[nodiscard]] std::string GetSnapshotPath(uint64_t generation) const;
+    [[nodiscard]] std::string GetLogPath(uint64_t generation) const;
+
+    bool Committed(uint64_t sequence);
+    void RunCompactor();
+
+    const std::string directory;
+    const Settings settings;
+
+    // Orders changes to the database and the log alike
+    mutable std::mutex mutex;
+    MovieDatabase database;
+    uint64_t generation = 0;    // The log being written is catalog-<generation>.wal
+    WriteAheadLog log;
+
+    std::mutex compacting;
+    std::mutex compactorMutex;
+    std::condition_variable compactorWake;
+    bool compactionWanted = false;
+    bool stopping = false;
+    std::thread compactor;
+};
+
+#endif
@@ -0,0 +1,219 @@
+﻿#include "CatalogSync.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "AtomicFile.h"
+#include "CalendarDate.h"
+#include "JsonProjection.h"
+
+namespace
+{
+    // TMDB refuses a change feed query spanning more days than this
+    constexpr int64_t MAX_DAYS_PER_QUERY = 14;
+
+    enum ChangesField : size_t
+    {
+        ID,
+        TOTAL_PAGES
+    };
+
+    const JsonProjection& ChangesProjection()
+    {
+        static const JsonProjection projection({"results[*].id", "total_pages"});
+        return projection;
+    }
+
+    class ChangesVisitor : public JsonProjection::Visitor
+    {
+    public:
+        explicit ChangesVisitor(std::vector<uint64_t>& ids) : ids(ids) {}
+
+        void OnValue(size_t field, const JsonProjection::Value& value) override
+        {
+            uint64_t number;
+
+            if (!value.GetNumber(number))
+            {
+                return;
+            }
+
+            if (field == ID && number != 0)
+            {
+                ids.push_back(number);
+            }
+            else if (field == TOTAL_PAGES)
+            {
+                totalPages = number;
+            }
+        }
+
+        [[nodiscard]] uint64_t GetTotalPages() const
+        {
+            return totalPages;
+        }
+
+    private:
+        std::vector<uint64_t>& ids;
+        uint64_t totalPages = 0;
+    };
+}
+
+CatalogSync::CatalogSync(const TMDBServiceProvider& provider, CatalogStore& store, Settings settings)
+    : provider(provider), store(store), settings(std::move(settings))
+{
+}
+
+CatalogSync::Result CatalogSync::Run(const CancellationToken& cancellation)
+{
+    return Run(CalendarDate::Format(CalendarDate::Today()), cancellation);
+}
+
+CatalogSync::Result CatalogSync::Run(const std::string& endDate, const CancellationToken& cancellation)
+{
+    Result result;
+    int64_t end;
+
+    if (!CalendarDate::Parse(endDate, end))
+    {
+        std::cerr << "Not a date: " << endDate << std::endl;
+        return result;
+    }
+
+    const std::string watermark = ReadWatermark(settings.watermarkPath);
+    int64_t start;
+
+    if (watermark.empty() || !CalendarDate::Parse(watermark, start))
+    {
+        result.complete = WriteWatermark(settings.watermarkPath, endDate);
+        return result;
+    }
+
+    // Already synced past the end date; writing it would take the next sync back over old days
+    if (start > end)
+    {
+        result.complete = true;
+        return result;
+    }
+
+    // The watermark's own day is taken again, as it was still going on when it was written
+    std::vector<uint64_t> ids;
+
+    for (int64_t from = start; from <= end; from += MAX_DAYS_PER_QUERY)
+    {
+        const int64_t to = std::min(end, from + MAX_DAYS_PER_QUERY - 1);
+
+        if (!CollectChanges(CalendarDate::Format(from), CalendarDate::Format(to), ids, cancellation))
+        {
+            return result;
+        }
+    }
+
+    // A movie changed on several days is fetched once
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    result.changed = ids.size();
+
+    Apply(ids, result, cancellation);
+
+    // Cancelled part way, or with any movie missing for now, the same range is taken again
+    // next time; one that will never be had doesn't hold it back
+    if (result.updated + result.skipped == result.changed)
+    {
+        result.complete = WriteWatermark(settings.watermarkPath, endDate);
+    }
+
+    return result;
+}
+
+std::string CatalogSync::ReadWatermark(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string date;
+
+    if (!file.is_open() || !(file >> date))
+    {
+        return "";
+    }
+
+    return date;
+}
+
+bool CatalogSync::WriteWatermark(const std::string& path, const std::string& date)
+{
+    const std::string line = date + '\n';
+    return AtomicFile::Write(path, "sync watermark", line.data(), line.size());
+}
+
+bool CatalogSync::CollectChanges(const std::string& startDate, const std::string& endDate, std::vector<uint64_t>& ids, const CancellationToken& cancellation) const
+{
+    uint64_t totalPages = 1;
+
+    for (uint32_t page = 1; page <= totalPages; ++page)
+    {
+        const ResponseBuffer body = provider.FetchMovieChanges(startDate, endDate, page, cancellation);
+        ChangesVisitor visitor(ids);
+
+        if (body.empty() || !ChangesProjection().Scan(body.View(), visitor))
+        {
+            std::cerr << "Error fetching the movies changed from " << startDate << " to " << endDate << ", page " << page << std::endl;
+            return false;
+        }
+
+        totalPages = visitor.GetTotalPages();
+    }
+
+    return true;
+}
+
+void CatalogSync::Apply(const std::vector<uint64_t>& ids, Result& result, const CancellationToken& cancellation)
+{
+    const size_t batchSize = std::max<size_t>(1, settings.batchSize);
+
+    for (size_t first = 0; first < ids.size() && !cancellation.IsCancelled(); first += batchSize)
+    {
+        const size_t last = std::min(ids.size(), first + batchSize);
+        std::vector<std::string> batch;
+
+        for (size_t i = first; i < last; ++i)
+        {
+            batch.push_back(std::to_string(ids[i]));
+        }
+
+        std::vector<bool> refused;
+        const std::vector<ResponseBuffer> details = provider.GetMovieDetails(batch, refused, cancellation);
+        MovieList movies;
+
+        for (size_t i = 0; i < details.size(); ++i)
+        {
+            Movie movie;
+
+            if (details[i].empty())
+            {
+                ++(refused[i] ? result.skipped : result.failed);
+            }
+            else if (MovieDatabase::ParseMovieFromJson(details[i].View(), movie))
+            {
+                movies.push_back(std::move(movie));
+            }
+            else
+            {
+                // Malformed or without a title; fetching it again would give the same
+                ++result.skipped;
+            }
+        }
+
+        const size_t count = movies.size();
+
+        // One sync for the whole batch
+        if (!store.UpsertMovies(std::move(movies)))
+        {
+            result.failed += count;
+            continue;
+        }
+
+        result.updated += count;
+    }
+}
@@ -0,0 +1,65 @@
+﻿#ifndef CATALOG_SYNC_H
+#define CATALOG_SYNC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CancellationToken.h"
+#include "CatalogStore.h"
+#include "TMDBServiceProvider.h"
+
+// Brings a catalog up to date from TMDB's change feed instead of crawling it again.
+// movie/changes lists the ids of the movies changed since the watermark, the date the last
+// sync ran; only those movies' details are fetched, and each is upserted. What a sync costs
+// follows how much changed, not how big the catalog is.
+//
+// The watermark only moves on once every change is in the store or known never to get
+// there (a movie the API refuses or whose details don't parse), so a sync that fails or is
+// cancelled is simply run again. It never moves back to an earlier date. Without a
+// watermark there is no telling what the catalog already has: the first sync records
+// today and changes nothing, so seed the catalog with a crawl before it.
+class CatalogSync
+{
+public:
+    struct Settings
+    {
+        std::string watermarkPath;  // Where the date of the last sync is kept
+        size_t batchSize = 100;     // Movies looked up and upserted at a time
+    };
+
+    struct Result
+    {
+        size_t changed = 0;         // Ids the feed listed
+        size_t updated = 0;         // Movies upserted
+        size_t failed = 0;          // Ids whose details couldn't be had this time
+        size_t skipped = 0;         // Ids refused or unusable, which no retry will fix
+        bool complete = false;      // The watermark moved on to the end date
+    };
+
+    CatalogSync(const TMDBServiceProvider& provider, CatalogStore& store, Settings settings);
+
+    // Syncs the changes up to and including today
+    Result Run(const CancellationToken& cancellation = {});
+
+    // ...or up to and including `endDate`, a YYYY-MM-DD
+    Result Run(const std::string& endDate, const CancellationToken& cancellation = {});
+
+    // The date in the watermark file, or empty if there is none
+    [[nodiscard]] static std::string ReadWatermark(const std::string& path);
+    static bool WriteWatermark(const std::string& path, const std::string& date);
+
+private:
+    // Appends the ids changed from `startDate` to `endDate`, both included
+    bool CollectChanges(const std::string& startDate, const std::string& endDate, std::vector<uint64_t>& ids, const CancellationToken& cancellation) const;
+
+    void Apply(const std::vector<uint64_t>& ids, Result& result, const CancellationToken& cancellation);
+
+    const TMDBServiceProvider& provider;
+    CatalogStore& store;
+    const Settings settings;
+};
+
+#endif
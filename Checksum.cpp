@@ -0,0 +1,69 @@
+﻿#include "Checksum.h"
+
+#include <array>
+
+namespace
+{
+    std::array<uint32_t, 256> MakeCrc32Table()
+    {
+        std::array<uint32_t, 256> table{};
+
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t value = i;
+
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            }
+
+            table[i] = value;
+        }
+
+        return table;
+    }
+}
+
+uint32_t Checksum::Crc32(const void* data, size_t size, uint32_t crc)
+{
+    static const std::array<uint32_t, 256> table = MakeCrc32Table();
+
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+uint32_t Checksum::Adler32(const void* data, size_t size, uint32_t adler)
+{
+    // 5552 is the largest block for which the sums cannot overflow 32 bits before the modulo
+    constexpr uint32_t modulus = 65521;
+    constexpr size_t maxBlock = 5552;
+
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (size > 0)
+    {
+        const size_t block = size < maxBlock ? size : maxBlock;
+
+        for (size_t i = 0; i < block; ++i)
+        {
+            a += bytes[i];
+            b += a;
+        }
+
+        a %= modulus;
+        b %= modulus;
+        bytes += block;
+        size -= block;
+    }
+
+    return (b << 16) | a;
+}
@@ -0,0 +1,16 @@
+﻿#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Checksum
+{
+    // CRC-32 (IEEE 802.3, as used by gzip). Pass the previous result to continue a running checksum.
+    uint32_t Crc32(const void* data, size_t size, uint32_t crc = 0);
+
+    // Adler-32 (as used by zlib). Pass the previous result to continue a running checksum.
+    uint32_t Adler32(const void* data, size_t size, uint32_t adler = 1);
+}
+
+#endif
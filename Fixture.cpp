@@ -0,0 +1,90 @@
+﻿#include "Fixture.h"
+
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "AtomicFile.h"
+
+std::string Fixture::FileNameForRequest(std::string_view request)
+{
+    const size_t queryStart = request.find('?');
+    const std::string_view path = request.substr(0, queryStart);
+
+    std::string name;
+
+    for (const char c : path)
+    {
+        name += c == '/' ? '_' : c;
+    }
+
+    if (queryStart != std::string_view::npos)
+    {
+        std::string_view query = request.substr(queryStart + 1);
+
+        while (!query.empty())
+        {
+            const size_t end = query.find('&');
+            const std::string_view parameter = query.substr(0, end);
+            query = end == std::string_view::npos ? std::string_view{} : query.substr(end + 1);
+
+            if (parameter.empty() || parameter.substr(0, parameter.find('=')) == "api_key")
+            {
+                continue;
+            }
+
+            name += '_';
+
+            for (const char c : parameter)
+            {
+                name += c == '=' ? '-' : c;
+            }
+        }
+    }
+
+    // Anything else that could escape the directory or upset a filesystem becomes '_'
+    for (char& c : name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' && c != '.')
+        {
+            c = '_';
+        }
+    }
+
+    if (name.empty() || name[0] == '.')
+    {
+        name.insert(name.begin(), '_');
+    }
+
+    return name + ".json";
+}
+
+bool Fixture::Write(const std::string& directory, std::string_view request, const char* data, size_t size)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    if (error)
+    {
+        std::cerr << "Error creating fixture directory " << directory << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    const std::filesystem::path path = std::filesystem::path(directory) / FileNameForRequest(request);
+    return AtomicFile::Write(path.string(), "fixture", data, size);
+}
+
+bool Fixture::Read(const std::string& directory, std::string_view request, std::string& body)
+{
+    std::ifstream file(std::filesystem::path(directory) / FileNameForRequest(request), std::ios::binary);
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    body.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
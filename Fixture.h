@@ -0,0 +1,21 @@
+﻿#ifndef FIXTURE_H
+#define FIXTURE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Recorded API responses, shared by TMDBServiceProvider's record mode and the stand-in server.
+// Requests are named relative to the API root, e.g. "movie/popular?api_key=...&page=1".
+namespace Fixture
+{
+    // File name for a request. The api_key parameter is dropped so fixtures can be shared.
+    std::string FileNameForRequest(std::string_view request);
+
+    // Replaces the file whole; see AtomicFile
+    bool Write(const std::string& directory, std::string_view request, const char* data, size_t size);
+
+    bool Read(const std::string& directory, std::string_view request, std::string& body);
+}
+
+#endif
@@ -0,0 +1,86 @@
+﻿#include "HedgePolicy.h"
+
+#include <algorithm>
+
+HedgePolicy::HedgePolicy(const Settings& settings) : settings(settings)
+{
+    samples.reserve(settings.window);
+}
+
+std::optional<std::chrono::milliseconds> HedgePolicy::OnRequest()
+{
+    std::lock_guard lock(mutex);
+    ++stats.requests;
+
+    if (settings.budget <= 0.0)
+    {
+        return std::nullopt;
+    }
+
+    credit = std::min(settings.maxBurst, credit + settings.budget);
+
+    if (samples.size() < std::max<size_t>(settings.minSamples, 1))
+    {
+        return std::nullopt;
+    }
+
+    return delay;
+}
+
+bool HedgePolicy::TryHedge()
+{
+    std::lock_guard lock(mutex);
+
+    if (credit < 1.0)
+    {
+        return false;
+    }
+
+    credit -= 1.0;
+    ++stats.hedges;
+    return true;
+}
+
+void HedgePolicy::OnLatency(Clock::duration latency)
+{
+    std::lock_guard lock(mutex);
+
+    if (samples.size() < std::max<size_t>(settings.window, 1))
+    {
+        samples.push_back(latency);
+    }
+    else
+    {
+        samples[nextSample] = latency;
+        nextSample = (nextSample + 1) % samples.size();
+    }
+
+    // The percentile moves slowly, so it is refreshed every so often rather than per sample
+    if (++samplesSinceUpdate >= std::max<size_t>(settings.window / 16, 1) || samples.size() == settings.minSamples)
+    {
+        UpdateDelay();
+    }
+}
+
+void HedgePolicy::OnHedgeWon()
+{
+    std::lock_guard lock(mutex);
+    ++stats.hedgeWins;
+}
+
+HedgePolicy::Stats HedgePolicy::GetStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void HedgePolicy::UpdateDelay()
+{
+    samplesSinceUpdate = 0;
+
+    std::vector<Clock::duration> sorted = samples;
+    const auto rank = static_cast<size_t>(std::clamp(settings.percentile, 0.0, 1.0) * static_cast<double>(sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(rank), sorted.end());
+
+    delay = std::max(settings.minDelay, std::chrono::ceil<std::chrono::milliseconds>(sorted[rank]));
+}
@@ -0,0 +1,67 @@
+﻿#ifndef HEDGE_POLICY_H
+#define HEDGE_POLICY_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Decides when a slow request is worth sending twice. The hedge delay is a high percentile
+// of recent latencies, so only the slowest few requests are duplicated, and every request
+// earns a fraction of a hedge, which caps the extra load however slow the upstream gets.
+class HedgePolicy
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        double percentile = 0.95;               // Hedge requests slower than this share of recent ones
+        double budget = 0.05;                   // Hedges earned per request; 0 turns hedging off
+        double maxBurst = 10.0;                 // Hedges that can be saved up while traffic is fast
+        size_t window = 512;                    // Recent latencies the percentile is taken over
+        size_t minSamples = 32;                 // Don't hedge until this many have been seen
+        std::chrono::milliseconds minDelay{10};
+    };
+
+    struct Stats
+    {
+        uint64_t requests = 0;
+        uint64_t hedges = 0;
+        uint64_t hedgeWins = 0;                 // Hedges that answered before the original
+    };
+
+    HedgePolicy() : HedgePolicy(Settings{}) {}
+    explicit HedgePolicy(const Settings& settings);
+
+    // Called as each request goes out. Returns how long to wait for it before hedging, or
+    // nothing while hedging is off or there are too few samples to say what slow means.
+    [[nodiscard]] std::optional<std::chrono::milliseconds> OnRequest();
+
+    // Spends one hedge from the budget
+    bool TryHedge();
+
+    void OnLatency(Clock::duration latency);
+    void OnHedgeWon();
+
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    void UpdateDelay();
+
+    mutable std::mutex mutex;
+    const Settings settings;
+
+    // Ring buffer of the most recent latencies
+    std::vector<Clock::duration> samples;
+    size_t nextSample = 0;
+    size_t samplesSinceUpdate = 0;
+
+    std::chrono::milliseconds delay{0};
+    double credit = 0.0;
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,2028 @@
+﻿#include "HttpClient.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#include <unordered_set>
+
+#include "HTTPRequest/include/HTTPRequest.hpp"
+#endif
+
+namespace
+{
+    bool EqualsIgnoreCase(const std::string& a, const std::string& b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+        {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+}
+
+std::string HttpResponse::GetHeader(const std::string& name) const
+{
+    for (const auto& [fieldName, value] : headers)
+    {
+        if (EqualsIgnoreCase(fieldName, name))
+        {
+            return value;
+        }
+    }
+
+    return {};
+}
+
+std::future<HttpResponse> HttpClient::Send(Request request)
+{
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    auto future = promise->get_future();
+
+    Send(std::move(request), [promise](HttpResponse&& response)
+    {
+        promise->set_value(std::move(response));
+    });
+
+    return future;
+}
+
+#ifdef __linux__
+
+namespace
+{
+    struct Url
+    {
+        std::string host;
+        uint16_t port = 80;
+        std::string target;
+    };
+
+    bool ParseUrl(const std::string& url, Url& result, std::string& error)
+    {
+        const std::string scheme = "http://";
+
+        if (url.compare(0, scheme.size(), scheme) != 0)
+        {
+            error = url.compare(0, 8, "https://") == 0 ? "https is not supported" : "unsupported URL: " + url;
+            return false;
+        }
+
+        const size_t hostStart = scheme.size();
+        const size_t hostEnd = url.find_first_of(":/?", hostStart);
+        result.host = url.substr(hostStart, hostEnd - hostStart);
+
+        if (result.host.empty())
+        {
+            error = "URL has no host: " + url;
+            return false;
+        }
+
+        size_t targetStart = hostEnd;
+
+        if (hostEnd != std::string::npos && url[hostEnd] == ':')
+        {
+            targetStart = url.find_first_of("/?", hostEnd);
+            const std::string port = url.substr(hostEnd + 1, targetStart - hostEnd - 1);
+
+            if (port.empty() || port.size() > 5 || !std::all_of(port.begin(), port.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+            {
+                error = "invalid port in URL: " + url;
+                return false;
+            }
+
+            result.port = static_cast<uint16_t>(std::stoul(port));
+        }
+
+        if (targetStart == std::string::npos)
+        {
+            result.target = "/";
+        }
+        else
+        {
+            result.target = url.substr(targetStart);
+
+            if (result.target.front() != '/')
+            {
+                result.target.insert(result.target.begin(), '/');
+            }
+        }
+
+        return true;
+    }
+
+    // Receives the parts of a response as the parser recognises them
+    struct ResponseHandler
+    {
+        virtual ~ResponseHandler() = default;
+        virtual void OnHeaders(HttpResponse& response) = 0;
+        virtual void OnBody(HttpResponse& response, const char* data, size_t size) = 0;
+    };
+
+    // Incremental HTTP/1.1 response parser. Feed consumes at most one response and reports
+    // how many bytes it used, so the caller can tell where the next response starts.
+    class ResponseParser
+    {
+    public:
+        size_t Feed(const char* data, size_t size, HttpResponse& response, ResponseHandler& handler)
+        {
+            const char* cursor = data;
+            const char* end = data + size;
+
+            while (cursor < end && state != State::Complete && state != State::Failed)
+            {
+                switch (state)
+                {
+                case State::StatusLine:
+                    if (ReadLine(cursor, end))
+                    {
+                        ParseStatusLine(response);
+                    }
+                    break;
+                case State::Headers:
+                    if (ReadLine(cursor, end))
+                    {
+                        ParseHeaderLine(response, handler);
+                    }
+                    break;
+                case State::Body:
+                case State::ChunkData:
+                {
+                    const auto count = static_cast<size_t>(std::min<uint64_t>(remaining, end - cursor));
+                    handler.OnBody(response, cursor, count);
+                    cursor += count;
+                    remaining -= count;
+
+                    if (remaining == 0)
+                    {
+                        state = state == State::Body ? State::Complete : State::ChunkDataEnd;
+                    }
+                    break;
+                }
+                case State::ChunkSize:
+                    if (ReadLine(cursor, end))
+                    {
+                        ParseChunkSize();
+                    }
+                    break;
+                case State::ChunkDataEnd:
+                    if (ReadLine(cursor, end))
+                    {
+                        state = line.empty() ? State::ChunkSize : Fail("malformed chunk terminator");
+                    }
+                    break;
+                case State::Trailers:
+                    if (ReadLine(cursor, end) && line.empty())
+                    {
+                        state = State::Complete;
+                    }
+                    break;
+                case State::UntilClose:
+                    handler.OnBody(response, cursor, end - cursor);
+                    cursor = end;
+                    break;
+                case State::Complete:
+                case State::Failed:
+                    break;
+                }
+            }
+
+            return static_cast<size_t>(cursor - data);
+        }
+
+        // Bytes of a Content-Length body still to come; the caller may receive them directly
+        [[nodiscard]] uint64_t RemainingFixedBody() const { return state == State::Body ? remaining : 0; }
+
+        void CommitFixedBody(size_t count)
+        {
+            remaining -= count;
+
+            if (remaining == 0)
+            {
+                state = State::Complete;
+            }
+        }
+
+        // A response without a length is terminated by the server closing the connection
+        bool FinishAtClose()
+        {
+            if (state != State::UntilClose)
+            {
+                return false;
+            }
+
+            state = State::Complete;
+            return true;
+        }
+
+        void Reset() { *this = ResponseParser{}; }
+
+        [[nodiscard]] bool IsComplete() const { return state == State::Complete; }
+        [[nodiscard]] bool HasFailed() const { return state == State::Failed; }
+        [[nodiscard]] bool KeepAlive() const { return keepAlive; }
+        [[nodiscard]] const std::string& GetError() const { return error; }
+
+    private:
+        enum class State
+        {
+            StatusLine,
+            Headers,
+            Body,
+            ChunkSize,
+            ChunkData,
+            ChunkDataEnd,
+            Trailers,
+            UntilClose,
+            Complete,
+            Failed
+        };
+
+        static constexpr size_t MAX_LINE = 65536;
+
+        bool ReadLine(const char*& cursor, const char* end)
+        {
+            if (lineComplete)
+            {
+                line.clear();
+                lineComplete = false;
+            }
+
+            const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+            const char* stop = newline ? newline : end;
+
+            line.append(cursor, stop);
+            cursor = newline ? newline + 1 : end;
+
+            if (line.size() > MAX_LINE)
+            {
+                state = Fail("header line too long");
+                return false;
+            }
+
+            if (!newline)
+            {
+                return false;
+            }
+
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+
+            lineComplete = true;
+            return true;
+        }
+
+        void ParseStatusLine(HttpResponse& response)
+        {
+            // HTTP/1.x SP code SP reason
+            if (line.size() < 12 || line.compare(0, 7, "HTTP/1.") != 0 || line[8] != ' ')
+            {
+                state = Fail("malformed status line");
+                return;
+            }
+
+            minorVersion = line[7] - '0';
+            response.status = std::atoi(line.c_str() + 9);
+            response.reason = line.size() > 13 ? line.substr(13) : std::string{};
+            response.headers.clear();
+            keepAlive = minorVersion >= 1;
+            state = State::Headers;
+        }
+
+        void ParseHeaderLine(HttpResponse& response, ResponseHandler& handler)
+        {
+            if (line.empty())
+            {
+                OnHeadersComplete(response, handler);
+                return;
+            }
+
+            const size_t colon = line.find(':');
+
+            if (colon == std::string::npos)
+            {
+                state = Fail("malformed header line");
+                return;
+            }
+
+            std::string name = line.substr(0, colon);
+            const size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+            const size_t valueEnd = line.find_last_not_of(" \t");
+            std::string value = valueStart == std::string::npos ? std::string{} : line.substr(valueStart, valueEnd - valueStart + 1);
+
+            if (EqualsIgnoreCase(name, "Content-Length"))
+            {
+                hasLength = true;
+                remaining = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (EqualsIgnoreCase(name, "Transfer-Encoding"))
+            {
+                chunked = value.size() >= 7 && EqualsIgnoreCase(value.substr(value.size() - 7), "chunked");
+            }
+            else if (EqualsIgnoreCase(name, "Connection"))
+            {
+                if (EqualsIgnoreCase(value, "close"))
+                {
+                    keepAlive = false;
+                }
+                else if (EqualsIgnoreCase(value, "keep-alive"))
+                {
+                    keepAlive = true;
+                }
+            }
+
+            response.headers.emplace_back(std::move(name), std::move(value));
+        }
+
+        void OnHeadersComplete(HttpResponse& response, ResponseHandler& handler)
+        {
+            if (response.status >= 100 && response.status < 200)
+            {
+                // Interim response; the real one follows
+                const bool wasKeepAlive = keepAlive;
+                Reset();
+                keepAlive = wasKeepAlive;
+                return;
+            }
+
+            if (response.status == 204 || response.status == 304)
+            {
+                state = State::Complete;
+            }
+            else if (chunked)
+            {
+                state = State::ChunkSize;
+            }
+            else if (hasLength)
+            {
+                state = remaining == 0 ? State::Complete : State::Body;
+            }
+            else
+            {
+                keepAlive = false;
+                state = State::UntilClose;
+            }
+
+            handler.OnHeaders(response);
+        }
+
+        void ParseChunkSize()
+        {
+            char* parsedEnd = nullptr;
+            remaining = std::strtoull(line.c_str(), &parsedEnd, 16);
+
+            if (parsedEnd == line.c_str())
+            {
+                state = Fail("malformed chunk size");
+                return;
+            }
+
+            state = remaining == 0 ? State::Trailers : State::ChunkData;
+        }
+
+        State Fail(const char* message)
+        {
+            error = message;
+            return State::Failed;
+        }
+
+        State state = State::StatusLine;
+        std::string line;
+        bool lineComplete = false;
+        std::string error;
+        uint64_t remaining = 0;
+        bool hasLength = false;
+        bool chunked = false;
+        bool keepAlive = true;
+        int minorVersion = 1;
+    };
+}
+
+struct HttpClient::Impl
+{
+    struct Connection;
+
+    struct Address
+    {
+        sockaddr_storage storage{};
+        socklen_t length = 0;
+        int family = AF_UNSPEC;
+    };
+
+    struct HostPool
+    {
+        std::string host;
+        uint16_t port = 80;
+        std::deque<RequestId> waiting;
+        std::vector<Connection*> idle;
+        size_t open = 0;
+
+        // Cached resolution. Once expired the old addresses keep serving until a refresh lands.
+        std::vector<Address> addresses;
+        Clock::time_point resolvedAt;
+        bool resolving = false;
+        size_t warmTarget = 0;      // Connections Preconnect asked for, opened once resolved
+        bool pipelining = true;     // Cleared once the host shows it doesn't keep pipelined requests
+    };
+
+    struct PendingRequest : ResponseHandler
+    {
+        void OnHeaders(HttpResponse& head) override
+        {
+            streaming = onHeaders && onHeaders(head);
+
+            if (!streaming)
+            {
+                // Size the buffer once up front so the body can be received in place
+                const uint64_t length = std::strtoull(head.GetHeader("Content-Length").c_str(), nullptr, 10);
+                head.body = bufferPool->Acquire(static_cast<size_t>(std::min<uint64_t>(length, MAX_PRESIZE)));
+            }
+        }
+
+        void OnBody(HttpResponse& head, const char* data, size_t size) override
+        {
+            if (!streaming)
+            {
+                head.body.Append(data, size);
+            }
+            else if (!onBody(Piece(data, size)))
+            {
+                pauseRequested = true;
+            }
+        }
+
+        ResponseBuffer Piece(const char* data, size_t size) const
+        {
+            // Bytes read into the stream buffer are handed over in place. Only a response
+            // that began in a read for the one pipelined ahead of it is copied out of readBuffer.
+            const char* base = streamBuffer->data();
+
+            if (base && data >= base && data + size <= base + streamBuffer->size())
+            {
+                return streamBuffer->Slice(static_cast<size_t>(data - base), size);
+            }
+
+            ResponseBuffer piece = bufferPool->Acquire(size);
+            piece.Append(data, size);
+            return piece;
+        }
+
+        static constexpr uint64_t MAX_PRESIZE = 64 * 1024 * 1024;
+
+        RequestId id = 0;
+        HostPool* pool = nullptr;
+        BufferPool* bufferPool = nullptr;
+        const ResponseBuffer* streamBuffer = nullptr;
+        std::string wire;
+        Callback callback;
+        std::function<bool(const HttpResponse&)> onHeaders;
+        std::function<bool(ResponseBuffer)> onBody;
+        HttpResponse response;
+        Connection* connection = nullptr;
+        std::vector<RequestId> followers;   // Pipelined behind this one when it is dispatched
+        bool retried = false;
+        bool streaming = false;
+        bool pauseRequested = false;
+        bool abandoned = false;             // Already reported; its response is read and dropped
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        HostPool* pool = nullptr;
+        bool connecting = true;
+        bool reused = false;
+        bool receivedAny = false;
+        bool paused = false;
+        bool headPipelined = false;                 // `request` was written behind another one
+        PendingRequest* request = nullptr;          // The request whose response is being read
+        std::deque<PendingRequest*> pipelined;      // Written after it, answered in this order
+        std::string outgoing;
+        size_t written = 0;
+        uint32_t events = 0;
+        ResponseParser parser;
+        Clock::time_point idleSince;
+    };
+
+    struct Timer
+    {
+        Clock::time_point when;
+        uint64_t sequence;
+        RequestId request;          // 0 for plain tasks
+        std::function<void()> task;
+
+        bool operator>(const Timer& other) const
+        {
+            return when != other.when ? when > other.when : sequence > other.sequence;
+        }
+    };
+
+    // Shared with the resolver thread, so shutdown needn't wait out a lookup
+    struct Resolver
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<HostPool*> queue;
+        bool stopping = false;
+    };
+
+    explicit Impl(const Settings& settings);
+    ~Impl();
+
+    void Enqueue(std::function<void()> task);
+    void Loop();
+    int NextTimeout() const;
+    void RunTimers();
+    void AddTimer(Clock::time_point when, RequestId request, std::function<void()> task);
+    void SweepIdle();
+
+    void Start(RequestId id, Request request, Callback callback);
+    void StartBatch(const std::vector<RequestId>& ids, std::vector<Request> requests, const BatchCallback& callback);
+    PendingRequest* Prepare(RequestId id, Request request, Callback callback);
+    void Cancel(RequestId id);
+    void Abandon(PendingRequest* request, const std::string& error, bool cancelled);
+    void Resume(RequestId id);
+    void Expire(RequestId id);
+    void Preconnect(const std::string& url, size_t count);
+    HostPool* PoolFor(const Url& url, std::string& hostHeader);
+    bool EnsureResolved(HostPool* pool);
+    void ResolveLoop(const std::shared_ptr<Resolver>& shared);
+    void OnResolved(HostPool* pool, std::vector<Address> addresses, const std::string& error);
+    void Warm(HostPool* pool);
+    void Dispatch(HostPool* pool);
+    Connection* Open(HostPool* pool, std::string& error);
+    void Assign(Connection* connection, PendingRequest* request);
+    void Requeue(HostPool* pool, std::vector<PendingRequest*> orphans);
+    void HandleEvents(Connection* connection, uint32_t events);
+    void Write(Connection* connection);
+    void Read(Connection* connection);
+    bool CompleteExchange(Connection* connection);
+    void FailConnection(Connection* connection, const std::string& error);
+    void Close(Connection* connection);
+    void SetInterest(Connection* connection, uint32_t events);
+    void Finish(PendingRequest* request, const std::string& error, bool cancelled = false);
+
+    Settings settings;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<RequestId> nextId{1};
+
+    std::mutex incomingMutex;
+    std::vector<std::function<void()>> incoming;
+
+    // getaddrinfo blocks, so it runs on its own thread and reports back through Enqueue
+    std::shared_ptr<Resolver> resolver = std::make_shared<Resolver>();
+    std::thread resolverThread;
+
+    // Loop-thread state
+    std::unordered_map<std::string, std::unique_ptr<HostPool>> pools;
+    std::unordered_map<RequestId, std::unique_ptr<PendingRequest>> requests;
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> connections;
+    std::vector<std::unique_ptr<Connection>> closed;
+    std::vector<Timer> timers;
+    uint64_t timerSequence = 0;
+    static constexpr size_t MIN_STREAM_READ = 16 * 1024;
+
+    std::vector<char> readBuffer = std::vector<char>(65536);
+    ResponseBuffer streamBuffer;    // Streamed bodies are read into this and handed out in slices
+};
+
+HttpClient::Impl::Impl(const Settings& settings) : settings(settings)
+{
+    if (!this->settings.bufferPool)
+    {
+        this->settings.bufferPool = std::make_shared<BufferPool>();
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (epollFd < 0 || wakeFd < 0)
+    {
+        throw std::runtime_error(std::string{"Failed to create event loop: "} + std::strerror(errno));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    AddTimer(Clock::now() + std::chrono::seconds{1}, 0, [this] { SweepIdle(); });
+
+    thread = std::thread([this] { Loop(); });
+    resolverThread = std::thread([this, shared = resolver] { ResolveLoop(shared); });
+}
+
+HttpClient::Impl::~Impl()
+{
+    stopping = true;
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(wakeFd, &one, sizeof(one));
+    thread.join();
+
+    {
+        std::lock_guard lock(resolver->mutex);
+        resolver->stopping = true;
+        resolver->queue.clear();
+    }
+
+    // A lookup in progress can't be interrupted, and the thread touches nothing of ours
+    // once it sees `stopping`, so it is left to finish on its own
+    resolver->wake.notify_all();
+    resolverThread.detach();
+
+    close(wakeFd);
+    close(epollFd);
+}
+
+void HttpClient::Impl::Enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard lock(incomingMutex);
+        incoming.push_back(std::move(task));
+    }
+
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto written = write(wakeFd, &one, sizeof(one));
+}
+
+void HttpClient::Impl::Loop()
+{
+    std::vector<epoll_event> events(256);
+    std::vector<std::function<void()>> tasks;
+
+    while (!stopping)
+    {
+        const int count = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), NextTimeout());
+
+        for (int i = 0; i < count; ++i)
+        {
+            auto* connection = static_cast<Connection*>(events[i].data.ptr);
+
+            if (connection == nullptr)
+            {
+                uint64_t value;
+                [[maybe_unused]] const auto read = ::read(wakeFd, &value, sizeof(value));
+                continue;
+            }
+
+            // A connection closed earlier in this batch is parked in `closed`, never freed
+            if (connection->fd >= 0)
+            {
+                HandleEvents(connection, events[i].events);
+            }
+        }
+
+        {
+            std::lock_guard lock(incomingMutex);
+            tasks.swap(incoming);
+        }
+
+        for (auto& task : tasks)
+        {
+            task();
+        }
+
+        tasks.clear();
+        RunTimers();
+        closed.clear();
+    }
+
+    // Nobody will drive the remaining work; report it as cancelled
+    std::vector<PendingRequest*> outstanding;
+
+    for (auto& [id, request] : requests)
+    {
+        outstanding.push_back(request.get());
+    }
+
+    for (auto* request : outstanding)
+    {
+        Finish(request, "client shutting down", true);
+    }
+
+    for (auto& [key, connection] : connections)
+    {
+        close(connection->fd);
+    }
+}
+
+int HttpClient::Impl::NextTimeout() const
+{
+    if (timers.empty())
+    {
+        return -1;
+    }
+
+    const auto wait = timers.front().when - Clock::now();
+
+    if (wait <= Clock::duration::zero())
+    {
+        return 0;
+    }
+
+    // Round up so we never wake just before the deadline and spin
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+}
+
+void HttpClient::Impl::RunTimers()
+{
+    const auto now = Clock::now();
+
+    while (!timers.empty() && timers.front().when <= now)
+    {
+        std::pop_heap(timers.begin(), timers.end(), std::greater<>{});
+        Timer timer = std::move(timers.back());
+        timers.pop_back();
+
+        if (timer.request != 0)
+        {
+            Expire(timer.request);
+        }
+        else
+        {
+            timer.task();
+        }
+    }
+}
+
+void HttpClient::Impl::AddTimer(Clock::time_point when, RequestId request, std::function<void()> task)
+{
+    timers.push_back(Timer{when, timerSequence++, request, std::move(task)});
+    std::push_heap(timers.begin(), timers.end(), std::greater<>{});
+}
+
+void HttpClient::Impl::SweepIdle()
+{
+    const auto now = Clock::now();
+    std::vector<Connection*> stale;
+
+    for (auto& [key, pool] : pools)
+    {
+        for (auto* connection : pool->idle)
+        {
+            if (now - connection->idleSince >= settings.idleTimeout)
+            {
+                stale.push_back(connection);
+            }
+        }
+    }
+
+    for (auto* connection : stale)
+    {
+        Close(connection);
+    }
+
+    AddTimer(now + std::chrono::seconds{1}, 0, [this] { SweepIdle(); });
+}
+
+void HttpClient::Impl::Start(RequestId id, Request request, Callback callback)
+{
+    if (PendingRequest* pending = Prepare(id, std::move(request), std::move(callback)))
+    {
+        pending->pool->waiting.push_back(id);
+        Dispatch(pending->pool);
+    }
+}
+
+void HttpClient::Impl::StartBatch(const std::vector<RequestId>& ids, std::vector<Request> requests, const BatchCallback& callback)
+{
+    PendingRequest* leader = nullptr;
+    std::vector<HostPool*> touched;
+
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        PendingRequest* pending = Prepare(ids[i], std::move(requests[i]), [callback, i](HttpResponse&& response)
+        {
+            callback(i, std::move(response));
+        });
+
+        if (!pending)
+        {
+            continue;
+        }
+
+        // Consecutive requests to the same host share a connection, up to the depth limit
+        if (leader && leader->pool == pending->pool && leader->followers.size() + 1 < settings.maxPipelineDepth)
+        {
+            leader->followers.push_back(pending->id);
+            continue;
+        }
+
+        leader = pending;
+        leader->pool->waiting.push_back(leader->id);
+
+        if (std::find(touched.begin(), touched.end(), leader->pool) == touched.end())
+        {
+            touched.push_back(leader->pool);
+        }
+    }
+
+    for (HostPool* pool : touched)
+    {
+        Dispatch(pool);
+    }
+}
+
+HttpClient::Impl::PendingRequest* HttpClient::Impl::Prepare(RequestId id, Request request, Callback callback)
+{
+    auto pending = std::make_unique<PendingRequest>();
+    pending->id = id;
+    pending->callback = std::move(callback);
+    pending->onHeaders = std::move(request.onHeaders);
+    pending->onBody = std::move(request.onBody);
+    pending->bufferPool = settings.bufferPool.get();
+    pending->streamBuffer = &streamBuffer;
+
+    Url url;
+    std::string error;
+
+    if (!ParseUrl(request.url, url, error))
+    {
+        HttpResponse response;
+        response.error = error;
+        pending->callback(std::move(response));
+        return nullptr;
+    }
+
+    std::string hostHeader;
+    HostPool* pool = PoolFor(url, hostHeader);
+
+    pending->pool = pool;
+    pending->wire.reserve(128 + url.target.size());
+    pending->wire += "GET " + url.target + " HTTP/1.1\r\nHost: " + hostHeader + "\r\n";
+
+    for (const auto& [name, value] : request.headers)
+    {
+        pending->wire += name + ": " + value + "\r\n";
+    }
+
+    pending->wire += "\r\n";
+
+    const auto timeout = request.timeout.count() > 0 ? request.timeout : settings.requestTimeout;
+    AddTimer(std::min(Clock::now() + timeout, request.deadline), id, nullptr);
+
+    PendingRequest* raw = pending.get();
+    requests.emplace(id, std::move(pending));
+    return raw;
+}
+
+void HttpClient::Impl::Cancel(RequestId id)
+{
+    const auto it = requests.find(id);
+
+    if (it == requests.end())
+    {
+        return;
+    }
+
+    PendingRequest* request = it->second.get();
+
+    if (request->abandoned)
+    {
+        return;
+    }
+
+    if (auto* connection = request->connection)
+    {
+        // Other requests on the same connection still want their responses, so this one
+        // is read to the end and dropped rather than cutting the connection
+        if (!connection->pipelined.empty() || connection->request != request)
+        {
+            Abandon(request, "cancelled", true);
+            return;
+        }
+
+        // The connection is mid-exchange and can't be reused
+        HostPool* pool = connection->pool;
+        Close(connection);
+        Finish(request, "cancelled", true);
+        Dispatch(pool);
+        return;
+    }
+
+    Finish(request, "cancelled", true);
+}
+
+void HttpClient::Impl::Abandon(PendingRequest* request, const std::string& error, bool cancelled)
+{
+    Connection* connection = request->connection;
+
+    if (connection->request == request && connection->paused)
+    {
+        Resume(request->id);
+    }
+
+    request->abandoned = true;
+    request->streaming = false;
+    request->onHeaders = nullptr;
+    request->onBody = nullptr;
+
+    HttpResponse response;
+    response.error = error;
+    response.cancelled = cancelled;
+
+    const Callback callback = std::move(request->callback);
+    request->callback = nullptr;
+    callback(std::move(response));
+}
+
+void HttpClient::Impl::Resume(RequestId id)
+{
+    const auto it = requests.find(id);
+
+    if (it == requests.end() || !it->second->connection || !it->second->connection->paused
+        || it->second->connection->request != it->second.get())
+    {
+        return;
+    }
+
+    Connection* connection = it->second->connection;
+    connection->paused = false;
+    it->second->pauseRequested = false;
+
+    epoll_event event{};
+    event.events = connection->events = EPOLLIN;
+    event.data.ptr = connection;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, connection->fd, &event);
+}
+
+void HttpClient::Impl::Expire(RequestId id)
+{
+    const auto it = requests.find(id);
+
+    if (it == requests.end())
+    {
+        return;
+    }
+
+    PendingRequest* request = it->second.get();
+    HostPool* pool = request->pool;
+
+    if (Connection* connection = request->connection)
+    {
+        if (connection->request != request)
+        {
+            // Still queued behind another response on a pipelined connection
+            if (!request->abandoned)
+            {
+                Abandon(request, "request timed out", false);
+            }
+
+            return;
+        }
+
+        // Whatever is pipelined behind it goes out again on another connection
+        request->retried = true;
+        FailConnection(connection, "request timed out");
+        return;
+    }
+
+    Finish(request, "request timed out");
+    Dispatch(pool);
+}
+
+void HttpClient::Impl::Preconnect(const std::string& url, size_t count)
+{
+    Url parsed;
+    std::string error;
+
+    if (!ParseUrl(url, parsed, error))
+    {
+        return;
+    }
+
+    std::string hostHeader;
+    HostPool* pool = PoolFor(parsed, hostHeader);
+    pool->warmTarget = std::max(pool->warmTarget, count);
+
+    if (EnsureResolved(pool))
+    {
+        Warm(pool);
+    }
+}
+
+HttpClient::Impl::HostPool* HttpClient::Impl::PoolFor(const Url& url, std::string& hostHeader)
+{
+    hostHeader = url.port == 80 ? url.host : url.host + ':' + std::to_string(url.port);
+    auto& pool = pools[hostHeader];
+
+    if (!pool)
+    {
+        pool = std::make_unique<HostPool>();
+        pool->host = url.host;
+        pool->port = url.port;
+    }
+
+    return pool.get();
+}
+
+bool HttpClient::Impl::EnsureResolved(HostPool* pool)
+{
+    if (!pool->addresses.empty() && Clock::now() - pool->resolvedAt < settings.dnsTtl)
+    {
+        return true;
+    }
+
+    if (!pool->resolving)
+    {
+        pool->resolving = true;
+
+        {
+            std::lock_guard lock(resolver->mutex);
+            resolver->queue.push_back(pool);
+        }
+
+        resolver->wake.notify_one();
+    }
+
+    // Stale addresses are still far more likely right than wrong
+    return !pool->addresses.empty();
+}
+
+void HttpClient::Impl::ResolveLoop(const std::shared_ptr<Resolver>& shared)
+{
+    for (;;)
+    {
+        HostPool* pool;
+        std::string host;
+        uint16_t port;
+
+        {
+            std::unique_lock lock(shared->mutex);
+            shared->wake.wait(lock, [&shared] { return shared->stopping || !shared->queue.empty(); });
+
+            if (shared->stopping)
+            {
+                return;
+            }
+
+            // Host and port never change after the pool is created, so reading them here is safe
+            pool = shared->queue.front();
+            shared->queue.pop_front();
+            host = pool->host;
+            port = pool->port;
+        }
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* results = nullptr;
+        const int resolved = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results);
+
+        std::vector<Address> addresses;
+        std::string error;
+
+        if (resolved != 0)
+        {
+            error = "failed to resolve " + host + ": " + gai_strerror(resolved);
+        }
+        else
+        {
+            for (addrinfo* result = results; result; result = result->ai_next)
+            {
+                Address address;
+                std::memcpy(&address.storage, result->ai_addr, result->ai_addrlen);
+                address.length = static_cast<socklen_t>(result->ai_addrlen);
+                address.family = result->ai_family;
+                addresses.push_back(address);
+            }
+
+            freeaddrinfo(results);
+        }
+
+        std::lock_guard lock(shared->mutex);
+
+        if (shared->stopping)
+        {
+            return;
+        }
+
+        Enqueue([this, pool, addresses = std::move(addresses), error = std::move(error)]() mutable
+        {
+            OnResolved(pool, std::move(addresses), error);
+        });
+    }
+}
+
+void HttpClient::Impl::OnResolved(HostPool* pool, std::vector<Address> addresses, const std::string& error)
+{
+    pool->resolving = false;
+
+    if (!error.empty() && !pool->addresses.empty())
+    {
+        // Keep serving the last good answer rather than failing everything on a DNS blip
+        pool->resolvedAt = Clock::now();
+        return;
+    }
+
+    if (!error.empty())
+    {
+        pool->warmTarget = 0;
+
+        while (!pool->waiting.empty())
+        {
+            const auto it = requests.find(pool->waiting.front());
+            pool->waiting.pop_front();
+
+            if (it != requests.end() && !it->second->connection)
+            {
+                Finish(it->second.get(), error);
+            }
+        }
+
+        return;
+    }
+
+    pool->addresses = std::move(addresses);
+    pool->resolvedAt = Clock::now();
+
+    Warm(pool);
+    Dispatch(pool);
+}
+
+void HttpClient::Impl::Warm(HostPool* pool)
+{
+    const size_t target = std::min(pool->warmTarget, settings.maxConnectionsPerHost);
+    pool->warmTarget = 0;
+
+    while (pool->open < target)
+    {
+        std::string error;
+        Connection* connection = Open(pool, error);
+
+        if (!connection)
+        {
+            return;
+        }
+
+        // Parked as idle while still connecting; a request assigned to it is written once the
+        // handshake completes. Marked as reused so a request that lands on one that failed
+        // gets the usual second try.
+        connection->reused = true;
+        connection->idleSince = Clock::now();
+        pool->idle.push_back(connection);
+    }
+
+    Dispatch(pool);
+}
+
+void HttpClient::Impl::Dispatch(HostPool* pool)
+{
+    if (pool->waiting.empty() || !EnsureResolved(pool))
+    {
+        return;
+    }
+
+    while (!pool->waiting.empty())
+    {
+        const auto it = requests.find(pool->waiting.front());
+
+        // Finished or cancelled while queued
+        if (it == requests.end() || it->second->connection)
+        {
+            pool->waiting.pop_front();
+            continue;
+        }
+
+        if (!pool->pipelining && !it->second->followers.empty())
+        {
+            // Send the batch one request at a time instead, keeping its order
+            pool->waiting.insert(std::next(pool->waiting.begin()), it->second->followers.begin(), it->second->followers.end());
+            it->second->followers.clear();
+        }
+
+        Connection* connection = nullptr;
+
+        if (!pool->idle.empty())
+        {
+            connection = pool->idle.back();
+            pool->idle.pop_back();
+        }
+        else if (pool->open < settings.maxConnectionsPerHost)
+        {
+            std::string error;
+            connection = Open(pool, error);
+
+            if (!connection)
+            {
+                pool->waiting.pop_front();
+                Finish(it->second.get(), error);
+                continue;
+            }
+        }
+        else
+        {
+            return;
+        }
+
+        pool->waiting.pop_front();
+
+        PendingRequest* leader = it->second.get();
+        Assign(connection, leader);
+
+        for (const RequestId followerId : leader->followers)
+        {
+            const auto follower = requests.find(followerId);
+
+            if (follower == requests.end())
+            {
+                continue;
+            }
+
+            PendingRequest* request = follower->second.get();
+            request->connection = connection;
+            request->response = HttpResponse{};
+            request->streaming = false;
+            request->pauseRequested = false;
+            connection->pipelined.push_back(request);
+            connection->outgoing += request->wire;
+        }
+
+        leader->followers.clear();
+
+        if (!connection->connecting)
+        {
+            Write(connection);
+        }
+    }
+}
+
+HttpClient::Impl::Connection* HttpClient::Impl::Open(HostPool* pool, std::string& error)
+{
+    int fd = -1;
+
+    for (const Address& address : pool->addresses)
+    {
+        fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == 0 || errno == EINPROGRESS)
+        {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    if (fd < 0)
+    {
+        error = "failed to connect to " + pool->host + ": " + std::strerror(errno);
+        return nullptr;
+    }
+
+    const int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    auto connection = std::make_unique<Connection>();
+    connection->fd = fd;
+    connection->pool = pool;
+    connection->events = EPOLLOUT;
+
+    epoll_event event{};
+    event.events = connection->events;
+    event.data.ptr = connection.get();
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    ++pool->open;
+    Connection* raw = connection.get();
+    connections.emplace(raw, std::move(connection));
+    return raw;
+}
+
+void HttpClient::Impl::Assign(Connection* connection, PendingRequest* request)
+{
+    connection->request = request;
+    connection->written = 0;
+    connection->receivedAny = false;
+    connection->parser.Reset();
+    connection->headPipelined = false;
+    connection->outgoing = request->wire;
+    request->connection = connection;
+    request->response = HttpResponse{};
+    request->streaming = false;
+    request->pauseRequested = false;
+}
+
+void HttpClient::Impl::Requeue(HostPool* pool, std::vector<PendingRequest*> orphans)
+{
+    // Dropped requests were already reported
+    orphans.erase(std::remove_if(orphans.begin(), orphans.end(), [this](PendingRequest* request)
+    {
+        if (request->abandoned)
+        {
+            Finish(request, {});
+            return true;
+        }
+
+        return false;
+    }), orphans.end());
+
+    if (orphans.empty())
+    {
+        return;
+    }
+
+    // Back to the front of the queue as one batch, in their original order
+    PendingRequest* leader = orphans.front();
+
+    for (size_t i = 1; i < orphans.size(); ++i)
+    {
+        leader->followers.push_back(orphans[i]->id);
+    }
+
+    pool->waiting.push_front(leader->id);
+}
+
+void HttpClient::Impl::HandleEvents(Connection* connection, uint32_t events)
+{
+    if (connection->connecting)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+
+        if (error != 0)
+        {
+            FailConnection(connection, std::string{"connect failed: "} + std::strerror(error));
+            return;
+        }
+
+        connection->connecting = false;
+
+        if (connection->request)
+        {
+            Write(connection);
+        }
+        else
+        {
+            SetInterest(connection, EPOLLIN);
+        }
+
+        return;
+    }
+
+    if ((events & EPOLLOUT) && connection->request && connection->written < connection->outgoing.size())
+    {
+        Write(connection);
+
+        if (connection->fd < 0)
+        {
+            return;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        Read(connection);
+    }
+}
+
+void HttpClient::Impl::Write(Connection* connection)
+{
+    const std::string& wire = connection->outgoing;
+
+    while (connection->written < wire.size())
+    {
+        const ssize_t sent = send(connection->fd, wire.data() + connection->written, wire.size() - connection->written, MSG_NOSIGNAL);
+
+        if (sent > 0)
+        {
+            connection->written += static_cast<size_t>(sent);
+            continue;
+        }
+
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (sent < 0 && errno == EAGAIN)
+        {
+            SetInterest(connection, EPOLLIN | EPOLLOUT);
+            return;
+        }
+
+        FailConnection(connection, std::string{"send failed: "} + std::strerror(errno));
+        return;
+    }
+
+    SetInterest(connection, EPOLLIN);
+}
+
+void HttpClient::Impl::Read(Connection* connection)
+{
+    for (;;)
+    {
+        PendingRequest* request = connection->request;
+
+        // Once the headers are in, a Content-Length body is received straight into the
+        // response buffer rather than through readBuffer. One that may be streamed is read
+        // into streamBuffer, which is only ever appended to, so the pieces handed out of it
+        // stay put; once it runs low a fresh one takes its place.
+        const uint64_t direct = request && !request->streaming ? connection->parser.RemainingFixedBody() : 0;
+        const bool streamable = direct == 0 && request && request->onBody;
+        char* destination = readBuffer.data();
+        size_t capacity = readBuffer.size();
+
+        if (direct > 0)
+        {
+            capacity = static_cast<size_t>(std::min<uint64_t>(direct, 1024 * 1024));
+            destination = request->response.body.WritableTail(capacity);
+        }
+        else if (streamable)
+        {
+            if (streamBuffer.capacity() - streamBuffer.size() < MIN_STREAM_READ)
+            {
+                streamBuffer = settings.bufferPool->Acquire(readBuffer.size());
+            }
+
+            capacity = streamBuffer.capacity() - streamBuffer.size();
+            destination = streamBuffer.WritableTail(capacity);
+        }
+
+        const ssize_t received = recv(connection->fd, destination, capacity, 0);
+
+        if (received > 0)
+        {
+            if (!request)
+            {
+                // Nothing is outstanding, so the server has no business talking
+                Close(connection);
+                return;
+            }
+
+            connection->receivedAny = true;
+
+            if (direct > 0)
+            {
+                request->response.body.Commit(static_cast<size_t>(received));
+                connection->parser.CommitFixedBody(static_cast<size_t>(received));
+            }
+            else
+            {
+                if (streamable)
+                {
+                    streamBuffer.Commit(static_cast<size_t>(received));
+                }
+
+                // With pipelining, one read can hold the end of one response and the start
+                // of the next
+                size_t offset = 0;
+
+                for (;;)
+                {
+                    offset += connection->parser.Feed(destination + offset, static_cast<size_t>(received) - offset, request->response, *request);
+
+                    if (!connection->parser.IsComplete() || offset == static_cast<size_t>(received))
+                    {
+                        break;
+                    }
+
+                    if (!CompleteExchange(connection))
+                    {
+                        // Anything after a response the connection ends on is noise
+                        return;
+                    }
+
+                    request = connection->request;
+                    connection->receivedAny = true;
+                }
+            }
+
+            if (connection->parser.HasFailed())
+            {
+                FailConnection(connection, connection->parser.GetError());
+                return;
+            }
+
+            if (connection->parser.IsComplete())
+            {
+                if (!CompleteExchange(connection))
+                {
+                    return;
+                }
+
+                continue;
+            }
+
+            if (request->pauseRequested)
+            {
+                // The consumer is behind. Drop out of epoll entirely until it catches up, so
+                // a peer hang-up can't make a level-triggered loop spin meanwhile.
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+                connection->paused = true;
+                return;
+            }
+
+            continue;
+        }
+
+        if (received == 0)
+        {
+            if (connection->request && connection->parser.FinishAtClose())
+            {
+                CompleteExchange(connection);
+            }
+            else if (connection->request)
+            {
+                FailConnection(connection, "connection closed by server");
+            }
+            else
+            {
+                Close(connection);
+            }
+
+            return;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
+
+        if (errno != EAGAIN)
+        {
+            FailConnection(connection, std::string{"recv failed: "} + std::strerror(errno));
+        }
+
+        return;
+    }
+}
+
+bool HttpClient::Impl::CompleteExchange(Connection* connection)
+{
+    PendingRequest* request = connection->request;
+    HostPool* pool = connection->pool;
+
+    connection->request = nullptr;
+    request->connection = nullptr;
+    connection->reused = true;
+
+    const bool keepAlive = connection->parser.KeepAlive();
+
+    if (keepAlive && !connection->pipelined.empty())
+    {
+        // The next pipelined response follows on the same connection
+        connection->request = connection->pipelined.front();
+        connection->pipelined.pop_front();
+        connection->headPipelined = true;
+        connection->receivedAny = false;
+        connection->parser.Reset();
+
+        Finish(request, {});
+        return true;
+    }
+
+    if (keepAlive)
+    {
+        connection->idleSince = Clock::now();
+        pool->idle.push_back(connection);
+        SetInterest(connection, EPOLLIN);
+    }
+    else
+    {
+        // The server is closing with requests still unanswered; it won't keep them
+        std::vector<PendingRequest*> orphans(connection->pipelined.begin(), connection->pipelined.end());
+        pool->pipelining = pool->pipelining && orphans.empty();
+
+        Close(connection);
+        Requeue(pool, std::move(orphans));
+    }
+
+    Dispatch(pool);
+    Finish(request, {});
+    return false;
+}
+
+void HttpClient::Impl::FailConnection(Connection* connection, const std::string& error)
+{
+    PendingRequest* request = connection->request;
+    HostPool* pool = connection->pool;
+
+    // A kept-alive connection may have been closed by the server while idle. GETs are
+    // idempotent, so give the request one more go on a fresh connection.
+    const bool retry = request && !request->abandoned && connection->reused && !connection->receivedAny && !request->retried;
+
+    // A server that answers some pipelined requests and then hangs up on the rest
+    // doesn't really support pipelining
+    if (connection->headPipelined && !connection->receivedAny)
+    {
+        pool->pipelining = false;
+    }
+
+    std::vector<PendingRequest*> orphans(connection->pipelined.begin(), connection->pipelined.end());
+
+    if (request && retry)
+    {
+        request->retried = true;
+        orphans.insert(orphans.begin(), request);
+    }
+
+    Close(connection);
+    Requeue(pool, std::move(orphans));
+    Dispatch(pool);
+
+    if (request && !retry)
+    {
+        Finish(request, error);
+    }
+}
+
+void HttpClient::Impl::Close(Connection* connection)
+{
+    if (connection->fd < 0)
+    {
+        return;
+    }
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    connection->fd = -1;
+
+    HostPool* pool = connection->pool;
+    --pool->open;
+    pool->idle.erase(std::remove(pool->idle.begin(), pool->idle.end(), connection), pool->idle.end());
+
+    if (connection->request)
+    {
+        connection->request->connection = nullptr;
+        connection->request = nullptr;
+    }
+
+    for (PendingRequest* request : connection->pipelined)
+    {
+        request->connection = nullptr;
+    }
+
+    connection->pipelined.clear();
+
+    const auto it = connections.find(connection);
+    closed.push_back(std::move(it->second));
+    connections.erase(it);
+}
+
+void HttpClient::Impl::SetInterest(Connection* connection, uint32_t events)
+{
+    if (connection->events == events)
+    {
+        return;
+    }
+
+    connection->events = events;
+
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+void HttpClient::Impl::Finish(PendingRequest* request, const std::string& error, bool cancelled)
+{
+    const auto it = requests.find(request->id);
+    auto owned = std::move(it->second);
+    requests.erase(it);
+
+    // A batch leader that leaves before being dispatched hands the batch to its first
+    // follower still around, in the same place in the queue
+    auto& followers = owned->followers;
+    auto next = std::find_if(followers.begin(), followers.end(), [this](RequestId id) { return requests.count(id) > 0; });
+
+    if (next != followers.end())
+    {
+        PendingRequest* leader = requests[*next].get();
+        leader->followers.assign(std::next(next), followers.end());
+
+        auto& waiting = owned->pool->waiting;
+        const auto slot = std::find(waiting.begin(), waiting.end(), owned->id);
+
+        if (slot != waiting.end())
+        {
+            *slot = leader->id;
+        }
+        else
+        {
+            waiting.push_front(leader->id);
+        }
+    }
+
+    HttpResponse response = std::move(owned->response);
+
+    if (!error.empty())
+    {
+        response.error = error;
+        response.cancelled = cancelled;
+    }
+
+    if (owned->callback)
+    {
+        owned->callback(std::move(response));
+    }
+}
+
+HttpClient::HttpClient(const Settings& settings) : impl(std::make_unique<Impl>(settings))
+{
+}
+
+HttpClient::~HttpClient() = default;
+
+HttpClient::RequestId HttpClient::Send(Request request, Callback callback)
+{
+    const RequestId id = impl->nextId++;
+
+    impl->Enqueue([this, id, request = std::move(request), callback = std::move(callback)]() mutable
+    {
+        impl->Start(id, std::move(request), std::move(callback));
+    });
+
+    return id;
+}
+
+std::vector<HttpClient::RequestId> HttpClient::SendPipelined(std::vector<Request> requests, BatchCallback callback)
+{
+    std::vector<RequestId> ids;
+
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        ids.push_back(impl->nextId++);
+    }
+
+    impl->Enqueue([this, ids, requests = std::move(requests), callback = std::move(callback)]() mutable
+    {
+        impl->StartBatch(ids, std::move(requests), callback);
+    });
+
+    return ids;
+}
+
+void HttpClient::Cancel(RequestId id)
+{
+    impl->Enqueue([this, id] { impl->Cancel(id); });
+}
+
+void HttpClient::Resume(RequestId id)
+{
+    impl->Enqueue([this, id] { impl->Resume(id); });
+}
+
+void HttpClient::Preconnect(const std::string& url, size_t connections)
+{
+    impl->Enqueue([this, url, connections] { impl->Preconnect(url, connections); });
+}
+
+void HttpClient::Post(std::function<void()> task)
+{
+    impl->Enqueue(std::move(task));
+}
+
+void HttpClient::Schedule(std::chrono::milliseconds delay, std::function<void()> task)
+{
+    const auto when = Clock::now() + delay;
+
+    impl->Enqueue([this, when, task = std::move(task)]() mutable
+    {
+        impl->AddTimer(when, 0, std::move(task));
+    });
+}
+
+#else
+
+struct HttpClient::Impl
+{
+    struct Job
+    {
+        Clock::time_point when;
+        uint64_t sequence;
+        std::function<void()> task;
+
+        bool operator>(const Job& other) const
+        {
+            return when != other.when ? when > other.when : sequence > other.sequence;
+        }
+    };
+
+    explicit Impl(const Settings& settings) : settings(settings)
+    {
+        if (!this->settings.bufferPool)
+        {
+            this->settings.bufferPool = std::make_shared<BufferPool>();
+        }
+
+        for (size_t i = 0; i < std::max<size_t>(1, settings.maxConnectionsPerHost); ++i)
+        {
+            workers.emplace_back([this] { Work(); });
+        }
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void Enqueue(Clock::time_point when, std::function<void()> task)
+    {
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back(Job{when, sequence++, std::move(task)});
+            std::push_heap(jobs.begin(), jobs.end(), std::greater<>{});
+        }
+
+        wake.notify_one();
+    }
+
+    void Work()
+    {
+        std::unique_lock lock(mutex);
+
+        while (!stopping)
+        {
+            if (jobs.empty())
+            {
+                wake.wait(lock);
+                continue;
+            }
+
+            if (jobs.front().when > Clock::now())
+            {
+                wake.wait_until(lock, jobs.front().when);
+                continue;
+            }
+
+            std::pop_heap(jobs.begin(), jobs.end(), std::greater<>{});
+            Job job = std::move(jobs.back());
+            jobs.pop_back();
+
+            lock.unlock();
+            job.task();
+            lock.lock();
+        }
+    }
+
+    Settings settings;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Job> jobs;
+    uint64_t sequence = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+    std::atomic<RequestId> nextId{1};
+    std::unordered_set<RequestId> cancelled;
+};
+
+HttpClient::HttpClient(const Settings& settings) : impl(std::make_unique<Impl>(settings))
+{
+}
+
+HttpClient::~HttpClient() = default;
+
+HttpClient::RequestId HttpClient::Send(Request request, Callback callback)
+{
+    const RequestId id = impl->nextId++;
+
+    impl->Enqueue(Clock::now(), [this, id, request = std::move(request), callback = std::move(callback)]
+    {
+        HttpResponse response;
+
+        {
+            std::lock_guard lock(impl->mutex);
+
+            if (impl->cancelled.erase(id) > 0)
+            {
+                response.error = "cancelled";
+                response.cancelled = true;
+            }
+        }
+
+        if (!response.cancelled)
+        {
+            try
+            {
+                http::HeaderFields headerFields(request.headers.begin(), request.headers.end());
+                auto timeout = request.timeout.count() > 0 ? request.timeout : impl->settings.requestTimeout;
+
+                if (request.deadline != Clock::time_point::max())
+                {
+                    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(request.deadline - Clock::now());
+
+                    if (remaining.count() <= 0)
+                    {
+                        throw std::runtime_error("request timed out");
+                    }
+
+                    timeout = std::min(timeout, remaining);
+                }
+
+                auto result = http::Request{request.url}.send("GET", "", headerFields, timeout);
+
+                response.status = result.status.code;
+                response.reason = result.status.reason;
+                response.headers.assign(result.headerFields.begin(), result.headerFields.end());
+
+                // The body is already complete, so hand it over in one piece and ignore pausing
+                if (request.onHeaders && request.onHeaders(response))
+                {
+                    // HTTPRequest owns its own vector, so one copy is unavoidable here too
+                    ResponseBuffer piece = impl->settings.bufferPool->Acquire(result.body.size());
+                    piece.Append(reinterpret_cast<const char*>(result.body.data()), result.body.size());
+                    request.onBody(std::move(piece));
+                }
+                else
+                {
+                    // HTTPRequest owns its own vector, so one copy is unavoidable here
+                    response.body = impl->settings.bufferPool->Acquire(result.body.size());
+                    response.body.Append(reinterpret_cast<const char*>(result.body.data()), result.body.size());
+                }
+            }
+            catch (const std::exception& e)
+            {
+                response.error = e.what();
+            }
+        }
+
+        callback(std::move(response));
+    });
+
+    return id;
+}
+
+void HttpClient::Resume(RequestId)
+{
+    // The fallback never pauses
+}
+
+void HttpClient::Preconnect(const std::string&, size_t)
+{
+    // HTTPRequest opens a fresh connection per request, so there is nothing to keep warm
+}
+
+std::vector<HttpClient::RequestId> HttpClient::SendPipelined(std::vector<Request> requests, BatchCallback callback)
+{
+    // HTTPRequest can't pipeline, so the batch becomes independent requests
+    std::vector<RequestId> ids;
+    auto shared = std::make_shared<BatchCallback>(std::move(callback));
+
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        ids.push_back(Send(std::move(requests[i]), [shared, i](HttpResponse&& response)
+        {
+            (*shared)(i, std::move(response));
+        }));
+    }
+
+    return ids;
+}
+
+void HttpClient::Cancel(RequestId id)
+{
+    // Requests already on the wire can't be interrupted by the blocking fallback
+    std::lock_guard lock(impl->mutex);
+    impl->cancelled.insert(id);
+}
+
+void HttpClient::Post(std::function<void()> task)
+{
+    impl->Enqueue(Clock::now(), std::move(task));
+}
+
+void HttpClient::Schedule(std::chrono::milliseconds delay, std::function<void()> task)
+{
+    impl->Enqueue(Clock::now() + delay, std::move(task));
+}
+
+#endif
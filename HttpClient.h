@@ -0,0 +1,104 @@
+﻿#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.h"
+
+using HttpHeaders = std::vector<std::pair<std::string, std::string>>;
+
+struct HttpResponse
+{
+    int status = 0;             // 0 when no response was received
+    std::string reason;
+    HttpHeaders headers;
+    ResponseBuffer body;
+    std::string error;          // Set when the request failed below the HTTP level
+    bool cancelled = false;
+
+    [[nodiscard]] bool Succeeded() const { return error.empty() && status >= 200 && status < 300; }
+    [[nodiscard]] std::string GetHeader(const std::string& name) const;
+};
+
+// Non-blocking HTTP/1.1 client. On Linux a single epoll loop thread multiplexes every
+// connection and keeps them alive for reuse; elsewhere requests fall back to blocking
+// HTTPRequest calls on a small worker pool. Callbacks always run on the client's own
+// threads and must not block.
+class HttpClient
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using RequestId = uint64_t;
+    using Callback = std::function<void(HttpResponse&& response)>;
+    using BatchCallback = std::function<void(size_t index, HttpResponse&& response)>;
+
+    struct Settings
+    {
+        size_t maxConnectionsPerHost = 16;
+        std::chrono::milliseconds requestTimeout{30000};
+        std::chrono::milliseconds idleTimeout{30000};
+        std::chrono::seconds dnsTtl{60};            // getaddrinfo doesn't report the record's own TTL
+        size_t maxPipelineDepth = 8;                // Requests per connection in a SendPipelined batch
+        std::shared_ptr<BufferPool> bufferPool;    // Response bodies come from here; created if null
+    };
+
+    struct Request
+    {
+        std::string url;
+        HttpHeaders headers;
+        std::chrono::milliseconds timeout{0};   // 0 uses Settings::requestTimeout
+
+        // The request fails once this passes, whether it is resolving, connecting, queued
+        // for a connection, sending or receiving
+        Clock::time_point deadline = Clock::time_point::max();
+
+        // Streaming: onHeaders sees the status and headers before any body arrives and returns
+        // true to have the body handed to onBody instead of collected in HttpResponse::body.
+        // onBody returns false to stop reading from the socket until Resume() is called. Each
+        // piece is the pooled buffer the body was received into, so keeping it copies nothing.
+        std::function<bool(const HttpResponse& head)> onHeaders;
+        std::function<bool(ResponseBuffer piece)> onBody;
+    };
+
+    HttpClient() : HttpClient(Settings{}) {}
+    explicit HttpClient(const Settings& settings);
+    ~HttpClient();
+
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    // The callback fires exactly once, including for failures and cancellation.
+    RequestId Send(Request request, Callback callback);
+    std::future<HttpResponse> Send(Request request);
+
+    // HTTP/1.1 pipelining: writes the requests back-to-back on one keep-alive connection
+    // and reads the responses in order, saving a round trip per request. Batches deeper
+    // than maxPipelineDepth are split across connections. If a server closes a connection
+    // with requests still unanswered, those are sent again and that host is not pipelined
+    // to from then on. The callback fires once per request, with its index in `requests`.
+    std::vector<RequestId> SendPipelined(std::vector<Request> requests, BatchCallback callback);
+
+    void Cancel(RequestId id);
+    void Resume(RequestId id);
+
+    // Resolves the URL's host and opens up to `connections` keep-alive connections to it,
+    // so the first requests don't pay for DNS and the TCP handshake.
+    void Preconnect(const std::string& url, size_t connections = 1);
+
+    // Runs a task on the client's thread, immediately or after a delay.
+    void Post(std::function<void()> task);
+    void Schedule(std::chrono::milliseconds delay, std::function<void()> task);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+#endif
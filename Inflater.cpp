@@ -0,0 +1,830 @@
+﻿#include "Inflater.h"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+#include "Checksum.h"
+
+namespace
+{
+    constexpr size_t WINDOW_SIZE = 32768;
+    constexpr size_t FLUSH_THRESHOLD = 65536;
+
+    constexpr uint16_t LENGTH_BASE[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    constexpr uint8_t LENGTH_EXTRA[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    constexpr uint16_t DISTANCE_BASE[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    constexpr uint8_t DISTANCE_EXTRA[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    constexpr uint8_t CODE_LENGTH_ORDER[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    constexpr int NEED_INPUT = -1;
+    constexpr int INVALID_CODE = -2;
+
+    constexpr uint8_t GZIP_FHCRC = 0x02;
+    constexpr uint8_t GZIP_FEXTRA = 0x04;
+    constexpr uint8_t GZIP_FNAME = 0x08;
+    constexpr uint8_t GZIP_FCOMMENT = 0x10;
+}
+
+Inflater::Inflater(Format format, Sink sink, std::shared_ptr<BufferPool> pool)
+    : format(format), sink(std::move(sink)), pool(std::move(pool)), window(WINDOW_SIZE)
+{
+}
+
+Inflater::Status Inflater::Feed(const void* data, size_t size)
+{
+    if (state == State::Failed)
+    {
+        return Status::Error;
+    }
+
+    if (state == State::Done)
+    {
+        return Status::Finished;
+    }
+
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    input.insert(input.end(), bytes, bytes + size);
+
+    const Status status = Run();
+    Flush();
+
+    input.erase(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(position));
+    position = 0;
+
+    return status;
+}
+
+Inflater::Status Inflater::Finish()
+{
+    Flush();
+
+    if (state == State::Done)
+    {
+        return Status::Finished;
+    }
+
+    if (state != State::Failed)
+    {
+        Fail("compressed stream is truncated");
+    }
+
+    return Status::Error;
+}
+
+bool Inflater::FormatForContentEncoding(const std::string& contentEncoding, Format& format)
+{
+    std::string encoding;
+
+    for (char c : contentEncoding)
+    {
+        if (!std::isspace(static_cast<unsigned char>(c)))
+        {
+            encoding += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+    }
+
+    if (encoding == "gzip" || encoding == "x-gzip")
+    {
+        format = Format::Gzip;
+        return true;
+    }
+
+    if (encoding == "deflate")
+    {
+        // Servers disagree on whether "deflate" means zlib-wrapped or raw, so sniff it
+        format = Format::Auto;
+        return true;
+    }
+
+    return false;
+}
+
+Inflater::Status Inflater::Run()
+{
+    for (;;)
+    {
+        const Checkpoint checkpoint = Save();
+        bool progressed = false;
+
+        switch (state)
+        {
+        case State::Header:
+            progressed = ReadHeader();
+            break;
+        case State::BlockHeader:
+            progressed = ReadBlockHeader();
+            break;
+        case State::Stored:
+            progressed = CopyStored();
+            break;
+        case State::Codes:
+            progressed = DecodeCodes();
+            break;
+        case State::Trailer:
+            progressed = ReadTrailer();
+            break;
+        case State::Done:
+            return Status::Finished;
+        case State::Failed:
+            return Status::Error;
+        }
+
+        if (state == State::Failed)
+        {
+            return Status::Error;
+        }
+
+        if (!progressed)
+        {
+            // Everything except stored and coded data is decoded all-or-nothing, so
+            // rewind and wait until the whole header is buffered.
+            Restore(checkpoint);
+            return Status::NeedMoreInput;
+        }
+    }
+}
+
+bool Inflater::ReadHeader()
+{
+    if (format == Format::Auto)
+    {
+        if (!Need(16))
+        {
+            return false;
+        }
+
+        const auto first = static_cast<uint32_t>(bitBuffer & 0xFF);
+        const auto second = static_cast<uint32_t>((bitBuffer >> 8) & 0xFF);
+
+        if (first == 0x1F && second == 0x8B)
+        {
+            format = Format::Gzip;
+        }
+        else if ((first & 0x0F) == 8 && (first >> 4) <= 7 && (first * 256 + second) % 31 == 0)
+        {
+            format = Format::Zlib;
+        }
+        else
+        {
+            format = Format::Raw;
+        }
+    }
+
+    if (format == Format::Zlib)
+    {
+        if (!Need(16))
+        {
+            return false;
+        }
+
+        const uint32_t cmf = Take(8);
+        const uint32_t flags = Take(8);
+
+        if ((cmf & 0x0F) != 8 || (cmf * 256 + flags) % 31 != 0)
+        {
+            return Fail("invalid zlib header");
+        }
+
+        if (flags & 0x20)
+        {
+            return Fail("zlib preset dictionaries are not supported");
+        }
+
+        checksum = 1;
+    }
+    else if (format == Format::Gzip)
+    {
+        if (!Need(32))
+        {
+            return false;
+        }
+
+        if (Take(8) != 0x1F || Take(8) != 0x8B || Take(8) != 8)
+        {
+            return Fail("invalid gzip header");
+        }
+
+        const uint32_t flags = Take(8);
+
+        // MTIME, XFL and OS are not interesting
+        for (int i = 0; i < 6; ++i)
+        {
+            if (!Need(8))
+            {
+                return false;
+            }
+
+            Take(8);
+        }
+
+        if (flags & GZIP_FEXTRA)
+        {
+            if (!Need(16))
+            {
+                return false;
+            }
+
+            uint32_t extraLength = Take(16);
+
+            while (extraLength-- > 0)
+            {
+                if (!Need(8))
+                {
+                    return false;
+                }
+
+                Take(8);
+            }
+        }
+
+        for (const uint8_t flag : {GZIP_FNAME, GZIP_FCOMMENT})
+        {
+            if (flags & flag)
+            {
+                do
+                {
+                    if (!Need(8))
+                    {
+                        return false;
+                    }
+                } while (Take(8) != 0);
+            }
+        }
+
+        if (flags & GZIP_FHCRC)
+        {
+            if (!Need(16))
+            {
+                return false;
+            }
+
+            Take(16);
+        }
+
+        checksum = 0;
+    }
+
+    state = State::BlockHeader;
+    return true;
+}
+
+bool Inflater::ReadBlockHeader()
+{
+    if (!Need(3))
+    {
+        return false;
+    }
+
+    lastBlock = Take(1) != 0;
+
+    switch (Take(2))
+    {
+    case 0:
+    {
+        AlignToByte();
+
+        if (!Need(32))
+        {
+            return false;
+        }
+
+        const uint32_t length = Take(16);
+        const uint32_t complement = Take(16);
+
+        if (length != (~complement & 0xFFFF))
+        {
+            return Fail("stored block length does not match its complement");
+        }
+
+        storedRemaining = length;
+        state = State::Stored;
+        return true;
+    }
+    case 1:
+    {
+        static const auto fixedTables = []
+        {
+            std::pair<Huffman, Huffman> tables;
+            uint8_t lengths[288];
+
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            Inflater::Build(tables.first, lengths, 288);
+
+            std::fill(lengths, lengths + 30, 5);
+            Inflater::Build(tables.second, lengths, 30);
+
+            return tables;
+        }();
+
+        lengthCodes = fixedTables.first;
+        distanceCodes = fixedTables.second;
+        state = State::Codes;
+        return true;
+    }
+    case 2:
+        if (!ReadDynamicTables())
+        {
+            return false;
+        }
+
+        state = State::Codes;
+        return true;
+    default:
+        return Fail("invalid block type");
+    }
+}
+
+bool Inflater::ReadDynamicTables()
+{
+    if (!Need(14))
+    {
+        return false;
+    }
+
+    const int lengthCount = static_cast<int>(Take(5)) + 257;
+    const int distanceCount = static_cast<int>(Take(5)) + 1;
+    const int codeLengthCount = static_cast<int>(Take(4)) + 4;
+
+    if (lengthCount > 286 || distanceCount > 30)
+    {
+        return Fail("too many length or distance codes");
+    }
+
+    uint8_t lengths[286 + 30] = {};
+
+    for (int i = 0; i < codeLengthCount; ++i)
+    {
+        if (!Need(3))
+        {
+            return false;
+        }
+
+        lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(Take(3));
+    }
+
+    Huffman codeLengthCodes;
+
+    if (!Build(codeLengthCodes, lengths, 19))
+    {
+        return Fail("invalid code length code");
+    }
+
+    std::fill(lengths, lengths + 19, 0);
+
+    int index = 0;
+
+    while (index < lengthCount + distanceCount)
+    {
+        const int symbol = Decode(codeLengthCodes);
+
+        if (symbol == NEED_INPUT)
+        {
+            return false;
+        }
+
+        if (symbol == INVALID_CODE)
+        {
+            return Fail("invalid code length");
+        }
+
+        if (symbol < 16)
+        {
+            lengths[index++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t repeated = 0;
+        int repeat;
+
+        if (symbol == 16)
+        {
+            if (index == 0)
+            {
+                return Fail("repeat with no previous code length");
+            }
+
+            if (!Need(2))
+            {
+                return false;
+            }
+
+            repeated = lengths[index - 1];
+            repeat = 3 + static_cast<int>(Take(2));
+        }
+        else if (symbol == 17)
+        {
+            if (!Need(3))
+            {
+                return false;
+            }
+
+            repeat = 3 + static_cast<int>(Take(3));
+        }
+        else
+        {
+            if (!Need(7))
+            {
+                return false;
+            }
+
+            repeat = 11 + static_cast<int>(Take(7));
+        }
+
+        if (index + repeat > lengthCount + distanceCount)
+        {
+            return Fail("code lengths overrun the table");
+        }
+
+        std::fill(lengths + index, lengths + index + repeat, repeated);
+        index += repeat;
+    }
+
+    if (lengths[256] == 0)
+    {
+        return Fail("missing end-of-block code");
+    }
+
+    if (!Build(lengthCodes, lengths, lengthCount) || !Build(distanceCodes, lengths + lengthCount, distanceCount))
+    {
+        return Fail("invalid literal/length or distance code");
+    }
+
+    return true;
+}
+
+bool Inflater::CopyStored()
+{
+    bool progressed = false;
+
+    // Bytes already pulled into the bit buffer come first
+    while (storedRemaining > 0 && bitCount >= 8)
+    {
+        Emit(static_cast<uint8_t>(Take(8)));
+        --storedRemaining;
+        progressed = true;
+    }
+
+    const size_t available = std::min<size_t>(storedRemaining, input.size() - position);
+
+    for (size_t i = 0; i < available; ++i)
+    {
+        Emit(input[position + i]);
+    }
+
+    position += available;
+    storedRemaining -= static_cast<uint32_t>(available);
+    progressed = progressed || available > 0;
+
+    if (storedRemaining == 0)
+    {
+        state = lastBlock ? State::Trailer : State::BlockHeader;
+        return true;
+    }
+
+    return progressed;
+}
+
+bool Inflater::DecodeCodes()
+{
+    bool progressed = false;
+
+    for (;;)
+    {
+        const Checkpoint checkpoint = Save();
+        const int symbol = Decode(lengthCodes);
+
+        if (symbol == INVALID_CODE)
+        {
+            return Fail("invalid literal/length code");
+        }
+
+        if (symbol == NEED_INPUT)
+        {
+            Restore(checkpoint);
+            return progressed;
+        }
+
+        if (symbol < 256)
+        {
+            Emit(static_cast<uint8_t>(symbol));
+            progressed = true;
+            continue;
+        }
+
+        if (symbol == 256)
+        {
+            state = lastBlock ? State::Trailer : State::BlockHeader;
+            return true;
+        }
+
+        const int lengthIndex = symbol - 257;
+
+        if (lengthIndex >= 29)
+        {
+            return Fail("invalid length symbol");
+        }
+
+        if (!Need(LENGTH_EXTRA[lengthIndex]))
+        {
+            Restore(checkpoint);
+            return progressed;
+        }
+
+        const uint32_t length = LENGTH_BASE[lengthIndex] + Take(LENGTH_EXTRA[lengthIndex]);
+        const int distanceIndex = Decode(distanceCodes);
+
+        if (distanceIndex == INVALID_CODE || distanceIndex >= 30)
+        {
+            return Fail("invalid distance code");
+        }
+
+        if (distanceIndex == NEED_INPUT || !Need(DISTANCE_EXTRA[distanceIndex]))
+        {
+            Restore(checkpoint);
+            return progressed;
+        }
+
+        const uint32_t distance = DISTANCE_BASE[distanceIndex] + Take(DISTANCE_EXTRA[distanceIndex]);
+
+        if (distance > totalOut)
+        {
+            return Fail("distance reaches before the start of the stream");
+        }
+
+        for (uint32_t i = 0; i < length; ++i)
+        {
+            Emit(window[(totalOut - distance) & (WINDOW_SIZE - 1)]);
+        }
+
+        progressed = true;
+    }
+}
+
+bool Inflater::ReadTrailer()
+{
+    AlignToByte();
+    Flush();
+
+    if (format == Format::Gzip)
+    {
+        if (!Need(32))
+        {
+            return false;
+        }
+
+        const uint32_t expectedCrc = Take(32);
+
+        if (!Need(32))
+        {
+            return false;
+        }
+
+        const uint32_t expectedSize = Take(32);
+
+        if (expectedCrc != checksum || expectedSize != static_cast<uint32_t>(totalOut))
+        {
+            return Fail("gzip checksum mismatch");
+        }
+    }
+    else if (format == Format::Zlib)
+    {
+        uint32_t expectedAdler = 0;
+
+        for (int i = 0; i < 4; ++i)
+        {
+            if (!Need(8))
+            {
+                return false;
+            }
+
+            expectedAdler = (expectedAdler << 8) | Take(8);
+        }
+
+        if (expectedAdler != checksum)
+        {
+            return Fail("zlib checksum mismatch");
+        }
+    }
+
+    state = State::Done;
+    return true;
+}
+
+bool Inflater::Need(int bits)
+{
+    while (bitCount < bits)
+    {
+        if (position == input.size())
+        {
+            return false;
+        }
+
+        bitBuffer |= static_cast<uint64_t>(input[position++]) << bitCount;
+        bitCount += 8;
+    }
+
+    return true;
+}
+
+uint32_t Inflater::Take(int bits)
+{
+    const auto value = static_cast<uint32_t>(bitBuffer & ((uint64_t{1} << bits) - 1));
+    bitBuffer >>= bits;
+    bitCount -= bits;
+    return value;
+}
+
+void Inflater::AlignToByte()
+{
+    Take(bitCount & 7);
+}
+
+int Inflater::Decode(const Huffman& huffman)
+{
+    // Top up opportunistically; running dry here is only a problem if the code is long
+    while (bitCount < 32 && position < input.size())
+    {
+        bitBuffer |= static_cast<uint64_t>(input[position++]) << bitCount;
+        bitCount += 8;
+    }
+
+    const uint16_t entry = huffman.fast[bitBuffer & ((1u << FAST_BITS) - 1)];
+    const int entryLength = entry >> 9;
+
+    if (entryLength != 0 && entryLength <= bitCount)
+    {
+        Take(entryLength);
+        return entry & 0x1FF;
+    }
+
+    // Canonical decode one bit at a time for codes longer than the fast table
+    int code = 0;
+    int first = 0;
+    int index = 0;
+
+    for (int length = 1; length < 16; ++length)
+    {
+        if (length > bitCount)
+        {
+            return NEED_INPUT;
+        }
+
+        code |= static_cast<int>((bitBuffer >> (length - 1)) & 1);
+        const int count = huffman.count[length];
+
+        if (code - count < first)
+        {
+            Take(length);
+            return huffman.symbol[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return INVALID_CODE;
+}
+
+bool Inflater::Build(Huffman& huffman, const uint8_t* lengths, int count)
+{
+    huffman.count.fill(0);
+    huffman.fast.fill(0);
+
+    for (int symbol = 0; symbol < count; ++symbol)
+    {
+        ++huffman.count[lengths[symbol]];
+    }
+
+    int left = 1;
+
+    for (int length = 1; length < 16; ++length)
+    {
+        left <<= 1;
+        left -= huffman.count[length];
+
+        if (left < 0)
+        {
+            return false;
+        }
+    }
+
+    uint16_t offsets[16] = {};
+    uint16_t nextCode[16] = {};
+    uint16_t code = 0;
+
+    for (int length = 1; length < 16; ++length)
+    {
+        offsets[length] = static_cast<uint16_t>(length == 1 ? 0 : offsets[length - 1] + huffman.count[length - 1]);
+        code = static_cast<uint16_t>((code + (length == 1 ? 0 : huffman.count[length - 1])) << 1);
+        nextCode[length] = code;
+    }
+
+    for (int symbol = 0; symbol < count; ++symbol)
+    {
+        const int length = lengths[symbol];
+
+        if (length == 0)
+        {
+            continue;
+        }
+
+        huffman.symbol[offsets[length]++] = static_cast<uint16_t>(symbol);
+
+        const uint16_t symbolCode = nextCode[length]++;
+
+        if (length > FAST_BITS)
+        {
+            continue;
+        }
+
+        // Codes are packed MSB-first, the bit buffer is LSB-first
+        uint32_t reversed = 0;
+
+        for (int bit = 0; bit < length; ++bit)
+        {
+            reversed |= ((symbolCode >> bit) & 1u) << (length - 1 - bit);
+        }
+
+        for (uint32_t slot = reversed; slot < (1u << FAST_BITS); slot += 1u << length)
+        {
+            huffman.fast[slot] = static_cast<uint16_t>((length << 9) | symbol);
+        }
+    }
+
+    return true;
+}
+
+void Inflater::Restore(const Checkpoint& checkpoint)
+{
+    position = checkpoint.position;
+    bitBuffer = checkpoint.bitBuffer;
+    bitCount = checkpoint.bitCount;
+}
+
+void Inflater::Emit(uint8_t byte)
+{
+    window[totalOut & (WINDOW_SIZE - 1)] = byte;
+    ++totalOut;
+
+    if (tail == limit)
+    {
+        Flush();
+        Refill();
+    }
+
+    *tail++ = static_cast<char>(byte);
+}
+
+void Inflater::Refill()
+{
+    // Pieces of the full buffer may still be held, so decoding goes on in another
+    output = pool ? pool->Acquire(FLUSH_THRESHOLD) : ResponseBuffer{};
+    tail = output.WritableTail(FLUSH_THRESHOLD);
+    limit = tail + FLUSH_THRESHOLD;
+}
+
+void Inflater::Flush()
+{
+    const size_t start = output.size();
+    const auto count = static_cast<size_t>(tail - (output.data() + start));
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (format == Format::Gzip)
+    {
+        checksum = Checksum::Crc32(tail - count, count, checksum);
+    }
+    else if (format == Format::Zlib)
+    {
+        checksum = Checksum::Adler32(tail - count, count, checksum);
+    }
+
+    // Handed over as a slice; the next piece is decoded after it in the same buffer
+    output.Commit(count);
+    sink(output.Slice(start, count));
+}
+
+bool Inflater::Fail(const char* message)
+{
+    state = State::Failed;
+    error = message;
+    return false;
+}
@@ -0,0 +1,127 @@
+﻿#ifndef INFLATER_H
+#define INFLATER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+
+// Streaming DEFLATE decoder (RFC 1951) with gzip (RFC 1952) and zlib (RFC 1950) framing.
+// Input may be fed in arbitrarily sized pieces; decoded bytes are handed to the sink as
+// soon as they are produced, so only the 32 KiB history window is kept in memory. Each
+// piece is decoded straight into a slice of a pooled buffer, which the sink may keep.
+class Inflater
+{
+public:
+    enum class Format
+    {
+        Raw,
+        Zlib,
+        Gzip,
+        Auto    // Sniffs gzip or zlib framing and falls back to raw DEFLATE
+    };
+
+    enum class Status
+    {
+        NeedMoreInput,
+        Finished,
+        Error
+    };
+
+    using Sink = std::function<void(ResponseBuffer piece)>;
+
+    // Without a pool, output buffers are allocated as needed
+    Inflater(Format format, Sink sink, std::shared_ptr<BufferPool> pool = nullptr);
+
+    Status Feed(const void* data, size_t size);
+
+    // Call once the input is exhausted; reports an error if the stream was truncated.
+    Status Finish();
+
+    [[nodiscard]] const std::string& GetError() const { return error; }
+
+    // Maps a Content-Encoding value to a format; returns false for encodings we can't decode.
+    static bool FormatForContentEncoding(const std::string& contentEncoding, Format& format);
+
+private:
+    static constexpr int FAST_BITS = 9;
+
+    struct Huffman
+    {
+        std::array<uint16_t, 16> count{};
+        std::array<uint16_t, 288> symbol{};
+        std::array<uint16_t, 1 << FAST_BITS> fast{};   // (length << 9) | symbol, 0 when the code is longer
+    };
+
+    enum class State
+    {
+        Header,
+        BlockHeader,
+        Stored,
+        Codes,
+        Trailer,
+        Done,
+        Failed
+    };
+
+    struct Checkpoint
+    {
+        size_t position;
+        uint64_t bitBuffer;
+        int bitCount;
+    };
+
+    Status Run();
+    bool ReadHeader();
+    bool ReadBlockHeader();
+    bool ReadDynamicTables();
+    bool CopyStored();
+    bool DecodeCodes();
+    bool ReadTrailer();
+
+    bool Need(int bits);
+    uint32_t Take(int bits);
+    void AlignToByte();
+    int Decode(const Huffman& huffman);
+    static bool Build(Huffman& huffman, const uint8_t* lengths, int count);
+
+    [[nodiscard]] Checkpoint Save() const { return {position, bitBuffer, bitCount}; }
+    void Restore(const Checkpoint& checkpoint);
+
+    void Emit(uint8_t byte);
+    void Refill();
+    void Flush();
+    bool Fail(const char* message);
+
+    Format format;
+    Sink sink;
+    std::shared_ptr<BufferPool> pool;
+    State state = State::Header;
+    std::string error;
+
+    std::vector<uint8_t> input;
+    size_t position = 0;
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+
+    bool lastBlock = false;
+    uint32_t storedRemaining = 0;
+    Huffman lengthCodes;
+    Huffman distanceCodes;
+
+    std::vector<uint8_t> window;
+    uint64_t totalOut = 0;
+
+    // Decoded bytes go to `tail`; those past output's size haven't been handed over yet
+    ResponseBuffer output;
+    char* tail = nullptr;
+    char* limit = nullptr;
+    uint32_t checksum = 0;
+};
+
+#endif
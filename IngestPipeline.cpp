@@ -0,0 +1,337 @@
+﻿#include "IngestPipeline.h"
+
+#include <algorithm>
+#include <iostream>
+
+void IngestPipeline::AddCatalog(std::string name, MovieDatabase& database, uint32_t pages, Fetch fetch)
+{
+    catalogs.push_back(std::make_unique<Catalog>(std::move(name), database, pages, std::move(fetch)));
+}
+
+size_t IngestPipeline::Run(const CancellationToken& cancellation)
+{
+    // Page 1 of every catalog first, then page 2 and so on, so every catalog can start early
+    uint32_t mostPages = 0;
+
+    for (const auto& catalog : catalogs)
+    {
+        mostPages = std::max(mostPages, catalog->pages);
+    }
+
+    for (uint32_t page = 1; page <= mostPages; ++page)
+    {
+        for (size_t index = 0; index < catalogs.size(); ++index)
+        {
+            if (page <= catalogs[index]->pages)
+            {
+                jobs.emplace_back(index, page);
+            }
+        }
+    }
+
+    {
+        TaskGroup group(scheduler);
+
+        for (size_t slot = 0; slot < std::max<size_t>(settings.fetchers, 1); ++slot)
+        {
+            StartFetch(group, cancellation);
+        }
+
+        // Pages still waiting once every body is parsed are behind one that cancellation
+        // kept from being fetched, and are added anyway, each catalog's on its own
+        for (const auto& catalog : catalogs)
+        {
+            group.Then([&catalog = *catalog]
+            {
+                for (auto& [page, rest] : catalog.waiting)
+                {
+                    Add(catalog, rest);
+                }
+            });
+        }
+
+        group.Wait();
+    }
+
+    size_t skipped = jobs.size() - std::min(nextJob.load(), jobs.size());
+
+    for (const auto& catalog : catalogs)
+    {
+        skipped += catalog->skipped;
+    }
+
+    return skipped;
+}
+
+void IngestPipeline::StartFetch(TaskGroup& group, const CancellationToken& cancellation)
+{
+    if (cancellation.IsCancelled())
+    {
+        return;
+    }
+
+    const size_t job = nextJob++;
+
+    if (job >= jobs.size())
+    {
+        return;
+    }
+
+    const size_t index = jobs[job].first;
+    const uint32_t page = jobs[job].second;
+
+    // Held until the body has all arrived, so the group isn't done while the request is in
+    // flight
+    group.Hold();
+
+    catalogs[index]->fetch(page, cancellation, std::make_shared<PageStream>(*this, group, cancellation, index, page));
+}
+
+IngestPipeline::PageStream::PageStream(IngestPipeline& pipeline, TaskGroup& group, const CancellationToken& cancellation, size_t catalog, uint32_t page)
+    : pipeline(pipeline), group(group), cancellation(cancellation), catalog(catalog), page(page), parser(pipeline.settings.backend)
+{
+}
+
+void IngestPipeline::PageStream::Begin(std::function<void()> resume)
+{
+    {
+        std::lock_guard lock(mutex);
+        this->resume = std::move(resume);
+        paused = false;
+    }
+
+    Push(Piece{Piece::Kind::Begin, {}, false});
+}
+
+bool IngestPipeline::PageStream::Write(ResponseBuffer piece)
+{
+    return Push(Piece{Piece::Kind::Data, std::move(piece), false});
+}
+
+void IngestPipeline::PageStream::End(bool ok)
+{
+    Push(Piece{Piece::Kind::End, {}, ok});
+
+    // The body is in, so the slot is free for the next page while this one is parsed
+    pipeline.FreeSlot(group, cancellation);
+    group.Release();
+}
+
+bool IngestPipeline::PageStream::Push(Piece piece)
+{
+    bool reading;
+
+    {
+        std::lock_guard lock(mutex);
+        queued += piece.data.size();
+        pieces.push_back(std::move(piece));
+
+        // Decided along with the push, so the drain can't miss a pause and never resume
+        paused = queued > pipeline.settings.queuedBytes;
+        reading = !paused;
+
+        if (draining)
+        {
+            return reading;
+        }
+
+        draining = true;
+    }
+
+    pipeline.StartParse(group, shared_from_this());
+    return reading;
+}
+
+void IngestPipeline::PageStream::Drain()
+{
+    for (;;)
+    {
+        Piece piece;
+        std::function<void()> wake;
+
+        {
+            std::lock_guard lock(mutex);
+
+            if (pieces.empty())
+            {
+                draining = false;
+                return;
+            }
+
+            piece = std::move(pieces.front());
+            pieces.pop_front();
+            queued -= piece.data.size();
+
+            // Resumed at half, so reading doesn't stop and start on every piece
+            if (paused && queued <= pipeline.settings.queuedBytes / 2)
+            {
+                paused = false;
+                wake = resume;
+            }
+        }
+
+        if (wake)
+        {
+            wake();
+        }
+
+        switch (piece.kind)
+        {
+        case Piece::Kind::Begin:
+            parser.Reset();
+            break;
+        case Piece::Kind::Data:
+            parser.Feed(piece.data.View());
+            break;
+        case Piece::Kind::End:
+        {
+            Parsed parsed;
+            parsed.page = page;
+
+            if (!piece.ok)
+            {
+                parsed.failure = cancellation.IsCancelled() ? "cancelled" : "request failed";
+            }
+            else if (!(parsed.ok = parser.Finish(parsed.movies)))
+            {
+                parsed.failure = "invalid JSON";
+            }
+
+            parser.Reset();
+            pipeline.Deliver(*pipeline.catalogs[catalog], std::move(parsed), group, cancellation);
+            break;
+        }
+        }
+    }
+}
+
+void IngestPipeline::StartParse(TaskGroup& group, std::shared_ptr<PageStream> stream)
+{
+    {
+        std::lock_guard lock(parseMutex);
+        const size_t parsers = settings.parsers > 0 ? settings.parsers : scheduler.GetWorkerCount();
+
+        // Its pieces wait, and its socket pauses once enough do, until a parser is free
+        if (parsing >= std::max<size_t>(parsers, 1))
+        {
+            readyToParse.push_back(std::move(stream));
+            return;
+        }
+
+        ++parsing;
+    }
+
+    group.Run([this, &group, stream = std::move(stream)]
+    {
+        stream->Drain();
+        FinishParse(group);
+    });
+}
+
+void IngestPipeline::FinishParse(TaskGroup& group)
+{
+    std::shared_ptr<PageStream> next;
+
+    {
+        std::lock_guard lock(parseMutex);
+
+        if (readyToParse.empty())
+        {
+            --parsing;
+            return;
+        }
+
+        next = std::move(readyToParse.front());
+        readyToParse.pop_front();
+    }
+
+    // The parser goes straight to the page that has waited longest
+    group.Run([this, &group, next = std::move(next)]
+    {
+        next->Drain();
+        FinishParse(group);
+    });
+}
+
+void IngestPipeline::FreeSlot(TaskGroup& group, const CancellationToken& cancellation)
+{
+    {
+        std::lock_guard lock(writeMutex);
+
+        // Sends again once the writer has caught up; see Deliver
+        if (parsedWaiting >= std::max<size_t>(settings.parsedPages, 1))
+        {
+            ++parkedSlots;
+            return;
+        }
+    }
+
+    StartFetch(group, cancellation);
+}
+
+void IngestPipeline::Deliver(Catalog& catalog, Parsed parsed, TaskGroup& group, const CancellationToken& cancellation)
+{
+    {
+        std::lock_guard lock(writeMutex);
+        ++parsedWaiting;
+    }
+
+    std::unique_lock lock(catalog.mutex);
+
+    const uint32_t page = parsed.page;
+    catalog.waiting.emplace(page, std::move(parsed));
+
+    // Pages are parsed out of order. Whoever finds nobody adding adds every page that is
+    // next in order, those delivered meanwhile included; the rest leave theirs to it.
+    if (catalog.adding)
+    {
+        return;
+    }
+
+    catalog.adding = true;
+    size_t added = 0;
+
+    for (auto it = catalog.waiting.find(catalog.next); it != catalog.waiting.end(); it = catalog.waiting.find(catalog.next))
+    {
+        Parsed ready = std::move(it->second);
+        catalog.waiting.erase(it);
+        ++catalog.next;
+        ++added;
+
+        lock.unlock();
+        Add(catalog, ready);
+        lock.lock();
+    }
+
+    catalog.adding = false;
+    lock.unlock();
+
+    size_t restarted = 0;
+
+    {
+        std::lock_guard writeLock(writeMutex);
+        parsedWaiting -= added;
+
+        const size_t limit = std::max<size_t>(settings.parsedPages, 1);
+        restarted = parsedWaiting < limit ? std::min(parkedSlots, limit - parsedWaiting) : 0;
+        parkedSlots -= restarted;
+    }
+
+    for (size_t slot = 0; slot < restarted; ++slot)
+    {
+        StartFetch(group, cancellation);
+    }
+}
+
+void IngestPipeline::Add(Catalog& catalog, Parsed& parsed)
+{
+    if (parsed.ok)
+    {
+        catalog.database.AddMovies(std::move(parsed.movies));
+    }
+    else
+    {
+        std::cerr << "Skipping " << catalog.name << " page " << parsed.page << ": " << parsed.failure << std::endl;
+        ++catalog.skipped;
+    }
+}
@@ -0,0 +1,169 @@
+﻿#ifndef INGEST_PIPELINE_H
+#define INGEST_PIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BodyStream.h"
+#include "BufferPool.h"
+#include "CancellationToken.h"
+#include "JsonProjection.h"
+#include "MovieDatabase.h"
+#include "TaskScheduler.h"
+
+// Crawls paged lists into MovieDatabases on a TaskScheduler, in three stages with a bounded
+// queue between each:
+//
+// - Fetching: up to `fetchers` requests are in flight at once, without a thread waiting on
+//   any of them.
+// - Parsing: each body is parsed as it arrives, its pieces in order by one task at a time,
+//   so a page is mostly parsed by the time its last byte is in and is never held whole. Up
+//   to `parsers` pages are parsed at once. Reading a body pauses while more than
+//   `queuedBytes` of it waits for a parser, so parsing that falls behind holds back the
+//   socket instead of letting bodies pile up.
+// - Writing: a catalog has one writer at a time, which adds its parsed pages in page order.
+//   A page parsed ahead of one still to come waits, and fetching pauses while
+//   `parsedPages` wait, so a page that is slow to arrive can't leave the rest piling up
+//   behind it.
+class IngestPipeline
+{
+public:
+    struct Settings
+    {
+        size_t fetchers = 6;                // Requests in flight at once
+        size_t parsers = 0;                 // Pages parsed at once; 0 for one per scheduler worker
+        size_t queuedBytes = 256 * 1024;    // Of a body waiting to be parsed
+        size_t parsedPages = 32;            // Waiting for the writer to reach them
+        JsonProjection::Backend backend = JsonProjection::Backend::Direct;
+    };
+
+    // Starts fetching the page and returns, handing the body to `stream` as it arrives, as
+    // TMDBServiceProvider::StreamHttpGetRequestAsync does
+    using Fetch = std::function<void(uint32_t page, const CancellationToken& cancellation, std::shared_ptr<BodyStream> stream)>;
+
+    IngestPipeline(const Settings& settings, TaskScheduler& scheduler) : settings(settings), scheduler(scheduler) {}
+    explicit IngestPipeline(const Settings& settings) : IngestPipeline(settings, TaskScheduler::GetShared()) {}
+
+    // Pages 1 to `pages` of a list. `name` labels the pages that are skipped. Leave the
+    // database alone until Run returns.
+    void AddCatalog(std::string name, MovieDatabase& database, uint32_t pages, Fetch fetch);
+
+    // Returns once every page has been ingested or skipped, with the number skipped, pages
+    // never requested included. After cancellation no further page is requested, but what
+    // has already arrived is still ingested. Runs only once.
+    size_t Run(const CancellationToken& cancellation = {});
+
+private:
+    struct Parsed
+    {
+        uint32_t page = 0;
+        bool ok = false;
+        std::string failure;
+        MovieList movies;
+    };
+
+    struct Catalog
+    {
+        Catalog(std::string name, MovieDatabase& database, uint32_t pages, Fetch fetch)
+            : name(std::move(name)), database(database), pages(pages), fetch(std::move(fetch)) {}
+
+        const std::string name;
+        MovieDatabase& database;
+        const uint32_t pages;
+        const Fetch fetch;
+
+        // Pages parsed before one ahead of them, and the next page to add
+        std::mutex mutex;
+        std::map<uint32_t, Parsed> waiting;
+        uint32_t next = 1;
+        bool adding = false;
+        size_t skipped = 0;         // Only touched by whoever is adding
+    };
+
+    // A page's body on its way from the client thread to the parser, in the buffers it was
+    // received or decoded into, never copied. One task at a time parses them, in order; reading pauses while more than
+    // Settings::queuedBytes wait.
+    class PageStream : public BodyStream, public std::enable_shared_from_this<PageStream>
+    {
+    public:
+        PageStream(IngestPipeline& pipeline, TaskGroup& group, const CancellationToken& cancellation, size_t catalog, uint32_t page);
+
+        void Begin(std::function<void()> resume) override;
+        bool Write(ResponseBuffer piece) override;
+        void End(bool ok) override;
+
+        // Parses whatever is queued; see StartParse
+        void Drain();
+
+    private:
+        struct Piece
+        {
+            enum class Kind
+            {
+                Begin,
+                Data,
+                End
+            };
+
+            Kind kind = Kind::Data;
+            ResponseBuffer data;
+            bool ok = false;
+        };
+
+        // Returns whether to go on reading
+        bool Push(Piece piece);
+
+        IngestPipeline& pipeline;
+        TaskGroup& group;
+        const CancellationToken& cancellation;
+        const size_t catalog;
+        const uint32_t page;
+
+        // Only touched by the task draining the pieces
+        MovieDatabase::PageParser parser;
+
+        std::mutex mutex;
+        std::deque<Piece> pieces;
+        size_t queued = 0;          // Bytes in `pieces`
+        bool draining = false;
+        bool paused = false;
+        std::function<void()> resume;
+    };
+
+    void StartFetch(TaskGroup& group, const CancellationToken& cancellation);
+    void FreeSlot(TaskGroup& group, const CancellationToken& cancellation);
+    void StartParse(TaskGroup& group, std::shared_ptr<PageStream> stream);
+    void FinishParse(TaskGroup& group);
+    void Deliver(Catalog& catalog, Parsed parsed, TaskGroup& group, const CancellationToken& cancellation);
+    static void Add(Catalog& catalog, Parsed& parsed);
+
+    const Settings settings;
+    TaskScheduler& scheduler;
+
+    std::vector<std::unique_ptr<Catalog>> catalogs;
+
+    // Pages being parsed, and those with pieces waiting for a parser
+    std::mutex parseMutex;
+    size_t parsing = 0;
+    std::deque<std::shared_ptr<PageStream>> readyToParse;
+
+    // Parsed pages waiting for the writer, and fetch slots idle until fewer are
+    std::mutex writeMutex;
+    size_t parsedWaiting = 0;
+    size_t parkedSlots = 0;
+
+    // Catalog and page of every request, claimed by the slots in order
+    std::vector<std::pair<size_t, uint32_t>> jobs;
+    std::atomic<size_t> nextJob{0};
+};
+
+#endif
@@ -0,0 +1,985 @@
+﻿#include "JsonProjection.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "StructuralIndex.h"
+
+namespace
+{
+    bool IsWhitespace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    void SkipWhitespace(const char*& cursor, const char* end)
+    {
+        while (cursor < end && IsWhitespace(*cursor))
+        {
+            ++cursor;
+        }
+    }
+
+    // Expects the cursor just past the opening quote and leaves it just past the closing one
+    bool SkipStringBody(const char*& cursor, const char* end)
+    {
+        for (;;)
+        {
+            const auto* quote = static_cast<const char*>(std::memchr(cursor, '"', end - cursor));
+
+            if (!quote)
+            {
+                return false;
+            }
+
+            // Escaped if preceded by an odd number of backslashes
+            const char* backslash = quote;
+
+            while (backslash > cursor && backslash[-1] == '\\')
+            {
+                --backslash;
+            }
+
+            cursor = quote + 1;
+
+            if ((quote - backslash) % 2 == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    bool SkipScalar(const char*& cursor, const char* end)
+    {
+        const char* start = cursor;
+
+        while (cursor < end && *cursor != ',' && *cursor != '}' && *cursor != ']' && !IsWhitespace(*cursor))
+        {
+            ++cursor;
+        }
+
+        return cursor > start;
+    }
+
+    // Skips one value of any kind, counting brackets rather than parsing what is inside
+    bool SkipValue(const char*& cursor, const char* end)
+    {
+        if (cursor == end)
+        {
+            return false;
+        }
+
+        if (*cursor == '"')
+        {
+            ++cursor;
+            return SkipStringBody(cursor, end);
+        }
+
+        if (*cursor != '{' && *cursor != '[')
+        {
+            return SkipScalar(cursor, end);
+        }
+
+        size_t depth = 0;
+
+        while (cursor < end)
+        {
+            switch (*cursor++)
+            {
+            case '"':
+                if (!SkipStringBody(cursor, end))
+                {
+                    return false;
+                }
+                break;
+            case '{':
+            case '[':
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0)
+                {
+                    return true;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    // The direct backend: steps through the document a byte at a time
+    class ByteReader
+    {
+    public:
+        explicit ByteReader(std::string_view document) : cursor(document.data()), end(document.data() + document.size()) {}
+
+        // The next byte that isn't whitespace, or 0 at the end
+        char Peek()
+        {
+            SkipWhitespace(cursor, end);
+            return cursor < end ? *cursor : '\0';
+        }
+
+        // Past what Peek returned
+        void Advance()
+        {
+            ++cursor;
+        }
+
+        bool AtEnd()
+        {
+            SkipWhitespace(cursor, end);
+            return cursor == end;
+        }
+
+        // From an opening quote; `body` excludes the quotes and is still escaped
+        bool ReadString(std::string_view& body)
+        {
+            const char* start = ++cursor;
+
+            if (!SkipStringBody(cursor, end))
+            {
+                return false;
+            }
+
+            body = std::string_view(start, cursor - 1 - start);
+            return true;
+        }
+
+        // One value of any kind; `text` is all of it, as written
+        bool Skip(std::string_view& text)
+        {
+            SkipWhitespace(cursor, end);
+            const char* start = cursor;
+
+            if (!SkipValue(cursor, end))
+            {
+                return false;
+            }
+
+            text = std::string_view(start, cursor - start);
+            return true;
+        }
+
+    private:
+        const char* cursor;
+        const char* end;
+    };
+
+    // The indexed backend: steps from one structural character to the next. A value's end
+    // is found from where the next entry starts, and a container is skipped to its match.
+    class IndexReader
+    {
+    public:
+        IndexReader(std::string_view document, const StructuralIndex& index) : document(document), index(index) {}
+
+        char Peek() const
+        {
+            return entry < index.GetSize() ? document[index.GetPosition(entry)] : '\0';
+        }
+
+        void Advance()
+        {
+            ++entry;
+        }
+
+        bool AtEnd() const
+        {
+            return entry == index.GetSize();
+        }
+
+        bool ReadString(std::string_view& body)
+        {
+            // The index only holds quotes that open a string, so this one closes
+            const size_t start = index.GetPosition(entry) + 1;
+            body = document.substr(start, ValueEnd() - 1 - start);
+            ++entry;
+            return true;
+        }
+
+        bool Skip(std::string_view& text)
+        {
+            if (AtEnd())
+            {
+                return false;
+            }
+
+            const size_t start = index.GetPosition(entry);
+
+            switch (document[start])
+            {
+            case '{':
+            case '[':
+                entry = index.GetMatch(entry);
+                text = document.substr(start, index.GetPosition(entry) + 1 - start);
+                ++entry;
+                return true;
+            case '}':
+            case ']':
+            case ':':
+            case ',':
+                return false;
+            default:
+                text = document.substr(start, ValueEnd() - start);
+                ++entry;
+                return true;
+            }
+        }
+
+    private:
+        // Only whitespace can come between a string or scalar and the next entry
+        size_t ValueEnd() const
+        {
+            size_t stop = entry + 1 < index.GetSize() ? index.GetPosition(entry + 1) : document.size();
+
+            while (IsWhitespace(document[stop - 1]))
+            {
+                --stop;
+            }
+
+            return stop;
+        }
+
+        const std::string_view document;
+        const StructuralIndex& index;
+        size_t entry = 0;
+    };
+
+    bool ParseHex(const char* digits, uint32_t& value)
+    {
+        const auto result = std::from_chars(digits, digits + 4, value, 16);
+        return result.ec == std::errc{} && result.ptr == digits + 4;
+    }
+
+    // Returns the end of what was written
+    char* WriteUtf8(char* out, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            *out++ = static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            *out++ = static_cast<char>(0xC0 | (codePoint >> 6));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            *out++ = static_cast<char>(0xE0 | (codePoint >> 12));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xF0 | (codePoint >> 18));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            *out++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+
+        return out;
+    }
+
+    // True if every byte is printable ASCII other than a backslash, as most titles are, so
+    // there is nothing to unescape or validate. Looks at eight bytes at a time.
+    bool IsPlainAscii(const char* bytes, size_t size)
+    {
+        constexpr uint64_t ONES = 0x0101010101010101ULL;
+        constexpr uint64_t HIGH = 0x8080808080808080ULL;
+
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+
+            // High bits of the bytes that are 0x80 or more, below 0x20, or a backslash
+            const uint64_t backslash = word ^ (ONES * '\\');
+            const uint64_t special = word | ((word - ONES * 0x20) & ~word) | ((backslash - ONES) & ~backslash);
+
+            if (special & HIGH)
+            {
+                return false;
+            }
+        }
+
+        for (; i < size; ++i)
+        {
+            const auto byte = static_cast<unsigned char>(bytes[i]);
+
+            if (byte < 0x20 || byte >= 0x80 || byte == '\\')
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // The length of the well-formed UTF-8 sequence that starts with a byte of 0x80 or more,
+    // or 0 if there isn't one
+    size_t Utf8SequenceLength(const char* cursor, const char* end)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(cursor);
+        size_t length;
+
+        if (bytes[0] >= 0xC2 && bytes[0] <= 0xDF)
+        {
+            length = 2;
+        }
+        else if (bytes[0] >= 0xE0 && bytes[0] <= 0xEF)
+        {
+            length = 3;
+        }
+        else if (bytes[0] >= 0xF0 && bytes[0] <= 0xF4)
+        {
+            length = 4;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (static_cast<size_t>(end - cursor) < length)
+        {
+            return 0;
+        }
+
+        for (size_t i = 1; i < length; ++i)
+        {
+            if ((bytes[i] & 0xC0) != 0x80)
+            {
+                return 0;
+            }
+        }
+
+        // Overlong forms, surrogates and code points past U+10FFFF
+        if ((bytes[0] == 0xE0 && bytes[1] < 0xA0) || (bytes[0] == 0xED && bytes[1] >= 0xA0) ||
+            (bytes[0] == 0xF0 && bytes[1] < 0x90) || (bytes[0] == 0xF4 && bytes[1] >= 0x90))
+        {
+            return 0;
+        }
+
+        return length;
+    }
+
+    bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // TMDB's ratings and popularities are short decimals like 7.125. Up to 15 digits are an
+    // integer a double holds exactly, as is a power of ten up to 1e22, so one division
+    // rounds correctly. Anything else, exponents included, is left to from_chars.
+    bool ParseShortDecimal(std::string_view text, double& out)
+    {
+        constexpr double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+        const char* cursor = text.data();
+        const char* end = text.data() + text.size();
+        const bool negative = cursor < end && *cursor == '-';
+
+        if (negative)
+        {
+            ++cursor;
+        }
+
+        if (cursor == end || !IsDigit(*cursor))
+        {
+            return false;
+        }
+
+        uint64_t mantissa = 0;
+        size_t digits = 0;
+        size_t decimals = 0;
+
+        for (; cursor < end && IsDigit(*cursor); ++cursor, ++digits)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*cursor - '0');
+        }
+
+        if (cursor < end && *cursor == '.')
+        {
+            const char* point = cursor++;
+
+            for (; cursor < end && IsDigit(*cursor); ++cursor, ++digits)
+            {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*cursor - '0');
+            }
+
+            decimals = static_cast<size_t>(cursor - point - 1);
+
+            if (decimals == 0)
+            {
+                return false;
+            }
+        }
+
+        if (cursor != end || digits > 15)
+        {
+            return false;
+        }
+
+        const double value = static_cast<double>(mantissa) / POWERS_OF_TEN[decimals];
+        out = negative ? -value : value;
+        return true;
+    }
+}
+
+bool JsonProjection::Value::GetString(std::string& out) const
+{
+    if (kind != Kind::String)
+    {
+        return false;
+    }
+
+    if (IsPlainAscii(text.data(), text.size()))
+    {
+        out.assign(text);
+        return true;
+    }
+
+    // Unescaping never lengthens a string, so it is written in place into room for all of
+    // it and cut to size at the end. Other bytes are copied once their UTF-8 is checked.
+    out.resize(text.size());
+
+    const char* cursor = text.data();
+    const char* end = text.data() + text.size();
+    char* write = out.data();
+
+    while (cursor < end)
+    {
+        const auto byte = static_cast<unsigned char>(*cursor);
+
+        if (byte >= 0x80)
+        {
+            const size_t length = Utf8SequenceLength(cursor, end);
+
+            if (length == 0)
+            {
+                return false;
+            }
+
+            std::memcpy(write, cursor, length);
+            write += length;
+            cursor += length;
+            continue;
+        }
+
+        if (byte < 0x20)
+        {
+            return false;
+        }
+
+        if (byte != '\\')
+        {
+            *write++ = *cursor++;
+            continue;
+        }
+
+        if (++cursor == end)
+        {
+            return false;
+        }
+
+        switch (*cursor++)
+        {
+        case '"': *write++ = '"'; break;
+        case '\\': *write++ = '\\'; break;
+        case '/': *write++ = '/'; break;
+        case 'b': *write++ = '\b'; break;
+        case 'f': *write++ = '\f'; break;
+        case 'n': *write++ = '\n'; break;
+        case 'r': *write++ = '\r'; break;
+        case 't': *write++ = '\t'; break;
+        case 'u':
+        {
+            uint32_t codePoint;
+
+            if (end - cursor < 4 || !ParseHex(cursor, codePoint))
+            {
+                return false;
+            }
+
+            cursor += 4;
+
+            // Characters outside the BMP come as a surrogate pair
+            if (codePoint >= 0xD800 && codePoint < 0xDC00)
+            {
+                uint32_t low;
+
+                if (end - cursor < 6 || cursor[0] != '\\' || cursor[1] != 'u' || !ParseHex(cursor + 2, low) || low < 0xDC00 || low >= 0xE000)
+                {
+                    return false;
+                }
+
+                cursor += 6;
+                codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+            else if (codePoint >= 0xDC00 && codePoint < 0xE000)
+            {
+                return false;
+            }
+
+            write = WriteUtf8(write, codePoint);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    out.resize(static_cast<size_t>(write - out.data()));
+    return true;
+}
+
+bool JsonProjection::Value::GetNumber(double& out) const
+{
+    if (kind != Kind::Number)
+    {
+        return false;
+    }
+
+    if (ParseShortDecimal(text, out))
+    {
+        return true;
+    }
+
+    const auto result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc{} && result.ptr == text.data() + text.size();
+}
+
+bool JsonProjection::Value::GetNumber(uint64_t& out) const
+{
+    if (kind != Kind::Number)
+    {
+        return false;
+    }
+
+    const auto result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc{} && result.ptr == text.data() + text.size();
+}
+
+JsonProjection::JsonProjection(const std::vector<std::string>& paths) : nodes(1)
+{
+    for (size_t field = 0; field < paths.size(); ++field)
+    {
+        const std::string_view path = paths[field];
+        size_t node = 0;
+        size_t position = 0;
+
+        while (position < path.size())
+        {
+            if (path.compare(position, 3, "[*]") == 0)
+            {
+                node = ElementChild(node);
+                position += 3;
+            }
+            else if (path[position] == '.')
+            {
+                ++position;
+            }
+            else
+            {
+                const size_t stop = std::min(path.find_first_of(".[", position), path.size());
+                node = KeyChild(node, path.substr(position, stop - position));
+                position = stop;
+            }
+        }
+
+        nodes[node].field = field;
+    }
+}
+
+size_t JsonProjection::KeyChild(size_t node, std::string_view key)
+{
+    for (const auto& [name, child] : nodes[node].keys)
+    {
+        if (name == key)
+        {
+            return child;
+        }
+    }
+
+    // Not a reference: adding a node may move the others
+    const size_t child = nodes.size();
+    nodes.emplace_back();
+    nodes[node].keys.emplace_back(key, child);
+    return child;
+}
+
+size_t JsonProjection::ElementChild(size_t node)
+{
+    if (nodes[node].elements == NONE)
+    {
+        nodes[node].elements = nodes.size();
+        nodes.emplace_back();
+    }
+
+    return nodes[node].elements;
+}
+
+bool JsonProjection::Scan(std::string_view document, Visitor& visitor, Backend backend) const
+{
+    if (backend == Backend::Direct)
+    {
+        ByteReader reader(document);
+        return ScanValue(0, reader, visitor) && reader.AtEnd();
+    }
+
+    // One per thread and kept, so its storage is only grown, never reallocated per document
+    thread_local StructuralIndex index;
+
+    if (!index.Build(document))
+    {
+        return false;
+    }
+
+    IndexReader reader(document, index);
+    return ScanValue(0, reader, visitor) && reader.AtEnd();
+}
+
+template <typename Reader>
+bool JsonProjection::ScanValue(size_t index, Reader& reader, Visitor& visitor) const
+{
+    std::string_view text;
+
+    if (index == NONE)
+    {
+        return reader.Skip(text);
+    }
+
+    const Node& node = nodes[index];
+    const char first = reader.Peek();
+
+    if (first == '{' && !node.keys.empty())
+    {
+        if (node.field != NONE)
+        {
+            visitor.OnEnter(node.field);
+        }
+
+        if (!ScanObject(node, reader, visitor))
+        {
+            return false;
+        }
+    }
+    else if (first == '[' && node.elements != NONE)
+    {
+        if (node.field != NONE)
+        {
+            visitor.OnEnter(node.field);
+        }
+
+        if (!ScanArray(node, reader, visitor))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // Wanted as a whole, or of a different shape than the paths expect
+        if (!reader.Skip(text))
+        {
+            return false;
+        }
+
+        if (node.field == NONE)
+        {
+            return true;
+        }
+
+        Value value;
+        value.text = text;
+
+        switch (first)
+        {
+        case '"':
+            value.kind = Kind::String;
+            value.text = value.text.substr(1, value.text.size() - 2);
+            break;
+        case '{': value.kind = Kind::Object; break;
+        case '[': value.kind = Kind::Array; break;
+        case 't': value.kind = Kind::True; break;
+        case 'f': value.kind = Kind::False; break;
+        case 'n': value.kind = Kind::Null; break;
+        default: value.kind = Kind::Number; break;
+        }
+
+        visitor.OnValue(node.field, value);
+        return true;
+    }
+
+    if (node.field != NONE)
+    {
+        visitor.OnLeave(node.field);
+    }
+
+    return true;
+}
+
+template <typename Reader>
+bool JsonProjection::ScanObject(const Node& node, Reader& reader, Visitor& visitor) const
+{
+    reader.Advance();
+
+    if (reader.Peek() == '}')
+    {
+        reader.Advance();
+        return true;
+    }
+
+    for (;;)
+    {
+        std::string_view key;
+
+        if (reader.Peek() != '"' || !reader.ReadString(key) || reader.Peek() != ':')
+        {
+            return false;
+        }
+
+        reader.Advance();
+
+        size_t child = NONE;
+
+        for (const auto& [name, index] : node.keys)
+        {
+            if (name == key)
+            {
+                child = index;
+                break;
+            }
+        }
+
+        if (!ScanValue(child, reader, visitor))
+        {
+            return false;
+        }
+
+        const char next = reader.Peek();
+
+        if (next == ',')
+        {
+            reader.Advance();
+            continue;
+        }
+
+        if (next != '}')
+        {
+            return false;
+        }
+
+        reader.Advance();
+        return true;
+    }
+}
+
+template <typename Reader>
+bool JsonProjection::ScanArray(const Node& node, Reader& reader, Visitor& visitor) const
+{
+    reader.Advance();
+
+    if (reader.Peek() == ']')
+    {
+        reader.Advance();
+        return true;
+    }
+
+    for (;;)
+    {
+        if (!ScanValue(node.elements, reader, visitor))
+        {
+            return false;
+        }
+
+        const char next = reader.Peek();
+
+        if (next == ',')
+        {
+            reader.Advance();
+            continue;
+        }
+
+        if (next != ']')
+        {
+            return false;
+        }
+
+        reader.Advance();
+        return true;
+    }
+}
+
+bool JsonArrayStream::Feed(std::string_view piece, const Element& element)
+{
+    if (failed)
+    {
+        return false;
+    }
+
+    const char* data = piece.data();
+    size_t copied = 0;          // Up to here is in the outline, unless in an element
+    size_t start = 0;           // Where the element being read starts in this piece
+
+    for (size_t i = 0; i < piece.size(); ++i)
+    {
+        const char c = data[i];
+
+        if (inString)
+        {
+            if (escaped)
+            {
+                escaped = false;
+            }
+            else if (c == '\\')
+            {
+                escaped = true;
+            }
+            else if (c == '"')
+            {
+                inString = false;
+                readingName = false;
+                continue;
+            }
+
+            if (readingName && name.size() <= key.size())
+            {
+                name += c;
+            }
+
+            continue;
+        }
+
+        if (wanted && !IsWhitespace(c))
+        {
+            wanted = false;
+
+            if (c == '[')
+            {
+                inArray = true;
+                ++depth;
+                continue;
+            }
+        }
+
+        if (inArray && depth == 2 && !inElement)
+        {
+            if (IsWhitespace(c) || c == ',')
+            {
+                continue;
+            }
+
+            if (c == ']')
+            {
+                inArray = false;
+                --depth;
+                continue;
+            }
+
+            outline.append(data + copied, i - copied);
+            outline += '0';
+            inElement = true;
+            start = i;
+        }
+
+        // A comma or the closing bracket ends an element, before it counts as anything else
+        if (inElement && depth == 2 && (c == ',' || c == ']' || c == '}'))
+        {
+            std::string_view text(data + start, i - start);
+
+            if (!partial.empty())
+            {
+                partial.append(text);
+                text = partial;
+            }
+
+            inElement = false;
+            copied = i;
+
+            if (c == '}' || !element(text))
+            {
+                failed = true;
+                return false;
+            }
+
+            partial.clear();
+        }
+
+        switch (c)
+        {
+        case '"':
+            inString = true;
+
+            if (depth == 1 && expectingName)
+            {
+                expectingName = false;
+                readingName = true;
+                name.clear();
+            }
+            break;
+        case '{':
+        case '[':
+            if (depth++ == 0 && c == '{')
+            {
+                inObject = true;
+                expectingName = true;
+            }
+            break;
+        case '}':
+        case ']':
+            if (depth == 0)
+            {
+                failed = true;
+                return false;
+            }
+
+            if (--depth == 1 && inArray)
+            {
+                inArray = false;
+            }
+            break;
+        case ',':
+            expectingName = depth == 1 && inObject;
+            break;
+        case ':':
+            wanted = depth == 1 && inObject && name == key;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (inElement)
+    {
+        partial.append(data + start, piece.size() - start);
+    }
+    else
+    {
+        outline.append(data + copied, piece.size() - copied);
+    }
+
+    return true;
+}
+
+void JsonArrayStream::Reset()
+{
+    outline.clear();
+    partial.clear();
+    name.clear();
+    depth = 0;
+    inString = false;
+    escaped = false;
+    inObject = false;
+    expectingName = false;
+    readingName = false;
+    wanted = false;
+    inArray = false;
+    inElement = false;
+    failed = false;
+}
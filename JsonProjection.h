@@ -0,0 +1,147 @@
+﻿#ifndef JSON_PROJECTION_H
+#define JSON_PROJECTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Pulls a few fields out of a JSON document without parsing the rest. The wanted paths are
+// compiled once into a trie. A scan descends only into values on a wanted path and skips
+// everything else by matching quotes and brackets, so an unwanted value costs a byte scan
+// rather than a parse, and no string is unescaped unless it was asked for.
+//
+// Skipped values are only checked for terminated strings and balanced brackets. That is
+// enough to reject a truncated document, but not every malformed one.
+class JsonProjection
+{
+public:
+    enum class Kind
+    {
+        String,
+        Number,
+        True,
+        False,
+        Null,
+        Object,
+        Array
+    };
+
+    // A matched value as it appears in the document. A string's text excludes the quotes
+    // and is still escaped; an object's or array's text is the whole of it, raw.
+    struct Value
+    {
+        Kind kind = Kind::Null;
+        std::string_view text;
+
+        // Unescaped. Fails, as a full parser would, on malformed UTF-8 or a raw control
+        // character.
+        [[nodiscard]] bool GetString(std::string& out) const;
+        [[nodiscard]] bool GetNumber(double& out) const;
+        [[nodiscard]] bool GetNumber(uint64_t& out) const;
+    };
+
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() = default;
+
+        // `field` is the path's index in the list the projection was built from
+        virtual void OnValue(size_t field, const Value& value) = 0;
+
+        // Bracket an object or array on a wanted path that also has wanted paths inside it
+        virtual void OnEnter(size_t) {}
+        virtual void OnLeave(size_t) {}
+    };
+
+    // Both come out about even on TMDB's documents. Direct skips long strings with memchr;
+    // Indexed spends most of its time building the index, the part that vectorises, and
+    // then skips a nested container in one step.
+    enum class Backend
+    {
+        Direct,     // Walks the bytes
+        Indexed     // Builds a StructuralIndex first, then walks that
+    };
+
+    // A path is keys joined by dots, with [*] standing for every element of an array, as in
+    // "results[*].title". Keys are compared with the document's as written, escapes and all.
+    explicit JsonProjection(const std::vector<std::string>& paths);
+
+    // Returns false if the document is malformed. Values found before the fault may already
+    // have been reported. Both backends report the same values for a well-formed document.
+    bool Scan(std::string_view document, Visitor& visitor, Backend backend = Backend::Direct) const;
+
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    struct Node
+    {
+        std::vector<std::pair<std::string, size_t>> keys;
+        size_t elements = NONE;     // The child for [*]
+        size_t field = NONE;
+    };
+
+    size_t KeyChild(size_t node, std::string_view key);
+    size_t ElementChild(size_t node);
+
+    // Reader is one of the two backends, see JsonProjection.cpp
+    template <typename Reader>
+    bool ScanValue(size_t node, Reader& reader, Visitor& visitor) const;
+
+    template <typename Reader>
+    bool ScanObject(const Node& node, Reader& reader, Visitor& visitor) const;
+
+    template <typename Reader>
+    bool ScanArray(const Node& node, Reader& reader, Visitor& visitor) const;
+
+    std::vector<Node> nodes;
+};
+
+// Picks the elements of one array out of a document that arrives in pieces, so that each
+// can be scanned as soon as it is complete instead of once the whole document is in. The
+// array is the one "key[*]" would find: the value of `key` in the top-level object.
+//
+// Only an element still arriving is kept. The rest of the document is kept as an outline,
+// each element replaced by 0, to be scanned once it has all arrived: the document is
+// well-formed when the outline and every element are.
+class JsonArrayStream
+{
+public:
+    // Returns false to give up on the document
+    using Element = std::function<bool(std::string_view element)>;
+
+    explicit JsonArrayStream(std::string key) : key(std::move(key)) {}
+
+    // Calls `element` with each element `piece` completes. Returns false once the document
+    // is known to be malformed, or `element` has given up on it.
+    bool Feed(std::string_view piece, const Element& element);
+
+    // The document so far without its elements
+    [[nodiscard]] std::string_view GetOutline() const { return outline; }
+
+    // Starts over on a new document
+    void Reset();
+
+private:
+    const std::string key;
+
+    std::string outline;
+    std::string partial;        // An element that started in an earlier piece
+    std::string name;           // The top-level key being read, cut off once too long to match
+
+    size_t depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    bool inObject = false;      // The top-level value is an object
+    bool expectingName = false; // The next string in the top-level object is a key
+    bool readingName = false;
+    bool wanted = false;        // Past the colon after `key`
+    bool inArray = false;
+    bool inElement = false;
+    bool failed = false;
+};
+
+#endif
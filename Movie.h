@@ -1,18 +1,48 @@
 ﻿#ifndef MOVIE_H
 #define MOVIE_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <utility>
+
+class MovieRef;
 
 class Movie
 {
 public:
     Movie() = default;
     explicit Movie(const char* str, float rating = 0) : title(str), rating(rating){};
+    explicit Movie(std::string str, float rating = 0, uint64_t id = 0) : title(std::move(str)), rating(rating), id(id){};
+    explicit Movie(const MovieRef& movie);
     const std::string & GetTitle() const { return title; }
     float GetRating() const { return rating; }
+    uint64_t GetId() const { return id; }
 
 private:
     std::string title;
     float rating = 0;
+    uint64_t id = 0;            // TMDB's id; 0 when unknown
 };
+
+// A movie as a MovieView reads it, whether from a Movie or in place from a mapped catalog.
+// The title is only borrowed, so a MovieRef is good for as long as the view it came from.
+class MovieRef
+{
+public:
+    MovieRef() = default;
+    MovieRef(const Movie& movie) : title(movie.GetTitle()), rating(movie.GetRating()), id(movie.GetId()) {}
+    MovieRef(std::string_view title, float rating, uint64_t id) : title(title), rating(rating), id(id) {}
+    std::string_view GetTitle() const { return title; }
+    float GetRating() const { return rating; }
+    uint64_t GetId() const { return id; }
+
+private:
+    std::string_view title;
+    float rating = 0;
+    uint64_t id = 0;
+};
+
+inline Movie::Movie(const MovieRef& movie) : title(movie.GetTitle()), rating(movie.GetRating()), id(movie.GetId()) {}
+
 #endif
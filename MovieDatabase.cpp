@@ -1,13 +1,432 @@
 ﻿#include "MovieDatabase.h"
 
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include "CatalogArchive.h"
+#include "CatalogArrow.h"
+#include "CatalogSnapshot.h"
+
+namespace
+{
+    enum ListPageField : size_t
+    {
+        RESULT,
+        ID,
+        TITLE,
+        VOTE_AVERAGE
+    };
+
+    // Only what a Movie keeps is looked at; the rest of each result is skipped unparsed
+    const JsonProjection& ListPageProjection()
+    {
+        static const JsonProjection projection({"results[*]", "results[*].id", "results[*].title", "results[*].vote_average"});
+        return projection;
+    }
+
+    // A details document is a single result: the fields are numbered as above, and RESULT
+    // brackets the whole document
+    const JsonProjection& DetailsProjection()
+    {
+        static const JsonProjection projection({"", "id", "title", "vote_average"});
+        return projection;
+    }
+
+    class ResultsVisitor : public JsonProjection::Visitor
+    {
+    public:
+        explicit ResultsVisitor(MovieList& movies) : movies(movies) {}
+
+        void OnEnter(size_t) override
+        {
+            id = 0;
+            rating = 0;
+            hasTitle = false;
+        }
+
+        void OnLeave(size_t field) override
+        {
+            // A result without a usable title is skipped rather than failing the page
+            if (field == RESULT && hasTitle)
+            {
+                movies.emplace_back(title, rating, id);
+            }
+        }
+
+        void OnValue(size_t field, const JsonProjection::Value& value) override
+        {
+            switch (field)
+            {
+            case ID:
+                if (!value.GetNumber(id))
+                {
+                    id = 0;
+                }
+                break;
+            case TITLE:
+                hasTitle = value.GetString(title);
+                break;
+            case VOTE_AVERAGE:
+            {
+                double number;
+                rating = value.GetNumber(number) ? static_cast<float>(number) : 0;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+    private:
+        MovieList& movies;
+
+        // Reused across results, so a title costs one allocation: the Movie's own copy
+        std::string title;
+        uint64_t id = 0;
+        float rating = 0;
+        bool hasTitle = false;
+    };
+
+    class IgnoringVisitor : public JsonProjection::Visitor
+    {
+    public:
+        void OnValue(size_t, const JsonProjection::Value&) override {}
+    };
+}
+
 void MovieDatabase::AddMovie(const std::string& title, float rating)
 {
-    movies.push_back(Movie{title.c_str(), rating});
+    AddMovie(Movie{title.c_str(), rating});
+}
+
+void MovieDatabase::AddMovie(std::string&& title, float rating)
+{
+    AddMovie(Movie{std::move(title), rating});
+}
+
+void MovieDatabase::AddMovie(Movie movie)
+{
+    ForgetOrders();
+    Append(std::move(movie));
+    IndexIds(size - 1);
+}
+
+void MovieDatabase::AddMovies(MovieList&& parsed)
+{
+    if (parsed.empty())
+    {
+        return;
+    }
+
+    ForgetOrders();
+
+    const size_t first = size;
+
+    for (Movie& movie : parsed)
+    {
+        Append(std::move(movie));
+    }
+
+    parsed.clear();
+    IndexIds(first);
+}
+
+void MovieDatabase::UpsertMovie(Movie movie)
+{
+    if (!ids.built)
+    {
+        ids.built = true;
+        IndexIds(0);
+    }
+
+    const auto found = movie.GetId() != 0 ? ids.positions.find(movie.GetId()) : ids.positions.end();
+
+    if (found == ids.positions.end())
+    {
+        AddMovie(std::move(movie));
+        return;
+    }
+
+    ForgetOrders();
+
+    const size_t position = found->second;
+    Writable(position / MovieBlock::CAPACITY).movies[position % MovieBlock::CAPACITY] = std::move(movie);
+}
+
+MovieView MovieDatabase::GetMovies() const
+{
+    return MovieView{MovieView::Blocks(blocks.begin(), blocks.end()), size};
+}
+
+void MovieDatabase::IndexIds(size_t first)
+{
+    if (!ids.built)
+    {
+        return;
+    }
+
+    // The first of several movies with the same id is the one an upsert replaces
+    for (size_t position = first; position < size; ++position)
+    {
+        const MovieRef movie = blocks[position / MovieBlock::CAPACITY]->Get(position % MovieBlock::CAPACITY);
+
+        if (movie.GetId() != 0)
+        {
+            ids.positions.emplace(movie.GetId(), position);
+        }
+    }
+}
+
+void MovieDatabase::Clear()
+{
+    ForgetOrders();
+    blocks.clear();
+    size = 0;
+    ids = IdIndex{};
+}
+
+void MovieDatabase::Append(Movie movie)
+{
+    if (size % MovieBlock::CAPACITY == 0)
+    {
+        blocks.push_back(std::make_shared<MovieBlock>());
+        blocks.back()->movies.reserve(MovieBlock::CAPACITY);
+    }
+
+    Writable(blocks.size() - 1).movies.push_back(std::move(movie));
+    ++size;
+}
+
+void MovieDatabase::Map(const MovieColumns& columns, size_t count, const std::shared_ptr<const void>& mapping)
+{
+    Clear();
+
+    for (size_t first = 0; first < count; first += MovieBlock::CAPACITY)
+    {
+        auto block = std::make_shared<MovieBlock>();
+        block->columns = columns;
+        block->columns.ids += first;
+        block->columns.ratings += first;
+        block->columns.titleOffsets += first;
+        block->mappedCount = std::min(MovieBlock::CAPACITY, count - first);
+        block->mapping = mapping;
+        blocks.push_back(std::move(block));
+    }
+
+    size = count;
+}
+
+MovieBlock& MovieDatabase::Writable(size_t block)
+{
+    std::shared_ptr<MovieBlock>& shared = blocks[block];
+
+    if (shared->IsMapped())
+    {
+        auto copy = std::make_shared<MovieBlock>();
+        copy->movies.reserve(MovieBlock::CAPACITY);
+
+        for (size_t slot = 0; slot < shared->GetSize(); ++slot)
+        {
+            copy->movies.emplace_back(shared->Get(slot));
+        }
+
+        shared = std::move(copy);
+    }
+    else if (shared.use_count() > 1)
+    {
+        auto copy = std::make_shared<MovieBlock>();
+        copy->movies.reserve(MovieBlock::CAPACITY);
+        copy->movies = shared->movies;
+        shared = std::move(copy);
+    }
+    else
+    {
+        // Pairs with the release of the last other reference, so whatever a view read of
+        // the block happens before it is written
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    return *shared;
+}
+
+bool MovieDatabase::AddMoviesFromJson(std::string_view page, JsonProjection::Backend backend)
+{
+    MovieList parsed;
+
+    if (!ParseMoviesFromJson(page, parsed, backend))
+    {
+        return false;
+    }
+
+    AddMovies(std::move(parsed));
+    return true;
+}
+
+bool MovieDatabase::ParseMoviesFromJson(std::string_view page, MovieList& movies, JsonProjection::Backend backend)
+{
+    // Scanned into a list of our own first so a bad page leaves `movies` as it was;
+    // splicing it in afterwards moves no movies.
+    MovieList parsed;
+    ResultsVisitor visitor(parsed);
+
+    if (!ListPageProjection().Scan(page, visitor, backend))
+    {
+        return false;
+    }
+
+    movies.splice(movies.end(), parsed);
+    return true;
+}
+
+MovieDatabase::PageParser::PageParser(JsonProjection::Backend backend) : backend(backend)
+{
+}
+
+bool MovieDatabase::PageParser::Feed(std::string_view piece)
+{
+    // A result is a details document of its own, so it is scanned as one
+    malformed = malformed || !results.Feed(piece, [this](std::string_view result)
+    {
+        ResultsVisitor visitor(parsed);
+        return DetailsProjection().Scan(result, visitor, backend);
+    });
+
+    return !malformed;
+}
+
+bool MovieDatabase::PageParser::Finish(MovieList& movies)
+{
+    // The rest of the page is checked as the whole page would be, with every result a 0
+    IgnoringVisitor ignored;
+
+    if (malformed || !ListPageProjection().Scan(results.GetOutline(), ignored, backend))
+    {
+        return false;
+    }
+
+    movies.splice(movies.end(), parsed);
+    return true;
+}
+
+void MovieDatabase::PageParser::Reset()
+{
+    results.Reset();
+    parsed.clear();
+    malformed = false;
+}
+
+bool MovieDatabase::ParseMovieFromJson(std::string_view details, Movie& movie, JsonProjection::Backend backend)
+{
+    MovieList parsed;
+    ResultsVisitor visitor(parsed);
+
+    if (!DetailsProjection().Scan(details, visitor, backend) || parsed.size() != 1)
+    {
+        return false;
+    }
+
+    movie = std::move(parsed.front());
+    return true;
+}
+
+bool MovieDatabase::SaveSnapshot(const std::string& path) const
+{
+    return CatalogSnapshot::Write(path, GetMovies());
+}
+
+bool MovieDatabase::LoadSnapshot(const std::string& path)
+{
+    auto snapshot = std::make_shared<CatalogSnapshot>();
+
+    if (!snapshot->Open(path))
+    {
+        return false;
+    }
+
+    ServeSnapshot(std::move(snapshot));
+    return true;
+}
+
+void MovieDatabase::ServeSnapshot(std::shared_ptr<const CatalogSnapshot> snapshot)
+{
+    Map(snapshot->GetColumns(), snapshot->GetSize(), snapshot);
+
+    // Read from the mapping too; positions past the end are caught by MovieView
+    titleOrder = {snapshot, snapshot->GetTitleOrder()};
+    ratingOrder = {snapshot, snapshot->GetRatingOrder()};
+}
+
+bool MovieDatabase::SaveArchive(const std::string& path) const
+{
+    return CatalogArchive::Write(path, GetMovies());
+}
+
+bool MovieDatabase::LoadArchive(const std::string& path)
+{
+    // Packed, so it has to be decoded; each movie is decoded straight into its block
+    CatalogArchive archive;
+    std::vector<std::shared_ptr<MovieBlock>> loaded;
+    auto byTitle = std::make_shared<std::vector<uint32_t>>();
+
+    if (!archive.Open(path))
+    {
+        return false;
+    }
+
+    if (!archive.Load(loaded, *byTitle))
+    {
+        std::cerr << "Corrupt catalog archive: " << path << std::endl;
+        return false;
+    }
+
+    Clear();
+    blocks = std::move(loaded);
+    size = archive.GetSize();
+
+    const uint32_t* positions = byTitle->data();
+    titleOrder = {std::move(byTitle), positions};
+    return true;
+}
+
+bool MovieDatabase::SaveArrow(const std::string& path) const
+{
+    return CatalogArrow::Write(path, GetMovies());
+}
+
+bool MovieDatabase::LoadArrow(const std::string& path)
+{
+    auto arrow = std::make_shared<CatalogArrow>();
+
+    if (!arrow->Open(path))
+    {
+        return false;
+    }
+
+    MovieColumns columns;
+
+    if (arrow->GetColumns(columns))
+    {
+        Map(columns, arrow->GetSize(), arrow);
+        return true;
+    }
+
+    // Laid out otherwise by another writer, so copied in
+    Clear();
+
+    for (size_t movie = 0; movie < arrow->GetSize(); ++movie)
+    {
+        Append(Movie{std::string{arrow->GetTitle(movie)}, arrow->GetRating(movie), arrow->GetId(movie)});
+    }
+
+    return true;
 }
 
 void MovieDatabase::PopulateWithFakeData()
 {
-    movies = {
+    Clear();
+    AddMovies({
         Movie{"The Shawshank Redemption", 9.3f},
         Movie{"The Godfather", 9.2f},
         Movie{"The Dark Knight", 9.4f},
@@ -18,5 +437,5 @@ void MovieDatabase::PopulateWithFakeData()
         Movie{"The Matrix", 9.0f},
         Movie{"Goodfellas", 9.1f},
         Movie{"The Lord of the Rings: The Return of the King", 9.3f},
-    };
+    });
 }
@@ -2,10 +2,20 @@
 #define MOVIE_DATABASE_H
 
 #include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "JsonProjection.h"
 #include "Movie.h"
+#include "MovieView.h"
+#include "ParallelSort.h"
 #include "json/single_include/nlohmann/json.hpp"
 
+class CatalogSnapshot;
+
 using MovieList = std::list<Movie>;
 
 class MovieDatabase
@@ -15,38 +25,164 @@ public:
 
     void PopulateWithFakeData();
 
-    const MovieList &GetMovies() const
+    // A point-in-time view, which stays as it is whatever is done to the database after.
+    // Taking one costs a pointer per MovieBlock::CAPACITY movies; see MovieView.
+    MovieView GetMovies() const;
+
+    [[nodiscard]] size_t GetSize() const
     {
-        return movies;
+        return size;
     }
 
-    MovieList GetMoviesSortedByTitle() const
+    // Views in title order, and by rating from the highest, ties in the order movies were
+    // added. An order loaded with the movies is read from where it lies; otherwise the
+    // movies are sorted for the view.
+    MovieView GetMoviesSortedByTitle() const
     {
-        auto sortedMovies = movies;
+        if (titleOrder.IsKnown())
+        {
+            return MovieView{MovieView::Blocks(blocks.begin(), blocks.end()), size, titleOrder};
+        }
 
-        sortedMovies.sort([](const Movie &a, const Movie &b) {
+        return Sorted([](const MovieRef& a, const MovieRef& b) {
             return a.GetTitle() < b.GetTitle();
         });
-
-        return sortedMovies;
     }
 
-    MovieList GetMoviesSortedByRating() const
+    MovieView GetMoviesSortedByRating() const
     {
-        auto sortedMovies = movies;
+        if (ratingOrder.IsKnown())
+        {
+            return MovieView{MovieView::Blocks(blocks.begin(), blocks.end()), size, ratingOrder};
+        }
 
-        sortedMovies.sort([](const Movie &a, const Movie &b) {
+        return Sorted([](const MovieRef& a, const MovieRef& b) {
             return a.GetRating() > b.GetRating();
         });
-
-        return sortedMovies;
     }
 
     void AddMovie(const std::string& title, float rating);
+    void AddMovie(std::string&& title, float rating);
+    void AddMovie(Movie movie);
+
+    // Replaces the movie with the same id, or adds it if there is none. A movie without an
+    // id is always added.
+    void UpsertMovie(Movie movie);
+
+    // Adds the movies in a TMDB list page's results. Only the fields a Movie keeps are
+    // parsed; see JsonProjection. Nothing is added if the page is malformed.
+    bool AddMoviesFromJson(std::string_view page, JsonProjection::Backend backend = JsonProjection::Backend::Direct);
+
+    // The parsing half of AddMoviesFromJson, which touches no database and so can run on
+    // any thread. Appends to `movies` only if the page is valid.
+    static bool ParseMoviesFromJson(std::string_view page, MovieList& movies, JsonProjection::Backend backend = JsonProjection::Backend::Direct);
+
+    // ParseMoviesFromJson for a page that arrives in pieces: each result is parsed as soon
+    // as it is complete, so only the result still arriving is held rather than the page.
+    class PageParser
+    {
+    public:
+        explicit PageParser(JsonProjection::Backend backend = JsonProjection::Backend::Direct);
+
+        // False once the page is known to be malformed
+        bool Feed(std::string_view piece);
+
+        // Once the page is all in. Appends to `movies` only if it is valid.
+        bool Finish(MovieList& movies);
+
+        // Starts over on another copy of the page
+        void Reset();
+
+    private:
+        JsonProjection::Backend backend;
+        JsonArrayStream results{"results"};
+        MovieList parsed;
+        bool malformed = false;
+    };
+
+    // Reads a TMDB movie details document, as GetMovieDetails returns, into `movie`, which
+    // is left alone if the document is malformed or has no title
+    static bool ParseMovieFromJson(std::string_view details, Movie& movie, JsonProjection::Backend backend = JsonProjection::Backend::Direct);
+
+    void AddMovies(MovieList&& parsed);
+
+    // See CatalogSnapshot. Loading maps the snapshot and replaces the database's movies with
+    // its columns, read in place, and its sort orders with the snapshot's until the next
+    // change. Nothing is copied until a change touches a block. A failed load leaves the
+    // database as it was.
+    bool SaveSnapshot(const std::string& path) const;
+    bool LoadSnapshot(const std::string& path);
+
+    // As LoadSnapshot, from a snapshot already open, such as a SharedCatalog generation
+    void ServeSnapshot(std::shared_ptr<const CatalogSnapshot> snapshot);
+
+    // See CatalogArchive: smaller than a snapshot, for keeping. Loading knows the title order
+    // without sorting, but not the rating order.
+    bool SaveArchive(const std::string& path) const;
+    bool LoadArchive(const std::string& path);
+
+    // See CatalogArrow: for analytics tools, which read it as any Arrow file. Loading takes
+    // files they write too, and knows no sort order. Our own files are read in place, as
+    // snapshots are; others are copied in.
+    bool SaveArrow(const std::string& path) const;
+    bool LoadArrow(const std::string& path);
 
 private:
+    // Every movie by `less`, ties in the order they were added. The sort runs on the shared
+    // TaskScheduler, over positions rather than the movies themselves.
+    template <typename Less>
+    MovieView Sorted(Less less) const
+    {
+        MovieView movies = GetMovies();
+        auto positions = std::make_shared<std::vector<uint32_t>>(size);
+
+        for (size_t position = 0; position < size; ++position)
+        {
+            (*positions)[position] = static_cast<uint32_t>(position);
+        }
+
+        ParallelSort::StableSort(positions->begin(), positions->end(), [&movies, &less](uint32_t a, uint32_t b) {
+            return less(movies[a], movies[b]);
+        });
+
+        const uint32_t* order = positions->data();
+        return MovieView{MovieView::Blocks(blocks.begin(), blocks.end()), size, {std::move(positions), order}};
+    }
+
+    void Clear();
+    void Append(Movie movie);
+
+    // Replaces the movies with `count` read in place from `columns`, which `mapping` keeps
+    void Map(const MovieColumns& columns, size_t count, const std::shared_ptr<const void>& mapping);
+
+    // The block, copied first if a view or a copy of the database also has it, or if it is
+    // still read from a mapping
+    MovieBlock& Writable(size_t block);
+
+    void ForgetOrders()
+    {
+        titleOrder = {};
+        ratingOrder = {};
+    }
+
+    // The position of each id, built by the first upsert and kept up to date from then on
+    struct IdIndex
+    {
+        std::unordered_map<uint64_t, size_t> positions;
+        bool built = false;
+    };
+
+    void IndexIds(size_t first);
+
+    // Shared with views and copies until written; see MovieView
+    std::vector<std::shared_ptr<MovieBlock>> blocks;
+    size_t size = 0;
+
+    // Positions in each sort order, when known without sorting
+    MovieView::Order titleOrder;
+    MovieView::Order ratingOrder;
 
-    MovieList movies;
+    IdIndex ids;
 };
 
 #endif
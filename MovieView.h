@@ -0,0 +1,162 @@
+﻿#ifndef MOVIE_VIEW_H
+#define MOVIE_VIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Movie.h"
+
+// Movies laid out a column each in a mapped file, as CatalogSnapshot and CatalogArrow keep
+// them, read where they lie
+struct MovieColumns
+{
+    const uint64_t* ids = nullptr;
+    const float* ratings = nullptr;
+    const uint64_t* titleOffsets = nullptr;     // One more than there are movies, into `titles`
+    const char* titles = nullptr;
+    uint64_t titleBytes = 0;
+};
+
+// Where a MovieDatabase keeps its movies: fixed-size blocks, all full but the last, that the
+// database shares with every view taken of it. A block loaded from a mapped catalog reads
+// its movies from the mapping instead, until the database first writes it.
+struct MovieBlock
+{
+    static constexpr size_t CAPACITY = 1024;
+
+    std::vector<Movie> movies;
+
+    // Set for a mapped block, whose columns start at its first movie; `mapping` keeps them
+    // mapped for as long as the block is around
+    MovieColumns columns;
+    size_t mappedCount = 0;
+    std::shared_ptr<const void> mapping;
+
+    [[nodiscard]] bool IsMapped() const { return mapping != nullptr; }
+
+    [[nodiscard]] size_t GetSize() const
+    {
+        return IsMapped() ? mappedCount : movies.size();
+    }
+
+    // A mapped title whose offsets are out of bounds reads as empty, as a mapped catalog's
+    // columns are only checked against its header
+    [[nodiscard]] MovieRef Get(size_t slot) const
+    {
+        if (!IsMapped())
+        {
+            return movies[slot];
+        }
+
+        const uint64_t begin = columns.titleOffsets[slot];
+        const uint64_t end = columns.titleOffsets[slot + 1];
+        const std::string_view title = begin <= end && end <= columns.titleBytes
+            ? std::string_view(columns.titles + begin, static_cast<size_t>(end - begin))
+            : std::string_view();
+
+        return {title, columns.ratings[slot], columns.ids[slot]};
+    }
+};
+
+// The movies of a MovieDatabase as they were when the view was taken. Taking one copies the
+// block pointers and no movies. The database copies a block before changing it while a view
+// still has it, so a view never sees a later change, and can be read on another thread
+// while the database goes on being written.
+//
+// A view may also have an order, the position of each movie to read in turn, as the
+// database's sorted views do. A position past the end reads as an empty movie, as orders
+// mapped from a catalog are only checked against its header.
+class MovieView
+{
+public:
+    using Blocks = std::vector<std::shared_ptr<const MovieBlock>>;
+
+    // `owner` keeps `positions` alive; both are null for catalog order
+    struct Order
+    {
+        std::shared_ptr<const void> owner;
+        const uint32_t* positions = nullptr;
+
+        [[nodiscard]] bool IsKnown() const { return positions != nullptr; }
+    };
+
+    // Movies are read as MovieRefs made on the fly, so this is an input iterator only
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = MovieRef;
+        using difference_type = std::ptrdiff_t;
+        using reference = MovieRef;
+
+        // Holds the MovieRef that -> reaches into
+        class pointer
+        {
+        public:
+            explicit pointer(MovieRef movie) : movie(movie) {}
+            const MovieRef* operator->() const { return &movie; }
+
+        private:
+            MovieRef movie;
+        };
+
+        Iterator() = default;
+        Iterator(const MovieView* view, size_t index) : view(view), index(index) {}
+
+        reference operator*() const { return (*view)[index]; }
+        pointer operator->() const { return pointer((*view)[index]); }
+
+        Iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const Iterator& other) const { return view == other.view && index == other.index; }
+        bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+    private:
+        const MovieView* view = nullptr;
+        size_t index = 0;
+    };
+
+    MovieView() = default;
+    MovieView(Blocks blocks, size_t count) : blocks(std::move(blocks)), count(count) {}
+    MovieView(Blocks blocks, size_t count, Order order) : blocks(std::move(blocks)), count(count), order(std::move(order)) {}
+
+    [[nodiscard]] Iterator begin() const { return {this, 0}; }
+    [[nodiscard]] Iterator end() const { return {this, count}; }
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+    // The movie `index`th in the view's order
+    [[nodiscard]] MovieRef operator[](size_t index) const
+    {
+        const size_t position = order.IsKnown() ? order.positions[index] : index;
+
+        if (position >= count)
+        {
+            return {};
+        }
+
+        return blocks[position / MovieBlock::CAPACITY]->Get(position % MovieBlock::CAPACITY);
+    }
+
+private:
+    Blocks blocks;
+    size_t count = 0;
+    Order order;
+};
+
+#endif
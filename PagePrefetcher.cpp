@@ -0,0 +1,353 @@
+﻿#include "PagePrefetcher.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr double SMOOTHING = 0.3;
+
+    double Seconds(PagePrefetcher::Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    void Smooth(double& average, double sample)
+    {
+        average = average == 0.0 ? sample : average + SMOOTHING * (sample - average);
+    }
+}
+
+PagePrefetcher::PagePrefetcher(const Settings& settings, Fetch fetch, Schedule schedule)
+    : settings(settings), fetch(std::move(fetch)), schedule(std::move(schedule))
+{
+}
+
+ResponseBuffer PagePrefetcher::GetPage(uint32_t page, const CancellationToken& cancellation)
+{
+    // Taking the lock means the wakeup can't fall between the reader's check and its wait
+    const auto registration = cancellation.OnCancel([this]
+    {
+        std::lock_guard lock(mutex);
+        fetched.notify_all();
+    });
+
+    ResponseBuffer body = Wait(page, cancellation);
+    cancellation.Unregister(registration);
+    return body;
+}
+
+ResponseBuffer PagePrefetcher::Wait(uint32_t page, const CancellationToken& cancellation)
+{
+    for (bool retried = false;; retried = true)
+    {
+        Actions actions;
+        uint64_t ticket;
+        bool guessedEarlier;
+
+        {
+            std::lock_guard lock(mutex);
+
+            if (!retried)
+            {
+                NoteConsumption(page, Clock::now(), actions);
+            }
+
+            auto it = pages.find(page);
+
+            if (it == pages.end())
+            {
+                Begin(page, false, actions);
+                it = pages.find(page);
+            }
+
+            // The reader owns the page from here on, so it no longer counts as a guess
+            Entry& entry = it->second;
+            guessedEarlier = entry.speculative && entry.ready;
+
+            if (entry.speculative && !entry.ready)
+            {
+                --speculativeInFlight;
+            }
+
+            entry.speculative = false;
+            ticket = entry.ticket;
+            Plan(actions);
+        }
+
+        Run(actions);
+
+        std::unique_lock lock(mutex);
+
+        const auto arrived = [this, page, ticket, &cancellation]
+        {
+            const auto it = pages.find(page);
+            return it == pages.end() || it->second.ticket != ticket || it->second.ready || cancellation.IsCancelled();
+        };
+
+        const auto deadline = cancellation.GetDeadline();
+
+        if (deadline == CancellationToken::Clock::time_point::max())
+        {
+            fetched.wait(lock, arrived);
+        }
+        else
+        {
+            fetched.wait_until(lock, deadline, arrived);
+        }
+
+        const auto it = pages.find(page);
+
+        if (it == pages.end() || it->second.ticket != ticket)
+        {
+            return {};
+        }
+
+        if (!it->second.ready)
+        {
+            // Called off, so the fetch the reader claimed goes too
+            Actions dropped;
+            Drop(it, dropped);
+            lock.unlock();
+            Run(dropped);
+            return {};
+        }
+
+        ResponseBuffer body = std::move(it->second.body);
+        bufferedBytes -= body.size();
+        pages.erase(it);
+
+        // A failed guess gets one proper attempt of its own; it may have failed long ago
+        if (body.empty() && guessedEarlier && !retried)
+        {
+            continue;
+        }
+
+        // Reading a page frees budget for the next one
+        Actions after;
+        Plan(after);
+        lock.unlock();
+        Run(after);
+
+        return body;
+    }
+}
+
+void PagePrefetcher::NoteConsumption(uint32_t page, Clock::time_point now, Actions& actions)
+{
+    if (settings.maxPagesAhead == 0)
+    {
+        return;
+    }
+
+    if (!idle && page == lastPage + 1)
+    {
+        Smooth(pageInterval, Seconds(now - lastConsumed));
+    }
+    else if (idle || page != lastPage)
+    {
+        // A jump or a fresh start: the old pace says nothing about this one
+        pageInterval = 0.0;
+    }
+
+    lastPage = page;
+    lastConsumed = now;
+    idle = false;
+
+    const uint64_t current = ++generation;
+    const auto delay = std::max(settings.idleTimeout, std::chrono::milliseconds{static_cast<int64_t>(pageInterval * 3000.0)});
+
+    actions.calls.push_back([this, delay, current]
+    {
+        schedule(delay, [this, current] { OnIdle(current); });
+    });
+}
+
+void PagePrefetcher::Plan(Actions& actions)
+{
+    if (idle || settings.maxPagesAhead == 0)
+    {
+        return;
+    }
+
+    // Guesses behind the reader, or beyond the window after a jump back, are dead weight.
+    // Pages someone asked for outright are left to their reader.
+    for (auto it = pages.begin(); it != pages.end();)
+    {
+        const auto next = std::next(it);
+
+        if (it->second.speculative && (it->first < lastPage || it->first - lastPage > settings.maxPagesAhead))
+        {
+            Drop(it, actions);
+        }
+
+        it = next;
+    }
+
+    // Enough pages ahead to cover one fetch at the current pace, plus one in hand
+    uint32_t ahead = 1;
+
+    if (pageInterval > 0.0)
+    {
+        ahead = static_cast<uint32_t>(std::min<double>(settings.maxPagesAhead, std::ceil(fetchLatency / pageInterval) + 1.0));
+    }
+
+    for (uint32_t page = lastPage + 1; page <= lastPage + std::min(ahead, settings.maxPagesAhead); ++page)
+    {
+        if (pages.count(page) > 0)
+        {
+            continue;
+        }
+
+        const double committed = static_cast<double>(bufferedBytes) + static_cast<double>(speculativeInFlight + 1) * pageBytes;
+
+        if (speculativeInFlight >= settings.maxConcurrentFetches || committed > static_cast<double>(settings.maxBufferedBytes))
+        {
+            break;
+        }
+
+        Begin(page, true, actions);
+    }
+}
+
+void PagePrefetcher::Begin(uint32_t page, bool speculative, Actions& actions)
+{
+    Entry& entry = pages[page];
+    entry.ticket = nextTicket++;
+    entry.speculative = speculative;
+    entry.started = Clock::now();
+
+    if (speculative)
+    {
+        ++speculativeInFlight;
+    }
+
+    actions.fetches.emplace_back(page, entry.ticket);
+}
+
+void PagePrefetcher::Drop(std::map<uint32_t, Entry>::iterator it, Actions& actions)
+{
+    Entry& entry = it->second;
+
+    if (entry.ready)
+    {
+        bufferedBytes -= entry.body.size();
+    }
+    else
+    {
+        if (entry.speculative)
+        {
+            --speculativeInFlight;
+        }
+
+        if (entry.cancel)
+        {
+            actions.calls.push_back(std::move(entry.cancel));
+        }
+    }
+
+    pages.erase(it);
+}
+
+void PagePrefetcher::Run(Actions& actions)
+{
+    for (auto& call : actions.calls)
+    {
+        call();
+    }
+
+    for (const auto& [page, ticket] : actions.fetches)
+    {
+        auto cancel = fetch(page, [this, page = page, ticket = ticket](ResponseBuffer body)
+        {
+            OnFetched(page, ticket, std::move(body));
+        });
+
+        std::unique_lock lock(mutex);
+        const auto it = pages.find(page);
+
+        if (it != pages.end() && it->second.ticket == ticket)
+        {
+            if (!it->second.ready)
+            {
+                it->second.cancel = std::move(cancel);
+            }
+        }
+        else if (cancel)
+        {
+            // Dropped before the fetch had even started
+            lock.unlock();
+            cancel();
+        }
+    }
+}
+
+void PagePrefetcher::OnFetched(uint32_t page, uint64_t ticket, ResponseBuffer body)
+{
+    Actions actions;
+
+    {
+        std::lock_guard lock(mutex);
+        const auto it = pages.find(page);
+
+        if (it == pages.end() || it->second.ticket != ticket || it->second.ready)
+        {
+            return;
+        }
+
+        Entry& entry = it->second;
+
+        if (entry.speculative)
+        {
+            --speculativeInFlight;
+        }
+
+        if (!body.empty())
+        {
+            Smooth(fetchLatency, Seconds(Clock::now() - entry.started));
+            Smooth(pageBytes, static_cast<double>(body.size()));
+        }
+
+        bufferedBytes += body.size();
+        entry.body = std::move(body);
+        entry.ready = true;
+        entry.cancel = nullptr;
+
+        Plan(actions);
+    }
+
+    fetched.notify_all();
+    Run(actions);
+}
+
+void PagePrefetcher::OnIdle(uint64_t idleGeneration)
+{
+    Actions actions;
+
+    {
+        std::lock_guard lock(mutex);
+
+        if (idleGeneration != generation)
+        {
+            return;
+        }
+
+        // Pages already here are kept for when the reader comes back; guesses still on
+        // the wire are not worth the bandwidth
+        idle = true;
+
+        for (auto it = pages.begin(); it != pages.end();)
+        {
+            const auto next = std::next(it);
+
+            if (it->second.speculative && !it->second.ready)
+            {
+                Drop(it, actions);
+            }
+
+            it = next;
+        }
+    }
+
+    Run(actions);
+}
@@ -0,0 +1,97 @@
+﻿#ifndef PAGE_PREFETCHER_H
+#define PAGE_PREFETCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "BufferPool.h"
+#include "CancellationToken.h"
+
+// Serves the pages of one paged list and fetches ahead of the reader. It watches how fast
+// pages are consumed and keeps enough requests in flight to cover the fetch latency at
+// that pace, within a concurrency limit and a byte budget for pages nobody has read yet.
+// Once the reader stops turning pages, speculative fetches still in flight are cancelled.
+class PagePrefetcher
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        uint32_t maxPagesAhead = 4;                     // 0 disables prefetching
+        size_t maxConcurrentFetches = 2;                // Speculative requests in flight at once
+        size_t maxBufferedBytes = 4 * 1024 * 1024;      // Prefetched but unread, counting those in flight
+        std::chrono::milliseconds idleTimeout{3000};    // Reader counts as gone after this, or 3 page intervals
+    };
+
+    // Starts fetching a page and returns a function that cancels the fetch. `done` gets
+    // an empty buffer if the fetch fails or is cancelled.
+    using Fetch = std::function<std::function<void()>(uint32_t page, std::function<void(ResponseBuffer body)> done)>;
+    using Schedule = std::function<void(std::chrono::milliseconds delay, std::function<void()> task)>;
+
+    // Callbacks handed to `fetch` and `schedule` point back at the prefetcher, so whatever
+    // runs them must stop before it is destroyed.
+    PagePrefetcher(const Settings& settings, Fetch fetch, Schedule schedule);
+
+    PagePrefetcher(const PagePrefetcher&) = delete;
+    PagePrefetcher& operator=(const PagePrefetcher&) = delete;
+
+    // Blocks until the page is available; returns an empty buffer if it couldn't be fetched.
+    // Cancelling, or reaching the token's deadline, gives up the wait and the fetch with it.
+    [[nodiscard]] ResponseBuffer GetPage(uint32_t page, const CancellationToken& cancellation = {});
+
+private:
+    struct Entry
+    {
+        uint64_t ticket = 0;
+        bool ready = false;
+        bool speculative = false;
+        Clock::time_point started;
+        ResponseBuffer body;
+        std::function<void()> cancel;
+    };
+
+    // Work decided under the lock and carried out after releasing it
+    struct Actions
+    {
+        std::vector<std::pair<uint32_t, uint64_t>> fetches;
+        std::vector<std::function<void()>> calls;
+    };
+
+    ResponseBuffer Wait(uint32_t page, const CancellationToken& cancellation);
+    void NoteConsumption(uint32_t page, Clock::time_point now, Actions& actions);
+    void Plan(Actions& actions);
+    void Begin(uint32_t page, bool speculative, Actions& actions);
+    void Drop(std::map<uint32_t, Entry>::iterator it, Actions& actions);
+    void Run(Actions& actions);
+    void OnFetched(uint32_t page, uint64_t ticket, ResponseBuffer body);
+    void OnIdle(uint64_t idleGeneration);
+
+    const Settings settings;
+    const Fetch fetch;
+    const Schedule schedule;
+
+    std::mutex mutex;
+    std::condition_variable fetched;
+    std::map<uint32_t, Entry> pages;
+    uint64_t nextTicket = 1;
+
+    // Reader model
+    uint32_t lastPage = 0;
+    Clock::time_point lastConsumed;
+    double pageInterval = 0.0;      // Seconds between sequential page turns (EWMA), 0 if unknown
+    double fetchLatency = 0.0;      // Seconds per fetch (EWMA)
+    double pageBytes = 0.0;         // Bytes per page (EWMA)
+    uint64_t generation = 0;
+    bool idle = true;
+
+    size_t speculativeInFlight = 0;
+    size_t bufferedBytes = 0;
+};
+
+#endif
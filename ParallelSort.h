@@ -0,0 +1,48 @@
+﻿#ifndef PARALLEL_SORT_H
+#define PARALLEL_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#include "TaskScheduler.h"
+
+// Stable sorting on a TaskScheduler. A range is split in halves, sorted as separate tasks
+// and merged back, down to pieces of GRAIN elements, which are sorted as they are. A range
+// no bigger than GRAIN is sorted on the calling thread alone, as splitting would cost more
+// than it saves.
+namespace ParallelSort
+{
+    constexpr size_t GRAIN = 16 * 1024;
+
+    template <typename Iterator, typename Less>
+    void StableSort(Iterator first, Iterator last, Less less, TaskScheduler& scheduler)
+    {
+        const auto size = static_cast<size_t>(std::distance(first, last));
+
+        if (size <= GRAIN)
+        {
+            std::stable_sort(first, last, less);
+            return;
+        }
+
+        const Iterator middle = first + size / 2;
+
+        {
+            TaskGroup group(scheduler);
+            group.Run([first, middle, less, &scheduler] { StableSort(first, middle, less, scheduler); });
+            StableSort(middle, last, less, scheduler);
+            group.Wait();
+        }
+
+        std::inplace_merge(first, middle, last, less);
+    }
+
+    template <typename Iterator, typename Less>
+    void StableSort(Iterator first, Iterator last, Less less)
+    {
+        StableSort(first, last, less, TaskScheduler::GetShared());
+    }
+}
+
+#endif
@@ -0,0 +1,100 @@
+﻿#include "RateLimiter.h"
+
+#include <algorithm>
+
+RateLimiter::RateLimiter(const Settings& settings)
+    : settings(settings),
+      rate(std::clamp(settings.initialRate, settings.minRate, settings.maxRate)),
+      tokens(settings.burst),
+      lastRefill(Clock::now())
+{
+}
+
+bool RateLimiter::TryAcquire(Clock::duration& wait, double count)
+{
+    std::lock_guard lock(mutex);
+    const auto now = Clock::now();
+
+    if (now < pausedUntil)
+    {
+        wait = pausedUntil - now;
+        return false;
+    }
+
+    Refill(now);
+
+    const double needed = std::min(count, settings.burst);
+
+    if (tokens >= needed)
+    {
+        tokens -= count;
+        return true;
+    }
+
+    const auto deficit = std::chrono::duration<double>((needed - tokens) / rate);
+    wait = std::chrono::duration_cast<Clock::duration>(deficit);
+    return false;
+}
+
+void RateLimiter::OnSuccess()
+{
+    std::lock_guard lock(mutex);
+
+    // One second of traffic at the current rate is `rate` requests, so this adds
+    // additiveIncrease per second regardless of how fast we are going.
+    rate = std::min(settings.maxRate, rate + settings.additiveIncrease / rate);
+}
+
+void RateLimiter::OnThrottled(std::chrono::milliseconds retryAfter)
+{
+    std::lock_guard lock(mutex);
+    const auto now = Clock::now();
+
+    Decrease(now);
+
+    if (retryAfter.count() > 0)
+    {
+        pausedUntil = std::max(pausedUntil, now + retryAfter);
+        tokens = 0.0;
+        lastRefill = pausedUntil;
+    }
+}
+
+void RateLimiter::OnServerError()
+{
+    std::lock_guard lock(mutex);
+    Decrease(Clock::now());
+}
+
+double RateLimiter::GetRate() const
+{
+    std::lock_guard lock(mutex);
+    return rate;
+}
+
+void RateLimiter::Refill(Clock::time_point now)
+{
+    if (now <= lastRefill)
+    {
+        return;
+    }
+
+    const std::chrono::duration<double> elapsed = now - lastRefill;
+    tokens = std::min(settings.burst, tokens + elapsed.count() * rate);
+    lastRefill = now;
+}
+
+void RateLimiter::Decrease(Clock::time_point now)
+{
+    // Requests already in flight when the upstream starts pushing back will all fail
+    // together; only the first of them should cut the rate, or we spiral down to minRate.
+    if (now - lastDecrease < settings.decreaseCooldown)
+    {
+        return;
+    }
+
+    Refill(now);
+    rate = std::max(settings.minRate, rate * settings.multiplicativeDecrease);
+    tokens = std::min(tokens, 1.0);
+    lastDecrease = now;
+}
@@ -0,0 +1,52 @@
+﻿#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <chrono>
+#include <mutex>
+
+// Token bucket whose refill rate adapts AIMD-style: it creeps up while the upstream
+// accepts requests and halves when it answers with 429 or 5xx.
+class RateLimiter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Settings
+    {
+        double initialRate = 20.0;          // Requests per second
+        double minRate = 1.0;
+        double maxRate = 50.0;
+        double burst = 10.0;                // Bucket capacity
+        double additiveIncrease = 1.0;      // Requests per second gained per second of clean traffic
+        double multiplicativeDecrease = 0.5;
+        std::chrono::milliseconds decreaseCooldown{1000};
+    };
+
+    RateLimiter() : RateLimiter(Settings{}) {}
+    explicit RateLimiter(const Settings& settings);
+
+    // Takes `count` tokens if they are available. Otherwise reports how long to wait before
+    // trying again, which covers any Retry-After pause still in force. A count above the
+    // burst size is granted once the bucket is full and leaves it in debt.
+    bool TryAcquire(Clock::duration& wait, double count = 1.0);
+
+    void OnSuccess();
+    void OnThrottled(std::chrono::milliseconds retryAfter);
+    void OnServerError();
+
+    [[nodiscard]] double GetRate() const;
+
+private:
+    void Refill(Clock::time_point now);
+    void Decrease(Clock::time_point now);
+
+    mutable std::mutex mutex;
+    Settings settings;
+    double rate;
+    double tokens;
+    Clock::time_point lastRefill;
+    Clock::time_point lastDecrease;
+    Clock::time_point pausedUntil;
+};
+
+#endif
@@ -0,0 +1,296 @@
+﻿#include "SharedCatalog.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // A worker that finds the generation it read already unlinked tries the next one
+    constexpr int ATTACH_ATTEMPTS = 8;
+
+#ifdef __linux__
+    bool WriteObject(const std::string& object, const MovieView& movies)
+    {
+        // Left behind by a loader that died while publishing it
+        ::shm_unlink(object.c_str());
+
+        // Read-only for everyone who opens it; this descriptor is the only way to write it
+        const int fd = ::shm_open(object.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+
+        if (fd < 0)
+        {
+            std::cerr << "Error creating shared catalog " << object << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        const bool written = CatalogSnapshot::Write(movies, [fd](const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                const ssize_t count = ::write(fd, data, size);
+
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (count <= 0)
+                {
+                    return false;
+                }
+
+                data += count;
+                size -= static_cast<size_t>(count);
+            }
+
+            return true;
+        });
+
+        ::close(fd);
+
+        if (!written)
+        {
+            std::cerr << "Error writing shared catalog " << object << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+#endif
+}
+
+SharedCatalog::SharedCatalog(std::string name, size_t catalogCount) : name(std::move(name)), catalogCount(catalogCount)
+{
+}
+
+SharedCatalog::~SharedCatalog()
+{
+    UnmapControl();
+}
+
+bool SharedCatalog::Publish(const std::vector<MovieView>& catalogs)
+{
+#ifdef __linux__
+    std::lock_guard lock(mutex);
+
+    if (catalogs.size() != catalogCount)
+    {
+        std::cerr << "Shared catalog " << name << " takes " << catalogCount << " catalogs, not " << catalogs.size() << std::endl;
+        return false;
+    }
+
+    if (!controlWritable && !MapControl(true))
+    {
+        return false;
+    }
+
+    const uint64_t previous = control->generation.load(std::memory_order_acquire);
+    const uint64_t next = previous + 1;
+
+    for (size_t index = 0; index < catalogCount; ++index)
+    {
+        if (!WriteObject(GetGenerationName(next, index), catalogs[index]))
+        {
+            UnlinkGeneration(next);
+            return false;
+        }
+    }
+
+    control->generation.store(next, std::memory_order_release);
+
+    // Workers that have it keep it; its memory is freed when the last of them lets go
+    if (previous != 0)
+    {
+        UnlinkGeneration(previous);
+    }
+
+    return true;
+#else
+    (void)catalogs;
+    std::cerr << "Shared catalogs are not supported here" << std::endl;
+    return false;
+#endif
+}
+
+void SharedCatalog::Unpublish()
+{
+#ifdef __linux__
+    std::lock_guard lock(mutex);
+
+    if (control)
+    {
+        UnlinkGeneration(control->generation.load(std::memory_order_acquire));
+    }
+
+    ::shm_unlink(GetControlName().c_str());
+#endif
+}
+
+bool SharedCatalog::Refresh()
+{
+#ifdef __linux__
+    std::lock_guard lock(mutex);
+
+    if (!control && !MapControl(false))
+    {
+        return false;
+    }
+
+    for (int attempt = 0; attempt < ATTACH_ATTEMPTS; ++attempt)
+    {
+        const uint64_t newest = control->generation.load(std::memory_order_acquire);
+
+        if (newest == 0 || newest == generation)
+        {
+            return newest != 0;
+        }
+
+        // All of the generation or none of it
+        std::vector<std::shared_ptr<const CatalogSnapshot>> mapped;
+        bool unlinked = false;
+        bool failed = false;
+
+        for (size_t index = 0; index < catalogCount && !unlinked && !failed; ++index)
+        {
+            const std::string object = GetGenerationName(newest, index);
+            const int fd = ::shm_open(object.c_str(), O_RDONLY | O_CLOEXEC, 0);
+
+            if (fd < 0)
+            {
+                unlinked = errno == ENOENT;
+                failed = !unlinked;
+
+                if (failed)
+                {
+                    std::cerr << "Error opening shared catalog " << object << ": " << std::strerror(errno) << std::endl;
+                }
+
+                continue;
+            }
+
+            auto snapshot = std::make_shared<CatalogSnapshot>();
+            failed = !snapshot->Open(fd, object);
+            ::close(fd);
+            mapped.push_back(std::move(snapshot));
+        }
+
+        if (unlinked)
+        {
+            continue;
+        }
+
+        if (failed)
+        {
+            break;
+        }
+
+        catalogs = std::move(mapped);
+        generation = newest;
+        return true;
+    }
+
+    return !catalogs.empty();
+#else
+    std::cerr << "Shared catalogs are not supported here" << std::endl;
+    return false;
+#endif
+}
+
+std::shared_ptr<const CatalogSnapshot> SharedCatalog::GetCatalog(size_t index) const
+{
+    std::lock_guard lock(mutex);
+    return index < catalogs.size() ? catalogs[index] : nullptr;
+}
+
+uint64_t SharedCatalog::GetGeneration() const
+{
+    std::lock_guard lock(mutex);
+    return generation;
+}
+
+bool SharedCatalog::MapControl(bool writable)
+{
+#ifdef __linux__
+    UnmapControl();
+
+    const std::string object = GetControlName();
+    const int fd = ::shm_open(object.c_str(), writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+        // A worker started before the loader finds nothing yet, which isn't an error
+        if (writable || errno != ENOENT)
+        {
+            std::cerr << "Error opening shared catalog " << object << ": " << std::strerror(errno) << std::endl;
+        }
+
+        return false;
+    }
+
+    struct stat status{};
+    bool sized = ::fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Control);
+
+    if (!sized && writable)
+    {
+        sized = ::ftruncate(fd, sizeof(Control)) == 0;
+    }
+
+    void* mapping = sized ? ::mmap(nullptr, sizeof(Control), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    control = static_cast<Control*>(mapping);
+    controlWritable = writable;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SharedCatalog::UnmapControl()
+{
+#ifdef __linux__
+    if (control)
+    {
+        ::munmap(control, sizeof(Control));
+    }
+#endif
+
+    control = nullptr;
+    controlWritable = false;
+}
+
+std::string SharedCatalog::GetControlName() const
+{
+    return "/" + name;
+}
+
+std::string SharedCatalog::GetGenerationName(uint64_t generation, size_t index) const
+{
+    return "/" + name + "." + std::to_string(generation) + "." + std::to_string(index);
+}
+
+void SharedCatalog::UnlinkGeneration(uint64_t generation) const
+{
+#ifdef __linux__
+    for (size_t index = 0; index < catalogCount; ++index)
+    {
+        ::shm_unlink(GetGenerationName(generation, index).c_str());
+    }
+#else
+    (void)generation;
+#endif
+}
@@ -0,0 +1,79 @@
+﻿#ifndef SHARED_CATALOG_H
+#define SHARED_CATALOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CatalogSnapshot.h"
+#include "MovieView.h"
+
+// Catalogs shared by every process on a host, published by a loader process and read by any
+// number of workers from the same pages. A generation is a fixed number of catalogs, each a
+// CatalogSnapshot, which holds offsets rather than pointers and so reads wherever it is
+// mapped, in a POSIX shared memory object of its own; a small control object names the
+// newest generation. Workers map generations read-only, so
+// attaching costs a header check whatever the catalog's size, and memory doesn't grow with
+// the number of workers.
+//
+// Publishing writes every catalog of the generation before switching the control object to
+// it, in one atomic store, and then unlinks the generation before. A worker therefore never
+// holds catalogs of two generations at once. A worker keeps the generation it
+// has until it refreshes, and callers still holding it keep it mapped after that, so a
+// switch never pulls a catalog out from under a query. There is meant to be one loader.
+class SharedCatalog
+{
+public:
+    // `name` becomes the shared memory object names, so it may not contain '/'. Loader and
+    // workers must agree on the number of catalogs in a generation.
+    explicit SharedCatalog(std::string name, size_t catalogCount = 1);
+    ~SharedCatalog();
+
+    SharedCatalog(const SharedCatalog&) = delete;
+    SharedCatalog& operator=(const SharedCatalog&) = delete;
+
+    // Loader side: makes `catalogs`, one per catalog in the generation, the next generation
+    bool Publish(const std::vector<MovieView>& catalogs);
+    bool Publish(const MovieView& movies) { return Publish(std::vector<MovieView>{movies}); }
+
+    // Removes the names, so no one attaches any more; what is mapped stays readable
+    void Unpublish();
+
+    // Worker side: maps the newest generation unless it is the one held. False if nothing
+    // has been published.
+    bool Refresh();
+
+    // A catalog of the generation the last Refresh mapped, or null
+    [[nodiscard]] std::shared_ptr<const CatalogSnapshot> GetCatalog(size_t index = 0) const;
+    [[nodiscard]] uint64_t GetGeneration() const;
+
+private:
+    // Zero-filled when created, which is a generation of 0: nothing published yet
+    struct Control
+    {
+        std::atomic<uint64_t> generation;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The control object is shared between processes");
+
+    bool MapControl(bool writable);
+    void UnmapControl();
+
+    [[nodiscard]] std::string GetControlName() const;
+    [[nodiscard]] std::string GetGenerationName(uint64_t generation, size_t index) const;
+    void UnlinkGeneration(uint64_t generation) const;
+
+    const std::string name;
+    const size_t catalogCount;
+
+    mutable std::mutex mutex;
+    Control* control = nullptr;
+    bool controlWritable = false;
+    std::vector<std::shared_ptr<const CatalogSnapshot>> catalogs;
+    uint64_t generation = 0;
+};
+
+#endif
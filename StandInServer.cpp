@@ -0,0 +1,771 @@
+﻿#include "StandInServer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <json/single_include/nlohmann/json.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "CalendarDate.h"
+#include "Checksum.h"
+#include "Fixture.h"
+
+using json = nlohmann::json;
+
+namespace
+{
+    constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+
+    const char* const ADJECTIVES[] = {
+        "Silent", "Crimson", "Last", "Hidden", "Broken", "Eternal", "Desperate", "Frozen",
+        "Golden", "Lost", "Midnight", "Savage", "Distant", "Electric", "Wild", "Deadly"
+    };
+
+    const char* const NOUNS[] = {
+        "Horizon", "Kingdom", "Destiny", "Empire", "River", "Signal", "Garden", "Protocol",
+        "Desert", "Echo", "Harbor", "Legacy", "Machine", "Orbit", "Shadow", "Voyage"
+    };
+
+    const int GENRE_IDS[] = {28, 12, 16, 35, 80, 99, 18, 10751, 14, 36, 27, 10402, 9648, 10749, 878, 53, 10752, 37};
+
+    const char* const LISTS[] = {"movie/popular", "movie/now_playing", "movie/top_rated", "movie/upcoming"};
+
+    // TMDB's limits on a change feed query
+    constexpr int64_t MAX_CHANGE_DAYS = 14;
+    constexpr uint64_t CHANGES_PER_PAGE = 100;
+
+    std::string_view QueryParameter(std::string_view request, std::string_view name)
+    {
+        const size_t queryStart = request.find('?');
+
+        if (queryStart == std::string_view::npos)
+        {
+            return {};
+        }
+
+        std::string_view query = request.substr(queryStart + 1);
+
+        while (!query.empty())
+        {
+            const size_t end = query.find('&');
+            const std::string_view parameter = query.substr(0, end);
+            query = end == std::string_view::npos ? std::string_view{} : query.substr(end + 1);
+
+            const size_t equals = parameter.find('=');
+
+            if (parameter.substr(0, equals) == name && equals != std::string_view::npos)
+            {
+                return parameter.substr(equals + 1);
+            }
+        }
+
+        return {};
+    }
+
+    uint64_t ParseNumber(std::string_view text, uint64_t fallback)
+    {
+        if (text.empty() || text.size() > 18 || !std::all_of(text.begin(), text.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+        {
+            return fallback;
+        }
+
+        uint64_t value = 0;
+
+        for (const char c : text)
+        {
+            value = value * 10 + static_cast<uint64_t>(c - '0');
+        }
+
+        return value;
+    }
+
+    bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+        {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+
+    void AppendLittleEndian(std::string& out, uint32_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+        {
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    // Gzip framing around stored DEFLATE blocks: a body the client has to decode, without
+    // the stand-in spending its time compressing
+    std::string GzipStored(const std::string& body)
+    {
+        constexpr size_t MAX_BLOCK = 65535;
+        std::string out{'\x1f', '\x8b', '\x08', '\0', '\0', '\0', '\0', '\0', '\0', '\xff'};
+        size_t offset = 0;
+
+        do
+        {
+            const size_t length = std::min(body.size() - offset, MAX_BLOCK);
+            out += static_cast<char>(offset + length == body.size() ? 1 : 0);
+            AppendLittleEndian(out, static_cast<uint32_t>(length), 2);
+            AppendLittleEndian(out, static_cast<uint32_t>(~length), 2);
+            out.append(body, offset, length);
+            offset += length;
+        }
+        while (offset < body.size());
+
+        AppendLittleEndian(out, Checksum::Crc32(body.data(), body.size()), 4);
+        AppendLittleEndian(out, static_cast<uint32_t>(body.size()), 4);
+        return out;
+    }
+
+    std::string_view Trim(std::string_view text)
+    {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+        {
+            text.remove_prefix(1);
+        }
+
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+        {
+            text.remove_suffix(1);
+        }
+
+        return text;
+    }
+
+    std::shared_ptr<const std::string> StatusBody(int code, const char* message)
+    {
+        return std::make_shared<const std::string>(json{{"status_code", code}, {"status_message", message}, {"success", false}}.dump());
+    }
+}
+
+StandInServer::StandInServer(Settings settings) : settings(std::move(settings))
+{
+}
+
+StandInServer::~StandInServer()
+{
+    Stop();
+}
+
+bool StandInServer::Start()
+{
+    if (running)
+    {
+        return true;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(settings.port);
+
+    if (inet_pton(AF_INET, settings.address.c_str(), &address.sin_addr) != 1)
+    {
+        std::cerr << "Invalid listen address: " << settings.address << std::endl;
+        return false;
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listenFd < 0)
+    {
+        std::cerr << "Error creating socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const int enable = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    socklen_t length = sizeof(address);
+
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listenFd, SOMAXCONN) != 0
+        || getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+    {
+        std::cerr << "Error listening on " << settings.address << ':' << settings.port << ": " << std::strerror(errno) << std::endl;
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    port = ntohs(address.sin_port);
+    running = true;
+    acceptThread = std::thread([this] { AcceptLoop(); });
+    return true;
+}
+
+void StandInServer::Stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+
+    // Shutting the sockets down wakes the threads blocked on them
+    shutdown(listenFd, SHUT_RDWR);
+    acceptThread.join();
+    close(listenFd);
+    listenFd = -1;
+
+    std::list<Connection> remaining;
+
+    {
+        std::lock_guard lock(connectionsMutex);
+
+        for (Connection& connection : connections)
+        {
+            if (connection.fd >= 0)
+            {
+                shutdown(connection.fd, SHUT_RDWR);
+            }
+        }
+
+        remaining.swap(connections);
+    }
+
+    for (Connection& connection : remaining)
+    {
+        connection.thread.join();
+    }
+}
+
+std::string StandInServer::GetBaseUrl() const
+{
+    const std::string host = settings.address == "0.0.0.0" ? "127.0.0.1" : settings.address;
+    return "http://" + host + ':' + std::to_string(port) + settings.root;
+}
+
+void StandInServer::AcceptLoop()
+{
+    while (running)
+    {
+        const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        const int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        ReapFinished();
+
+        std::lock_guard lock(connectionsMutex);
+
+        if (!running)
+        {
+            close(fd);
+            break;
+        }
+
+        Connection& connection = connections.emplace_back();
+        connection.fd = fd;
+        connection.thread = std::thread([this, &connection] { Serve(&connection); });
+    }
+}
+
+void StandInServer::ReapFinished()
+{
+    std::list<Connection> finished;
+
+    {
+        std::lock_guard lock(connectionsMutex);
+
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            const auto next = std::next(it);
+
+            if (it->finished)
+            {
+                finished.splice(finished.end(), connections, it);
+            }
+
+            it = next;
+        }
+    }
+
+    for (Connection& connection : finished)
+    {
+        connection.thread.join();
+    }
+}
+
+void StandInServer::Serve(Connection* connection)
+{
+    const int fd = connection->fd;
+    std::string buffer;
+    char chunk[16 * 1024];
+    uint32_t served = 0;
+
+    // Latency runs from when a request arrived, so pipelined requests wait out their
+    // delays together the way they would on a real network
+    auto receivedAt = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        size_t headerEnd;
+
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            const ssize_t received = buffer.size() < MAX_HEADER_BYTES ? recv(fd, chunk, sizeof(chunk), 0) : -1;
+
+            if (received <= 0)
+            {
+                headerEnd = std::string::npos;
+                break;
+            }
+
+            buffer.append(chunk, static_cast<size_t>(received));
+            receivedAt = std::chrono::steady_clock::now();
+        }
+
+        if (headerEnd == std::string::npos)
+        {
+            break;
+        }
+
+        const std::string_view head(buffer.data(), headerEnd);
+        const size_t lineEnd = head.find("\r\n");
+        const std::string_view requestLine = head.substr(0, lineEnd);
+
+        const size_t methodEnd = requestLine.find(' ');
+        const size_t targetEnd = requestLine.find(' ', methodEnd + 1);
+
+        if (methodEnd == std::string_view::npos || targetEnd == std::string_view::npos)
+        {
+            break;
+        }
+
+        const std::string_view method = requestLine.substr(0, methodEnd);
+        const std::string target(requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1));
+        const std::string_view version = requestLine.substr(targetEnd + 1);
+
+        bool keepAlive = version == "HTTP/1.1";
+        bool acceptsGzip = false;
+        uint64_t requestBody = 0;
+
+        for (size_t start = lineEnd == std::string_view::npos ? head.size() : lineEnd + 2; start < head.size();)
+        {
+            const size_t end = std::min(head.find("\r\n", start), head.size());
+            const std::string_view line = head.substr(start, end - start);
+            const size_t colon = line.find(':');
+            start = end + 2;
+
+            if (colon == std::string_view::npos)
+            {
+                continue;
+            }
+
+            const std::string_view name = Trim(line.substr(0, colon));
+            const std::string_view value = Trim(line.substr(colon + 1));
+
+            if (EqualsIgnoreCase(name, "Connection"))
+            {
+                keepAlive = EqualsIgnoreCase(value, "keep-alive") || (keepAlive && !EqualsIgnoreCase(value, "close"));
+            }
+            else if (EqualsIgnoreCase(name, "Content-Length"))
+            {
+                requestBody = ParseNumber(value, 0);
+            }
+            else if (EqualsIgnoreCase(name, "Accept-Encoding"))
+            {
+                acceptsGzip = value.find("gzip") != std::string_view::npos;
+            }
+        }
+
+        // Request bodies are never used, but they have to be skipped to find the next request
+        while (buffer.size() < headerEnd + 4 + requestBody)
+        {
+            const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+
+            if (received <= 0)
+            {
+                keepAlive = false;
+                break;
+            }
+
+            buffer.append(chunk, static_cast<size_t>(received));
+        }
+
+        const auto arrived = receivedAt;
+
+        if (settings.maxRequestsPerConnection > 0 && ++served >= settings.maxRequestsPerConnection)
+        {
+            keepAlive = false;
+        }
+
+        Reply reply;
+
+        if (method == "GET" || method == "HEAD")
+        {
+            reply = Answer(target);
+        }
+        else
+        {
+            reply.status = 405;
+            reply.reason = "Method Not Allowed";
+            reply.body = std::make_shared<const std::string>();
+        }
+
+        if (settings.gzip && acceptsGzip && reply.status == 200)
+        {
+            reply.body = std::make_shared<const std::string>(GzipStored(*reply.body));
+            reply.extraHeaders += "Content-Encoding: gzip\r\n";
+        }
+
+        std::string response = "HTTP/1.1 " + std::to_string(reply.status) + ' ' + reply.reason + "\r\n"
+            + "Content-Type: application/json;charset=utf-8\r\n"
+            + "Content-Length: " + std::to_string(reply.body->size()) + "\r\n"
+            + reply.extraHeaders
+            + (keepAlive ? "" : "Connection: close\r\n")
+            + "\r\n";
+
+        if (reply.delay.count() > 0)
+        {
+            std::this_thread::sleep_until(arrived + reply.delay);
+        }
+
+        if (!SendAll(fd, response.data(), response.size()))
+        {
+            break;
+        }
+
+        if (method != "HEAD" && !SendAll(fd, reply.body->data(), reply.body->size()))
+        {
+            break;
+        }
+
+        if (!keepAlive)
+        {
+            break;
+        }
+
+        buffer.erase(0, std::min(buffer.size(), headerEnd + 4 + static_cast<size_t>(requestBody)));
+    }
+
+    std::lock_guard lock(connectionsMutex);
+    close(connection->fd);
+    connection->fd = -1;
+    connection->finished = true;
+}
+
+StandInServer::Reply StandInServer::Answer(std::string_view target)
+{
+    // Four independent draws per request, seeded from the target and how often it has been
+    // asked for, not from arrival order, which concurrent requests make vary run to run
+    uint64_t occurrence = 0;
+    {
+        std::lock_guard lock(occurrencesMutex);
+        occurrence = occurrences[std::string{target}]++;
+    }
+
+    ++requestCount;
+    const uint64_t target32 = Checksum::Crc32(target.data(), target.size());
+    const uint64_t base = Mix(Mix(settings.seed) ^ (target32 << 32) ^ occurrence);
+    const auto unit = [](uint64_t value) { return static_cast<double>(value >> 11) * 0x1.0p-53; };
+
+    Reply reply;
+    reply.delay = settings.latency;
+
+    if (settings.jitter.count() > 0)
+    {
+        reply.delay += std::chrono::milliseconds{Mix(base) % static_cast<uint64_t>(settings.jitter.count() + 1)};
+    }
+
+    // A long tail on top of the jitter, like an upstream cache miss or GC pause
+    if (unit(Mix(base + 3)) < settings.stallRate)
+    {
+        reply.delay += settings.stall;
+    }
+
+    if (unit(Mix(base + 1)) < settings.throttleRate)
+    {
+        static const auto body = StatusBody(25, "Your request count is over the allowed limit.");
+        reply.status = 429;
+        reply.reason = "Too Many Requests";
+        reply.body = body;
+        reply.extraHeaders = "Retry-After: " + std::to_string(settings.retryAfter.count()) + "\r\n";
+        return reply;
+    }
+
+    if (unit(Mix(base + 2)) < settings.errorRate)
+    {
+        static const auto body = StatusBody(11, "Internal error: Something went wrong, contact TMDb.");
+        reply.status = 500;
+        reply.reason = "Internal Server Error";
+        reply.body = body;
+        return reply;
+    }
+
+    std::shared_ptr<const std::string> body;
+
+    if (target.compare(0, settings.root.size(), settings.root) == 0)
+    {
+        body = FindBody(target.substr(settings.root.size()));
+    }
+
+    if (!body)
+    {
+        static const auto notFound = StatusBody(34, "The resource you requested could not be found.");
+        reply.status = 404;
+        reply.reason = "Not Found";
+        reply.body = notFound;
+        return reply;
+    }
+
+    reply.body = std::move(body);
+    return reply;
+}
+
+std::shared_ptr<const std::string> StandInServer::FindBody(std::string_view request)
+{
+    const std::string name = Fixture::FileNameForRequest(request);
+
+    {
+        std::lock_guard lock(bodiesMutex);
+        const auto found = bodies.find(name);
+
+        if (found != bodies.end())
+        {
+            return found->second;
+        }
+    }
+
+    std::string body;
+    const bool recorded = !settings.fixtureDirectory.empty() && Fixture::Read(settings.fixtureDirectory, request, body);
+
+    if (!recorded && settings.synthetic)
+    {
+        body = Synthesize(request);
+    }
+
+    if (body.empty())
+    {
+        return nullptr;
+    }
+
+    // Cached for good: replays and synthetic pages never change, and a benchmark's working
+    // set is small
+    auto shared = std::make_shared<const std::string>(std::move(body));
+
+    std::lock_guard lock(bodiesMutex);
+    return bodies.emplace(name, std::move(shared)).first->second;
+}
+
+std::string StandInServer::Synthesize(std::string_view request) const
+{
+    const std::string_view path = request.substr(0, request.find('?'));
+
+    // Looks like a TMDB movie object, including the fields StreamFlix ignores, so parsing
+    // costs are realistic. Everything is derived from the id.
+    const auto makeMovie = [](uint64_t id)
+    {
+        const uint64_t hash = Mix(id);
+        const char* adjective = ADJECTIVES[hash % 16];
+        const char* noun = NOUNS[(hash >> 4) % 16];
+        const char* other = NOUNS[(hash >> 8) % 16];
+
+        std::string title;
+
+        switch ((hash >> 12) % 6)
+        {
+            case 0: title = std::string("The ") + adjective + ' ' + noun; break;
+            case 1: title = std::string(noun) + " of the " + adjective + ' ' + other; break;
+            case 2: title = std::string(adjective) + ' ' + noun + ": Part " + std::to_string(2 + (hash >> 16) % 5); break;
+            case 3: title = std::string("Amélie and the ") + noun; break;
+            case 4: title = std::string("\"") + adjective + "\" " + noun; break;
+            default: title = std::string(adjective) + ' ' + noun; break;
+        }
+
+        json genres = json::array();
+
+        for (uint64_t i = 0; i < 1 + (hash >> 20) % 3; ++i)
+        {
+            genres.push_back(GENRE_IDS[(hash >> (24 + 5 * i)) % (sizeof(GENRE_IDS) / sizeof(GENRE_IDS[0]))]);
+        }
+
+        char date[16];
+        std::snprintf(date, sizeof(date), "%04d-%02d-%02d", static_cast<int>(1970 + (hash >> 40) % 56),
+                      static_cast<int>(1 + (hash >> 46) % 12), static_cast<int>(1 + (hash >> 50) % 28));
+
+        char image[24];
+        std::snprintf(image, sizeof(image), "/%016llx.jpg", static_cast<unsigned long long>(Mix(hash)));
+
+        return json{
+            {"adult", false},
+            {"backdrop_path", image},
+            {"genre_ids", genres},
+            {"id", id},
+            {"original_language", "en"},
+            {"original_title", title},
+            {"overview", "When the " + std::string(noun) + " falls silent, a " + adjective + " crew sets out across the "
+                + other + " to find out why. What they uncover will change everything they believed about the \""
+                + noun + "\" itself."},
+            {"popularity", static_cast<double>((hash >> 24) % 1000000) / 1000.0},
+            {"poster_path", image},
+            {"release_date", date},
+            {"title", title},
+            {"video", false},
+            {"vote_average", static_cast<double>((hash >> 8) % 101) / 10.0},
+            {"vote_count", (hash >> 32) % 20000}
+        };
+    };
+
+    for (size_t list = 0; list < sizeof(LISTS) / sizeof(LISTS[0]); ++list)
+    {
+        if (path != LISTS[list])
+        {
+            continue;
+        }
+
+        const uint64_t page = std::max<uint64_t>(1, ParseNumber(QueryParameter(request, "page"), 1));
+        json results = json::array();
+
+        if (page <= settings.syntheticPages)
+        {
+            for (uint32_t i = 0; i < settings.syntheticResults; ++i)
+            {
+                const uint64_t position = (page - 1) * settings.syntheticResults + i;
+                results.push_back(makeMovie(11 + position * 4 + list));
+            }
+        }
+
+        return json{
+            {"page", page},
+            {"results", std::move(results)},
+            {"total_pages", settings.syntheticPages},
+            {"total_results", static_cast<uint64_t>(settings.syntheticPages) * settings.syntheticResults}
+        }.dump();
+    }
+
+    // The ids of movies changed between start_date and end_date, both included, by default
+    // today. Each day's changes are drawn from the movies the lists hold.
+    if (path == "movie/changes")
+    {
+        const std::string_view startText = QueryParameter(request, "start_date");
+        const std::string_view endText = QueryParameter(request, "end_date");
+
+        int64_t end = CalendarDate::Today();
+        int64_t start = end;
+
+        if ((!endText.empty() && !CalendarDate::Parse(endText, end)) || (!startText.empty() && !CalendarDate::Parse(startText, start))
+            || start > end || end - start >= MAX_CHANGE_DAYS)
+        {
+            return {};
+        }
+
+        const uint64_t listed = static_cast<uint64_t>(settings.syntheticPages) * settings.syntheticResults;
+        std::set<uint64_t> changed;
+
+        for (int64_t day = start; day <= end && listed > 0; ++day)
+        {
+            for (uint32_t i = 0; i < settings.syntheticChanges; ++i)
+            {
+                const uint64_t hash = Mix((static_cast<uint64_t>(day) << 32) + i);
+                changed.insert(11 + hash % listed * 4 + (hash >> 48) % (sizeof(LISTS) / sizeof(LISTS[0])));
+            }
+        }
+
+        const uint64_t totalPages = std::max<uint64_t>(1, (changed.size() + CHANGES_PER_PAGE - 1) / CHANGES_PER_PAGE);
+        const uint64_t page = std::max<uint64_t>(1, ParseNumber(QueryParameter(request, "page"), 1));
+        json results = json::array();
+
+        auto it = changed.begin();
+        std::advance(it, std::min<uint64_t>(changed.size(), (page - 1) * CHANGES_PER_PAGE));
+
+        for (uint64_t i = 0; i < CHANGES_PER_PAGE && it != changed.end(); ++i, ++it)
+        {
+            results.push_back({{"id", *it}, {"adult", false}});
+        }
+
+        return json{
+            {"results", std::move(results)},
+            {"page", page},
+            {"total_pages", totalPages},
+            {"total_results", changed.size()}
+        }.dump();
+    }
+
+    constexpr std::string_view moviePrefix = "movie/";
+
+    if (path.compare(0, moviePrefix.size(), moviePrefix) == 0)
+    {
+        const uint64_t id = ParseNumber(path.substr(moviePrefix.size()), 0);
+
+        if (id == 0)
+        {
+            return {};
+        }
+
+        json details = makeMovie(id);
+        details.erase("genre_ids");
+        details["budget"] = (Mix(id) >> 20) % 200000000;
+        details["revenue"] = (Mix(id) >> 18) % 900000000;
+        details["runtime"] = 80 + Mix(id) % 100;
+        details["status"] = "Released";
+        details["tagline"] = "Some journeys never end.";
+        details["imdb_id"] = "tt" + std::to_string(1000000 + id % 9000000);
+        details["genres"] = json::array({{{"id", 18}, {"name", "Drama"}}});
+        return details.dump();
+    }
+
+    return {};
+}
+
+bool StandInServer::SendAll(int fd, const char* data, size_t size) const
+{
+    // Paced in small slices so a bandwidth cap shapes the transfer instead of delaying it
+    const size_t slice = settings.bandwidth > 0 ? std::max<size_t>(1024, settings.bandwidth / 50) : size;
+    const auto start = std::chrono::steady_clock::now();
+    size_t sent = 0;
+
+    while (sent < size)
+    {
+        const ssize_t written = send(fd, data + sent, std::min(slice, size - sent), MSG_NOSIGNAL);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        sent += static_cast<size_t>(written);
+
+        if (settings.bandwidth > 0)
+        {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds{sent * 1000000000ULL / settings.bandwidth});
+        }
+    }
+
+    return true;
+}
+
+uint64_t StandInServer::Mix(uint64_t value)
+{
+    // splitmix64 finaliser
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
@@ -0,0 +1,107 @@
+﻿#ifndef STAND_IN_SERVER_H
+#define STAND_IN_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+// Local stand-in for the TMDB API, so fetching can be benchmarked offline and repeatably.
+// It replays fixtures recorded by TMDBServiceProvider, or generates synthetic pages, with
+// injected latency, bandwidth limits, 5xx errors and 429 throttling. Failures are drawn
+// from the seed and the request, so the same run sees the same faults whatever order its
+// requests arrive in. Linux only.
+class StandInServer
+{
+public:
+    struct Settings
+    {
+        std::string address = "127.0.0.1";
+        uint16_t port = 0;                      // 0 picks a free port
+        std::string root = "/3/";               // Request paths are resolved relative to this
+        std::string fixtureDirectory;
+        bool synthetic = false;                 // Generate a response when there is no fixture
+        uint32_t syntheticResults = 20;         // Results per synthetic list page
+        uint32_t syntheticPages = 500;
+        uint32_t syntheticChanges = 200;        // Movies per day in the synthetic change feed
+
+        std::chrono::milliseconds latency{0};   // From a request's arrival to its response
+        std::chrono::milliseconds jitter{0};    // Up to this much more, uniformly drawn
+        double stallRate = 0.0;                 // Fraction of requests held back a further `stall`
+        std::chrono::milliseconds stall{1000};
+        uint64_t bandwidth = 0;                 // Bytes per second per connection; 0 is unlimited
+        double errorRate = 0.0;                 // Fraction of requests answered with 500
+        double throttleRate = 0.0;              // Fraction of requests answered with 429
+        std::chrono::seconds retryAfter{1};
+        uint32_t maxRequestsPerConnection = 0;  // Then "Connection: close", like nginx's keepalive_requests
+        bool gzip = false;                      // Sends a successful body gzipped to a request accepting it
+        uint64_t seed = 1;
+    };
+
+    explicit StandInServer(Settings settings);
+    ~StandInServer();
+
+    StandInServer(const StandInServer&) = delete;
+    StandInServer& operator=(const StandInServer&) = delete;
+
+    bool Start();
+    void Stop();
+
+    [[nodiscard]] uint16_t GetPort() const { return port; }
+    [[nodiscard]] std::string GetBaseUrl() const;
+    [[nodiscard]] uint64_t GetRequestCount() const { return requestCount; }
+
+private:
+    struct Reply
+    {
+        int status = 200;
+        std::string reason = "OK";
+        std::shared_ptr<const std::string> body;
+        std::string extraHeaders;
+        std::chrono::milliseconds delay{0};
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        std::thread thread;
+        bool finished = false;
+    };
+
+    void AcceptLoop();
+    void Serve(Connection* connection);
+    void ReapFinished();
+    [[nodiscard]] Reply Answer(std::string_view target);
+    [[nodiscard]] std::shared_ptr<const std::string> FindBody(std::string_view request);
+    [[nodiscard]] std::string Synthesize(std::string_view request) const;
+    bool SendAll(int fd, const char* data, size_t size) const;
+
+    static uint64_t Mix(uint64_t value);
+
+    const Settings settings;
+    int listenFd = -1;
+    uint16_t port = 0;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> requestCount{0};
+    std::thread acceptThread;
+
+    // One thread per connection keeps pipelined requests in order for free
+    std::mutex connectionsMutex;
+    std::list<Connection> connections;
+
+    // Bodies are immutable once loaded, so replies share them without copying
+    std::mutex bodiesMutex;
+    std::unordered_map<std::string, std::shared_ptr<const std::string>> bodies;
+
+    // Times each target has been asked for, which a retry's faults are drawn from
+    std::mutex occurrencesMutex;
+    std::unordered_map<std::string, uint64_t> occurrences;
+};
+
+#endif
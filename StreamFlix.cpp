@@ -1,27 +1,81 @@
 ﻿#include "StreamFlix.h"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <mutex>
+#include <memory>
 #include <regex>
-#include <thread>
+#include <vector>
 #include <bits/ostream.tcc>
 #include <TMDBServiceProvider.h>
 #include <json/single_include/nlohmann/json.hpp>
 
+#include "CatalogStore.h"
+#include "CatalogSync.h"
+#include "IngestPipeline.h"
 #include "MovieDatabase.h"
+#include "SharedCatalog.h"
+#include "TaskScheduler.h"
 
 using json = nlohmann::json;
 
+namespace
+{
+    // A saved catalog older than this is crawled again rather than shown
+    constexpr std::chrono::hours SNAPSHOT_MAX_AGE{24};
+
+    // Whether anything in a store's directory was written within SNAPSHOT_MAX_AGE; checked
+    // before the store opens, as opening touches its log
+    bool IsFresh(const std::string& directory)
+    {
+        std::error_code error;
+        const auto now = std::filesystem::file_time_type::clock::now();
+
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            const auto modified = entry.last_write_time(error);
+
+            if (!error && now - modified <= SNAPSHOT_MAX_AGE)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // An empty store is a miss
+    bool LoadFromStore(const CatalogStore& store, MovieDatabase& database)
+    {
+        store.Read([&database](const MovieDatabase& stored) { database = stored; });
+        return database.GetSize() > 0;
+    }
+
+    void SaveToStore(CatalogStore& store, MovieDatabase& database)
+    {
+        const MovieView movies = database.GetMovies();
+
+        if (!store.UpsertMovies(MovieList(movies.begin(), movies.end())))
+        {
+            std::cerr << "Error saving the catalog; it is only in memory" << std::endl;
+        }
+
+        // The store keeps every movie a crawl has seen, so it is what is shown
+        LoadFromStore(store, database);
+    }
+}
+
 void StreamFlix::DisplayMovies(const std::string& title, const MovieDatabase& movieDatabase)
 {
     std::cout << "______________________________________________________" << std::endl;
     std::cout << title << std::endl;
     std::cout << "______________________________________________________" << std::endl;
 
-    const MovieList& movies = movieDatabase.GetMovies();
+    const MovieView movies = movieDatabase.GetMovies();
 
-    for (auto& movie : movies)
+    for (const MovieRef movie : movies)
     {
         std::cout << movie.GetTitle() << " | " << movie.GetRating() << std::endl;
     }
@@ -33,9 +87,9 @@ void StreamFlix::DisplayMoviesSortedByTitle(const std::string& title, const Movi
     std::cout << title << " (Sorted Alphabetically)" << std::endl;
     std::cout << "______________________________________________________" << std::endl;
 
-    const MovieList& moviesSortedByTitle = movieDatabase.GetMoviesSortedByTitle();
+    const MovieView moviesSortedByTitle = movieDatabase.GetMoviesSortedByTitle();
 
-    for (auto& movie : moviesSortedByTitle)
+    for (const MovieRef movie : moviesSortedByTitle)
     {
         std::cout << movie.GetTitle() << " | " << movie.GetRating() << std::endl;
     }
@@ -47,91 +101,288 @@ void StreamFlix::DisplayMoviesSortedByRating(const std::string& title, const Mov
     std::cout << title << " (Sorted by rating)" << std::endl;
     std::cout << "______________________________________________________" << std::endl;
 
-    const MovieList& moviesSortedByRating = movieDatabase.GetMoviesSortedByRating();
+    const MovieView moviesSortedByRating = movieDatabase.GetMoviesSortedByRating();
 
-    for (auto& movie : moviesSortedByRating)
+    for (const MovieRef movie : moviesSortedByRating)
     {
         std::cout << movie.GetTitle() << " | " << movie.GetRating() << std::endl;
     }
 }
 
-std::string StreamFlix::LoadAPIKeyFromJson(const char* str)
+StreamFlix::Settings StreamFlix::LoadSettingsFromJson(const char* str)
 {
+    Settings settings;
     std::ifstream file(str);
 
+    if (!file.is_open())
+    {
+        std::cerr << "Error opening file: " << str << std::endl;
+        return settings;
+    }
+
+    // Only "api_key" is required. "base_url" redirects requests (e.g. to a TMDBStandIn
+    // server) and "record_directory" saves every response as a fixture it can replay;
+    // "fetchers" is how many requests are in flight, "parsers" how many pages are parsed
+    // at once, "queued_body_bytes" how much of a body may wait for its parser and
+    // "parsed_pages" how many parsed pages may wait to be added; "snapshot_directory" is
+    // where the catalogs are saved between runs and "export_directory" where they are
+    // written as Arrow files, for analytics tools to read. "mode" is "loader" or "worker"
+    // to share the catalogs between processes, under the name "shared_catalog", or "sync"
+    // to keep every movie crawled up to date from TMDB's change feed.
     try
     {
-        if (!file.is_open())
+        json jsonData;
+        file >> jsonData;
+        settings.provider.baseUrl = jsonData.value("base_url", settings.provider.baseUrl);
+        settings.provider.recordDirectory = jsonData.value("record_directory", settings.provider.recordDirectory);
+        settings.pipeline.fetchers = jsonData.value("fetchers", settings.pipeline.fetchers);
+        settings.pipeline.parsers = jsonData.value("parsers", settings.pipeline.parsers);
+        settings.pipeline.queuedBytes = jsonData.value("queued_body_bytes", settings.pipeline.queuedBytes);
+        settings.pipeline.parsedPages = jsonData.value("parsed_pages", settings.pipeline.parsedPages);
+        settings.snapshotDirectory = jsonData.value("snapshot_directory", std::string{});
+        settings.exportDirectory = jsonData.value("export_directory", std::string{});
+        settings.sharedCatalog = jsonData.value("shared_catalog", settings.sharedCatalog);
+
+        const std::string mode = jsonData.value("mode", std::string{"standalone"});
+
+        if (mode == "loader")
+        {
+            settings.mode = Settings::Mode::Loader;
+        }
+        else if (mode == "worker")
+        {
+            settings.mode = Settings::Mode::Worker;
+        }
+        else if (mode == "sync")
+        {
+            settings.mode = Settings::Mode::Sync;
+        }
+        else if (mode != "standalone")
         {
-            std::cerr << "Error opening file: " << str << std::endl;
-            return "";
+            std::cerr << "Unknown mode " << mode << ", running standalone" << std::endl;
         }
 
-        json jsonData;
-        file >> jsonData;
-        file.close();
-        auto apiKey = jsonData.at("api_key").get<std::string>();
-        return apiKey;
+        settings.apiKey = jsonData.at("api_key").get<std::string>();
     }
     catch (const json::exception& e)
     {
         std::cerr << "Error parsing JSON: " << e.what() << std::endl;
-        file.close();
-        return "";
     }
+
+    if (!settings.provider.baseUrl.empty() && settings.provider.baseUrl.back() != '/')
+    {
+        settings.provider.baseUrl += '/';
+    }
+
+    return settings;
 }
 
-void StreamFlix::Run()
+bool StreamFlix::Crawl(const TMDBServiceProvider& tmdbServiceProvider, const IngestPipeline::Settings& pipelineSettings,
+                       MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies, const CancellationToken& cancellation)
 {
-    MovieDatabase popularMovies;
-    MovieDatabase nowPlayingMovies;
+    // Pages are parsed on the shared TaskScheduler as they arrive, while the next ones are
+    // still on the wire
+    IngestPipeline pipeline(pipelineSettings);
 
-    static std::string TMDB_API_KEY = LoadAPIKeyFromJson("api_key.json");
+    pipeline.AddCatalog("popular movies", popularMovies, POPULAR_PAGES, [&tmdbServiceProvider](uint32_t page, const CancellationToken& token, std::shared_ptr<BodyStream> stream)
+    {
+        tmdbServiceProvider.StreamPopularMoviesAsync(page, std::move(stream), token);
+    });
 
-    TMDBServiceProvider tmdbServiceProvider(TMDB_API_KEY);
+    pipeline.AddCatalog("now playing movies", nowPlayingMovies, NOW_PLAYING_PAGES, [&tmdbServiceProvider](uint32_t page, const CancellationToken& token, std::shared_ptr<BodyStream> stream)
+    {
+        tmdbServiceProvider.StreamNowPlayingMoviesAsync(page, std::move(stream), token);
+    });
 
-    json popularMovieJson;
-    json nowPlayingMovieJson;
+    return pipeline.Run(cancellation) == 0;
+}
 
-    std::mutex coutMutex;
+bool StreamFlix::Publish(const std::string& sharedCatalog, const MovieDatabase& popularMovies, const MovieDatabase& nowPlayingMovies)
+{
+    // What is published stays after the loader exits, until its next run replaces it. Both
+    // catalogs are one generation, so a worker never pairs one run's with another's.
+    SharedCatalog catalogs(sharedCatalog, 2);
+    return catalogs.Publish({popularMovies.GetMovies(), nowPlayingMovies.GetMovies()});
+}
+
+bool StreamFlix::Attach(const std::string& sharedCatalog, MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies)
+{
+    SharedCatalog catalogs(sharedCatalog, 2);
 
-    std::thread popularThread([&]
+    if (!catalogs.Refresh())
     {
+        std::cerr << "Nothing published as " << sharedCatalog << " yet; run a loader first" << std::endl;
+        return false;
+    }
+
+    // The databases keep the generation mapped after the SharedCatalog goes
+    popularMovies.ServeSnapshot(catalogs.GetCatalog(0));
+    nowPlayingMovies.ServeSnapshot(catalogs.GetCatalog(1));
+    return true;
+}
+
+bool StreamFlix::Load(const Settings& settings, CatalogStore& popularStore, CatalogStore& nowPlayingStore,
+                      MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies, const CancellationToken& cancellation)
+{
+    const TMDBServiceProvider tmdbServiceProvider(settings.apiKey, settings.provider);
+
+    // One connection per request the crawl keeps in flight, opened while the stores load.
+    // If they load, the connections go unused and time out.
+    tmdbServiceProvider.WarmUp(std::min<size_t>(settings.pipeline.fetchers, POPULAR_PAGES + NOW_PLAYING_PAGES));
+
+    // Starts from the catalogs the last run stored, if they were written within
+    // SNAPSHOT_MAX_AGE; opening a store replays its log over its last snapshot. Deleting
+    // the directory makes the next run crawl again.
+    const bool stored = !settings.snapshotDirectory.empty();
+    bool popularOpen = false;
+    bool nowPlayingOpen = false;
+    bool popularLoaded = false;
+    bool nowPlayingLoaded = false;
+
+    if (stored)
+    {
+        const bool popularFresh = IsFresh(GetStoreDirectory(settings, "popular"));
+        const bool nowPlayingFresh = IsFresh(GetStoreDirectory(settings, "now_playing"));
+
+        TaskGroup group;
+        group.Run([&]
         {
-            std::lock_guard lock(coutMutex);
-            std::cout << "Popular movies thread ID: " << std::this_thread::get_id() << std::endl;
-        }
+            popularOpen = popularStore.Open();
+            popularLoaded = popularOpen && popularFresh && LoadFromStore(popularStore, popularMovies);
+        });
+        nowPlayingOpen = nowPlayingStore.Open();
+        nowPlayingLoaded = nowPlayingOpen && nowPlayingFresh && LoadFromStore(nowPlayingStore, nowPlayingMovies);
+        group.Wait();
+    }
 
-        for (int i = 1; i <= 5; ++i)
+    if (popularLoaded && nowPlayingLoaded)
+    {
+        return true;
+    }
+
+    popularMovies = MovieDatabase{};
+    nowPlayingMovies = MovieDatabase{};
+
+    const bool complete = Crawl(tmdbServiceProvider, settings.pipeline, popularMovies, nowPlayingMovies, cancellation) && !cancellation.IsCancelled();
+
+    // A crawl cut short or missing pages isn't kept, or later runs would start from it
+    if (popularOpen && nowPlayingOpen && complete)
+    {
+        TaskGroup group;
+        group.Run([&] { SaveToStore(popularStore, popularMovies); });
+        SaveToStore(nowPlayingStore, nowPlayingMovies);
+        group.Wait();
+    }
+
+    return complete;
+}
+
+bool StreamFlix::Sync(const Settings& settings, CatalogStore& store, bool complete, const MovieDatabase& popularMovies,
+                      const MovieDatabase& nowPlayingMovies, MovieDatabase& catalog, const CancellationToken& cancellation)
+{
+    if (settings.snapshotDirectory.empty())
+    {
+        std::cerr << "Sync needs a snapshot_directory to keep the catalog in" << std::endl;
+        return false;
+    }
+
+    if (!store.Open())
+    {
+        return false;
+    }
+
+    const std::string watermark = (std::filesystem::path(GetStoreDirectory(settings, "catalog")) / "sync.watermark").string();
+
+    // The change feed only says what changed since the last sync, so the first one starts
+    // from what a complete crawl found
+    if (CatalogSync::ReadWatermark(watermark).empty())
+    {
+        if (!complete)
         {
-            auto popularMoviesJsonString = tmdbServiceProvider.GetPopularMovies(i);
-            popularMovieJson = json::parse(popularMoviesJsonString);
+            std::cerr << "Catalogs incomplete, not synced" << std::endl;
+            return false;
+        }
 
-            for (auto& movie : popularMovieJson["results"])
-            {
-                popularMovies.AddMovie(movie["title"], movie["vote_average"]);
-            }
+        for (const MovieDatabase* crawled : {&popularMovies, &nowPlayingMovies})
+        {
+            const MovieView movies = crawled->GetMovies();
+            store.UpsertMovies(MovieList(movies.begin(), movies.end()));
         }
-    });
+    }
+
+    const TMDBServiceProvider tmdbServiceProvider(settings.apiKey, settings.provider);
+    CatalogSync sync(tmdbServiceProvider, store, CatalogSync::Settings{watermark});
+    const CatalogSync::Result result = sync.Run(cancellation);
 
-    std::thread nowPlayingThread([&]
+    if (!result.complete)
     {
+        std::cerr << "Catalog sync incomplete, " << result.updated << " of " << result.changed
+                  << " changed movies updated; the rest are taken again next run" << std::endl;
+    }
+
+    store.Read([&catalog](const MovieDatabase& stored) { catalog = stored; });
+    return result.complete;
+}
+
+std::string StreamFlix::GetStoreDirectory(const Settings& settings, const std::string& catalog)
+{
+    return (std::filesystem::path(settings.snapshotDirectory) / catalog).string();
+}
+
+void StreamFlix::Run(const CancellationToken& cancellation)
+{
+    const Settings settings = LoadSettingsFromJson("api_key.json");
+
+    MovieDatabase popularMovies;
+    MovieDatabase nowPlayingMovies;
+
+    // Only opened by Load, when there is a snapshot directory, and by Sync
+    CatalogStore popularStore(GetStoreDirectory(settings, "popular"));
+    CatalogStore nowPlayingStore(GetStoreDirectory(settings, "now_playing"));
+    CatalogStore catalogStore(GetStoreDirectory(settings, "catalog"));
+    MovieDatabase catalog;
+
+    if (settings.mode == Settings::Mode::Worker)
+    {
+        if (!Attach(settings.sharedCatalog, popularMovies, nowPlayingMovies))
         {
-            std::lock_guard lock(coutMutex);
-            std::cout << "Now playing movies thread ID: " << std::this_thread::get_id() << std::endl;
+            return;
         }
+    }
+    else
+    {
+        const bool complete = Load(settings, popularStore, nowPlayingStore, popularMovies, nowPlayingMovies, cancellation);
 
-        auto nowPlayingMoviesJsonString = tmdbServiceProvider.GetNowPlayingMovies(1);
-        nowPlayingMovieJson = json::parse(nowPlayingMoviesJsonString);
-
-        for (auto& movie : nowPlayingMovieJson["results"])
+        // Workers keep the generation they have rather than switch to a partial crawl
+        if (settings.mode == Settings::Mode::Loader)
         {
-            nowPlayingMovies.AddMovie(movie["title"], movie["vote_average"]);
+            if (!complete)
+            {
+                std::cerr << "Catalogs incomplete, not published" << std::endl;
+            }
+            else if (!Publish(settings.sharedCatalog, popularMovies, nowPlayingMovies))
+            {
+                std::cerr << "Error publishing the catalogs as " << settings.sharedCatalog << std::endl;
+            }
         }
-    });
+        else if (settings.mode == Settings::Mode::Sync)
+        {
+            Sync(settings, catalogStore, complete, popularMovies, nowPlayingMovies, catalog, cancellation);
+        }
+    }
+
+    const std::string& exportDirectory = settings.exportDirectory;
 
-    popularThread.join();
-    nowPlayingThread.join();
+    if (!exportDirectory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(exportDirectory, error);
+
+        TaskGroup group;
+        group.Run([&] { popularMovies.SaveArrow(exportDirectory + "/popular.arrow"); });
+        nowPlayingMovies.SaveArrow(exportDirectory + "/now_playing.arrow");
+        group.Wait();
+    }
 
     DisplayMovies("POPULAR", popularMovies);
     DisplayMoviesSortedByTitle("POPULAR", popularMovies);
@@ -141,16 +392,25 @@ void StreamFlix::Run()
     DisplayMoviesSortedByTitle("NOW PLAYING", nowPlayingMovies);
     DisplayMoviesSortedByRating("NOW PLAYING", nowPlayingMovies);
 
+    if (settings.mode == Settings::Mode::Sync)
+    {
+        DisplayMoviesSortedByRating("CATALOG", catalog);
+    }
+
     std::regex pattern(".*[dD]es.*");
 
     MovieList matchingMovies;
-    const auto& movies = popularMovies.GetMovies();
+    const MovieView movies = popularMovies.GetMovies();
+
+    for (const MovieRef movie : movies)
+    {
+        const std::string_view title = movie.GetTitle();
 
-    std::copy_if(movies.begin(), movies.end(), std::back_inserter(matchingMovies),
-                 [&pattern](const Movie& movie)
-                 {
-                     return std::regex_search(movie.GetTitle(), pattern);
-                 });
+        if (std::regex_search(title.begin(), title.end(), pattern))
+        {
+            matchingMovies.emplace_back(movie);
+        }
+    }
 
     for (auto& movie : matchingMovies)
     {
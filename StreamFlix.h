@@ -1,18 +1,70 @@
 ﻿#ifndef STREAM_FLIX_H
 #define STREAM_FLIX_H
+#include "CancellationToken.h"
+#include "CatalogStore.h"
+#include "IngestPipeline.h"
 #include "MovieDatabase.h"
+#include "TMDBServiceProvider.h"
 
 class StreamFlix
 {
 public:
+    // Everything api_key.json configures, read from it in one pass
+    struct Settings
+    {
+        // With several processes on one host, a loader gets the catalogs as a standalone
+        // run would and publishes them together as a SharedCatalog; workers read the newest
+        // published ones in place instead of each keeping a copy. Sync also keeps a catalog
+        // of every movie crawled, brought up to date from the change feed each run; see
+        // CatalogSync.
+        enum class Mode
+        {
+            Standalone,
+            Loader,
+            Worker,
+            Sync
+        };
+
+        std::string apiKey;
+        TMDBServiceProvider::Settings provider;
+        IngestPipeline::Settings pipeline;
+        std::string snapshotDirectory;      // Where the CatalogStores are; empty to crawl every run
+        std::string exportDirectory;        // Empty to write no Arrow files
+        Mode mode = Mode::Standalone;
+        std::string sharedCatalog = "streamflix";   // Name of the SharedCatalog
+    };
+
     StreamFlix() = default;
-    static std::string LoadAPIKeyFromJson(const char* str);
-    static void Run();
+    static Settings LoadSettingsFromJson(const char* str);
+    // Fetching stops at the token's deadline or when it is cancelled; whatever has loaded
+    // by then is still shown
+    static void Run(const CancellationToken& cancellation = {});
     static void Shutdown();
 
     static void DisplayMovies(const std::string& title, const MovieDatabase& movieDatabase);
     static void DisplayMoviesSortedByTitle(const std::string & title, const MovieDatabase& movieDatabase);
     static void DisplayMoviesSortedByRating(const std::string& title, const MovieDatabase& movieDatabase);
+
+private:
+    static constexpr uint32_t POPULAR_PAGES = 5;
+    static constexpr uint32_t NOW_PLAYING_PAGES = 1;
+
+    // Loads the stored catalogs or crawls them into the stores. Returns true if they are
+    // complete.
+    static bool Load(const Settings& settings, CatalogStore& popularStore, CatalogStore& nowPlayingStore,
+                     MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies, const CancellationToken& cancellation);
+    // Syncs the catalog store, first seeding it from the crawled catalogs, and copies it
+    // into `catalog`. Returns true if every change is in.
+    static bool Sync(const Settings& settings, CatalogStore& store, bool complete, const MovieDatabase& popularMovies,
+                     const MovieDatabase& nowPlayingMovies, MovieDatabase& catalog, const CancellationToken& cancellation);
+    static std::string GetStoreDirectory(const Settings& settings, const std::string& catalog);
+
+    // Returns true if every page was ingested
+    static bool Crawl(const TMDBServiceProvider& tmdbServiceProvider, const IngestPipeline::Settings& pipelineSettings,
+                      MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies, const CancellationToken& cancellation);
+
+    static bool Publish(const std::string& sharedCatalog, const MovieDatabase& popularMovies, const MovieDatabase& nowPlayingMovies);
+    static bool Attach(const std::string& sharedCatalog, MovieDatabase& popularMovies, MovieDatabase& nowPlayingMovies);
 };
 
 #endif
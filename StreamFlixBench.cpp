@@ -0,0 +1,1985 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CalendarDate.h"
+#include "CatalogArchive.h"
+#include "CatalogArrow.h"
+#include "CatalogSnapshot.h"
+#include "CatalogStore.h"
+#include "CatalogSync.h"
+#include "IngestPipeline.h"
+#include "JsonProjection.h"
+#include "MovieDatabase.h"
+#include "ParallelSort.h"
+#include "SharedCatalog.h"
+#include "StandInServer.h"
+#include "StructuralIndex.h"
+#include "TaskScheduler.h"
+#include "TMDBServiceProvider.h"
+#include "json/single_include/nlohmann/json.hpp"
+
+#include <unistd.h>
+
+namespace
+{
+    std::atomic<uint64_t> allocationCount{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+}
+
+// Counted so the parsing cases can report what they allocate per page. Every form of new
+// and delete is replaced, so each block is freed by the family that allocated it.
+namespace
+{
+    void* Allocate(std::size_t size, std::size_t alignment)
+    {
+        ++allocationCount;
+        allocatedBytes += size;
+
+        // aligned_alloc wants a size that is a multiple of the alignment
+        const std::size_t rounded = (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment;
+
+        if (void* memory = alignment <= alignof(std::max_align_t) ? std::malloc(rounded) : std::aligned_alloc(alignment, rounded))
+        {
+            return memory;
+        }
+
+        throw std::bad_alloc{};
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size)
+{
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+// Benchmarks against an in-process stand-in server, so results depend on neither the
+// network nor an API key. Pass a substring to run only the cases whose names contain it,
+// then optionally a directory of recorded fixtures to serve in place of synthetic pages.
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr int RUNS = 15;
+    constexpr std::chrono::milliseconds LATENCY{20};
+
+    struct Case
+    {
+        const char* name;
+        std::function<void(const StandInServer& server)> run;
+    };
+
+    // Checks that failed in this run, which then exits non-zero
+    size_t failedChecks = 0;
+
+    // Counts a failed check and hands back whether it passed, for the line reporting it
+    bool Check(bool passed)
+    {
+        failedChecks += passed ? 0 : 1;
+        return passed;
+    }
+
+    TMDBServiceProvider::Settings ProviderSettings(const StandInServer& server)
+    {
+        // The stand-in doesn't throttle, so neither should the client
+        TMDBServiceProvider::Settings settings;
+        settings.baseUrl = server.GetBaseUrl();
+        settings.rateLimit.initialRate = 100000.0;
+        settings.rateLimit.maxRate = 100000.0;
+        settings.rateLimit.burst = 1000.0;
+        return settings;
+    }
+
+    // Runs the body once to warm up, then RUNS times, and prints the spread. Given the bytes
+    // one run goes through, also prints the throughput at the median.
+    void Measure(const char* name, const std::function<void()>& body, size_t bytes = 0)
+    {
+        body();
+
+        std::vector<double> samples;
+
+        for (int i = 0; i < RUNS; ++i)
+        {
+            const auto start = Clock::now();
+            body();
+            samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        std::cout << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(2)
+                  << " median " << std::setw(9) << samples[samples.size() / 2] << " ms"
+                  << "  min " << std::setw(9) << samples.front() << " ms"
+                  << "  max " << std::setw(9) << samples.back() << " ms";
+
+        if (bytes > 0)
+        {
+            std::cout << "  " << std::setw(6) << static_cast<double>(bytes) / samples[samples.size() / 2] / 1e6 << " GB/s";
+        }
+
+        std::cout << std::endl;
+    }
+
+    void MeasureAllocations(const char* name, const std::function<void()>& body)
+    {
+        const uint64_t count = allocationCount;
+        const uint64_t bytes = allocatedBytes;
+
+        body();
+
+        std::cout << std::left << std::setw(32) << name << std::right
+                  << " " << std::setw(6) << allocationCount - count << " allocations"
+                  << "  " << std::setw(8) << allocatedBytes - bytes << " bytes" << std::endl;
+    }
+
+    double Percentile(std::vector<double> samples, double fraction)
+    {
+        std::sort(samples.begin(), samples.end());
+        return samples[static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1))];
+    }
+
+    std::vector<std::string> MovieIds(size_t count)
+    {
+        std::vector<std::string> ids;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            ids.push_back(std::to_string(550 + i));
+        }
+
+        return ids;
+    }
+
+    // One page's worth of detail lookups, as when enriching a page of results
+    void DetailsSequential(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const auto ids = MovieIds(20);
+
+        Measure("details/sequential", [&]
+        {
+            for (const auto& id : ids)
+            {
+                [[maybe_unused]] const auto body = provider.GetMovieDetails(id);
+            }
+        });
+    }
+
+    void DetailsConcurrent(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const auto ids = MovieIds(20);
+
+        Measure("details/concurrent", [&]
+        {
+            std::vector<std::future<ResponseBuffer>> futures;
+
+            for (const auto& id : ids)
+            {
+                futures.push_back(provider.MakeHttpGetRequestAsync(server.GetBaseUrl() + "movie/" + id + "?api_key=bench"));
+            }
+
+            for (auto& future : futures)
+            {
+                future.get();
+            }
+        });
+    }
+
+    void DetailsPipelined(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const auto ids = MovieIds(20);
+
+        Measure("details/pipelined", [&]
+        {
+            [[maybe_unused]] const auto bodies = provider.GetMovieDetails(ids);
+        });
+    }
+
+    // Per-request latency against an upstream that is fast except for an occasional stall,
+    // with and without hedging
+    void DetailsTail(const StandInServer&)
+    {
+        constexpr size_t THREADS = 8;
+        constexpr size_t REQUESTS_PER_THREAD = 250;
+
+        StandInServer::Settings serverSettings;
+        serverSettings.synthetic = true;
+        serverSettings.latency = std::chrono::milliseconds{5};
+        serverSettings.jitter = std::chrono::milliseconds{2};
+        serverSettings.stallRate = 0.02;
+        serverSettings.stall = std::chrono::milliseconds{250};
+
+        for (const bool hedging : {false, true})
+        {
+            StandInServer server(serverSettings);
+
+            if (!server.Start())
+            {
+                return;
+            }
+
+            auto settings = ProviderSettings(server);
+            settings.hedge.budget = hedging ? settings.hedge.budget : 0.0;
+
+            const TMDBServiceProvider provider("bench", settings);
+
+            std::mutex mutex;
+            std::vector<double> latencies;
+            std::vector<std::thread> threads;
+
+            for (size_t t = 0; t < THREADS; ++t)
+            {
+                threads.emplace_back([&, t]
+                {
+                    std::vector<double> own;
+
+                    for (size_t i = 0; i < REQUESTS_PER_THREAD; ++i)
+                    {
+                        const auto start = Clock::now();
+                        [[maybe_unused]] const auto body = provider.GetMovieDetails(std::to_string(550 + t * REQUESTS_PER_THREAD + i));
+                        own.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                    }
+
+                    std::lock_guard lock(mutex);
+                    latencies.insert(latencies.end(), own.begin(), own.end());
+                });
+            }
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+
+            const auto stats = provider.GetHedgeStats();
+            const double extra = 100.0 * static_cast<double>(server.GetRequestCount() - latencies.size()) / static_cast<double>(latencies.size());
+
+            std::cout << std::left << std::setw(32) << (hedging ? "details/tail hedged" : "details/tail") << std::right << std::fixed << std::setprecision(2)
+                      << " p50 " << std::setw(7) << Percentile(latencies, 0.5) << " ms"
+                      << "  p99 " << std::setw(7) << Percentile(latencies, 0.99) << " ms"
+                      << "  p99.9 " << std::setw(7) << Percentile(latencies, 0.999) << " ms"
+                      << "  extra upstream " << std::setprecision(1) << extra << "%"
+                      << " (" << stats.hedges << " hedges, " << stats.hedgeWins << " won)" << std::endl;
+        }
+    }
+
+    // A reader paging through a list, doing 10 ms of work on each page, with and without the
+    // read-ahead. Both must see the same pages; a reader that gives up gets an empty one.
+    void ListPrefetch(const StandInServer& server)
+    {
+        constexpr uint32_t PAGES = 30;
+        std::vector<std::string> pages[2];
+
+        for (const bool prefetch : {false, true})
+        {
+            auto settings = ProviderSettings(server);
+            settings.prefetch.maxPagesAhead = prefetch ? settings.prefetch.maxPagesAhead : 0;
+
+            const TMDBServiceProvider provider("bench", settings);
+            std::vector<double> turns;
+
+            for (uint32_t page = 1; page <= PAGES; ++page)
+            {
+                const auto start = Clock::now();
+                const ResponseBuffer body = provider.GetPopularMovies(page);
+                turns.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                pages[prefetch].emplace_back(body.View());
+                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            }
+
+            std::cout << std::left << std::setw(32) << (prefetch ? "list/prefetch ahead" : "list/prefetch off") << std::right << std::fixed << std::setprecision(2)
+                      << " p50 " << std::setw(7) << Percentile(turns, 0.5) << " ms"
+                      << "  p90 " << std::setw(7) << Percentile(turns, 0.9) << " ms per page turn" << std::endl;
+        }
+
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const bool cancelled = provider.GetPopularMovies(PAGES + 1, CancellationToken::WithTimeout(std::chrono::milliseconds{1})).empty();
+        const bool same = !pages[0].front().empty() && pages[0] == pages[1];
+
+        std::cout << std::left << std::setw(32) << "list/prefetch pages" << std::right << " "
+                  << (Check(same) ? "as fetched one by one" : "not as fetched one by one") << ", "
+                  << (Check(cancelled) ? "gives up when cancelled" : "ignores cancellation") << std::endl;
+    }
+
+    constexpr int PAGES_PER_RUN = 1000;
+
+    std::string FetchListPage(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        return std::string{provider.MakeHttpGetRequest(server.GetBaseUrl() + "movie/popular?api_key=bench&language=en-US&page=1").View()};
+    }
+
+    // How Run used to ingest a page: build the whole document, then walk the results
+    void BuildDomAndIngest(const std::string& page)
+    {
+        MovieDatabase database;
+        const auto document = nlohmann::json::parse(page);
+
+        for (const auto& movie : document["results"])
+        {
+            database.AddMovie(movie["title"].get<std::string>(), movie["vote_average"].get<float>());
+        }
+    }
+
+    void IngestDom(const StandInServer& server)
+    {
+        const std::string page = FetchListPage(server);
+
+        Measure("ingest/dom x1000", [&]
+        {
+            for (int i = 0; i < PAGES_PER_RUN; ++i)
+            {
+                BuildDomAndIngest(page);
+            }
+        });
+
+        MeasureAllocations("ingest/dom per page", [&] { BuildDomAndIngest(page); });
+    }
+
+    void IngestProjection(const StandInServer& server)
+    {
+        const std::string page = FetchListPage(server);
+
+        Measure("ingest/projection x1000", [&]
+        {
+            for (int i = 0; i < PAGES_PER_RUN; ++i)
+            {
+                MovieDatabase database;
+                database.AddMoviesFromJson(page);
+            }
+        });
+
+        MeasureAllocations("ingest/projection per page", [&]
+        {
+            MovieDatabase database;
+            database.AddMoviesFromJson(page);
+        });
+    }
+
+    // The same movies in the same order, ratings compared bit for bit
+    template <typename Expected, typename Actual>
+    bool SameMovies(const Expected& expected, const Actual& actual)
+    {
+        return std::equal(expected.begin(), expected.end(), actual.begin(), actual.end(), [](const auto& a, const auto& b)
+        {
+            const float ratings[2] = {a.GetRating(), b.GetRating()};
+            return a.GetId() == b.GetId() && a.GetTitle() == b.GetTitle() && std::memcmp(&ratings[0], &ratings[1], sizeof(float)) == 0;
+        });
+    }
+
+    // A crawl of 40 list pages: one page at a time against the fetch, parse and write stages
+    void IngestCrawl(const StandInServer& server)
+    {
+        constexpr uint32_t PAGES = 40;
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+
+        const auto crawlSequential = [&](MovieDatabase& database)
+        {
+            for (uint32_t page = 1; page <= PAGES; ++page)
+            {
+                const ResponseBuffer body = provider.GetPopularMovies(page);
+                database.AddMoviesFromJson(body.View());
+            }
+        };
+
+        // Each body parsed as it streams in
+        const auto crawlPipelined = [&](MovieDatabase& database, const IngestPipeline::Settings& settings)
+        {
+            IngestPipeline pipeline(settings);
+            pipeline.AddCatalog("popular", database, PAGES, [&provider](uint32_t page, const CancellationToken& cancellation, std::shared_ptr<BodyStream> stream)
+            {
+                provider.StreamPopularMoviesAsync(page, std::move(stream), cancellation);
+            });
+            pipeline.Run();
+        };
+
+        Measure("ingest/crawl sequential", [&]
+        {
+            MovieDatabase database;
+            crawlSequential(database);
+        });
+
+        Measure("ingest/crawl pipelined", [&]
+        {
+            MovieDatabase database;
+            crawlPipelined(database, IngestPipeline::Settings{});
+        });
+
+        // Every stage as narrow as it goes: one parser, pieces paused on past a few KB, and
+        // fetching paused as soon as a page waits on an earlier one
+        IngestPipeline::Settings narrow;
+        narrow.parsers = 1;
+        narrow.queuedBytes = 4096;
+        narrow.parsedPages = 1;
+
+        Measure("ingest/crawl pipelined narrow", [&]
+        {
+            MovieDatabase database;
+            crawlPipelined(database, narrow);
+        });
+
+        MovieDatabase sequential;
+        MovieDatabase pipelined;
+        MovieDatabase narrowed;
+        crawlSequential(sequential);
+        crawlPipelined(pipelined, IngestPipeline::Settings{});
+        crawlPipelined(narrowed, narrow);
+
+        const bool same = pipelined.GetSize() > 0 && SameMovies(sequential.GetMovies(), pipelined.GetMovies()) && SameMovies(sequential.GetMovies(), narrowed.GetMovies());
+
+        std::cout << std::left << std::setw(32) << "ingest/crawl pipelined movies" << std::right << " " << pipelined.GetSize() << ", "
+                  << (Check(same) ? "as crawled one by one" : "not as crawled one by one") << std::endl;
+    }
+
+    // Pages far bigger than the parse queue, so reading pauses and resumes through every one,
+    // plain and gzipped. Gzipped pages are decoded as they arrive, whole or streamed.
+    void IngestLargePages(const StandInServer&)
+    {
+        constexpr uint32_t PAGES = 4;
+        MovieDatabase plain;
+
+        for (const bool gzip : {false, true})
+        {
+            StandInServer::Settings serverSettings;
+            serverSettings.synthetic = true;
+            serverSettings.syntheticResults = 20000;
+            serverSettings.gzip = gzip;
+
+            StandInServer server(serverSettings);
+
+            if (!server.Start())
+            {
+                return;
+            }
+
+            const TMDBServiceProvider provider("bench", ProviderSettings(server));
+            const std::string name = gzip ? "ingest/stream large gzip" : "ingest/stream large pages";
+            MovieDatabase whole;
+            MovieDatabase streamed;
+
+            for (uint32_t page = 1; page <= PAGES; ++page)
+            {
+                whole.AddMoviesFromJson(provider.GetPopularMovies(page).View());
+            }
+
+            Measure(name.c_str(), [&]
+            {
+                streamed = MovieDatabase{};
+                IngestPipeline pipeline(IngestPipeline::Settings{});
+                pipeline.AddCatalog("popular", streamed, PAGES, [&provider](uint32_t page, const CancellationToken& cancellation, std::shared_ptr<BodyStream> stream)
+                {
+                    provider.StreamPopularMoviesAsync(page, std::move(stream), cancellation);
+                });
+                pipeline.Run();
+            });
+
+            if (!gzip)
+            {
+                plain = whole;
+            }
+
+            const bool same = whole.GetSize() > 0 && SameMovies(plain.GetMovies(), whole.GetMovies()) && SameMovies(plain.GetMovies(), streamed.GetMovies());
+
+            std::cout << std::left << std::setw(32) << (gzip ? "ingest/stream large gzip movies" : "ingest/stream large movies") << std::right << " "
+                      << streamed.GetSize() << " movies, " << (Check(same) ? "as sent" : "not as sent") << std::endl;
+        }
+    }
+
+    // An export-sized document: a list page's results over and over, about 10 MB
+    std::string MakeExport(const StandInServer& server)
+    {
+        const auto page = nlohmann::json::parse(FetchListPage(server));
+        auto results = nlohmann::json::array();
+
+        while (results.size() < 20000)
+        {
+            for (const auto& movie : page["results"])
+            {
+                results.push_back(movie);
+            }
+        }
+
+        nlohmann::json document;
+        document["results"] = std::move(results);
+        return document.dump();
+    }
+
+    class CountingVisitor : public JsonProjection::Visitor
+    {
+    public:
+        void OnValue(size_t, const JsonProjection::Value&) override
+        {
+            ++values;
+        }
+
+        size_t values = 0;
+    };
+
+    void JsonIndex(const StandInServer& server)
+    {
+        const std::string document = MakeExport(server);
+        const std::string vectorName = std::string("json/index ") + StructuralIndex::GetVectorKernelName();
+        StructuralIndex index;
+
+        Measure("json/index scalar", [&] { index.Build(document, StructuralIndex::Kernel::Scalar); }, document.size());
+        Measure(vectorName.c_str(), [&] { index.Build(document, StructuralIndex::Kernel::Vector); }, document.size());
+    }
+
+    void JsonExport(const StandInServer& server)
+    {
+        const std::string document = MakeExport(server);
+        const JsonProjection projection({"results[*]", "results[*].id", "results[*].title", "results[*].vote_average"});
+
+        Measure("json/export dom", [&] { BuildDomAndIngest(document); }, document.size());
+
+        Measure("json/export direct", [&]
+        {
+            CountingVisitor visitor;
+            projection.Scan(document, visitor, JsonProjection::Backend::Direct);
+        }, document.size());
+
+        Measure("json/export indexed", [&]
+        {
+            CountingVisitor visitor;
+            projection.Scan(document, visitor, JsonProjection::Backend::Indexed);
+        }, document.size());
+
+        Measure("json/export ingest direct", [&]
+        {
+            MovieDatabase database;
+            database.AddMoviesFromJson(document, JsonProjection::Backend::Direct);
+        }, document.size());
+
+        Measure("json/export ingest indexed", [&]
+        {
+            MovieDatabase database;
+            database.AddMoviesFromJson(document, JsonProjection::Backend::Indexed);
+        }, document.size());
+    }
+
+    using Records = std::vector<std::tuple<std::string, float, uint64_t>>;
+
+    // What AddMoviesFromJson should make of a page, worked out from nlohmann's DOM
+    bool ReferenceRecords(const std::string& page, Records& records)
+    {
+        const auto document = nlohmann::json::parse(page, nullptr, false);
+
+        if (document.is_discarded())
+        {
+            return false;
+        }
+
+        if (!document.is_object() || !document.contains("results") || !document["results"].is_array())
+        {
+            return true;
+        }
+
+        for (const auto& movie : document["results"])
+        {
+            if (!movie.is_object() || !movie.contains("title") || !movie["title"].is_string())
+            {
+                continue;
+            }
+
+            const auto rating = movie.value("vote_average", nlohmann::json());
+            const auto id = movie.value("id", nlohmann::json());
+
+            records.emplace_back(movie["title"].get<std::string>(),
+                                 rating.is_number() ? rating.get<float>() : 0.0f,
+                                 id.is_number_unsigned() ? id.get<uint64_t>() : 0);
+        }
+
+        return true;
+    }
+
+    // Everything a projection reports, so the two backends can be compared value by value
+    class RecordingVisitor : public JsonProjection::Visitor
+    {
+    public:
+        void OnValue(size_t field, const JsonProjection::Value& value) override
+        {
+            events.emplace_back(field, value.text);
+        }
+
+        void OnEnter(size_t field) override
+        {
+            events.emplace_back(field, "{");
+        }
+
+        void OnLeave(size_t field) override
+        {
+            events.emplace_back(field, "}");
+        }
+
+        std::vector<std::pair<size_t, std::string_view>> events;
+    };
+
+    bool Ingest(const std::string& page, JsonProjection::Backend backend, Records& records)
+    {
+        MovieDatabase database;
+        const bool ingested = database.AddMoviesFromJson(page, backend);
+
+        for (const MovieRef movie : database.GetMovies())
+        {
+            records.emplace_back(movie.GetTitle(), movie.GetRating(), movie.GetId());
+        }
+
+        return ingested;
+    }
+
+    // As Ingest, with the page fed to a PageParser `piece` bytes at a time
+    bool IngestStreamed(const std::string& page, JsonProjection::Backend backend, size_t piece, Records& records)
+    {
+        MovieDatabase::PageParser parser(backend);
+        MovieList movies;
+
+        for (size_t offset = 0; offset < page.size(); offset += piece)
+        {
+            parser.Feed(std::string_view(page).substr(offset, piece));
+        }
+
+        if (!parser.Finish(movies))
+        {
+            return false;
+        }
+
+        for (const Movie& movie : movies)
+        {
+            records.emplace_back(movie.GetTitle(), movie.GetRating(), movie.GetId());
+        }
+
+        return true;
+    }
+
+    bool Agrees(const JsonProjection& projection, const std::string& page)
+    {
+        Records expected;
+        Records direct;
+        Records indexed;
+        const bool valid = ReferenceRecords(page, expected);
+        const bool ingestedDirect = Ingest(page, JsonProjection::Backend::Direct, direct);
+        const bool ingestedIndexed = Ingest(page, JsonProjection::Backend::Indexed, indexed);
+
+        // A byte at a time splits every token somewhere; 1000 keeps most results whole
+        Records bytewise;
+        Records piecewise;
+        const bool streamedBytewise = IngestStreamed(page, JsonProjection::Backend::Direct, 1, bytewise);
+        const bool streamedPiecewise = IngestStreamed(page, JsonProjection::Backend::Indexed, 1000, piecewise);
+
+        RecordingVisitor directEvents;
+        RecordingVisitor indexedEvents;
+        const bool scannedDirect = projection.Scan(page, directEvents, JsonProjection::Backend::Direct);
+        const bool scannedIndexed = projection.Scan(page, indexedEvents, JsonProjection::Backend::Indexed);
+
+        // On malformed input the backends may stop at different places; both must fail
+        if (!valid)
+        {
+            return !ingestedDirect && !ingestedIndexed && !scannedDirect && !scannedIndexed && !streamedBytewise && !streamedPiecewise;
+        }
+
+        return ingestedDirect && direct == expected && ingestedIndexed && indexed == expected
+            && streamedBytewise && bytewise == expected && streamedPiecewise && piecewise == expected
+            && scannedDirect && scannedIndexed && directEvents.events == indexedEvents.events;
+    }
+
+    // Both projection backends, whole and streamed, against nlohmann, on list pages and every
+    // 97th truncation of them. Run it with a fixture directory to check recorded TMDB responses.
+    void JsonDifferential(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const JsonProjection projection({"results[*]", "results[*].id", "results[*].title", "results[*].vote_average", "results[*].genre_ids", "total_pages"});
+
+        size_t documents = 0;
+        size_t mismatches = 0;
+
+        for (uint32_t page = 1; page <= 10; ++page)
+        {
+            for (const auto& body : {provider.GetPopularMovies(page), provider.GetNowPlayingMovies(page)})
+            {
+                const std::string text{body.View()};
+
+                for (size_t length = 0; length < text.size(); length += 97)
+                {
+                    ++documents;
+                    mismatches += Agrees(projection, text.substr(0, length)) ? 0 : 1;
+                }
+
+                ++documents;
+                mismatches += Agrees(projection, text) ? 0 : 1;
+            }
+        }
+
+        std::cout << std::left << std::setw(32) << "json/differential" << std::right
+                  << " " << documents << " documents, " << mismatches << " mismatches" << std::endl;
+        Check(mismatches == 0);
+    }
+
+    // Stops the compiler from dropping a result nothing reads
+    template <typename T>
+    void Keep(const T& value)
+    {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    // One field's values from list pages, decoded by `baseline` and then by JsonProjection.
+    // Run it with a fixture directory to decode recorded TMDB pages.
+    template <typename T>
+    void MeasureDecode(const std::string& name, JsonProjection::Kind kind, const std::vector<std::string>& values,
+                       const std::function<void(const std::string& value)>& baseline)
+    {
+        constexpr int REPEATS = 100;
+        size_t bytes = 0;
+
+        for (const auto& value : values)
+        {
+            bytes += value.size() * REPEATS;
+        }
+
+        Measure(name.c_str(), [&]
+        {
+            for (int i = 0; i < REPEATS; ++i)
+            {
+                for (const auto& value : values)
+                {
+                    baseline(value);
+                }
+            }
+        }, bytes);
+
+        const std::string projected = name.substr(0, name.rfind(' ')) + " projection";
+
+        Measure(projected.c_str(), [&]
+        {
+            T decoded{};
+
+            for (int i = 0; i < REPEATS; ++i)
+            {
+                for (const auto& value : values)
+                {
+                    const JsonProjection::Value raw{kind, value};
+
+                    if constexpr (std::is_same_v<T, std::string>)
+                    {
+                        Keep(raw.GetString(decoded));
+                    }
+                    else
+                    {
+                        Keep(raw.GetNumber(decoded));
+                    }
+
+                    Keep(decoded);
+                }
+            }
+        }, bytes);
+    }
+
+    void JsonDecode(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const JsonProjection projection({"results[*].id", "results[*].title", "results[*].vote_average"});
+
+        std::vector<std::string> values[3];
+
+        for (uint32_t page = 1; page <= 10; ++page)
+        {
+            for (const auto& body : {provider.GetPopularMovies(page), provider.GetNowPlayingMovies(page)})
+            {
+                RecordingVisitor visitor;
+                projection.Scan(body.View(), visitor);
+
+                for (const auto& [field, text] : visitor.events)
+                {
+                    values[field].emplace_back(text);
+                }
+            }
+        }
+
+        // Against nlohmann's lexer and conversion for strings, and plain from_chars for numbers
+        MeasureDecode<std::string>("json/decode title nlohmann", JsonProjection::Kind::String, values[1], [](const std::string& value)
+        {
+            Keep(nlohmann::json::parse('"' + value + '"').get<std::string>());
+        });
+
+        MeasureDecode<double>("json/decode rating from_chars", JsonProjection::Kind::Number, values[2], [](const std::string& value)
+        {
+            double decoded;
+            Keep(std::from_chars(value.data(), value.data() + value.size(), decoded).ec);
+            Keep(decoded);
+        });
+
+        MeasureDecode<uint64_t>("json/decode id from_chars", JsonProjection::Kind::Number, values[0], [](const std::string& value)
+        {
+            uint64_t decoded;
+            Keep(std::from_chars(value.data(), value.data() + value.size(), decoded).ec);
+            Keep(decoded);
+        });
+    }
+
+    // Awkward on purpose: ids far enough apart to need 64-bit deltas, repeated ids and
+    // titles, and a block of ratings that thousandths can't hold, so an archive keeps them raw
+    MovieDatabase EdgeCaseCatalog()
+    {
+        MovieList movies;
+
+        // One past three full blocks, so the last block steps from an ordinary id to the largest
+        for (uint64_t i = 0; i < 3 * CatalogArchive::BLOCK_ROWS + 1; ++i)
+        {
+            const float rating = i < CatalogArchive::BLOCK_ROWS ? static_cast<float>(i % 100) / 10.0f : static_cast<float>(i) / 7.0f;
+            movies.emplace_back("Title " + std::to_string(i % 500), rating, 1 + i / 3);
+        }
+
+        movies.emplace_back("Far away", 9.9f, UINT64_MAX);
+        movies.emplace_back("Near by", 9.9f, 2);
+        movies.emplace_back("Title 7", 9.9f, UINT64_MAX);
+
+        MovieDatabase database;
+        database.AddMovies(std::move(movies));
+        return database;
+    }
+
+    // Whether `loaded` holds what `database` does, and sorts it the same way
+    bool SameCatalog(const MovieDatabase& database, const MovieDatabase& loaded)
+    {
+        return SameMovies(database.GetMovies(), loaded.GetMovies())
+            && SameMovies(database.GetMoviesSortedByTitle(), loaded.GetMoviesSortedByTitle())
+            && SameMovies(database.GetMoviesSortedByRating(), loaded.GetMoviesSortedByRating());
+    }
+
+    // Every `stride`th movie found by id as the first one saved with that id, and every
+    // movie rated at least `minimum` visited in id order, ties in the order they were saved
+    bool SameQueries(const MovieDatabase& database, const CatalogArchive& archive, size_t stride, float minimum)
+    {
+        std::unordered_map<uint64_t, MovieRef> firstById;
+        std::vector<std::pair<uint64_t, float>> expected;
+        const MovieView movies = database.GetMovies();
+
+        for (const MovieRef movie : movies)
+        {
+            firstById.emplace(movie.GetId(), movie);
+
+            if (movie.GetRating() >= minimum)
+            {
+                expected.emplace_back(movie.GetId(), movie.GetRating());
+            }
+        }
+
+        std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        size_t index = 0;
+
+        for (const MovieRef movie : movies)
+        {
+            Movie found;
+
+            if (index++ % stride == 0
+                && (!archive.FindById(movie.GetId(), found) || !SameMovies(MovieList{Movie{firstById[movie.GetId()]}}, MovieList{found})))
+            {
+                return false;
+            }
+        }
+
+        std::vector<std::pair<uint64_t, float>> visited;
+        archive.ForEachRatedAtLeast(minimum, [&visited](uint64_t id, float rating) { visited.emplace_back(id, rating); });
+
+        return visited == expected;
+    }
+
+    // A catalog saved by `save` and read back by `load`, checked against the original
+    template <typename Save, typename Load>
+    void ReportRoundTrip(const char* name, const MovieDatabase& database, const std::string& path, Save save, Load load)
+    {
+        MovieDatabase loaded;
+        const bool same = Check((database.*save)(path) && (loaded.*load)(path) && SameCatalog(database, loaded));
+
+        std::cout << std::left << std::setw(32) << name << std::right << " " << database.GetSize() << " movies, "
+                  << (same ? "as saved" : "not as saved") << std::endl;
+    }
+
+    // Cold start from a million-movie catalog saved the last time round
+    void SnapshotLoad(const StandInServer&)
+    {
+        constexpr size_t MOVIES = 1000000;
+
+        MovieList movies;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            movies.emplace_back("Movie number " + std::to_string(i * 7919 % MOVIES), static_cast<float>(i % 100) / 10.0f, i + 1);
+        }
+
+        MovieDatabase database;
+        database.AddMovies(std::move(movies));
+
+        const std::string path = (std::filesystem::temp_directory_path() / "streamflix-bench.snapshot").string();
+
+        Measure("snapshot/save 1M", [&] { database.SaveSnapshot(path); });
+
+        MovieDatabase loaded;
+
+        Measure("snapshot/load 1M", [&] { Keep(loaded.LoadSnapshot(path)); });
+
+        // As StreamFlix::Run starts from a snapshot: load it, then list every movie in
+        // catalog, title and rating order
+        Measure("snapshot/cold start 1M", [&]
+        {
+            MovieDatabase started;
+            started.LoadSnapshot(path);
+
+            size_t bytes = 0;
+
+            for (const MovieView& movies : {started.GetMovies(), started.GetMoviesSortedByTitle(), started.GetMoviesSortedByRating()})
+            {
+                for (const MovieRef movie : movies)
+                {
+                    bytes += movie.GetTitle().size();
+                }
+            }
+
+            Keep(bytes);
+        });
+
+        Measure("snapshot/by title sorted 1M", [&] { Keep(database.GetMoviesSortedByTitle()); });
+        Measure("snapshot/by title loaded 1M", [&] { Keep(loaded.GetMoviesSortedByTitle()); });
+
+        ReportRoundTrip("snapshot/round trip 1M", database, path, &MovieDatabase::SaveSnapshot, &MovieDatabase::LoadSnapshot);
+        ReportRoundTrip("snapshot/round trip edge cases", EdgeCaseCatalog(), path, &MovieDatabase::SaveSnapshot, &MovieDatabase::LoadSnapshot);
+
+        // Changes to a loaded catalog copy the blocks they touch out of the mapping, and
+        // leave the rest, and the file, as they were
+        MovieDatabase changed = EdgeCaseCatalog();
+        changed.SaveSnapshot(path);
+        loaded.LoadSnapshot(path);
+
+        for (MovieDatabase* database : {&changed, &loaded})
+        {
+            database->UpsertMovie(Movie{"Changed", 1.0f, 2});
+            database->AddMovie(Movie{"Added", 2.0f, 5000});
+        }
+
+        MovieDatabase reloaded;
+        const bool same = Check(SameCatalog(changed, loaded) && reloaded.LoadSnapshot(path) && SameCatalog(EdgeCaseCatalog(), reloaded));
+
+        std::cout << std::left << std::setw(32) << "snapshot/change after load" << std::right << " " << loaded.GetSize() << " movies, "
+                  << (same ? "as changed, file as saved" : "not as changed") << std::endl;
+
+        std::filesystem::remove(path);
+    }
+
+    // The same million movies archived instead: TMDB-like ids with gaps, ratings to a tenth,
+    // and titles that share prefixes, as real ones do
+    void ArchiveLoad(const StandInServer&)
+    {
+        constexpr size_t MOVIES = 1000000;
+
+        MovieList movies;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            movies.emplace_back("Movie number " + std::to_string(i * 7919 % MOVIES), static_cast<float>(i % 100) / 10.0f, 11 + i * 3 + i % 2);
+        }
+
+        MovieDatabase database;
+        database.AddMovies(std::move(movies));
+
+        const std::string snapshotPath = (std::filesystem::temp_directory_path() / "streamflix-bench.snapshot").string();
+        const std::string archivePath = (std::filesystem::temp_directory_path() / "streamflix-bench.archive").string();
+
+        database.SaveSnapshot(snapshotPath);
+        Measure("archive/save 1M", [&] { database.SaveArchive(archivePath); });
+
+        std::cout << "    snapshot " << std::filesystem::file_size(snapshotPath) / 1024 << " KiB, archive "
+                  << std::filesystem::file_size(archivePath) / 1024 << " KiB" << std::endl;
+
+        MovieDatabase loaded;
+
+        Measure("archive/load snapshot 1M", [&] { loaded.LoadSnapshot(snapshotPath); });
+        Measure("archive/load archive 1M", [&] { loaded.LoadArchive(archivePath); });
+
+        CatalogArchive archive;
+        archive.Open(archivePath);
+
+        Measure("archive/find by id x1000", [&]
+        {
+            Movie movie;
+
+            for (uint64_t i = 0; i < 1000; ++i)
+            {
+                Keep(archive.FindById(11 + i * 2999, movie));
+            }
+        });
+
+        Measure("archive/rated 9.5 or more 1M", [&]
+        {
+            size_t count = 0;
+            archive.ForEachRatedAtLeast(9.5f, [&count](uint64_t, float) { ++count; });
+            Keep(count);
+        });
+
+        ReportRoundTrip("archive/round trip 1M", database, archivePath, &MovieDatabase::SaveArchive, &MovieDatabase::LoadArchive);
+        std::cout << "    queries " << (Check(SameQueries(database, archive, 997, 9.5f)) ? "as saved" : "not as saved") << std::endl;
+
+        const MovieDatabase edgeCases = EdgeCaseCatalog();
+        ReportRoundTrip("archive/round trip edge cases", edgeCases, archivePath, &MovieDatabase::SaveArchive, &MovieDatabase::LoadArchive);
+
+        CatalogArchive edgeArchive;
+        const bool opened = edgeArchive.Open(archivePath);
+        std::cout << "    queries " << (Check(opened && SameQueries(edgeCases, edgeArchive, 1, 200.0f) && SameQueries(edgeCases, edgeArchive, 1, 0.5f)) ? "as saved" : "not as saved") << std::endl;
+
+        std::filesystem::remove(snapshotPath);
+        std::filesystem::remove(archivePath);
+    }
+
+    // Many small tasks, each a thread of its own against the shared scheduler, and a million
+    // titles sorted on one thread against sorted on the scheduler
+    void TasksSchedule(const StandInServer&)
+    {
+        constexpr size_t TASKS = 10000;
+
+        const auto work = [](size_t seed)
+        {
+            uint64_t value = seed;
+
+            for (int i = 0; i < 2000; ++i)
+            {
+                value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+            }
+
+            Keep(value);
+        };
+
+        std::cout << "    " << TaskScheduler::GetShared().GetWorkerCount() << " workers" << std::endl;
+
+        Measure("tasks/thread per task 10k", [&]
+        {
+            std::vector<std::thread> threads;
+
+            for (size_t task = 0; task < TASKS; ++task)
+            {
+                threads.emplace_back([&work, task] { work(task); });
+            }
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        });
+
+        Measure("tasks/scheduler 10k", [&]
+        {
+            TaskGroup group;
+
+            for (size_t task = 0; task < TASKS; ++task)
+            {
+                group.Run([&work, task] { work(task); });
+            }
+
+            group.Wait();
+        });
+
+        // Each continuation once, after every task before it, and before Wait returns
+        constexpr size_t ROUNDS = 100;
+        size_t misplaced = 0;
+
+        for (size_t round = 0; round < ROUNDS; ++round)
+        {
+            std::atomic<size_t> finished{0};
+            std::atomic<size_t> early{0};
+            std::atomic<size_t> continued{0};
+
+            TaskGroup group;
+
+            for (size_t task = 0; task < TASKS / ROUNDS; ++task)
+            {
+                group.Run([&, task] { work(task); ++finished; });
+            }
+
+            for (int continuation = 0; continuation < 2; ++continuation)
+            {
+                group.Then([&]
+                {
+                    early += finished != TASKS / ROUNDS;
+                    ++continued;
+                });
+            }
+
+            group.Wait();
+            misplaced += early + (continued != 2);
+        }
+
+        std::cout << std::left << std::setw(32) << "tasks/continuations" << std::right << " " << ROUNDS << " groups, "
+                  << (Check(misplaced == 0) ? "once each after their tasks" : "not once each after their tasks") << std::endl;
+
+        constexpr size_t MOVIES = 1000000;
+
+        std::vector<std::string> titles;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            titles.push_back("Movie number " + std::to_string(i * 7919 % MOVIES));
+        }
+
+        std::vector<const std::string*> order;
+        const auto byTitle = [](const std::string* a, const std::string* b) { return *a < *b; };
+
+        const auto reset = [&]
+        {
+            order.clear();
+
+            for (const std::string& title : titles)
+            {
+                order.push_back(&title);
+            }
+        };
+
+        Measure("tasks/stable sort 1M", [&]
+        {
+            reset();
+            std::stable_sort(order.begin(), order.end(), byTitle);
+        });
+
+        Measure("tasks/parallel stable sort 1M", [&]
+        {
+            reset();
+            ParallelSort::StableSort(order.begin(), order.end(), byTitle);
+        });
+    }
+
+    // A flatbuffer laid out front to back, each reference patched in by Refer once what it
+    // points at is written. Kept apart from CatalogArrow's own, so that files built with it
+    // check the reader against the format rather than against its writer.
+    class FlatFixture
+    {
+    public:
+        FlatFixture() : bytes(sizeof(uint32_t), '\0') {}
+
+        template <typename T>
+        static std::string Scalar(T value)
+        {
+            return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        // Each slot's bytes, empty where the field is absent; where each went is left in `at`
+        size_t Table(const std::vector<std::string>& fields, std::vector<size_t>& at)
+        {
+            Pad(sizeof(uint16_t));
+            const size_t vtable = bytes.size();
+            bytes.resize(vtable + (2 + fields.size()) * sizeof(uint16_t));
+
+            Pad(sizeof(uint64_t));
+            const size_t table = bytes.size();
+            bytes += Scalar(static_cast<int32_t>(table - vtable));
+            at.assign(fields.size(), 0);
+
+            for (size_t slot = 0; slot < fields.size(); ++slot)
+            {
+                if (!fields[slot].empty())
+                {
+                    Pad(fields[slot].size());
+                    Put(vtable + (2 + slot) * sizeof(uint16_t), static_cast<uint16_t>(bytes.size() - table));
+                    at[slot] = bytes.size();
+                    bytes += fields[slot];
+                }
+            }
+
+            Put(vtable, static_cast<uint16_t>((2 + fields.size()) * sizeof(uint16_t)));
+            Put(vtable + sizeof(uint16_t), static_cast<uint16_t>(bytes.size() - table));
+            return table;
+        }
+
+        size_t String(std::string_view text)
+        {
+            Pad(sizeof(uint32_t));
+            const size_t position = bytes.size();
+            bytes += Scalar(static_cast<uint32_t>(text.size()));
+            bytes += text;
+            bytes += '\0';
+            return position;
+        }
+
+        // Structs of 8-byte fields, so the elements start 8-byte aligned
+        size_t Structs(const std::string& elements, uint32_t count)
+        {
+            Pad(sizeof(uint64_t));
+            bytes += Scalar(uint32_t{0});
+            const size_t position = bytes.size();
+            bytes += Scalar(count);
+            bytes += elements;
+            return position;
+        }
+
+        size_t References(uint32_t count, std::vector<size_t>& at)
+        {
+            Pad(sizeof(uint32_t));
+            const size_t position = bytes.size();
+            bytes += Scalar(count);
+            at.clear();
+
+            for (uint32_t element = 0; element < count; ++element)
+            {
+                at.push_back(bytes.size());
+                bytes += Scalar(uint32_t{0});
+            }
+
+            return position;
+        }
+
+        void Refer(size_t from, size_t to)
+        {
+            Put(from, static_cast<uint32_t>(to - from));
+        }
+
+        std::string Finish(size_t root)
+        {
+            Refer(0, root);
+            Pad(sizeof(uint64_t));
+            return std::move(bytes);
+        }
+
+    private:
+        void Pad(size_t alignment)
+        {
+            bytes.resize((bytes.size() + alignment - 1) / alignment * alignment, '\0');
+        }
+
+        template <typename T>
+        void Put(size_t position, T value)
+        {
+            std::memcpy(&bytes[position], &value, sizeof(T));
+        }
+
+        std::string bytes;
+    };
+
+    // An Arrow file as another tool might write it: a column more, the columns in another
+    // order, int64 ids, utf8 titles with 32-bit offsets and float64 ratings, in two batches
+    std::string ForeignArrow(const MovieView& movies, size_t firstBatch)
+    {
+        using F = FlatFixture;
+
+        static constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+        static constexpr int16_t METADATA_V5 = 4;
+        static constexpr uint8_t SCHEMA = 1;
+        static constexpr uint8_t RECORD_BATCH = 3;
+        static constexpr uint8_t INT = 2;
+        static constexpr uint8_t FLOATING_POINT = 3;
+        static constexpr uint8_t UTF8 = 5;
+        static constexpr int16_t DOUBLE = 2;
+
+        // Schema.fbs, each field nullable with no children
+        const auto schema = [](F& flat)
+        {
+            const std::tuple<const char*, uint8_t, std::vector<std::string>> columns[] = {
+                {"rating", FLOATING_POINT, {F::Scalar(DOUBLE)}},
+                {"year", INT, {F::Scalar(int32_t{32}), F::Scalar(true)}},
+                {"title", UTF8, {}},
+                {"id", INT, {F::Scalar(int32_t{64}), F::Scalar(true)}},
+            };
+
+            std::vector<size_t> at;
+            std::vector<size_t> fields;
+            const size_t table = flat.Table({F::Scalar(int16_t{0}), F::Scalar(uint32_t{0})}, at);
+            flat.Refer(at[1], flat.References(static_cast<uint32_t>(std::size(columns)), fields));
+
+            for (size_t column = 0; column < std::size(columns); ++column)
+            {
+                const auto& [name, type, parameters] = columns[column];
+                flat.Refer(fields[column], flat.Table({F::Scalar(uint32_t{0}), F::Scalar(true), F::Scalar(type), F::Scalar(uint32_t{0}), "", F::Scalar(uint32_t{0})}, at));
+
+                const std::vector<size_t> references = at;
+                std::vector<size_t> none;
+                flat.Refer(references[0], flat.String(name));
+                flat.Refer(references[3], flat.Table(parameters, at));
+                flat.Refer(references[5], flat.References(0, none));
+            }
+
+            return table;
+        };
+
+        const auto message = [](uint8_t header, int64_t bodyLength, const std::function<size_t(F&)>& write)
+        {
+            F flat;
+            std::vector<size_t> at;
+            const size_t table = flat.Table({F::Scalar(METADATA_V5), F::Scalar(header), F::Scalar(uint32_t{0}), F::Scalar(bodyLength)}, at);
+            flat.Refer(at[2], write(flat));
+            return flat.Finish(table);
+        };
+
+        const auto frame = [](const std::string& metadata)
+        {
+            return F::Scalar(CONTINUATION) + F::Scalar(static_cast<int32_t>(metadata.size())) + metadata;
+        };
+
+        std::string file = "ARROW1";
+        file.resize(8, '\0');
+        file += frame(message(SCHEMA, 0, schema));
+
+        std::string blocks;
+        const std::vector<Movie> rows(movies.begin(), movies.end());
+
+        for (size_t first = 0; first < rows.size(); first = std::min(rows.size(), first + firstBatch))
+        {
+            const size_t last = std::min(rows.size(), first + firstBatch);
+            std::string values[4];
+            std::string titles;
+            values[2] = F::Scalar(int32_t{0});
+
+            for (size_t row = first; row < last; ++row)
+            {
+                titles += rows[row].GetTitle();
+                values[0] += F::Scalar(static_cast<double>(rows[row].GetRating()));
+                values[1] += F::Scalar(static_cast<int32_t>(1950 + row % 75));
+                values[2] += F::Scalar(static_cast<int32_t>(titles.size()));
+                values[3] += F::Scalar(static_cast<int64_t>(rows[row].GetId()));
+            }
+
+            // Each column an empty validity bitmap and its values, the titles' after their offsets
+            std::string body;
+            std::string buffers;
+            std::string nodes;
+
+            const auto place = [&](const std::string& buffer)
+            {
+                buffers += F::Scalar(static_cast<int64_t>(body.size())) + F::Scalar(static_cast<int64_t>(buffer.size()));
+                body += buffer;
+                body.resize((body.size() + 7) / 8 * 8, '\0');
+            };
+
+            for (size_t column = 0; column < std::size(values); ++column)
+            {
+                nodes += F::Scalar(static_cast<int64_t>(last - first)) + F::Scalar(int64_t{0});
+                place("");
+                place(values[column]);
+
+                if (column == 2)
+                {
+                    place(titles);
+                }
+            }
+
+            const std::string metadata = frame(message(RECORD_BATCH, static_cast<int64_t>(body.size()), [&](F& flat)
+            {
+                std::vector<size_t> at;
+                const size_t batch = flat.Table({F::Scalar(static_cast<int64_t>(last - first)), F::Scalar(uint32_t{0}), F::Scalar(uint32_t{0})}, at);
+                flat.Refer(at[1], flat.Structs(nodes, static_cast<uint32_t>(std::size(values))));
+                flat.Refer(at[2], flat.Structs(buffers, static_cast<uint32_t>(std::size(values) * 2 + 1)));
+                return batch;
+            }));
+
+            blocks += F::Scalar(static_cast<int64_t>(file.size())) + F::Scalar(static_cast<int32_t>(metadata.size())) + F::Scalar(int32_t{0})
+                + F::Scalar(static_cast<int64_t>(body.size()));
+            file += metadata + body;
+        }
+
+        // File.fbs: the schema again, and where each batch is
+        F flat;
+        std::vector<size_t> at;
+        const size_t table = flat.Table({F::Scalar(METADATA_V5), F::Scalar(uint32_t{0}), "", F::Scalar(uint32_t{0})}, at);
+        const std::vector<size_t> references = at;
+        flat.Refer(references[1], schema(flat));
+        flat.Refer(references[3], flat.Structs(blocks, static_cast<uint32_t>(blocks.size() / 24)));
+        const std::string footer = flat.Finish(table);
+
+        return file + F::Scalar(CONTINUATION) + F::Scalar(int32_t{0}) + footer + F::Scalar(static_cast<int32_t>(footer.size())) + "ARROW1";
+    }
+
+    // The same million movies handed to analytics tools: printed as the console shows them,
+    // for them to parse back, against an Arrow file they read in place
+    void ArrowExport(const StandInServer&)
+    {
+        constexpr size_t MOVIES = 1000000;
+
+        MovieList movies;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            movies.emplace_back("Movie number " + std::to_string(i * 7919 % MOVIES), static_cast<float>(i % 100) / 10.0f, i + 1);
+        }
+
+        MovieDatabase database;
+        database.AddMovies(std::move(movies));
+
+        const std::string path = (std::filesystem::temp_directory_path() / "streamflix-bench.arrow").string();
+
+        Measure("arrow/console text 1M", [&]
+        {
+            std::ostringstream text;
+
+            for (const MovieRef movie : database.GetMovies())
+            {
+                text << movie.GetTitle() << " | " << movie.GetRating() << "\n";
+            }
+
+            Keep(text.str().size());
+        });
+
+        Measure("arrow/save 1M", [&] { Keep(database.SaveArrow(path)); });
+
+        std::cout << "    " << std::filesystem::file_size(path) / 1024 << " KiB" << std::endl;
+
+        Measure("arrow/open 1M", [&]
+        {
+            CatalogArrow arrow;
+            Keep(arrow.Open(path));
+        });
+
+        CatalogArrow arrow;
+        arrow.Open(path);
+
+        Measure("arrow/mean rating 1M", [&]
+        {
+            double total = 0;
+
+            for (size_t movie = 0; movie < arrow.GetSize(); ++movie)
+            {
+                total += arrow.GetRating(movie);
+            }
+
+            Keep(total / static_cast<double>(arrow.GetSize()));
+        });
+
+        MovieDatabase loaded;
+
+        Measure("arrow/load 1M", [&] { Keep(loaded.LoadArrow(path)); });
+
+        ReportRoundTrip("arrow/round trip 1M", database, path, &MovieDatabase::SaveArrow, &MovieDatabase::LoadArrow);
+
+        const MovieDatabase edgeCases = EdgeCaseCatalog();
+        ReportRoundTrip("arrow/round trip edge cases", edgeCases, path, &MovieDatabase::SaveArrow, &MovieDatabase::LoadArrow);
+
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << ForeignArrow(edgeCases.GetMovies(), 2000);
+        const bool same = Check(loaded.LoadArrow(path) && SameCatalog(edgeCases, loaded));
+
+        std::cout << std::left << std::setw(32) << "arrow/load other writer" << std::right << " " << edgeCases.GetSize()
+                  << " movies in 2 batches, " << (same ? "as written" : "not as written") << std::endl;
+
+        std::filesystem::remove(path);
+    }
+
+    // A million-movie catalog published for worker processes, which each attach to it in
+    // place of loading their own copy
+    void SharedAttach(const StandInServer&)
+    {
+        constexpr size_t MOVIES = 1000000;
+
+        MovieList movies;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            movies.emplace_back("Movie number " + std::to_string(i * 7919 % MOVIES), static_cast<float>(i % 100) / 10.0f, i + 1);
+        }
+
+        MovieDatabase database;
+        database.AddMovies(std::move(movies));
+
+        const MovieView view = database.GetMovies();
+        const std::string name = "streamflix-bench-" + std::to_string(::getpid());
+        SharedCatalog loader(name);
+
+        Measure("shared/publish 1M", [&] { Keep(loader.Publish(view)); });
+
+        Measure("shared/attach 1M", [&]
+        {
+            SharedCatalog worker(name);
+            Keep(worker.Refresh());
+        });
+
+        SharedCatalog worker(name);
+        worker.Refresh();
+
+        Measure("shared/refresh unchanged", [&] { Keep(worker.Refresh()); });
+
+        Measure("shared/publish and switch 1M", [&]
+        {
+            loader.Publish(view);
+            Keep(worker.Refresh());
+        });
+
+        MovieDatabase copy;
+
+        Measure("shared/own copy 1M", [&]
+        {
+            copy = MovieDatabase{};
+            copy.AddMovies(MovieList(view.begin(), view.end()));
+        });
+
+        // The worker reads what was published and moves on at the next Publish, while a
+        // database still serving the generation before reads it as it was, unlinked or not
+        MovieDatabase attached;
+        attached.ServeSnapshot(worker.GetCatalog());
+        const bool published = Check(SameCatalog(database, attached));
+
+        const MovieDatabase edgeCases = EdgeCaseCatalog();
+        const uint64_t before = worker.GetGeneration();
+        loader.Publish(edgeCases.GetMovies());
+
+        MovieDatabase switched;
+        const bool refreshed = Check(worker.Refresh() && worker.GetGeneration() == before + 1);
+        switched.ServeSnapshot(worker.GetCatalog());
+        const bool current = Check(SameCatalog(edgeCases, switched));
+        const bool kept = Check(SameCatalog(database, attached));
+
+        std::cout << std::left << std::setw(32) << "shared/round trip 1M" << std::right << " " << attached.GetSize() << " movies, "
+                  << (published ? "as published" : "not as published") << std::endl;
+        std::cout << "    " << (refreshed && current ? "switched on publish" : "not switched on publish") << ", old generation "
+                  << (kept ? "still readable" : "lost") << std::endl;
+
+        loader.Unpublish();
+
+        // Catalogs published together are only ever attached together
+        SharedCatalog pairLoader(name + "-pair", 2);
+        SharedCatalog pairWorker(name + "-pair", 2);
+        pairLoader.Publish({view, edgeCases.GetMovies()});
+        pairWorker.Refresh();
+        pairLoader.Publish({edgeCases.GetMovies(), view});
+        pairWorker.Refresh();
+
+        MovieDatabase first;
+        MovieDatabase second;
+        first.ServeSnapshot(pairWorker.GetCatalog(0));
+        second.ServeSnapshot(pairWorker.GetCatalog(1));
+        const bool paired = Check(pairWorker.GetGeneration() == 2 && SameCatalog(edgeCases, first) && SameCatalog(database, second));
+
+        std::cout << std::left << std::setw(32) << "shared/pair" << std::right << " "
+                  << (paired ? "switched together" : "not switched together") << std::endl;
+
+        pairLoader.Unpublish();
+    }
+
+    // Ingest of 400 list pages of 20 movies into a MovieDatabase, then into a CatalogStore
+    // from one writer and from eight, whose syncs are shared through group commit
+    void LogIngest(const StandInServer&)
+    {
+        constexpr size_t PAGES = 400;
+        constexpr size_t PAGE_SIZE = 20;
+
+        const auto page = [](size_t number)
+        {
+            MovieList movies;
+
+            for (size_t i = 0; i < PAGE_SIZE; ++i)
+            {
+                const uint64_t id = number * PAGE_SIZE + i + 1;
+                movies.emplace_back("Movie number " + std::to_string(id), static_cast<float>(id % 100) / 10.0f, id);
+            }
+
+            return movies;
+        };
+
+        Measure("wal/ingest in memory", [&]
+        {
+            MovieDatabase database;
+
+            for (size_t number = 0; number < PAGES; ++number)
+            {
+                database.AddMovies(page(number));
+            }
+        });
+
+        const auto directory = std::filesystem::temp_directory_path() / "streamflix-bench-catalog";
+
+        for (const size_t writers : {1, 8})
+        {
+            const std::string name = "wal/ingest durable x" + std::to_string(writers);
+
+            Measure(name.c_str(), [&]
+            {
+                std::filesystem::remove_all(directory);
+                CatalogStore store(directory.string());
+                store.Open();
+
+                std::atomic<size_t> next{0};
+                std::vector<std::thread> threads;
+
+                for (size_t t = 0; t < writers; ++t)
+                {
+                    threads.emplace_back([&]
+                    {
+                        for (size_t number = next++; number < PAGES; number = next++)
+                        {
+                            store.AddMovies(page(number));
+                        }
+                    });
+                }
+
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+            });
+        }
+
+        // Recovery: a log torn inside its last record reopens to every movie before it, and
+        // goes on taking changes after them
+        std::filesystem::remove_all(directory);
+        MovieList written;
+
+        {
+            CatalogStore store(directory.string());
+            store.Open();
+
+            for (size_t number = 0; number < PAGES; ++number)
+            {
+                store.AddMovies(page(number));
+            }
+
+            store.Read([&written](const MovieDatabase& database)
+            {
+                const MovieView movies = database.GetMovies();
+                written = MovieList(movies.begin(), movies.end());
+            });
+        }
+
+        const auto log = directory / "catalog-0.wal";
+        std::filesystem::resize_file(log, std::filesystem::file_size(log) - 3);
+        written.pop_back();
+
+        MovieList recovered;
+        bool reopenRefused = false;
+
+        {
+            CatalogStore store(directory.string());
+            store.Open();
+            reopenRefused = !store.Open();
+            store.AddMovie(Movie("Added after recovery", 5.0f, 1));
+            written.emplace_back("Added after recovery", 5.0f, 1);
+        }
+
+        {
+            CatalogStore store(directory.string());
+            store.Open();
+
+            store.Read([&recovered](const MovieDatabase& database)
+            {
+                const MovieView movies = database.GetMovies();
+                recovered = MovieList(movies.begin(), movies.end());
+            });
+        }
+
+        std::cout << std::left << std::setw(32) << "wal/recover torn record" << std::right << " " << recovered.size() << " movies, "
+                  << (Check(SameMovies(written, recovered)) ? "as written" : "not as written") << ", second Open " << (Check(reopenRefused) ? "refused" : "accepted") << std::endl;
+
+        // Compactions, on the store's own thread and forced, while eight writers go on: each
+        // rotates the log under them, and what they wrote either side must all come back
+        std::filesystem::remove_all(directory);
+        CatalogStore::Settings compacting;
+        compacting.compactionThreshold = 16 * 1024;
+        size_t compactions = 0;
+
+        {
+            CatalogStore store(directory.string(), compacting);
+            store.Open();
+
+            std::atomic<size_t> next{0};
+            std::vector<std::thread> threads;
+
+            for (size_t t = 0; t < 8; ++t)
+            {
+                threads.emplace_back([&]
+                {
+                    for (size_t number = next++; number < PAGES; number = next++)
+                    {
+                        store.AddMovies(page(number));
+                    }
+                });
+            }
+
+            while (next < PAGES)
+            {
+                compactions += store.Compact() ? 1 : 0;
+            }
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        size_t reopened = 0;
+
+        {
+            CatalogStore store(directory.string());
+            store.Open();
+
+            store.Read([&reopened](const MovieDatabase& database)
+            {
+                reopened = database.GetSize();
+            });
+        }
+
+        std::cout << std::left << std::setw(32) << "wal/recover across compactions" << std::right << " " << reopened << " movies after "
+                  << compactions << " forced compactions, " << (Check(reopened == PAGES * PAGE_SIZE) ? "all there" : "some lost") << std::endl;
+
+        std::filesystem::remove_all(directory);
+    }
+
+    // Catching a catalog of the stand-in's 40000 listed movies up on a day and on a week of
+    // changes, against the 2000 list pages crawling it again would take
+    void SyncIncremental(const StandInServer& server)
+    {
+        const TMDBServiceProvider provider("bench", ProviderSettings(server));
+        const auto directory = std::filesystem::temp_directory_path() / "streamflix-bench-sync";
+        const std::string watermark = (directory / "watermark").string();
+
+        std::filesystem::remove_all(directory);
+        CatalogStore store(directory.string());
+        store.Open();
+
+        MovieList seed;
+
+        for (uint64_t id = 11; id < 11 + 4 * 10000; ++id)
+        {
+            seed.emplace_back("Stale title " + std::to_string(id), 0.0f, id);
+        }
+
+        store.AddMovies(std::move(seed));
+
+        int64_t end;
+        CalendarDate::Parse("2026-01-15", end);
+
+        for (const int64_t days : {1, 7})
+        {
+            const std::string name = "sync/incremental " + std::to_string(days) + (days == 1 ? " day" : " days");
+            CatalogSync sync(provider, store, CatalogSync::Settings{watermark});
+            CatalogSync::Result result;
+            uint64_t requests = 0;
+
+            Measure(name.c_str(), [&]
+            {
+                CatalogSync::WriteWatermark(watermark, CalendarDate::Format(end - days + 1));
+
+                const uint64_t before = server.GetRequestCount();
+                result = sync.Run(CalendarDate::Format(end));
+                requests = server.GetRequestCount() - before;
+            });
+
+            std::cout << "    " << result.changed << " changed, " << result.updated << " updated, "
+                      << requests << " requests" << (result.complete ? "" : ", incomplete") << std::endl;
+        }
+
+        size_t stale = 0;
+
+        store.Read([&stale](const MovieDatabase& database)
+        {
+            for (const MovieRef movie : database.GetMovies())
+            {
+                stale += movie.GetTitle().compare(0, 6, "Stale ") == 0;
+            }
+        });
+
+        std::cout << "    " << 40000 - stale << " of 40000 movies refreshed" << std::endl;
+
+        // A watermark already past the end date stays where it is
+        const std::string later = CalendarDate::Format(end + 1);
+        CatalogSync::WriteWatermark(watermark, later);
+        CatalogSync(provider, store, CatalogSync::Settings{watermark}).Run(CalendarDate::Format(end));
+
+        std::cout << "    watermark past the end date " << (Check(CatalogSync::ReadWatermark(watermark) == later) ? "kept" : "moved back") << std::endl;
+
+        std::filesystem::remove_all(directory);
+    }
+
+    // A million-movie CatalogStore compacting while a reader keeps querying it. The reader
+    // only waits while the compactor holds the lock, which is now for taking a view rather
+    // than for copying every movie.
+    void CompactUnderLoad(const StandInServer&)
+    {
+        constexpr size_t MOVIES = 1000000;
+
+        const auto directory = std::filesystem::temp_directory_path() / "streamflix-bench-compact";
+        std::filesystem::remove_all(directory);
+
+        CatalogStore::Settings settings;
+        settings.compactionThreshold = UINT64_MAX;
+
+        CatalogStore store(directory.string(), settings);
+        store.Open();
+
+        MovieList movies;
+
+        for (size_t i = 0; i < MOVIES; ++i)
+        {
+            movies.emplace_back("Movie number " + std::to_string(i * 7919 % MOVIES), static_cast<float>(i % 100) / 10.0f, i + 1);
+        }
+
+        store.AddMovies(std::move(movies));
+
+        MovieDatabase database;
+        store.Read([&database](const MovieDatabase& stored) { database = stored; });
+
+        Measure("cow/copy movies 1M", [&]
+        {
+            const MovieView view = database.GetMovies();
+            Keep(MovieList(view.begin(), view.end()));
+        });
+
+        Measure("cow/take view 1M", [&] { Keep(database.GetMovies()); });
+
+        // Every block is shared with the view, so each upsert here copies a block
+        const MovieView held = database.GetMovies();
+
+        Measure("cow/upsert x1000 after view", [&]
+        {
+            for (uint64_t i = 0; i < 1000; ++i)
+            {
+                database.UpsertMovie(Movie{"Changed", 5.0f, 1 + i * 997});
+            }
+        });
+
+        std::atomic<bool> compacting{true};
+        std::vector<double> waits;
+
+        std::thread reader([&]
+        {
+            while (compacting)
+            {
+                const auto start = Clock::now();
+                store.Read([](const MovieDatabase& stored) { Keep(stored.GetSize()); });
+                waits.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            }
+        });
+
+        const auto start = Clock::now();
+        store.Compact();
+        const double took = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        compacting = false;
+        reader.join();
+
+        std::cout << std::left << std::setw(32) << "cow/compact 1M" << std::right << std::fixed << std::setprecision(2)
+                  << " took " << took << " ms, reads p99 " << Percentile(waits, 0.99) << " ms, max "
+                  << Percentile(waits, 1.0) << " ms over " << waits.size() << " reads" << std::endl;
+
+        std::filesystem::remove_all(directory);
+    }
+
+    const Case CASES[] = {
+        {"details/sequential", DetailsSequential},
+        {"details/concurrent", DetailsConcurrent},
+        {"details/pipelined", DetailsPipelined},
+        {"details/tail", DetailsTail},
+        {"list/prefetch", ListPrefetch},
+        {"ingest/dom", IngestDom},
+        {"ingest/projection", IngestProjection},
+        {"ingest/crawl", IngestCrawl},
+        {"ingest/stream large pages", IngestLargePages},
+        {"json/index", JsonIndex},
+        {"json/export", JsonExport},
+        {"json/differential", JsonDifferential},
+        {"json/decode", JsonDecode},
+        {"snapshot/load", SnapshotLoad},
+        {"archive/load", ArchiveLoad},
+        {"arrow/export", ArrowExport},
+        {"tasks/schedule", TasksSchedule},
+        {"shared/attach", SharedAttach},
+        {"wal/ingest", LogIngest},
+        {"cow/compact", CompactUnderLoad},
+        {"sync/incremental", SyncIncremental},
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    StandInServer::Settings settings;
+    settings.fixtureDirectory = argc > 2 ? argv[2] : "";
+    settings.synthetic = true;
+    settings.latency = LATENCY;
+
+    StandInServer server(settings);
+
+    if (!server.Start())
+    {
+        return 1;
+    }
+
+    std::cout << "Stand-in at " << server.GetBaseUrl() << " with " << LATENCY.count() << " ms latency" << std::endl;
+
+    for (const Case& benchmark : CASES)
+    {
+        if (std::strstr(benchmark.name, filter.c_str()))
+        {
+            benchmark.run(server);
+        }
+    }
+
+    if (failedChecks > 0)
+    {
+        std::cerr << failedChecks << (failedChecks == 1 ? " check" : " checks") << " failed" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,345 @@
+﻿#include "StructuralIndex.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define STRUCTURAL_INDEX_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STRUCTURAL_INDEX_SSE2
+#endif
+
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    constexpr size_t BLOCK = 64;
+
+    // One bit per byte of a block, lowest bit first
+    struct Masks
+    {
+        uint64_t quote = 0;
+        uint64_t backslash = 0;
+        uint64_t bracket = 0;       // Braces too
+        uint64_t punctuation = 0;   // Colons and commas
+        uint64_t space = 0;
+    };
+
+    enum : uint8_t
+    {
+        QUOTE = 1,
+        BACKSLASH = 2,
+        BRACKET = 4,
+        PUNCTUATION = 8,
+        SPACE = 16
+    };
+
+    constexpr auto CLASSES = []
+    {
+        std::array<uint8_t, 256> classes{};
+        classes['"'] = QUOTE;
+        classes['\\'] = BACKSLASH;
+
+        for (const unsigned char bracket : {'{', '}', '[', ']'})
+        {
+            classes[bracket] = BRACKET;
+        }
+
+        classes[':'] = PUNCTUATION;
+        classes[','] = PUNCTUATION;
+
+        for (const unsigned char space : {' ', '\t', '\n', '\r'})
+        {
+            classes[space] = SPACE;
+        }
+
+        return classes;
+    }();
+
+    struct ScalarClassifier
+    {
+        static void Classify(const char* block, Masks& masks)
+        {
+            for (size_t i = 0; i < BLOCK; ++i)
+            {
+                const uint8_t kind = CLASSES[static_cast<unsigned char>(block[i])];
+                masks.quote |= static_cast<uint64_t>(kind & QUOTE) << i;
+                masks.backslash |= static_cast<uint64_t>((kind & BACKSLASH) >> 1) << i;
+                masks.bracket |= static_cast<uint64_t>((kind & BRACKET) >> 2) << i;
+                masks.punctuation |= static_cast<uint64_t>((kind & PUNCTUATION) >> 3) << i;
+                masks.space |= static_cast<uint64_t>((kind & SPACE) >> 4) << i;
+            }
+        }
+    };
+
+#if defined(STRUCTURAL_INDEX_AVX2)
+    struct VectorClassifier
+    {
+        static uint64_t Bits(__m256i matches)
+        {
+            return static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+        }
+
+        static void Classify(const char* block, Masks& masks)
+        {
+            for (size_t i = 0; i < BLOCK; i += 32)
+            {
+                const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+
+                // Setting 0x20 folds [ and ] onto { and }
+                const __m256i folded = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+
+                const __m256i bracket = _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}')));
+                const __m256i punctuation = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(',')));
+
+                const __m256i space = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))));
+
+                masks.quote |= Bits(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'))) << i;
+                masks.backslash |= Bits(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\'))) << i;
+                masks.bracket |= Bits(bracket) << i;
+                masks.punctuation |= Bits(punctuation) << i;
+                masks.space |= Bits(space) << i;
+            }
+        }
+    };
+#elif defined(STRUCTURAL_INDEX_SSE2)
+    struct VectorClassifier
+    {
+        static uint64_t Bits(__m128i matches)
+        {
+            return static_cast<uint32_t>(_mm_movemask_epi8(matches));
+        }
+
+        static void Classify(const char* block, Masks& masks)
+        {
+            for (size_t i = 0; i < BLOCK; i += 16)
+            {
+                const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+
+                // Setting 0x20 folds [ and ] onto { and }
+                const __m128i folded = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+
+                const __m128i bracket = _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+                const __m128i punctuation = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')));
+
+                const __m128i space = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+
+                masks.quote |= Bits(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))) << i;
+                masks.backslash |= Bits(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\'))) << i;
+                masks.bracket |= Bits(bracket) << i;
+                masks.punctuation |= Bits(punctuation) << i;
+                masks.space |= Bits(space) << i;
+            }
+        }
+    };
+#else
+    using VectorClassifier = ScalarClassifier;
+#endif
+
+    // Bits of the bytes escaped by a backslash. `carry` is 1 when the block's first byte is
+    // escaped by a backslash that ended the previous block, and is updated for the next.
+    uint64_t FindEscaped(uint64_t backslash, uint64_t& carry)
+    {
+        constexpr uint64_t EVEN = 0x5555555555555555ULL;
+
+        backslash &= ~carry;
+        const uint64_t followsEscape = (backslash << 1) | carry;
+
+        // Adding a run's first bit carries it to the end of the run. Runs starting on an odd
+        // bit are added so that, after the flip below, every run's second, fourth... byte
+        // counts as escaped, as does the byte after a run of odd length.
+        const uint64_t oddStarts = backslash & ~EVEN & ~followsEscape;
+        const uint64_t evenStartsEnds = oddStarts + backslash;
+        carry = evenStartsEnds < oddStarts ? 1 : 0;
+
+        return (EVEN ^ (evenStartsEnds << 1)) & followsEscape;
+    }
+
+    // Bit i of the result is the XOR of bits 0 to i: set from an opening quote up to, but
+    // not including, the closing one
+    uint64_t PrefixXor(uint64_t bits)
+    {
+#if defined(__PCLMUL__)
+        const __m128i product = _mm_clmulepi64_si128(_mm_set_epi64x(0, static_cast<int64_t>(bits)), _mm_set1_epi8(-1), 0);
+        return static_cast<uint64_t>(_mm_cvtsi128_si64(product));
+#else
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+#endif
+    }
+
+    uint32_t CountTrailingZeros(uint64_t bits)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+    }
+
+    uint32_t CountOnes(uint64_t bits)
+    {
+#if defined(_MSC_VER)
+        return static_cast<uint32_t>(__popcnt64(bits));
+#else
+        return static_cast<uint32_t>(__builtin_popcountll(bits));
+#endif
+    }
+}
+
+bool StructuralIndex::Build(std::string_view document, Kernel kernel)
+{
+    size = 0;
+
+    if (document.size() >= UINT32_MAX)
+    {
+        return false;
+    }
+
+    open.clear();
+
+    const bool found = kernel == Kernel::Scalar
+        ? FindStructurals<ScalarClassifier>(document)
+        : FindStructurals<VectorClassifier>(document);
+
+    return found && open.empty();
+}
+
+const char* StructuralIndex::GetVectorKernelName()
+{
+#if defined(STRUCTURAL_INDEX_AVX2)
+    return "avx2";
+#elif defined(STRUCTURAL_INDEX_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+template <typename Classifier>
+bool StructuralIndex::FindStructurals(std::string_view document)
+{
+    uint64_t escapedCarry = 0;
+    uint64_t stringCarry = 0;
+    uint64_t scalarCarry = 0;
+
+    for (size_t offset = 0; offset < document.size(); offset += BLOCK)
+    {
+        Masks masks;
+
+        if (document.size() - offset >= BLOCK)
+        {
+            Classifier::Classify(document.data() + offset, masks);
+        }
+        else
+        {
+            // Padding with spaces adds nothing to the index
+            char tail[BLOCK];
+            std::memset(tail, ' ', BLOCK);
+            std::memcpy(tail, document.data() + offset, document.size() - offset);
+            Classifier::Classify(tail, masks);
+        }
+
+        const uint64_t quotes = masks.quote & ~FindEscaped(masks.backslash, escapedCarry);
+        const uint64_t inString = PrefixXor(quotes) ^ stringCarry;
+        stringCarry = 0 - (inString >> 63);
+
+        // Anything else outside a string belongs to a number, true, false or null
+        const uint64_t ops = masks.bracket | masks.punctuation;
+        const uint64_t scalars = ~(ops | masks.space | quotes | inString);
+        const uint64_t scalarStarts = scalars & ~((scalars << 1) | scalarCarry);
+        scalarCarry = scalars >> 63;
+
+        const uint64_t structurals = (ops & ~inString) | (quotes & inString) | scalarStarts;
+
+        if (capacity - size < BLOCK)
+        {
+            Grow();
+        }
+
+        const size_t blockStart = size;
+        uint32_t* out = positions.get() + size;
+
+        for (uint64_t remaining = structurals; remaining; remaining &= remaining - 1)
+        {
+            *out++ = static_cast<uint32_t>(offset) + CountTrailingZeros(remaining);
+        }
+
+        size = out - positions.get();
+
+        if (!PairBrackets(document, offset, masks.bracket & ~inString, structurals, blockStart))
+        {
+            return false;
+        }
+    }
+
+    return stringCarry == 0;
+}
+
+// Brackets are a small share of the entries, so they are visited through their own mask
+// rather than by reading the byte at every entry
+bool StructuralIndex::PairBrackets(std::string_view document, size_t offset, uint64_t brackets, uint64_t structurals, size_t blockStart)
+{
+    for (; brackets; brackets &= brackets - 1)
+    {
+        const uint32_t bit = CountTrailingZeros(brackets);
+        const auto entry = static_cast<uint32_t>(blockStart + CountOnes(structurals & ((uint64_t{1} << bit) - 1)));
+        const char c = document[offset + bit];
+
+        if (c == '{' || c == '[')
+        {
+            open.push_back(entry);
+            continue;
+        }
+
+        // '}' and ']' are two past '{' and '['
+        if (open.empty() || document[positions[open.back()]] != c - 2)
+        {
+            return false;
+        }
+
+        matches[open.back()] = entry;
+        open.pop_back();
+    }
+
+    return true;
+}
+
+void StructuralIndex::Grow()
+{
+    const size_t newCapacity = capacity == 0 ? 1024 : capacity * 2;
+
+    // new[] rather than make_unique, which would zero them
+    std::unique_ptr<uint32_t[]> newPositions(new uint32_t[newCapacity]);
+    std::unique_ptr<uint32_t[]> newMatches(new uint32_t[newCapacity]);
+
+    // Brackets are paired as the index grows, so matches already found are kept too
+    if (size > 0)
+    {
+        std::memcpy(newPositions.get(), positions.get(), size * sizeof(uint32_t));
+        std::memcpy(newMatches.get(), matches.get(), size * sizeof(uint32_t));
+    }
+
+    positions = std::move(newPositions);
+    matches = std::move(newMatches);
+    capacity = newCapacity;
+}
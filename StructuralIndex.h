@@ -0,0 +1,61 @@
+﻿#ifndef STRUCTURAL_INDEX_H
+#define STRUCTURAL_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Finds where a JSON document's structure is, 64 bytes at a time, in the style of
+// simdjson's first stage. Quotes, backslashes, brackets and whitespace are classified with
+// vector compares into bit masks, and bit arithmetic on the masks works out which bytes are
+// inside strings. What is left is indexed: every brace, bracket, colon and comma outside a
+// string, the opening quote of every string and the first byte of every other scalar.
+//
+// A parser can then step from one entry to the next without looking at the bytes between
+// them. Brackets are also paired up, so a whole container is skipped in one step.
+class StructuralIndex
+{
+public:
+    enum class Kernel
+    {
+        Scalar,
+        Vector      // The widest the build targets allow; the scalar one if none
+    };
+
+    StructuralIndex() = default;
+
+    StructuralIndex(const StructuralIndex&) = delete;
+    StructuralIndex& operator=(const StructuralIndex&) = delete;
+
+    // Returns false if a string is left open, the brackets don't pair up, or the document
+    // is 4 GiB or more. The index's storage is kept for the next document.
+    bool Build(std::string_view document, Kernel kernel = Kernel::Vector);
+
+    [[nodiscard]] size_t GetSize() const { return size; }
+    [[nodiscard]] uint32_t GetPosition(size_t entry) const { return positions[entry]; }
+
+    // The entry of the bracket that closes the one at `entry`
+    [[nodiscard]] uint32_t GetMatch(size_t entry) const { return matches[entry]; }
+
+    // "avx2", "sse2" or "scalar"
+    [[nodiscard]] static const char* GetVectorKernelName();
+
+private:
+    template <typename Classifier>
+    bool FindStructurals(std::string_view document);
+
+    bool PairBrackets(std::string_view document, size_t offset, uint64_t brackets, uint64_t structurals, size_t blockStart);
+    void Grow();
+
+    // Not vectors, so making room doesn't zero memory that is about to be overwritten
+    std::unique_ptr<uint32_t[]> positions;
+    std::unique_ptr<uint32_t[]> matches;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    std::vector<uint32_t> open;
+};
+
+#endif
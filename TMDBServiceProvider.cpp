@@ -1,22 +1,729 @@
 ﻿#include "TMDBServiceProvider.h"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
 
-#include "HTTPRequest/include/HTTPRequest.hpp"
+#include "Fixture.h"
 
+TMDBServiceProvider::TMDBServiceProvider(std::string apiKey, Settings settings)
+    : apiKey(std::move(apiKey)), settings(std::move(settings)), rateLimiter(this->settings.rateLimit),
+      popularPrefetcher(this->settings.prefetch,
+                        [this](uint32_t page, ResponseCallback done) { return FetchPage(PopularMoviesUrl(page), std::move(done)); },
+                        [this](std::chrono::milliseconds delay, std::function<void()> task) { httpClient.Schedule(delay, std::move(task)); }),
+      nowPlayingPrefetcher(this->settings.prefetch,
+                           [this](uint32_t page, ResponseCallback done) { return FetchPage(NowPlayingMoviesUrl(page), std::move(done)); },
+                           [this](std::chrono::milliseconds delay, std::function<void()> task) { httpClient.Schedule(delay, std::move(task)); })
+{
+}
+
+ResponseBuffer TMDBServiceProvider::MakeHttpGetRequest(const std::string& url, const CancellationToken& cancellation) const
+{
+    return MakeHttpGetRequestAsync(url, cancellation).get();
+}
+
+std::future<ResponseBuffer> TMDBServiceProvider::MakeHttpGetRequestAsync(const std::string& url, const CancellationToken& cancellation) const
+{
+    auto promise = std::make_shared<std::promise<ResponseBuffer>>();
+    auto future = promise->get_future();
+
+    MakeHttpGetRequestAsync(url, [promise](ResponseBuffer body)
+    {
+        promise->set_value(std::move(body));
+    }, cancellation);
+
+    return future;
+}
+
+void TMDBServiceProvider::MakeHttpGetRequestAsync(const std::string& url, ResponseCallback callback, const CancellationToken& cancellation) const
+{
+    StartRequest(url, std::move(callback), cancellation);
+}
+
+void TMDBServiceProvider::StreamHttpGetRequestAsync(const std::string& url, std::shared_ptr<BodyStream> stream, const CancellationToken& cancellation) const
+{
+    // Every way an attempt fails ends in an empty body for its callback
+    StartRequest(url, [stream](ResponseBuffer)
+    {
+        stream->End(false);
+    }, cancellation, stream);
+}
+
+std::vector<ResponseBuffer> TMDBServiceProvider::GetMovieDetails(const std::vector<std::string>& movieIds, const CancellationToken& cancellation) const
+{
+    std::vector<bool> refused;
+    return GetMovieDetails(movieIds, refused, cancellation);
+}
+
+std::vector<ResponseBuffer> TMDBServiceProvider::GetMovieDetails(const std::vector<std::string>& movieIds, std::vector<bool>& refused, const CancellationToken& cancellation) const
+{
+    auto carrier = std::make_shared<Attempt>();
+    std::vector<std::future<std::pair<ResponseBuffer, bool>>> futures;
+
+    for (const auto& movieId : movieIds)
+    {
+        auto promise = std::make_shared<std::promise<std::pair<ResponseBuffer, bool>>>();
+        futures.push_back(promise->get_future());
+
+        auto attempt = std::make_shared<Attempt>();
+        attempt->url = MovieDetailsUrl(movieId);
+        attempt->cancellation = cancellation;
+
+        // The attempt owns the callback and is the one calling it, so it is still there
+        attempt->callback = [promise, self = attempt.get()](ResponseBuffer body)
+        {
+            promise->set_value({std::move(body), self->refused});
+        };
+
+        carrier->batch.push_back(std::move(attempt));
+    }
+
+    if (!carrier->batch.empty())
+    {
+        Watch(carrier, cancellation);
+        Throttle(std::move(carrier));
+    }
+
+    std::vector<ResponseBuffer> results;
+    refused.clear();
+
+    for (auto& future : futures)
+    {
+        auto [body, wasRefused] = future.get();
+        results.push_back(std::move(body));
+        refused.push_back(wasRefused);
+    }
+
+    return results;
+}
+
+std::shared_ptr<TMDBServiceProvider::Attempt> TMDBServiceProvider::StartRequest(const std::string& url, ResponseCallback callback, const CancellationToken& cancellation, std::shared_ptr<BodyStream> stream) const
+{
+    auto attempt = std::make_shared<Attempt>();
+    attempt->url = url;
+    attempt->callback = std::move(callback);
+    attempt->stream = std::move(stream);
+    Watch(attempt, cancellation);
+    Throttle(attempt);
+    return attempt;
+}
+
+std::function<void()> TMDBServiceProvider::FetchPage(const std::string& url, ResponseCallback callback) const
+{
+    auto attempt = StartRequest(url, std::move(callback), {});
+
+    return [this, attempt = std::move(attempt)]
+    {
+        Cancel(attempt);
+    };
+}
+
+void TMDBServiceProvider::Watch(const std::shared_ptr<Attempt>& attempt, const CancellationToken& cancellation) const
+{
+    attempt->cancellation = cancellation;
+
+    // The attempt's deadline is enforced by the client's request timer; only an explicit
+    // Cancel needs a callback. Weak, so a finished attempt isn't kept alive by the token.
+    attempt->registration = cancellation.OnCancel([this, weak = std::weak_ptr<Attempt>(attempt)]
+    {
+        if (const auto target = weak.lock())
+        {
+            Cancel(target);
+        }
+    });
+}
+
+void TMDBServiceProvider::Cancel(const std::shared_ptr<Attempt>& attempt) const
+{
+    // Whatever stage the attempt is at (queued for a token, on the wire, or waiting to
+    // retry) it sees the flag on the client thread and finishes with an empty body.
+    httpClient.Post([this, attempt]
+    {
+        attempt->cancelled = true;
+
+        for (const HttpClient::RequestId id : {attempt->requestId, attempt->hedgeId})
+        {
+            if (id != 0)
+            {
+                httpClient.Cancel(id);
+            }
+        }
+
+        // A batch goes out as its members
+        for (const auto& member : attempt->batch)
+        {
+            member->cancelled = true;
+
+            if (member->requestId != 0)
+            {
+                httpClient.Cancel(member->requestId);
+            }
+        }
+
+        // One that isn't on the wire finishes now rather than when its turn comes
+        if (Withdraw(attempt))
+        {
+            Drop(*attempt);
+        }
+        else if (attempt->backingOff)
+        {
+            attempt->backingOff = false;
+            attempt->callback({});
+        }
+    });
+}
+
+void TMDBServiceProvider::Drop(const Attempt& attempt) const
+{
+    // A batch carrier has no callback of its own; its members each get their empty body
+    if (attempt.batch.empty())
+    {
+        attempt.callback({});
+        return;
+    }
+
+    for (const auto& member : attempt.batch)
+    {
+        member->callback({});
+    }
+}
+
+void TMDBServiceProvider::Throttle(std::shared_ptr<Attempt> attempt) const
+{
+    const auto deadline = attempt->cancellation.GetDeadline();
+
+    if (deadline != HttpClient::Clock::time_point::max())
+    {
+        // Drop it at its deadline if it is still waiting for a token by then
+        const auto delay = std::chrono::ceil<std::chrono::milliseconds>(deadline - HttpClient::Clock::now());
+
+        httpClient.Schedule(std::max(delay, std::chrono::milliseconds{0}), [this, weak = std::weak_ptr<Attempt>(attempt)]
+        {
+            const auto target = weak.lock();
+
+            if (target && Withdraw(target))
+            {
+                Drop(*target);
+            }
+        });
+    }
+
+    {
+        std::lock_guard lock(throttleMutex);
+        throttled.push_back(std::move(attempt));
+
+        if (drainScheduled)
+        {
+            return;
+        }
+
+        drainScheduled = true;
+    }
+
+    httpClient.Post([this] { DrainThrottled(); });
+}
+
+bool TMDBServiceProvider::Withdraw(const std::shared_ptr<Attempt>& attempt) const
+{
+    std::lock_guard lock(throttleMutex);
+    const auto it = std::find(throttled.begin(), throttled.end(), attempt);
+
+    if (it == throttled.end())
+    {
+        return false;
+    }
+
+    throttled.erase(it);
+    return true;
+}
+
+void TMDBServiceProvider::DrainThrottled() const
+{
+    // A single drain task hands out tokens in arrival order, so queued attempts don't
+    // each poll the limiter.
+    for (;;)
+    {
+        std::shared_ptr<Attempt> attempt;
+
+        {
+            std::lock_guard lock(throttleMutex);
+
+            if (throttled.empty())
+            {
+                drainScheduled = false;
+                return;
+            }
+
+            RateLimiter::Clock::duration wait{};
+
+            const Attempt& front = *throttled.front();
+            const double tokens = front.batch.empty() ? 1.0 : static_cast<double>(front.batch.size());
+
+            // Abandoned attempts leave the queue without spending a token
+            if (!front.Abandoned() && !rateLimiter.TryAcquire(wait, tokens))
+            {
+                const auto delay = std::chrono::ceil<std::chrono::milliseconds>(wait);
+                httpClient.Schedule(delay, [this] { DrainThrottled(); });
+                return;
+            }
+
+            attempt = std::move(throttled.front());
+            throttled.pop_front();
+        }
+
+        if (attempt->Abandoned())
+        {
+            Drop(*attempt);
+            continue;
+        }
+
+        Send(attempt);
+    }
+}
+
+void TMDBServiceProvider::Send(const std::shared_ptr<Attempt>& attempt) const
+{
+    if (!attempt->batch.empty())
+    {
+        SendBatch(attempt);
+        return;
+    }
+
+    attempt->requestId = httpClient.Send(MakeRequest(attempt, false), [this, attempt](HttpResponse&& response)
+    {
+        OnResponse(attempt, std::move(response));
+    });
+
+    attempt->sentAt = HttpClient::Clock::now();
+    ScheduleHedge(attempt);
+}
+
+HttpClient::Request TMDBServiceProvider::MakeRequest(const std::shared_ptr<Attempt>& attempt, bool hedge) const
+{
+    HttpClient::Request request;
+    request.url = attempt->url;
+    request.headers = {{"Accept-Encoding", "gzip, deflate"}};
+    request.deadline = attempt->cancellation.GetDeadline();
+
+    request.onHeaders = [this, attempt, hedge](const HttpResponse& head)
+    {
+        return OnHeaders(attempt, hedge, head);
+    };
+
+    request.onBody = [this, attempt, hedge](ResponseBuffer piece)
+    {
+        return OnBody(*attempt, hedge ? attempt->hedged : attempt->original, std::move(piece));
+    };
+
+    return request;
+}
+
+bool TMDBServiceProvider::OnHeaders(const std::shared_ptr<Attempt>& attempt, bool hedge, const HttpResponse& head) const
+{
+    Receiver& receiver = hedge ? attempt->hedged : attempt->original;
+
+    // Called again for the same copy if the client had to send it again
+    receiver = Receiver{};
+
+    if (head.status < 200 || head.status >= 300)
+    {
+        return false;
+    }
+
+    // A compressed body is decoded piece by piece as it arrives, so it is never held whole
+    // next to the decoded one, and decoding doesn't hold up the loop in one go
+    Inflater::Format format;
+    const bool compressed = Inflater::FormatForContentEncoding(head.GetHeader("Content-Encoding"), format);
+    const bool streamed = attempt->stream && !hedge;
+
+    // Otherwise received in place, straight into the response's buffer
+    if (!compressed && !streamed)
+    {
+        return false;
+    }
+
+    if (compressed)
+    {
+        receiver.inflater = std::make_unique<Inflater>(format, [this, &attempt = *attempt, &receiver](ResponseBuffer piece)
+        {
+            Take(attempt, receiver, std::move(piece));
+        }, bufferPool);
+    }
+
+    if (!streamed || !settings.recordDirectory.empty())
+    {
+        // Decoded it is at least as big
+        const uint64_t length = std::strtoull(head.GetHeader("Content-Length").c_str(), nullptr, 10);
+        receiver.body = bufferPool->Acquire(static_cast<size_t>(std::min<uint64_t>(length, MAX_PRESIZE)));
+    }
+
+    if (!streamed)
+    {
+        return true;
+    }
+
+    receiver.streamed = true;
+
+    attempt->stream->Begin([this, id = attempt->requestId]
+    {
+        httpClient.Resume(id);
+    });
+
+    return true;
+}
+
+bool TMDBServiceProvider::OnBody(Attempt& attempt, Receiver& receiver, ResponseBuffer piece) const
+{
+    receiver.pause = false;
+
+    if (!receiver.inflater)
+    {
+        Take(attempt, receiver, std::move(piece));
+    }
+    else if (!receiver.failed && receiver.inflater->Feed(piece.data(), piece.size()) == Inflater::Status::Error)
+    {
+        // Reported once the response is complete; what is left is read and dropped
+        receiver.failed = true;
+    }
+
+    return !receiver.pause;
+}
+
+void TMDBServiceProvider::Take(Attempt& attempt, Receiver& receiver, ResponseBuffer piece) const
+{
+    if (!receiver.streamed)
+    {
+        receiver.body.Append(piece.data(), piece.size());
+        return;
+    }
+
+    // The stream gets the piece itself; only a recording keeps a whole copy for the fixture
+    if (!settings.recordDirectory.empty())
+    {
+        receiver.body.Append(piece.data(), piece.size());
+    }
+
+    if (!attempt.stream->Write(std::move(piece)))
+    {
+        receiver.pause = true;
+    }
+}
+
+void TMDBServiceProvider::SendBatch(const std::shared_ptr<Attempt>& carrier) const
+{
+    std::vector<HttpClient::Request> requests;
+
+    for (const auto& attempt : carrier->batch)
+    {
+        requests.push_back(MakeRequest(attempt, false));
+    }
+
+    // Each member is answered on its own, so a failed one retries alone. The carrier is
+    // kept alive for as long as any member is out, so cancelling it still reaches them.
+    const auto ids = httpClient.SendPipelined(std::move(requests), [this, carrier](size_t index, HttpResponse&& response)
+    {
+        OnResponse(carrier->batch[index], std::move(response));
+    });
+
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        carrier->batch[i]->requestId = ids[i];
+    }
+}
+
+void TMDBServiceProvider::ScheduleHedge(const std::shared_ptr<Attempt>& attempt) const
+{
+    const auto delay = hedgePolicy.OnRequest();
+
+    if (!delay)
+    {
+        return;
+    }
+
+    httpClient.Schedule(*delay, [this, attempt, original = attempt->requestId]
+    {
+        Hedge(attempt, original);
+    });
+}
+
+void TMDBServiceProvider::Hedge(const std::shared_ptr<Attempt>& attempt, HttpClient::RequestId original) const
+{
+    // The original has answered, been cancelled or been retried in the meantime. One that
+    // is already streaming has answered too, and is only as slow as its reader.
+    if (attempt->requestId != original || attempt->hedgeId != 0 || attempt->Abandoned() || attempt->original.streamed)
+    {
+        return;
+    }
+
+    // A hedge that has to queue for a token would be too late to help
+    RateLimiter::Clock::duration wait{};
+
+    if (!hedgePolicy.TryHedge() || !rateLimiter.TryAcquire(wait))
+    {
+        return;
+    }
+
+    // The original's connection is busy, so the copy goes out on another one
+    attempt->hedgeId = httpClient.Send(MakeRequest(attempt, true), [this, attempt](HttpResponse&& response)
+    {
+        OnResponse(attempt, std::move(response), true);
+    });
+}
+
+bool TMDBServiceProvider::Settle(Attempt& attempt, bool hedge, const HttpResponse& response) const
+{
+    HttpClient::RequestId& own = hedge ? attempt.hedgeId : attempt.requestId;
+    HttpClient::RequestId& other = hedge ? attempt.requestId : attempt.hedgeId;
+
+    // The loser of a race that has already been decided
+    if (own == 0)
+    {
+        return false;
+    }
+
+    own = 0;
+
+    if (other != 0)
+    {
+        // Wait for the other copy rather than retrying over it
+        if (!response.cancelled && !response.Succeeded())
+        {
+            if (response.status == 429)
+            {
+                rateLimiter.OnThrottled(ParseRetryAfter(response.GetHeader("Retry-After")));
+            }
+
+            return false;
+        }
+
+        httpClient.Cancel(other);
+        other = 0;
+    }
+
+    if (response.Succeeded() && attempt.sentAt != HttpClient::Clock::time_point{})
+    {
+        // Measured from the original, so a hedge win still counts the wait that caused it
+        hedgePolicy.OnLatency(HttpClient::Clock::now() - attempt.sentAt);
+
+        if (hedge)
+        {
+            hedgePolicy.OnHedgeWon();
+        }
+    }
+
+    return true;
+}
+
+void TMDBServiceProvider::OnResponse(const std::shared_ptr<Attempt>& attempt, HttpResponse&& response, bool hedge) const
+{
+    if (!Settle(*attempt, hedge, response))
+    {
+        return;
+    }
+
+    if (response.cancelled)
+    {
+        attempt->callback({});
+        return;
+    }
+
+    if (!response.error.empty())
+    {
+        std::cerr << "Request failed, error: " << response.error << '\n';
+        Retry(attempt);
+        return;
+    }
+
+    const int status = response.status;
+
+    if (status >= 200 && status < 300)
+    {
+        rateLimiter.OnSuccess();
+
+        Receiver& receiver = hedge ? attempt->hedged : attempt->original;
+
+        if (receiver.inflater && (receiver.failed || receiver.inflater->Finish() != Inflater::Status::Finished))
+        {
+            std::cerr << "Failed to decode response body: " << receiver.inflater->GetError() << '\n';
+            receiver = Receiver{};
+            attempt->callback({});
+            return;
+        }
+
+        if (receiver.streamed)
+        {
+            Record(attempt->url, std::move(receiver.body));
+            receiver = Receiver{};
+            attempt->stream->End(true);
+            return;
+        }
+
+        ResponseBuffer body = receiver.inflater ? std::move(receiver.body) : std::move(response.body);
+        receiver = Receiver{};
+
+        Record(attempt->url, body);
+        Deliver(attempt, std::move(body));
+        return;
+    }
+
+    if (status == 429)
+    {
+        rateLimiter.OnThrottled(ParseRetryAfter(response.GetHeader("Retry-After")));
+        Retry(attempt);
+        return;
+    }
+
+    if (status >= 500)
+    {
+        rateLimiter.OnServerError();
+        Retry(attempt);
+        return;
+    }
+
+    std::cerr << "Request failed, status: " << status << ' ' << response.reason << '\n';
+    attempt->refused = status >= 400 && status < 500;
+    attempt->callback({});
+}
+
+void TMDBServiceProvider::Record(const std::string& url, ResponseBuffer body) const
+{
+    if (settings.recordDirectory.empty() || url.compare(0, settings.baseUrl.size(), settings.baseUrl) != 0)
+    {
+        return;
+    }
+
+    // Written on the scheduler, so the disk never holds up the client's loop. The body is
+    // shared with the caller, not copied.
+    recordings.Run([this, request = url.substr(settings.baseUrl.size()), body = std::move(body)]
+    {
+        Fixture::Write(settings.recordDirectory, request, body.data(), body.size());
+    });
+}
+
+void TMDBServiceProvider::Deliver(const std::shared_ptr<Attempt>& attempt, ResponseBuffer body) const
+{
+    if (!attempt->stream)
+    {
+        attempt->callback(std::move(body));
+        return;
+    }
+
+    // A hedge that beat a streamed original, received whole; the stream drops whatever the
+    // original had delivered
+    attempt->stream->Begin([] {});
+    attempt->stream->Write(std::move(body));
+    attempt->stream->End(true);
+}
 
-std::string TMDBServiceProvider::MakeHttpGetRequest(const std::string& url)
+void TMDBServiceProvider::Retry(const std::shared_ptr<Attempt>& attempt) const
 {
-    try
+    if (++attempt->number >= MAX_ATTEMPTS)
     {
-        http::Request request{url};
-        const auto response = request.send("GET");
-        return std::string{response.body.begin(), response.body.end()};
+        std::cerr << "Request failed after " << MAX_ATTEMPTS << " attempts: " << attempt->url.substr(0, attempt->url.find('?')) << '\n';
+        attempt->callback({});
+        return;
     }
-    catch (const std::exception& e)
+
+    const auto backoff = JitteredBackoff(attempt->number);
+
+    if (attempt->Abandoned())
     {
-        std::cerr << "Request failed, error: " << e.what() << '\n';
+        attempt->callback({});
+        return;
     }
 
-    return {};
+    // No point waiting to retry if the caller will have given up by then
+    if (HttpClient::Clock::now() + backoff >= attempt->cancellation.GetDeadline())
+    {
+        std::cerr << "Request abandoned at its deadline: " << attempt->url.substr(0, attempt->url.find('?')) << '\n';
+        attempt->callback({});
+        return;
+    }
+
+    attempt->backingOff = true;
+
+    httpClient.Schedule(backoff, [this, attempt]
+    {
+        // Cancel has already finished it
+        if (!attempt->backingOff)
+        {
+            return;
+        }
+
+        attempt->backingOff = false;
+
+        if (attempt->Abandoned())
+        {
+            attempt->callback({});
+            return;
+        }
+
+        Throttle(attempt);
+    });
+}
+
+HttpClient::Settings TMDBServiceProvider::ClientSettings(const Settings& settings, std::shared_ptr<BufferPool> pool)
+{
+    HttpClient::Settings clientSettings;
+    clientSettings.bufferPool = std::move(pool);
+    clientSettings.maxPipelineDepth = settings.pipelineDepth;
+    return clientSettings;
+}
+
+std::chrono::milliseconds TMDBServiceProvider::ParseRetryAfter(const std::string& value)
+{
+    // A server asking for longer than this is not waited on any longer
+    constexpr std::chrono::milliseconds longest = std::chrono::hours{1};
+
+    // Retry-After is either delta-seconds or an HTTP-date
+    if (!value.empty() && std::all_of(value.begin(), value.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+    {
+        uint64_t seconds = 0;
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+
+        // Too many digits to be a real wait
+        if (error != std::errc{} || end != value.data() + value.size())
+        {
+            return std::chrono::milliseconds{0};
+        }
+
+        return seconds >= static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(longest).count()) ? longest : std::chrono::seconds{seconds};
+    }
+
+    std::tm tm{};
+    std::istringstream stream(value);
+    stream >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+
+    if (stream.fail())
+    {
+        return std::chrono::milliseconds{0};
+    }
+
+#ifdef _WIN32
+    const std::time_t retryAt = _mkgmtime(&tm);
+#else
+    const std::time_t retryAt = timegm(&tm);
+#endif
+    const auto delay = std::chrono::system_clock::from_time_t(retryAt) - std::chrono::system_clock::now();
+
+    return std::clamp(std::chrono::duration_cast<std::chrono::milliseconds>(delay), std::chrono::milliseconds{0}, longest);
+}
+
+std::chrono::milliseconds TMDBServiceProvider::JitteredBackoff(uint32_t attempt)
+{
+    // "Full jitter": a uniform draw below an exponentially growing cap keeps retries
+    // from several threads from landing on the upstream in lockstep.
+    constexpr int64_t baseMs = 100;
+    constexpr int64_t capMs = 10000;
+
+    thread_local std::mt19937 generator{std::random_device{}()};
+    const int64_t ceiling = std::min(capMs, baseMs << std::min<uint32_t>(attempt, 16));
+
+    return std::chrono::milliseconds{std::uniform_int_distribution<int64_t>{0, ceiling}(generator)};
 }
@@ -1,39 +1,257 @@
 ﻿#ifndef TMDBSERVICEPROVIDER_H
 #define TMDBSERVICEPROVIDER_H
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
+
+#include "BodyStream.h"
+#include "BufferPool.h"
+#include "CancellationToken.h"
+#include "HedgePolicy.h"
+#include "HttpClient.h"
+#include "Inflater.h"
+#include "PagePrefetcher.h"
+#include "RateLimiter.h"
+#include "TaskScheduler.h"
 
 class TMDBServiceProvider
 {
 public:
-    explicit TMDBServiceProvider(std::string apiKey): apiKey(std::move(apiKey)) {}
-    static std::string MakeHttpGetRequest(const std::string& url);
+    // Receives the decoded body, or an empty buffer once every retry has failed. Bodies are
+    // pooled: drop the buffer when done with it so the next page can reuse its storage.
+    using ResponseCallback = std::function<void(ResponseBuffer body)>;
+
+    struct Settings
+    {
+        // Point this at a TMDBStandIn server to run offline
+        std::string baseUrl = "http://api.themoviedb.org/3/";
+
+        // When set, every successful response body is saved here as a fixture for the stand-in
+        std::string recordDirectory;
+
+        RateLimiter::Settings rateLimit;
+
+        // Read-ahead for GetPopularMovies and GetNowPlayingMovies
+        PagePrefetcher::Settings prefetch;
+
+        // Requests per connection when looking up several movies at once
+        size_t pipelineDepth = 20;
+
+        // Sends a second copy of a single lookup or list page that is slower than recent ones
+        HedgePolicy::Settings hedge;
+    };
+
+    explicit TMDBServiceProvider(std::string apiKey) : TMDBServiceProvider(std::move(apiKey), Settings{}) {}
+    TMDBServiceProvider(std::string apiKey, Settings settings);
+
+    // Every request can be given a cancellation token. Cancelling it, or reaching its
+    // deadline, abandons the request wherever it is (waiting for a rate limiter token,
+    // between retries or on the wire) and it finishes with an empty body.
+
+    // Blocks until the response arrives, so it must not be called from an async callback
+    [[nodiscard]] ResponseBuffer MakeHttpGetRequest(const std::string& url, const CancellationToken& cancellation = {}) const;
+    void MakeHttpGetRequestAsync(const std::string& url, ResponseCallback callback, const CancellationToken& cancellation = {}) const;
+    [[nodiscard]] std::future<ResponseBuffer> MakeHttpGetRequestAsync(const std::string& url, const CancellationToken& cancellation = {}) const;
+
+    // Hands the body to `stream` as it arrives instead of all at once, with retries and
+    // hedging as for any other request; see BodyStream. A failure ends the stream.
+    void StreamHttpGetRequestAsync(const std::string& url, std::shared_ptr<BodyStream> stream, const CancellationToken& cancellation = {}) const;
+
+    // Resolves the API host and opens connections ahead of the first request. Returns at
+    // once, so only work the caller does after it overlaps the lookup and handshakes; any
+    // connection still unused after HttpClient's idle timeout is closed.
+    void WarmUp(size_t connections) const
+    {
+        httpClient.Preconnect(settings.baseUrl, connections);
+    }
+
+    [[nodiscard]] ResponseBuffer GetMovieDetails(const std::string& movieId, const CancellationToken& cancellation = {}) const
+    {
+        return MakeHttpGetRequest(MovieDetailsUrl(movieId), cancellation);
+    }
+
+    // Looks up several movies at once, pipelined over as few connections as possible.
+    // Results are in the order of `movieIds`, with an empty buffer for any that failed.
+    [[nodiscard]] std::vector<ResponseBuffer> GetMovieDetails(const std::vector<std::string>& movieIds, const CancellationToken& cancellation = {}) const;
+
+    // ...and sets `refused` for each movie the API turned down with a 4xx, which asking
+    // again won't change, as opposed to one that failed for now
+    [[nodiscard]] std::vector<ResponseBuffer> GetMovieDetails(const std::vector<std::string>& movieIds, std::vector<bool>& refused, const CancellationToken& cancellation = {}) const;
+
+    // Paging through a list in order is served from pages fetched ahead of time
+    [[nodiscard]] ResponseBuffer GetPopularMovies(uint32_t page, const CancellationToken& cancellation = {}) const
+    {
+        return popularPrefetcher.GetPage(page, cancellation);
+    }
+
+    [[nodiscard]] ResponseBuffer GetNowPlayingMovies(uint32_t page, const CancellationToken& cancellation = {}) const
+    {
+        return nowPlayingPrefetcher.GetPage(page, cancellation);
+    }
+
+    // A single page when it arrives, bypassing the read-ahead, for callers that schedule
+    // their own fetches
+    void FetchPopularMoviesAsync(uint32_t page, ResponseCallback callback, const CancellationToken& cancellation = {}) const
+    {
+        MakeHttpGetRequestAsync(PopularMoviesUrl(page), std::move(callback), cancellation);
+    }
 
-    [[nodiscard]] std::string GetMovieDetails(const std::string& movieId) const
+    void FetchNowPlayingMoviesAsync(uint32_t page, ResponseCallback callback, const CancellationToken& cancellation = {}) const
     {
-        // Construct the URL for the API request
-        std::string url = BASE_URL + "movie/" + movieId + "?api_key=" + apiKey;
+        MakeHttpGetRequestAsync(NowPlayingMoviesUrl(page), std::move(callback), cancellation);
+    }
 
-        // Make the HTTP request and return the response
-        // (Assuming you have a function to make HTTP requests)
-        return MakeHttpGetRequest(url);
+    void StreamPopularMoviesAsync(uint32_t page, std::shared_ptr<BodyStream> stream, const CancellationToken& cancellation = {}) const
+    {
+        StreamHttpGetRequestAsync(PopularMoviesUrl(page), std::move(stream), cancellation);
     }
 
-    [[nodiscard]] std::string GetPopularMovies(uint32_t page) const
+    void StreamNowPlayingMoviesAsync(uint32_t page, std::shared_ptr<BodyStream> stream, const CancellationToken& cancellation = {}) const
     {
-        return MakeHttpGetRequest("http://api.themoviedb.org/3/movie/popular?api_key=" + apiKey + "&language=en-US&page=" + std::to_string(page));
+        StreamHttpGetRequestAsync(NowPlayingMoviesUrl(page), std::move(stream), cancellation);
     }
 
-    [[nodiscard]] std::string GetNowPlayingMovies(uint32_t page) const
+    // A page of the ids of movies changed from `startDate` to `endDate` (YYYY-MM-DD, both
+    // included, at most 14 days apart)
+    [[nodiscard]] ResponseBuffer FetchMovieChanges(const std::string& startDate, const std::string& endDate, uint32_t page, const CancellationToken& cancellation = {}) const
     {
-        return MakeHttpGetRequest("http://api.themoviedb.org/3/movie/now_playing?api_key=" + apiKey + "&language=en-US&page="+ std::to_string(page));
+        return MakeHttpGetRequest(MovieChangesUrl(startDate, endDate, page), cancellation);
+    }
+
+    [[nodiscard]] HedgePolicy::Stats GetHedgeStats() const
+    {
+        return hedgePolicy.GetStats();
     }
 
 private:
+        // One copy's body as the client hands it over, when it is taken rather than left in
+        // the response: streamed, or compressed and decoded on the way in
+        struct Receiver
+        {
+            std::unique_ptr<Inflater> inflater;     // Set for a compressed body
+            ResponseBuffer body;                    // Decoded; when streamed, only for recording
+            bool streamed = false;
+            bool failed = false;                    // Couldn't be decoded
+            bool pause = false;                     // The stream asked for a pause
+        };
+
+        struct Attempt
+        {
+            std::string url;
+            uint32_t number = 0;
+            ResponseCallback callback;
+
+            // Touched on the client thread only. While a hedge is out, either copy may answer.
+            HttpClient::RequestId requestId = 0;
+            HttpClient::RequestId hedgeId = 0;
+            HttpClient::Clock::time_point sentAt;
+            bool cancelled = false;
+            bool backingOff = false;        // Waiting out the delay before a retry
+            bool refused = false;           // Answered with a 4xx that retrying won't change
+
+            CancellationToken cancellation;
+            CancellationToken::Registration registration = 0;
+
+            // Set for a streamed body; `callback` then only ends the stream on failure
+            std::shared_ptr<BodyStream> stream;
+
+            // Only the original copy is streamed. A hedge is kept whole, and goes to the
+            // stream in one piece if it wins.
+            Receiver original;
+            Receiver hedged;
+
+            // A pipelined batch goes through the throttle queue as one unit carrying its members
+            std::vector<std::shared_ptr<Attempt>> batch;
+
+            ~Attempt()
+            {
+                cancellation.Unregister(registration);
+            }
+
+            [[nodiscard]] bool Abandoned() const
+            {
+                return cancelled || cancellation.IsCancelled();
+            }
+        };
+
+        [[nodiscard]] std::string MovieDetailsUrl(const std::string& movieId) const
+        {
+            return settings.baseUrl + "movie/" + movieId + "?api_key=" + apiKey;
+        }
+
+        [[nodiscard]] std::string MovieChangesUrl(const std::string& startDate, const std::string& endDate, uint32_t page) const
+        {
+            return settings.baseUrl + "movie/changes?api_key=" + apiKey + "&start_date=" + startDate + "&end_date=" + endDate + "&page=" + std::to_string(page);
+        }
+
+        [[nodiscard]] std::string PopularMoviesUrl(uint32_t page) const
+        {
+            return settings.baseUrl + "movie/popular?api_key=" + apiKey + "&language=en-US&page=" + std::to_string(page);
+        }
+
+        [[nodiscard]] std::string NowPlayingMoviesUrl(uint32_t page) const
+        {
+            return settings.baseUrl + "movie/now_playing?api_key=" + apiKey + "&language=en-US&page=" + std::to_string(page);
+        }
+
+        std::shared_ptr<Attempt> StartRequest(const std::string& url, ResponseCallback callback, const CancellationToken& cancellation, std::shared_ptr<BodyStream> stream = nullptr) const;
+        std::function<void()> FetchPage(const std::string& url, ResponseCallback callback) const;
+        void Watch(const std::shared_ptr<Attempt>& attempt, const CancellationToken& cancellation) const;
+        void Cancel(const std::shared_ptr<Attempt>& attempt) const;
+        void Drop(const Attempt& attempt) const;
+        void Throttle(std::shared_ptr<Attempt> attempt) const;
+        bool Withdraw(const std::shared_ptr<Attempt>& attempt) const;
+        void DrainThrottled() const;
+        void Send(const std::shared_ptr<Attempt>& attempt) const;
+        HttpClient::Request MakeRequest(const std::shared_ptr<Attempt>& attempt, bool hedge) const;
+        bool OnHeaders(const std::shared_ptr<Attempt>& attempt, bool hedge, const HttpResponse& head) const;
+        bool OnBody(Attempt& attempt, Receiver& receiver, ResponseBuffer piece) const;
+        void Take(Attempt& attempt, Receiver& receiver, ResponseBuffer piece) const;
+        void SendBatch(const std::shared_ptr<Attempt>& carrier) const;
+        void ScheduleHedge(const std::shared_ptr<Attempt>& attempt) const;
+        void Hedge(const std::shared_ptr<Attempt>& attempt, HttpClient::RequestId original) const;
+        bool Settle(Attempt& attempt, bool hedge, const HttpResponse& response) const;
+        void OnResponse(const std::shared_ptr<Attempt>& attempt, HttpResponse&& response, bool hedge = false) const;
+        void Record(const std::string& url, ResponseBuffer body) const;
+        void Deliver(const std::shared_ptr<Attempt>& attempt, ResponseBuffer body) const;
+        void Retry(const std::shared_ptr<Attempt>& attempt) const;
+
+        static HttpClient::Settings ClientSettings(const Settings& settings, std::shared_ptr<BufferPool> pool);
+        static std::chrono::milliseconds ParseRetryAfter(const std::string& value);
+        static std::chrono::milliseconds JitteredBackoff(uint32_t attempt);
+
+        static constexpr uint32_t MAX_ATTEMPTS = 5;
+        static constexpr uint64_t MAX_PRESIZE = 64 * 1024 * 1024;
+
         std::string apiKey;
-        const std::string BASE_URL = "https://api.themoviedb.org/3/";
+        const Settings settings;
         const std::string imageBaseUrl = "https://image.tmdb.org/t/p/w500";
+
+        mutable RateLimiter rateLimiter;
+        mutable HedgePolicy hedgePolicy{settings.hedge};
+
+        // Attempts waiting for a rate limiter token, oldest first
+        mutable std::mutex throttleMutex;
+        mutable std::deque<std::shared_ptr<Attempt>> throttled;
+        mutable bool drainScheduled = false;
+
+        const std::shared_ptr<BufferPool> bufferPool = std::make_shared<BufferPool>();
+
+        mutable PagePrefetcher popularPrefetcher;
+        mutable PagePrefetcher nowPlayingPrefetcher;
+
+        // Fixtures being written in record mode, waited for before the provider goes
+        mutable TaskGroup recordings;
+
+        // Declared last so its thread stops before anything its callbacks touch is destroyed
+        mutable HttpClient httpClient{ClientSettings(settings, bufferPool)};
 };
 
 #endif
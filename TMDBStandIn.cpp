@@ -0,0 +1,114 @@
+﻿#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "StandInServer.h"
+
+namespace
+{
+    void PrintUsage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options]\n"
+                  << "  --address ADDRESS     listen address (default 127.0.0.1)\n"
+                  << "  --port PORT           listen port (default 8080, 0 picks one)\n"
+                  << "  --fixtures DIR        replay responses recorded with \"record_directory\"\n"
+                  << "  --synthetic           generate responses that have no fixture\n"
+                  << "  --results N           results per synthetic page (default 20)\n"
+                  << "  --pages N             synthetic pages per list (default 500)\n"
+                  << "  --changes N           movies changed per day in movie/changes (default 200)\n"
+                  << "  --latency MS          delay before every response\n"
+                  << "  --jitter MS           up to this much extra delay\n"
+                  << "  --stall-rate P        fraction of requests held back a further --stall\n"
+                  << "  --stall MS            extra delay for stalled requests (default 1000)\n"
+                  << "  --bandwidth BYTES     per-connection cap in bytes per second\n"
+                  << "  --error-rate P        fraction of requests answered with 500\n"
+                  << "  --throttle-rate P     fraction of requests answered with 429\n"
+                  << "  --retry-after S       Retry-After sent with 429 (default 1)\n"
+                  << "  --max-requests N      close each connection after N requests\n"
+                  << "  --gzip                gzip successful bodies for clients that accept it\n"
+                  << "  --seed N              seed for jitter and fault injection (default 1)\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    StandInServer::Settings settings;
+    settings.port = 8080;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string option = argv[i];
+
+        if (option == "--synthetic")
+        {
+            settings.synthetic = true;
+            continue;
+        }
+
+        if (option == "--gzip")
+        {
+            settings.gzip = true;
+            continue;
+        }
+
+        if (option == "--help" || i + 1 >= argc)
+        {
+            PrintUsage(argv[0]);
+            return option == "--help" ? 0 : 1;
+        }
+
+        const char* value = argv[++i];
+
+        if (option == "--address") settings.address = value;
+        else if (option == "--port") settings.port = static_cast<uint16_t>(std::strtoul(value, nullptr, 10));
+        else if (option == "--fixtures") settings.fixtureDirectory = value;
+        else if (option == "--results") settings.syntheticResults = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else if (option == "--pages") settings.syntheticPages = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else if (option == "--changes") settings.syntheticChanges = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else if (option == "--latency") settings.latency = std::chrono::milliseconds{std::strtoll(value, nullptr, 10)};
+        else if (option == "--jitter") settings.jitter = std::chrono::milliseconds{std::strtoll(value, nullptr, 10)};
+        else if (option == "--stall-rate") settings.stallRate = std::strtod(value, nullptr);
+        else if (option == "--stall") settings.stall = std::chrono::milliseconds{std::strtoll(value, nullptr, 10)};
+        else if (option == "--bandwidth") settings.bandwidth = std::strtoull(value, nullptr, 10);
+        else if (option == "--error-rate") settings.errorRate = std::strtod(value, nullptr);
+        else if (option == "--throttle-rate") settings.throttleRate = std::strtod(value, nullptr);
+        else if (option == "--retry-after") settings.retryAfter = std::chrono::seconds{std::strtoll(value, nullptr, 10)};
+        else if (option == "--max-requests") settings.maxRequestsPerConnection = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else if (option == "--seed") settings.seed = std::strtoull(value, nullptr, 10);
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (settings.fixtureDirectory.empty() && !settings.synthetic)
+    {
+        std::cerr << "Nothing to serve: pass --fixtures, --synthetic or both" << std::endl;
+        return 1;
+    }
+
+    // Blocked before any thread starts, so only sigwait below ever sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    StandInServer server(settings);
+
+    if (!server.Start())
+    {
+        return 1;
+    }
+
+    std::cout << "Serving on " << server.GetBaseUrl() << " (set \"base_url\" in api_key.json to use it)" << std::endl;
+
+    int received = 0;
+    sigwait(&signals, &received);
+
+    server.Stop();
+    std::cout << "Served " << server.GetRequestCount() << " requests" << std::endl;
+}
@@ -0,0 +1,300 @@
+﻿#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <random>
+
+namespace
+{
+    // The scheduler and worker the calling thread belongs to, if any
+    thread_local const TaskScheduler* currentScheduler = nullptr;
+    thread_local size_t currentWorker = 0;
+}
+
+TaskScheduler::TaskScheduler(const Settings& settings)
+{
+    const size_t count = settings.workers > 0 ? settings.workers : std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t index = 0; index < count; ++index)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    // Only once every deque exists, as any worker may steal from any other
+    for (size_t index = 0; index < count; ++index)
+    {
+        workers[index]->thread = std::thread([this, index] { RunWorker(index); });
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard lock(sleepMutex);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (const auto& worker : workers)
+    {
+        worker->thread.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::GetShared()
+{
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+void TaskScheduler::Submit(Task task)
+{
+    ++queued;
+
+    if (currentScheduler == this)
+    {
+        Worker& own = *workers[currentWorker];
+        std::lock_guard lock(own.mutex);
+        own.tasks.push_back(std::move(task));
+    }
+    else
+    {
+        std::lock_guard lock(sharedMutex);
+        shared.push_back(std::move(task));
+    }
+
+    // A sleeper counted itself before checking for tasks, and waits holding the lock until
+    // it sleeps, so either it sees this task or this sees it
+    if (sleepers > 0)
+    {
+        {
+            std::lock_guard lock(sleepMutex);
+        }
+
+        wake.notify_one();
+    }
+}
+
+bool TaskScheduler::RunOne()
+{
+    Task task;
+
+    if (!Take(task))
+    {
+        return false;
+    }
+
+    task();
+    return true;
+}
+
+void TaskScheduler::RunWorker(size_t index)
+{
+    currentScheduler = this;
+    currentWorker = index;
+
+    for (;;)
+    {
+        Task task;
+
+        if (Take(task))
+        {
+            task();
+            continue;
+        }
+
+        std::unique_lock lock(sleepMutex);
+
+        if (stopping && queued == 0)
+        {
+            return;
+        }
+
+        ++sleepers;
+        wake.wait(lock, [this] { return queued > 0 || stopping; });
+        --sleepers;
+    }
+}
+
+bool TaskScheduler::Take(Task& task)
+{
+    const bool worker = currentScheduler == this;
+
+    if (worker)
+    {
+        Worker& own = *workers[currentWorker];
+        std::lock_guard lock(own.mutex);
+
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard lock(sharedMutex);
+
+        if (!shared.empty())
+        {
+            task = std::move(shared.front());
+            shared.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return Steal(worker ? currentWorker : workers.size(), task);
+}
+
+bool TaskScheduler::Steal(size_t thief, Task& task)
+{
+    // Starting from a random victim keeps thieves from all piling onto the same one
+    thread_local std::minstd_rand random{std::random_device{}()};
+    const size_t first = random() % workers.size();
+
+    for (size_t offset = 0; offset < workers.size(); ++offset)
+    {
+        const size_t victim = (first + offset) % workers.size();
+
+        if (victim == thief)
+        {
+            continue;
+        }
+
+        Worker& other = *workers[victim];
+        std::lock_guard lock(other.mutex);
+
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskScheduler::Idle(const std::function<bool()>& done)
+{
+    std::unique_lock lock(sleepMutex);
+    ++sleepers;
+    wake.wait(lock, [this, &done] { return queued > 0 || stopping || done(); });
+    --sleepers;
+}
+
+void TaskScheduler::WakeAll()
+{
+    {
+        std::lock_guard lock(sleepMutex);
+    }
+
+    wake.notify_all();
+}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void TaskGroup::Run(TaskScheduler::Task task)
+{
+    {
+        std::lock_guard lock(mutex);
+        ++pending;
+    }
+
+    Submit(std::move(task));
+}
+
+void TaskGroup::Then(TaskScheduler::Task continuation)
+{
+    {
+        std::lock_guard lock(mutex);
+
+        if (pending > 0)
+        {
+            continuations.push_back(std::move(continuation));
+            return;
+        }
+
+        ++pending;
+    }
+
+    Submit(std::move(continuation));
+}
+
+void TaskGroup::Hold()
+{
+    std::lock_guard lock(mutex);
+    ++pending;
+}
+
+void TaskGroup::Release()
+{
+    Finish();
+}
+
+void TaskGroup::Wait()
+{
+    while (!IsDone())
+    {
+        if (!scheduler.RunOne())
+        {
+            scheduler.Idle([this] { return IsDone(); });
+        }
+    }
+}
+
+void TaskGroup::Submit(TaskScheduler::Task task)
+{
+    scheduler.Submit([this, task = std::move(task)]() mutable
+    {
+        task();
+
+        // Whatever the task holds goes before the group can be seen to be done
+        task = nullptr;
+        Finish();
+    });
+}
+
+void TaskGroup::Finish()
+{
+    // The group may be gone as soon as the last of it is seen to be done
+    TaskScheduler& owner = scheduler;
+    std::vector<TaskScheduler::Task> next;
+    bool done;
+
+    {
+        std::lock_guard lock(mutex);
+
+        // The last to finish queues the continuations, which keep the group going
+        if (pending == 1)
+        {
+            next.swap(continuations);
+            pending += next.size();
+        }
+
+        done = --pending == 0;
+    }
+
+    for (TaskScheduler::Task& continuation : next)
+    {
+        Submit(std::move(continuation));
+    }
+
+    if (done)
+    {
+        owner.WakeAll();
+    }
+}
+
+bool TaskGroup::IsDone()
+{
+    std::lock_guard lock(mutex);
+    return pending == 0;
+}
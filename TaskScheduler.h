@@ -0,0 +1,133 @@
+﻿#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs tasks on a fixed set of worker threads started once, so work of any grain can be
+// handed off without creating threads or running more of them than there are cores.
+//
+// Each worker has a deque of its own. Tasks a worker submits go on the back of its deque
+// and it takes from the back, so related work stays on one core while its data is warm. A
+// worker with nothing left steals from the front of another's, picked at random, where the
+// oldest and usually largest tasks are. Tasks submitted from outside the pool go to a
+// shared queue that every worker checks.
+//
+// Tasks must not block other than by waiting on a TaskGroup, which runs queued tasks while
+// it waits; anything else, such as a request in flight, is held in a group instead.
+class TaskScheduler
+{
+public:
+    using Task = std::function<void()>;
+
+    struct Settings
+    {
+        size_t workers = 0;     // 0 for one per hardware thread
+    };
+
+    explicit TaskScheduler(const Settings& settings);
+    TaskScheduler() : TaskScheduler(Settings{}) {}
+
+    // Runs whatever is still queued before the workers stop
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // One for the whole process, started on first use
+    static TaskScheduler& GetShared();
+
+    void Submit(Task task);
+
+    // Runs one queued task on the calling thread, if there is one
+    bool RunOne();
+
+    [[nodiscard]] size_t GetWorkerCount() const
+    {
+        return workers.size();
+    }
+
+private:
+    friend class TaskGroup;
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void RunWorker(size_t index);
+
+    // The caller's own deque first, from the back, then the shared queue, then a steal
+    bool Take(Task& task);
+    bool Steal(size_t thief, Task& task);
+
+    // Sleeps until a task is queued, the scheduler stops or `done` holds. Whatever makes
+    // `done` hold calls WakeAll after.
+    void Idle(const std::function<bool()>& done);
+    void WakeAll();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex sharedMutex;
+    std::deque<Task> shared;
+
+    // Tasks submitted and not yet taken, counted before they are queued
+    std::atomic<size_t> queued{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> sleepers{0};
+    bool stopping = false;
+};
+
+// Tasks run on a scheduler and waited for together. Waiting runs queued tasks meanwhile, so
+// tasks can wait on groups of their own, as a divide-and-conquer sort does, without using
+// up the workers.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskScheduler& scheduler) : scheduler(scheduler) {}
+    TaskGroup() : TaskGroup(TaskScheduler::GetShared()) {}
+
+    // Waits for everything in the group
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void Run(TaskScheduler::Task task);
+
+    // Queued once everything in the group is done, and waited for along with it. Queued
+    // straight away if nothing is.
+    void Then(TaskScheduler::Task continuation);
+
+    // Counts work going on elsewhere, such as a request in flight, as part of the group until
+    // it is released, so that it can add tasks when it finishes. Release each hold once.
+    void Hold();
+    void Release();
+
+    // Returns once every task, hold and continuation is done, those added meanwhile included
+    void Wait();
+
+private:
+    void Submit(TaskScheduler::Task task);
+    void Finish();
+    [[nodiscard]] bool IsDone();
+
+    TaskScheduler& scheduler;
+
+    std::mutex mutex;
+    size_t pending = 0;
+    std::vector<TaskScheduler::Task> continuations;
+};
+
+#endif
@@ -0,0 +1,311 @@
+﻿#include "WriteAheadLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "Checksum.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Length, then the CRC-32 of the length and the record
+    constexpr size_t FRAME = 8;
+
+    uint32_t FrameChecksum(uint32_t length, std::string_view record)
+    {
+        return Checksum::Crc32(record.data(), record.size(), Checksum::Crc32(&length, sizeof(length)));
+    }
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    Close();
+}
+
+uint64_t WriteAheadLog::Replay(const std::string& path, const std::function<void(std::string_view record)>& apply)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.is_open())
+    {
+        return 0;
+    }
+
+    const std::string bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    uint64_t offset = 0;
+
+    while (bytes.size() - offset >= FRAME)
+    {
+        uint32_t length;
+        uint32_t checksum;
+        std::memcpy(&length, bytes.data() + offset, sizeof(length));
+        std::memcpy(&checksum, bytes.data() + offset + sizeof(length), sizeof(checksum));
+
+        if (length > bytes.size() - offset - FRAME)
+        {
+            break;
+        }
+
+        const std::string_view record{bytes.data() + offset + FRAME, length};
+
+        if (FrameChecksum(length, record) != checksum)
+        {
+            break;
+        }
+
+        apply(record);
+        offset += FRAME + length;
+    }
+
+    if (offset < bytes.size())
+    {
+        std::cerr << "Dropping the last " << bytes.size() - offset << " bytes of " << path << ", torn or corrupt" << std::endl;
+    }
+
+    return offset;
+}
+
+bool WriteAheadLog::Open(const std::string& path, uint64_t validBytes)
+{
+    std::lock_guard lock(mutex);
+
+    this->path = path;
+    fd = OpenFile(path, validBytes);
+    size = validBytes;
+    failed = fd < 0;
+
+    return !failed;
+}
+
+uint64_t WriteAheadLog::Append(std::string_view record)
+{
+    const auto length = static_cast<uint32_t>(record.size());
+    const uint32_t checksum = FrameChecksum(length, record);
+
+    std::lock_guard lock(mutex);
+
+    queued.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    queued.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+    queued.append(record);
+    size += FRAME + record.size();
+
+    return ++appended;
+}
+
+bool WriteAheadLog::WaitDurable(uint64_t sequence)
+{
+    std::unique_lock lock(mutex);
+
+    while (durable < sequence && !failed)
+    {
+        if (writing)
+        {
+            synced.wait(lock);
+        }
+        else if (!Flush(lock))
+        {
+            break;
+        }
+    }
+
+    return durable >= sequence;
+}
+
+bool WriteAheadLog::PrepareRotation(const std::string& path)
+{
+    const int opened = OpenFile(path, 0);
+
+    std::lock_guard lock(mutex);
+
+    // One prepared and never rotated into is replaced
+    CloseFile(nextFd);
+    nextPath = path;
+    nextFd = opened;
+
+    return opened >= 0;
+}
+
+bool WriteAheadLog::Rotate()
+{
+    std::lock_guard lock(mutex);
+
+    if (nextFd < 0)
+    {
+        return false;
+    }
+
+    // A group being written holds the old file, so it is closed by whoever writes next
+    retired.push_back({std::move(path), fd, std::move(queued)});
+    queued.clear();
+
+    path = std::move(nextPath);
+    fd = nextFd;
+    nextFd = -1;
+    size = 0;
+
+    return true;
+}
+
+void WriteAheadLog::Close()
+{
+    std::unique_lock lock(mutex);
+
+    if (fd < 0)
+    {
+        CloseFile(nextFd);
+        nextFd = -1;
+        return;
+    }
+
+    Flush(lock);
+
+    // Left over if writing failed
+    for (const Retired& file : retired)
+    {
+        CloseFile(file.fd);
+    }
+
+    retired.clear();
+    CloseFile(nextFd);
+    CloseFile(fd);
+    nextFd = -1;
+    fd = -1;
+}
+
+uint64_t WriteAheadLog::GetSize() const
+{
+    std::lock_guard lock(mutex);
+    return size;
+}
+
+int WriteAheadLog::OpenFile(const std::string& path, uint64_t validBytes)
+{
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(validBytes)) != 0 || ::lseek(fd, 0, SEEK_END) < 0)
+    {
+        std::cerr << "Error opening log " << path << ": " << std::strerror(errno) << std::endl;
+        CloseFile(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    // Without ftruncate, a torn tail is cut by rewriting what comes before it
+    std::string kept;
+    {
+        std::ifstream existing(path, std::ios::binary);
+        kept.assign(std::istreambuf_iterator<char>(existing), std::istreambuf_iterator<char>());
+        kept.resize(std::min<size_t>(kept.size(), validBytes));
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(kept.data(), static_cast<std::streamsize>(kept.size()));
+    return 0;
+#endif
+}
+
+void WriteAheadLog::CloseFile(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+#endif
+}
+
+bool WriteAheadLog::Flush(std::unique_lock<std::mutex>& lock)
+{
+    synced.wait(lock, [this] { return !writing; });
+
+    if (failed)
+    {
+        return false;
+    }
+
+    if (queued.empty() && retired.empty())
+    {
+        durable = appended;
+        return true;
+    }
+
+    std::string group;
+    group.swap(queued);
+    std::vector<Retired> rotated;
+    rotated.swap(retired);
+    const int target = fd;
+    const std::string targetPath = path;
+    const uint64_t last = appended;
+
+    // Records queued from here on make up the next group
+    writing = true;
+    lock.unlock();
+
+    // Files rotated out of come first, so nothing in a newer file is on disk before them
+    bool written = true;
+
+    for (const Retired& file : rotated)
+    {
+        written = written && (file.queued.empty() || WriteAndSync(file.fd, file.path, file.queued));
+        CloseFile(file.fd);
+    }
+
+    written = written && (group.empty() || WriteAndSync(target, targetPath, group));
+
+    lock.lock();
+    writing = false;
+    failed = !written;
+    durable = written ? last : durable;
+    synced.notify_all();
+
+    return written;
+}
+
+bool WriteAheadLog::WriteAndSync(int fd, const std::string& path, const std::string& bytes)
+{
+#ifdef __linux__
+    size_t offset = 0;
+
+    while (offset < bytes.size())
+    {
+        const ssize_t written = ::write(fd, bytes.data() + offset, bytes.size() - offset);
+
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            std::cerr << "Error writing log " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        offset += static_cast<size_t>(written);
+    }
+
+    if (::fdatasync(fd) != 0)
+    {
+        std::cerr << "Error syncing log " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+#else
+    // Handed to the OS, though not forced to disk
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    file.flush();
+    return static_cast<bool>(file);
+#endif
+}
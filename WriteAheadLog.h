@@ -0,0 +1,85 @@
+﻿#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// An append-only file of records, each framed by its length and a CRC-32 of it, so a
+// record torn by a crash is found on replay and everything from it on is dropped.
+//
+// Appending only queues a record. Waiting for it then commits in groups: the first waiter
+// writes and syncs everything queued so far, and those who queue meanwhile wait for the
+// next sync, which covers all of them. One sync is paid per group rather than per record.
+class WriteAheadLog
+{
+public:
+    WriteAheadLog() = default;
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Calls `apply` with each intact record in order. Returns the bytes they take up, after
+    // which the file is torn or corrupt; 0 if there is no file.
+    static uint64_t Replay(const std::string& path, const std::function<void(std::string_view record)>& apply);
+
+    // Opens for appending after the first `validBytes`, cutting off anything past them
+    bool Open(const std::string& path, uint64_t validBytes);
+
+    // Returns a sequence number to wait on. Records are written in the order queued.
+    uint64_t Append(std::string_view record);
+
+    // Returns once everything up to `sequence` is synced to disk, or false if writing failed
+    bool WaitDurable(uint64_t sequence);
+
+    // Moving to a new file is split in two so the caller can keep the slow part out of its
+    // own locks. Prepare creates the file at `path`; Rotate, which doesn't wait on the disk,
+    // sends records appended from then on to it. Those queued before still go to the old
+    // file, which the next group syncs ahead of the new one.
+    bool PrepareRotation(const std::string& path);
+    bool Rotate();
+
+    void Close();
+
+    // Bytes in the current file, queued ones included
+    [[nodiscard]] uint64_t GetSize() const;
+
+private:
+    // A file rotated out of, with the records still to be written to it
+    struct Retired
+    {
+        std::string path;
+        int fd = -1;
+        std::string queued;
+    };
+
+    static int OpenFile(const std::string& path, uint64_t validBytes);
+    static void CloseFile(int fd);
+    static bool WriteAndSync(int fd, const std::string& path, const std::string& bytes);
+
+    // Waits out a group being written, then writes everything queued. Expects the lock held.
+    bool Flush(std::unique_lock<std::mutex>& lock);
+
+    mutable std::mutex mutex;
+    std::condition_variable synced;
+
+    std::string path;
+    int fd = -1;
+    std::string queued;
+    std::vector<Retired> retired;   // Oldest first
+    std::string nextPath;           // Prepared to rotate into
+    int nextFd = -1;
+    uint64_t size = 0;
+    uint64_t appended = 0;      // Sequence number of the last record queued
+    uint64_t durable = 0;       // ...and of the last one synced
+    bool writing = false;
+    bool failed = false;
+};
+
+#endif
@@ -1,10 +1,14 @@
-﻿#include <iostream>
+﻿#include <chrono>
+#include <iostream>
 
 #include "StreamFlix.h"
 #include "HTTPRequest/include/HTTPRequest.hpp"
 
 int main()
 {
-    StreamFlix::Run();
+    // A hung upstream can't hold startup longer than this
+    constexpr std::chrono::seconds STARTUP_TIMEOUT{20};
+
+    StreamFlix::Run(CancellationToken::WithTimeout(STARTUP_TIMEOUT));
     StreamFlix::Shutdown();
 }